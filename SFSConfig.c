@@ -7,6 +7,26 @@
 
 #include "SFSConfig.h"
 
+static void free_plugin_configuration(struct plugin_configuration* plugin) {
+    g_hash_table_destroy(plugin->options);
+    free(plugin->name);
+    free(plugin->path);
+    free(plugin);
+}
+
+// Index of plugin name in the plugins of config, -1 if it is not listed
+static int find_plugin_configuration(configuration* config, const char* name) {
+    GSList* current;
+    int i = 0;
+
+    for (current = config->plugins; current != NULL; current = current->next, i++) {
+        if (strcmp(((struct plugin_configuration*)current->data)->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 int handle_section_layers(configuration* config, const char* name, const char* value) {
     if (strcmp(name, "block_align") == 0) {
         config->layers = g_slist_append(config->layers, GINT_TO_POINTER(BLOCK_ALIGN));
@@ -16,17 +36,57 @@ int handle_section_layers(configuration* config, const char* name, const char* v
         config->layers = g_slist_append(config->layers, GINT_TO_POINTER(MULTI_LOOPBACK));
     } else if (strcmp(name, "nopfuse") == 0) {
         config->layers = g_slist_append(config->layers, GINT_TO_POINTER(NOPFUSE));
+    } else if (strcmp(name, "capture") == 0) {
+        config->layers = g_slist_append(config->layers, GINT_TO_POINTER(CAPTURE));
     } else {
-        return 0;
+        // plugins are listed before the layers
+        int plugin = find_plugin_configuration(config, name);
+        if (plugin < 0) {
+            return 0;
+        }
+        config->layers = g_slist_append(config->layers, GINT_TO_POINTER(PLUGIN_LAYER + plugin));
     }
     return 1;
 }
 
+// Keys of the block size policies, policy_N where N is a number
+static int is_policy_key(const char* name) {
+    const char* number = name + strlen("policy_");
+    if (strncmp(name, "policy_", strlen("policy_")) != 0 || *number == '\0') {
+        return 0;
+    }
+    return strspn(number, "0123456789") == strlen(number);
+}
+
 int handle_section_block_align(configuration* config, const char* name, const char* value) {
     if (strcmp(name, "block_size") == 0) {
         (config->block_config).block_size = atoi(value);
     } else if (strcmp(name, "mode") == 0) {
         (config->block_config).mode = atoi(value);
+    } else if (strcmp(name, "cache_size") == 0) {
+        (config->block_config).cache_size = atoi(value);
+    } else if (strcmp(name, "readahead") == 0) {
+        (config->block_config).readahead = atoi(value);
+    } else if (strcmp(name, "sparse_truncate") == 0) {
+        (config->block_config).sparse_truncate = atoi(value);
+    } else if (is_policy_key(name)) {
+        // prefix:block_size, the prefix may itself contain ':'
+        char* separator = strrchr(value, ':');
+        if (separator == NULL || separator == value || atoi(separator + 1) <= 0) {
+            ERROR_MSG("Invalid block_align policy %s\n", value);
+            return 0;
+        }
+
+        struct block_size_policy* policy = malloc(sizeof(struct block_size_policy));
+        policy->prefix = strndup(value, separator - value);
+        // "/db/" is the same directory as "/db", and "/" matches every path
+        size_t prefix_size = strlen(policy->prefix);
+        while (prefix_size > 0 && policy->prefix[prefix_size - 1] == '/') {
+            policy->prefix[--prefix_size] = '\0';
+        }
+        policy->block_size = atoi(separator + 1);
+        (config->block_config).block_size_policies =
+            g_slist_append((config->block_config).block_size_policies, policy);
     } else {
         return 0;
     }
@@ -43,6 +103,14 @@ int handle_section_sfuse(configuration* config, const char* name, const char* va
         (config->enc_config).key_size = atoi(value);
     } else if (strcmp(name, "mode") == 0) {
         (config->enc_config).mode = atoi(value);
+    } else if (strcmp(name, "crypto_threads") == 0) {
+        (config->enc_config).crypto_threads = atoi(value);
+    } else if (strcmp(name, "size_cache") == 0) {
+        (config->enc_config).size_cache = atoi(value);
+    } else if (strcmp(name, "derive_ivs") == 0) {
+        (config->enc_config).derive_ivs = atoi(value);
+    } else if (strcmp(name, "driver") == 0) {
+        (config->enc_config).driver = strdup(value);
     } else {
         return 0;
     }
@@ -55,6 +123,8 @@ int handle_section_multi_loop(configuration* config, const char* name, const cha
         (config->m_loop_config).mode = atoi(value);
     } else if (strcmp(name, "ndevs") == 0) {
         (config->m_loop_config).ndevs = atoi(value);
+    } else if (strcmp(name, "driver") == 0) {
+        (config->m_loop_config).driver = strdup(value);
 
     } else if (strstr(name, "path") != NULL) {
         // TODO: FREE these strings
@@ -78,7 +148,133 @@ int handle_section_multi_loop(configuration* config, const char* name, const cha
 int handle_section_log(configuration* config, const char* name, const char* value) {
     if (strcmp(name, "mode") == 0) {
         config->logging_configuration.mode = atoi(value);
+    } else if (strcmp(name, "level") == 0) {
+        if (strcmp(value, "error") == 0) {
+            config->logging_configuration.level = LOG_LEVEL_ERROR;
+        } else if (strcmp(value, "debug") == 0) {
+            config->logging_configuration.level = LOG_LEVEL_DEBUG;
+        } else {
+            return 0;
+        }
+    } else if (strcmp(name, "async") == 0) {
+        config->logging_configuration.async = atoi(value);
+    } else if (strcmp(name, "queue") == 0) {
+        config->logging_configuration.queue_size = atoi(value);
+    }
+    return 1;
+}
+
+int handle_section_fuse(configuration* config, const char* name, const char* value) {
+    if (strcmp(name, "lowlevel") == 0) {
+        (config->fuse_config).lowlevel = atoi(value);
+    } else if (strcmp(name, "writeback_cache") == 0) {
+        (config->fuse_config).writeback_cache = atoi(value);
+    } else if (strcmp(name, "stats") == 0) {
+        (config->fuse_config).stats = atoi(value);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int handle_section_trace(configuration* config, const char* name, const char* value) {
+    if (strcmp(name, "sample") == 0) {
+        (config->trace_config).sample = atoi(value);
+    } else if (strcmp(name, "buffer") == 0) {
+        (config->trace_config).buffer_size = atoi(value);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int handle_section_capture(configuration* config, const char* name, const char* value) {
+    if (strcmp(name, "path") == 0) {
+        free((config->capture_config).path);
+        (config->capture_config).path = strdup(value);
+    } else if (strcmp(name, "buffer") == 0) {
+        (config->capture_config).buffer_size = atoi(value);
+    } else if (strcmp(name, "flush_interval") == 0) {
+        (config->capture_config).flush_interval = atoi(value);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int handle_section_stacks(configuration* config, const char* name, const char* value) {
+    if (strstr(name, "stack") == NULL) {
+        return 0;
     }
+
+    // prefix:configuration_file, the prefix is a single top-level directory
+    const char* separator = strchr(value, ':');
+    if (separator == NULL || value[0] != '/' || separator - value < 2 ||
+        memchr(value + 1, '/', separator - value - 1) != NULL || separator[1] == '\0') {
+        ERROR_MSG("Invalid stack %s\n", value);
+        return 0;
+    }
+
+    struct stack_configuration* stack = calloc(1, sizeof(struct stack_configuration));
+    stack->prefix = strndup(value, separator - value);
+    stack->path = strdup(separator + 1);
+    config->stacks = g_slist_append(config->stacks, stack);
+
+    return 1;
+}
+
+int handle_section_plugins(configuration* config, const char* name, const char* value) {
+    if (strstr(name, "plugin") == NULL) {
+        return 0;
+    }
+
+    // name:shared_object
+    const char* separator = strchr(value, ':');
+    if (separator == NULL || separator == value || separator[1] == '\0') {
+        ERROR_MSG("Invalid plugin %s\n", value);
+        return 0;
+    }
+
+    struct plugin_configuration* plugin = calloc(1, sizeof(struct plugin_configuration));
+    plugin->name = strndup(value, separator - value);
+    plugin->path = strdup(separator + 1);
+    plugin->options = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+
+    // the sections and layers of SafeFS can not be replaced
+    const char* reserved[] = {"layers", "block_align", "sfuse", "log", "multi_loop",
+                              "fuse", "stacks", "plugins", "nopfuse", "trace", "capture"};
+    size_t i;
+    for (i = 0; i < sizeof(reserved) / sizeof(reserved[0]); i++) {
+        if (strcmp(plugin->name, reserved[i]) == 0) {
+            ERROR_MSG("Plugin name %s is reserved\n", plugin->name);
+            free_plugin_configuration(plugin);
+            return 0;
+        }
+    }
+
+    if (find_plugin_configuration(config, plugin->name) >= 0) {
+        ERROR_MSG("Plugin %s is listed twice\n", plugin->name);
+        free_plugin_configuration(plugin);
+        return 0;
+    }
+    config->plugins = g_slist_append(config->plugins, plugin);
+
+    return 1;
+}
+
+// Options of the section named after a plugin
+int handle_section_plugin(configuration* config, const char* section, const char* name, const char* value) {
+    int plugin = find_plugin_configuration(config, section);
+    if (plugin < 0) {
+        return 0;
+    }
+
+    struct plugin_configuration* pconfig = g_slist_nth_data(config->plugins, plugin);
+    g_hash_table_insert(pconfig->options, strdup(name), strdup(value));
+
     return 1;
 }
 
@@ -93,23 +289,62 @@ int handler(void* config, const char* section, const char* name, const char* val
         return handle_section_log(config, name, value);
     } else if (strcmp(section, "multi_loop") == 0) {
         return handle_section_multi_loop(config, name, value);
+    } else if (strcmp(section, "fuse") == 0) {
+        return handle_section_fuse(config, name, value);
+    } else if (strcmp(section, "trace") == 0) {
+        return handle_section_trace(config, name, value);
+    } else if (strcmp(section, "capture") == 0) {
+        return handle_section_capture(config, name, value);
+    } else if (strcmp(section, "stacks") == 0) {
+        return handle_section_stacks(config, name, value);
+    } else if (strcmp(section, "plugins") == 0) {
+        return handle_section_plugins(config, name, value);
     } else {
-        return 0;
+        return handle_section_plugin(config, section, name, value);
     }
     return 1;
 }
 
 int init_config(char* configuration_file_path, configuration** config) {
-    configuration* pconfig = malloc(sizeof(struct sds_configuration));
+    // Options missing from the file are left zeroed.
+    configuration* pconfig = calloc(1, sizeof(struct sds_configuration));
     // This pointers are allocated when the first element is inserted.
     pconfig->layers = NULL;
     (pconfig->m_loop_config).loop_paths = NULL;
+    (pconfig->enc_config).size_cache = 1;
+    (pconfig->fuse_config).writeback_cache = 0;
+    (pconfig->fuse_config).stats = 0;
+    (pconfig->logging_configuration).level = LOG_LEVEL_DEBUG;
+    (pconfig->logging_configuration).async = 0;
+    (pconfig->logging_configuration).queue_size = 4096;
+    (pconfig->capture_config).buffer_size = 64;
+    (pconfig->capture_config).flush_interval = 1000;
 
     if (ini_parse(configuration_file_path, handler, pconfig) < 0) {
         DEBUG_MSG("Configuration could not be loaded.\n");
         return 1;
     }
-    GSList* current = pconfig->m_loop_config.loop_paths;
+    GSList* current;
+    for (current = pconfig->stacks; current != NULL; current = current->next) {
+        struct stack_configuration* stack = current->data;
+        GSList* other;
+
+        for (other = pconfig->stacks; other != current; other = other->next) {
+            if (strcmp(((struct stack_configuration*)other->data)->prefix, stack->prefix) == 0) {
+                ERROR_MSG("Stack %s is configured twice\n", stack->prefix);
+                return 1;
+            }
+        }
+        if (init_config(stack->path, &stack->config) != 0) {
+            ERROR_MSG("Could not load the configuration of stack %s (%s)\n", stack->prefix, stack->path);
+            return 1;
+        }
+        if (stack->config->stacks != NULL) {
+            ERROR_MSG("Stack %s can not host stacks\n", stack->prefix);
+            return 1;
+        }
+        stack->config->prefix = stack->prefix;
+    }
     *config = pconfig;
     return 0;
 }
@@ -118,6 +353,32 @@ int clean_config(configuration* config) {
     g_slist_free(config->layers);
     g_slist_free((config->m_loop_config).loop_paths);
 
+    GSList* current;
+    for (current = (config->block_config).block_size_policies; current != NULL; current = current->next) {
+        free(((struct block_size_policy*)current->data)->prefix);
+        free(current->data);
+    }
+    g_slist_free((config->block_config).block_size_policies);
+
+    for (current = config->stacks; current != NULL; current = current->next) {
+        struct stack_configuration* stack = current->data;
+        if (stack->config != NULL) {
+            clean_config(stack->config);
+        }
+        free(stack->prefix);
+        free(stack->path);
+        free(stack);
+    }
+    g_slist_free(config->stacks);
+
+    for (current = config->plugins; current != NULL; current = current->next) {
+        free_plugin_configuration(current->data);
+    }
+    g_slist_free(config->plugins);
+    free((config->enc_config).driver);
+    free((config->m_loop_config).driver);
+    free((config->capture_config).path);
+
     free((config->enc_config).key);
     free((config->enc_config).iv);
     free(config);
@@ -19,6 +19,9 @@
 #define SFUSE 1
 #define BLOCK_ALIGN 2
 #define NOPFUSE 3
+#define CAPTURE 4
+// layers of plugins are PLUGIN_LAYER + the index of the plugin in the plugins of the configuration
+#define PLUGIN_LAYER 16
 
 // Default configuration files location
 #define LOCAL_SDSCONFIG_PATH "default.ini"
@@ -29,6 +32,8 @@ typedef struct multi_loop_configuration {
     char* root_path;
     int mode;
     int ndevs;
+    // plugin replacing the driver of mode, NULL for the built-in one
+    char* driver;
 } m_loop_conf;
 
 typedef struct encode_configuration {
@@ -36,14 +41,66 @@ typedef struct encode_configuration {
     char* iv;
     int key_size;
     int mode;
+    int crypto_threads;
+    int size_cache;
+    int derive_ivs;
+    // plugin replacing the driver of mode, NULL for the built-in one
+    char* driver;
 } enc_config;
 
+// Block size of the files created below prefix
+struct block_size_policy {
+    char* prefix;
+    int block_size;
+};
+
 typedef struct block_align_configuration {
     int block_size;
     int mode;
+    // MiB of plaintext blocks cached by block_align, 0 disables the cache
+    int cache_size;
+    // KiB read ahead of sequential reads into the cache, 0 disables read-ahead
+    int readahead;
+    // extend files with holes in the lower layers instead of writing zero blocks
+    int sparse_truncate;
+    // struct block_size_policy, files created elsewhere use block_size
+    GSList* block_size_policies;
 } block_align_config;
 
-typedef struct log_configuration { int mode; } log_config;
+typedef struct log_configuration {
+    int mode;
+    // LOG_LEVEL_ERROR or LOG_LEVEL_DEBUG, see logdef.h
+    int level;
+    // debug messages are written to zlog by a background thread, off by default
+    int async;
+    // messages queued for the background thread
+    int queue_size;
+} log_config;
+
+typedef struct fuse_configuration {
+    // serve requests with the low-level (inode based) fuse API
+    int lowlevel;
+    // let the kernel cache writes when the stack supports it, libfuse 3 only
+    int writeback_cache;
+    // serve the statistics of the stack in /.safefs/stats
+    int stats;
+} fuse_conf;
+
+typedef struct trace_configuration {
+    // trace one request out of sample, 0 disables tracing
+    int sample;
+    // events kept per thread
+    int buffer_size;
+} trace_conf;
+
+typedef struct capture_configuration {
+    // file the operations are recorded to
+    char* path;
+    // KiB of records buffered by each thread before writing them to the file
+    int buffer_size;
+    // milliseconds the records of a thread stay buffered at most, 0 to only write full buffers
+    int flush_interval;
+} capture_conf;
 
 typedef struct sds_configuration {
     enc_config enc_config;
@@ -51,8 +108,32 @@ typedef struct sds_configuration {
     block_align_config block_config;
     GSList* layers;
     log_config logging_configuration;
+    fuse_conf fuse_config;
+    trace_conf trace_config;
+    capture_conf capture_config;
+    // struct stack_configuration, hosted instead of layers when not NULL
+    GSList* stacks;
+    // top-level directory served by the stack, NULL when it serves the whole mount
+    char* prefix;
+    // struct plugin_configuration
+    GSList* plugins;
 } configuration;
 
+// Layer or driver loaded from a shared object, see plugins/plugin.h
+struct plugin_configuration {
+    char* name;
+    char* path;
+    // options of the section named after the plugin
+    GHashTable* options;
+};
+
+// Stack of its own configuration file serving the top-level directory prefix
+struct stack_configuration {
+    char* prefix;
+    char* path;
+    configuration* config;
+};
+
 int init_config(char* configuration_file_path, configuration** config);
 
 int clean_config(configuration* config);
@@ -10,69 +10,11 @@
 
 #include "SFSFuse.h"
 #include "utils.h"
-
-int compose_layers(struct fuse_operations** operations, configuration config) {
-    DEBUG_MSG("Going to compose layers\n");
-
-    GSList* current = config.layers;
-    do {
-        // DEBUG_MSG("Going to read layer number %p\n", current);
-
-        int layer = GPOINTER_TO_INT(current->data);
-        DEBUG_MSG("Going to init driver %d\n", layer);
-
-        switch (layer) {
-            case BLOCK_ALIGN:
-                init_align_driver(operations, config);
-                break;
-            case SFUSE:
-                init_sfuse_driver(operations, config);
-                break;
-            case MULTI_LOOPBACK:
-                init_multi_loopback_driver(operations, config);
-                break;
-            case NOPFUSE:
-                init_nop_layer(operations, config);
-                break;
-            default:
-                return 1;
-        }
-        current = current->next;
-
-    } while (current != NULL);
-
-    return 0;
-}
-
-int clean_layers(configuration config) {
-    DEBUG_MSG("Going to clean layers\n");
-
-    GSList* current = config.layers;
-    do {
-        int layer = GPOINTER_TO_INT(current->data);
-        DEBUG_MSG("Going to clean drivers %d\n", layer);
-
-        switch (layer) {
-            case BLOCK_ALIGN:
-                clean_align_driver(config);
-                break;
-            case SFUSE:
-                clean_sfuse_driver(config);
-                break;
-            case MULTI_LOOPBACK:
-                clean_multi_loopback_driver(config);
-                break;
-            case NOPFUSE:
-                clean_nop_layer(config);
-                break;
-            default:
-                return 1;
-        }
-        current = current->next;
-
-    } while (current != NULL);
-    return 0;
-}
+#include "compose/compose.h"
+#include "plugins/plugin.h"
+#include "timestamps/timestamps.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
 
 int main(int argc, char* argv[]) {
     char* local_file_path = LOCAL_SDSCONFIG_PATH;
@@ -98,19 +40,49 @@ int main(int argc, char* argv[]) {
     struct fuse_operations* operations;
     DEBUG_MSG("Configuration structure is setup\n");
 
-    compose_layers(&operations, *config);
+    init_trace(config->trace_config);
+    res = (config->stacks != NULL) ? compose_stacks(&operations, *config) : compose_layers(&operations, *config);
+    if (res != 0) {
+        fprintf(stderr, "Could not compose the layers of the configuration\n");
+        exit(EXIT_FAILURE);
+    }
+    init_trace_operations(&operations);
+    if (config->fuse_config.stats) {
+        init_stats(&operations);
+    }
 
     struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
     int i;
     for (i = 0; i < argc; i++) {
         fuse_opt_add_arg(&args, argv[i]);
     }
-    fuse_opt_add_arg(&args, "-omodules=subdir,subdir=/");
 
-    fuse_main(args.argc, args.argv, operations, NULL);
+    int writeback = config->fuse_config.writeback_cache &&
+                    ((config->stacks != NULL) ? stacks_handle_unaligned_writes(*config)
+                                              : handles_unaligned_writes(*config));
+#ifdef SFS_FUSE3
+    // libfuse 3 builds only have the low-level front end, the layers keep the libfuse 2 operations
+    lowlevel_main(&args, operations, writeback);
+#else
+    if (config->fuse_config.lowlevel) {
+        lowlevel_main(&args, operations, writeback);
+    } else {
+        fuse_opt_add_arg(&args, "-omodules=subdir,subdir=/");
+        fuse_main(args.argc, args.argv, operations, NULL);
+    }
+#endif
+    fuse_opt_free_args(&args);
     DEBUG_MSG("Going to clean layers\n");
 
-    clean_layers(*config);
+    if (config->stacks != NULL) {
+        clean_stacks(*config);
+    } else {
+        clean_layers(*config);
+    }
+    clean_plugins();
+    clean_stats();
+    clean_trace();
+    clean_latencies();
     res = clean_config(config);
     LOG_EXIT();
     return res;
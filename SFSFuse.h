@@ -15,6 +15,8 @@
 #include "SFSConfig.h"
 #include "multi_loopback.h"
 #include "nopfuse.h"
+#include "lowlevel/lowlevel.h"
+#include "router/router.h"
 #include <stdio.h>
 #include <fuse.h>
 
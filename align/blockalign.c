@@ -6,42 +6,312 @@
 
 
 #include "blockalign.h"
+#include "blockcache.h"
+#include "blocklock.h"
+#include "readahead.h"
+#include "../geometry/geometry.h"
+#include "../trace/trace.h"
 #include <errno.h>
 #include <stdio.h>
 
-int BLOCKSIZE = 0;
+// Logical size of the files open through this layer, kept from open/create until the last release.
+// Every change to the size of an open file goes through this layer, so the lower layer is only
+// asked for the size of files that are not open.
+static ivdb fsize_cache;
+static GMutex fsize_mutex;
 
-ivdb fsize_cache;
+// Whole blocks of a request are passed to the lower layer as one request, only the unaligned head
+// and tail are processed block by block
+static int coalesce_blocks = 1;
 
-void define_block_size(block_align_config config) {
-    BLOCKSIZE = config.block_size;
+// Files are extended by truncating the lower layer, leaving holes, instead of writing zero blocks
+static int sparse_truncate = 0;
+
+void init_block_align(block_align_config config, int erasure, int authenticated) {
+    coalesce_blocks = !erasure;
+    // erasure coded stripes and authenticated blocks cannot be read back from holes
+    sparse_truncate = config.sparse_truncate && !erasure && !authenticated;
+
+    init_hash_full(&fsize_cache);
+    g_mutex_init(&fsize_mutex);
+
+    init_geometry(config);
+    init_block_locks();
+    init_block_cache(config);
+    init_readahead(config, coalesce_blocks);
+}
+
+void clean_block_align() {
+    clean_readahead();
+    clean_block_cache();
+    clean_block_locks();
+    clean_geometry();
+
+    g_hash_table_destroy(fsize_cache.hash);
+    g_mutex_clear(&fsize_mutex);
+}
+
+// Returns 1 and takes a reference on the entry of path if its size is known
+static int fsize_acquire(const char *path) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL) {
+        value->open_count++;
+    }
+    g_mutex_unlock(&fsize_mutex);
+
+    return value != NULL;
+}
+
+static void fsize_insert(const char *path, off_t size) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL) {
+        // opened concurrently, the size already known is kept
+        value->open_count++;
+    } else {
+        value = calloc(1, sizeof(value_db));
+        value->file_size = size;
+        value->open_count = 1;
+        hash_put(&fsize_cache, strdup(path), value);
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+static int fsize_get(const char *path, uint64_t *size) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL) {
+        *size = value->file_size;
+    }
+    g_mutex_unlock(&fsize_mutex);
+
+    return value != NULL;
+}
+
+// block_size is only needed when the size may shrink
+static void fsize_set(const char *path, off_t size, int extend_only, int block_size) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL && (!extend_only || value->file_size < size)) {
+        value->file_size = size;
+    }
+    // only whole blocks below the new size stay zeros
+    if (value != NULL && !extend_only && value->zero_end > size / block_size) {
+        value->zero_end = size / block_size;
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+// Records the blocks [start, end) of path as zeros, merged with the blocks it already has if they are adjacent
+static void fsize_add_zero_blocks(const char *path, uint64_t start, uint64_t end) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL) {
+        if (value->zero_start < value->zero_end && value->zero_end == start) {
+            value->zero_end = end;
+        } else {
+            value->zero_start = start;
+            value->zero_end = end;
+        }
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+// Returns 1 if the block of path is known to be zeros
+static int fsize_is_zero_block(const char *path, uint64_t block) {
+    value_db *value = NULL;
+    int zero = 0;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL) {
+        zero = block >= value->zero_start && block < value->zero_end;
+    }
+    g_mutex_unlock(&fsize_mutex);
+
+    return zero;
+}
+
+// Blocks [start, start + nblocks) of path are about to be written. The zero blocks are a single range, so
+// the blocks past a write in its middle are dropped too and read from the lower layer holes instead.
+static void fsize_clear_zero_blocks(const char *path, uint64_t start, uint64_t nblocks) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL && start < value->zero_end && start + nblocks > value->zero_start) {
+        if (start <= value->zero_start) {
+            value->zero_start = start + nblocks;
+        } else {
+            value->zero_end = start;
+        }
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+static void fsize_release(const char *path) {
+    value_db *value = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)path, &value);
+    if (value != NULL && --value->open_count <= 0) {
+        remove_keys(&fsize_cache, (char *)path);
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+// Forgets path and every path below it
+static void fsize_remove(const char *path) {
+    g_mutex_lock(&fsize_mutex);
+    remove_keys_with_prefix(&fsize_cache, path);
+    g_mutex_unlock(&fsize_mutex);
+}
+
+static void fsize_rename(const char *from, const char *to) {
+    value_db *value = NULL;
+    value_db *moved = NULL;
+
+    g_mutex_lock(&fsize_mutex);
+    hash_get(&fsize_cache, (char *)from, &value);
+    if (value != NULL) {
+        moved = malloc(sizeof(value_db));
+        *moved = *value;
+    }
+    // entries of files inside a renamed directory are dropped, their size is then asked to the lower layer
+    remove_keys_with_prefix(&fsize_cache, from);
+    remove_keys_with_prefix(&fsize_cache, to);
+    if (moved != NULL) {
+        hash_put(&fsize_cache, strdup(to), moved);
+    }
+    g_mutex_unlock(&fsize_mutex);
+}
+
+// Keeps the size of a file just opened or created
+static void track_open_file(const char *path, void *fi, const struct fuse_operations *nextlayer) {
+    struct stat st;
+    int known = fsize_acquire(path);
+
+    if (known && !block_cache_enabled()) {
+        return;
+    }
+    if (nextlayer->fgetattr(path, &st, fi) != 0) {
+        return;
+    }
+
+    // the content of a file with hard links can be changed through paths this layer does not know
+    if (st.st_nlink > 1) {
+        if (block_cache_enabled()) {
+            block_cache_exclude(path);
+        }
+        return;
+    }
+    if (!known) {
+        fsize_insert(path, st.st_size);
+    }
 }
 
-int block_align_create(const char *path, mode_t mode, void *fi, struct fuse_operations nextlayer) {
+int block_align_create(const char *path, mode_t mode, void *fi, const struct fuse_operations *nextlayer) {
     DEBUG_MSG("Align create Path %s\n", path);
 
     ((struct fuse_file_info *)fi)->flags =
         ((((struct fuse_file_info *)fi)->flags & (~O_RDONLY)) & (~O_WRONLY)) | O_RDWR;
 
-    return nextlayer.create(path, mode, fi);
+    int res = nextlayer->create(path, mode, fi);
+    if (res == 0) {
+        geometry_new_file(path, nextlayer);
+        if (block_cache_enabled()) {
+            block_cache_remove(path);
+        }
+        track_open_file(path, fi, nextlayer);
+    }
+    return res;
 }
 
-int block_align_open(const char *path, void *fi, struct fuse_operations nextlayer) {
+int block_align_open(const char *path, void *fi, const struct fuse_operations *nextlayer) {
     DEBUG_MSG("Align open Path %s\n", path);
     ((struct fuse_file_info *)fi)->flags =
         ((((struct fuse_file_info *)fi)->flags & (~O_RDONLY)) & (~O_WRONLY)) | O_RDWR;
 
-    return nextlayer.open(path, fi);
+    int res = nextlayer->open(path, fi);
+    if (res == 0) {
+        track_open_file(path, fi, nextlayer);
+    }
+    return res;
+}
+
+int block_align_release(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer) {
+    if (readahead_enabled()) {
+        readahead_release(fi);
+    }
+    int res = nextlayer->release(path, fi);
+    fsize_release(path);
+    return res;
+}
+
+int block_align_unlink(const char *path, const struct fuse_operations *nextlayer) {
+    int res = nextlayer->unlink(path);
+    if (res == 0) {
+        geometry_remove(path);
+        if (block_cache_enabled()) {
+            block_cache_remove(path);
+        }
+        fsize_remove(path);
+    }
+    return res;
+}
+
+int block_align_rename(const char *from, const char *to, const struct fuse_operations *nextlayer) {
+    int res = nextlayer->rename(from, to);
+    if (res == 0) {
+        geometry_rename(from, to);
+        if (block_cache_enabled()) {
+            struct stat st;
+            // only the files of a directory need the whole cache to be scanned, the type is unknown if getattr fails
+            int is_directory = nextlayer->getattr(to, &st) != 0 || S_ISDIR(st.st_mode);
+            block_cache_rename(from, to, is_directory);
+        }
+        fsize_rename(from, to);
+    }
+    return res;
+}
+
+int block_align_link(const char *from, const char *to, const struct fuse_operations *nextlayer) {
+    int res = nextlayer->link(from, to);
+    if (res == 0) {
+        if (block_cache_enabled()) {
+            block_cache_exclude(from);
+            block_cache_exclude(to);
+        }
+        fsize_remove(from);
+        fsize_remove(to);
+    }
+    return res;
 }
 
-off_t block_align_get_file_size(const char *path, struct fuse_file_info *fi, struct fuse_operations nextlayer) {
+off_t block_align_get_file_size(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer) {
     struct stat st;
+    uint64_t size;
+
+    if (fsize_get(path, &size)) {
+        return size;
+    }
 
     if (fi != NULL) {
-        nextlayer.fgetattr(path, &st, fi);
+        nextlayer->fgetattr(path, &st, fi);
         DEBUG_MSG("fi is not null\n");
     } else {
-        nextlayer.getattr(path, &st);
+        nextlayer->getattr(path, &st);
         DEBUG_MSG("fi is null\n");
     }
 
@@ -50,7 +320,7 @@ off_t block_align_get_file_size(const char *path, struct fuse_file_info *fi, str
 
 int read_block(char *buf, size_t size, uint64_t offset, struct io_info *inf) {
     // read to the buffer by calling the next layer
-    return inf->nextlayer.read(inf->path, buf, size, offset, inf->fi);
+    return inf->nextlayer->read(inf->path, buf, size, offset, inf->fi);
 }
 
 int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t block_extra_offset,
@@ -60,8 +330,29 @@ int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t b
 
     uint64_t file_size = 0;
     int bytes_to_read;
+    uint64_t generation = 0;
 
-    if (size + block_extra_offset != BLOCKSIZE) {
+    // blocks of a sparse extension are whole blocks inside the file
+    if (sparse_truncate && fsize_is_zero_block(inf->path, block_offset / inf->block_size)) {
+        memset(buf, 0, size);
+        return size;
+    }
+
+    if (block_cache_enabled()) {
+        char cached_buf[inf->block_size];
+        int cached_size = block_cache_get(inf->path, block_offset / inf->block_size, cached_buf, &generation);
+        if (cached_size >= 0) {
+            if (cached_size <= block_extra_offset) {
+                return 0;
+            }
+            int requested_size_read =
+                (cached_size - block_extra_offset > size) ? size : cached_size - block_extra_offset;
+            memcpy(buf, &cached_buf[block_extra_offset], requested_size_read);
+            return requested_size_read;
+        }
+    }
+
+    if (size + block_extra_offset != inf->block_size) {
 
         if (file_size == 0) {
             // Get the file size
@@ -70,11 +361,11 @@ int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t b
 
         bytes_to_read = ((size + block_extra_offset) >= file_size - block_offset) ? size + block_extra_offset
                                                                                   : file_size - block_offset;
-        if (bytes_to_read > BLOCKSIZE) {
-            bytes_to_read = BLOCKSIZE;
+        if (bytes_to_read > inf->block_size) {
+            bytes_to_read = inf->block_size;
         }
     } else {
-        bytes_to_read = BLOCKSIZE;
+        bytes_to_read = inf->block_size;
     }
 
     // block bytes that must be read
@@ -92,8 +383,7 @@ int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t b
               inf->path, (unsigned long long int)block_offset, (unsigned long long int)block_extra_offset, size, res);
 
     // The request was for reading size bytes at offset block_extra_offset
-    // If we read less bytes than the bytes read from the extra_offset return an error.
-    if (res - block_extra_offset < 0) {
+    if (res < 0) {
         ERROR_MSG("res < 0 - Read done file Path %s, and block offset %llu, extra_offset %llu, size %zu, res %d\n",
                   inf->path, (unsigned long long int)block_offset, (unsigned long long int)block_extra_offset, size,
                   res);
@@ -103,6 +393,16 @@ int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t b
     DEBUG_MSG("Read done before memcpy file Path %s, and block offset %llu, extra_offset %llu, size %zu, res %d\n",
               inf->path, (unsigned long long int)block_offset, (unsigned long long int)block_extra_offset, size, res);
 
+    // bytes_to_read covers the whole block, so what was read is its full content
+    if (res > 0 && block_cache_enabled()) {
+        block_cache_fill(inf->path, block_offset / inf->block_size, aux_buf, res, generation);
+    }
+
+    // If we read less bytes than the extra_offset the request starts past the end of the file
+    if (res <= block_extra_offset) {
+        return 0;
+    }
+
     int requested_size_read = ((res - block_extra_offset > size)) ? size : res - block_extra_offset;
 
     // copy the returned bytes to the buffer (excluding the extra_offset)
@@ -116,7 +416,7 @@ int process_read_block(char *buf, size_t size, uint64_t block_offset, uint64_t b
 
 int write_block(char *buf, size_t size, uint64_t offset, struct io_info *inf) {
     // Write the buffer to the block by calling the next layer
-    return inf->nextlayer.write(inf->path, buf, size, offset, inf->fi);
+    return inf->nextlayer->write(inf->path, buf, size, offset, inf->fi);
 }
 
 int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t block_extra_offset,
@@ -129,22 +429,36 @@ int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t
     int bytes_to_write = 0;
 
     // auxiliary buff
-    char aux_buf[BLOCKSIZE];
+    char aux_buf[inf->block_size];
 
     uint64_t file_size = 0;
 
+    // Size of the block when it was found in the cache, its content is then in aux_buf
+    int cached_size = -1;
+
     DEBUG_MSG("Process Write file Path %s, and block offset %llu, extra_offset %llu, size %zu\n", inf->path,
               (unsigned long long int)block_offset, (unsigned long long int)block_extra_offset, size);
 
     // Optimization to avoid calculating file size
-    // If the size to write is equal to BLOCKSIZE and extra_offset is zero (It should always be in this case!)
+    // If the size to write is equal to the block size and extra_offset is zero (It should always be in this case!)
     // Avoid calculating file size and reading back the content already written
-    if (size == BLOCKSIZE && block_extra_offset == 0) {
+    if (size == inf->block_size && block_extra_offset == 0) {
         write_buf = buf;
-        bytes_to_write = BLOCKSIZE;
+        bytes_to_write = inf->block_size;
 
     } else {
-        if (file_size == 0) {
+        if (sparse_truncate && fsize_is_zero_block(inf->path, block_offset / inf->block_size)) {
+            memset(aux_buf, 0, inf->block_size);
+            cached_size = inf->block_size;
+        } else if (block_cache_enabled()) {
+            cached_size = block_cache_get(inf->path, block_offset / inf->block_size, aux_buf, NULL);
+        }
+
+        if (cached_size > 0) {
+            // A cached block smaller than the block size is the last one of the file. For full blocks only the
+            // block size first remaining bytes matter.
+            file_size = block_offset + cached_size;
+        } else if (file_size == 0) {
             // Get the file size
             file_size = block_align_get_file_size(inf->path, inf->fi, inf->nextlayer);
         }
@@ -158,7 +472,7 @@ int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t
 
         // If the offset to be written is at the end of file it is an append to the file
         if (block_offset >= file_size) {
-            // If this happens fuse is trying to write bytes in an invalid position higher than filesize...
+            // block_align_write fills the bytes between the end of the file and the write with zeros first
             if (block_offset > file_size || block_extra_offset > 0) {
                 // Error this cannot happen
                 ERROR_MSG("Append ERROR file Path %s, and block offset %llu, extra_offset %llu, size %zu\n", inf->path,
@@ -185,18 +499,23 @@ int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t
 
             } else {
                 // bytes to read from the block being processed
-                int bytes_to_read = (remaining_file_bytes < BLOCKSIZE) ? remaining_file_bytes : BLOCKSIZE;
+                int bytes_to_read = (remaining_file_bytes < inf->block_size) ? remaining_file_bytes : inf->block_size;
 
                 // Since the bytes read can be appended with extra bytes we need to check the final amount of bytes to
                 // write
                 bytes_to_write =
                     (bytes_to_read > size + block_extra_offset) ? bytes_to_read : size + block_extra_offset;
 
-                // read from the next layer the necessary block bytes
-                int res = inf->nextlayer.read(inf->path, aux_buf, bytes_to_read, block_offset, inf->fi);
-                if (res < bytes_to_read) {
-                    ERROR_MSG("Bytes read %s\n", strerror(res));
-                    return -1;
+                // read from the next layer the necessary block bytes, unless they are cached
+                if (cached_size < bytes_to_read) {
+                    struct trace_span span;
+                    trace_span_begin(&span);
+                    int res = inf->nextlayer->read(inf->path, aux_buf, bytes_to_read, block_offset, inf->fi);
+                    trace_span_end(&span, "align.rmw_read", -1);
+                    if (res < bytes_to_read) {
+                        ERROR_MSG("Bytes read %s\n", strerror(res));
+                        return -1;
+                    }
                 }
 
                 // We read the block and then modify the necessary content.
@@ -211,6 +530,10 @@ int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t
         }
     }
 
+    if (sparse_truncate) {
+        fsize_clear_zero_blocks(inf->path, block_offset / inf->block_size, 1);
+    }
+
     // Finally, write the bytes
     res = write_block(write_buf, bytes_to_write, block_offset, inf);
     if (res < bytes_to_write) {
@@ -220,6 +543,120 @@ int process_write_block(char *buf, size_t size, uint64_t block_offset, uint64_t
         return -1;
     }
 
+    // write-through, the cache keeps the new content of the whole block
+    if (block_cache_enabled()) {
+        block_cache_update(inf->path, block_offset / inf->block_size, write_buf, bytes_to_write);
+    }
+    fsize_set(inf->path, block_offset + bytes_to_write, 1, inf->block_size);
+
+    return size;
+}
+
+// Reads nblocks whole blocks starting at the aligned offset. Cached blocks are copied and each run of
+// missing blocks is read with a single request.
+static int read_full_blocks(char *buf, int nblocks, uint64_t offset, struct io_info *inf) {
+    uint64_t first_block = offset / inf->block_size;
+    int blocks_done = 0;
+
+    while (blocks_done < nblocks) {
+        uint64_t generation = 0;
+        int run = nblocks - blocks_done;
+        // size of the cached block found right after the run, -1 if there is none
+        int hit_size = -1;
+
+        if (sparse_truncate && fsize_is_zero_block(inf->path, first_block + blocks_done)) {
+            memset(&buf[blocks_done * inf->block_size], 0, inf->block_size);
+            blocks_done++;
+            continue;
+        }
+
+        if (block_cache_enabled()) {
+            hit_size = block_cache_get(inf->path, first_block + blocks_done, &buf[blocks_done * inf->block_size], &generation);
+            if (hit_size >= 0) {
+                // a cached block smaller than the block size is the last one of the file
+                if (hit_size < inf->block_size) {
+                    return blocks_done * inf->block_size + hit_size;
+                }
+                blocks_done++;
+                continue;
+            }
+        }
+
+        // the run of blocks to read ends at the next zero or cached block
+        if (sparse_truncate || block_cache_enabled()) {
+            run = 1;
+            while (blocks_done + run < nblocks) {
+                if (sparse_truncate && fsize_is_zero_block(inf->path, first_block + blocks_done + run)) {
+                    break;
+                }
+                if (block_cache_enabled()) {
+                    hit_size = block_cache_get(inf->path, first_block + blocks_done + run,
+                                               &buf[(blocks_done + run) * inf->block_size], NULL);
+                    if (hit_size >= 0) {
+                        break;
+                    }
+                }
+                run++;
+            }
+        }
+
+        int size = run * inf->block_size;
+        int res = read_block(&buf[blocks_done * inf->block_size], size, offset + (uint64_t)blocks_done * inf->block_size, inf);
+        if (res < 0) {
+            ERROR_MSG("Read of %d blocks failed file Path %s, offset %llu, res %d\n", run, inf->path,
+                      (unsigned long long int)offset + blocks_done * inf->block_size, res);
+            return -1;
+        }
+
+        if (block_cache_enabled()) {
+            int i;
+            for (i = 0; i * inf->block_size < res; i++) {
+                int block_size = (res - i * inf->block_size < inf->block_size) ? res - i * inf->block_size : inf->block_size;
+                block_cache_fill(inf->path, first_block + blocks_done + i, &buf[(blocks_done + i) * inf->block_size],
+                                 block_size, generation);
+            }
+        }
+
+        // the end of the file was reached
+        if (res < size) {
+            return blocks_done * inf->block_size + res;
+        }
+        blocks_done += run;
+
+        if (hit_size >= 0) {
+            if (hit_size < inf->block_size) {
+                return blocks_done * inf->block_size + hit_size;
+            }
+            blocks_done++;
+        }
+    }
+
+    return nblocks * inf->block_size;
+}
+
+// Writes nblocks whole blocks starting at the aligned offset with a single request
+static int write_full_blocks(char *buf, int nblocks, uint64_t offset, struct io_info *inf) {
+    int size = nblocks * inf->block_size;
+    int i;
+
+    if (sparse_truncate) {
+        fsize_clear_zero_blocks(inf->path, offset / inf->block_size, nblocks);
+    }
+
+    int res = write_block(buf, size, offset, inf);
+    if (res < size) {
+        DEBUG_MSG("Error write of %d blocks file Path %s, offset %llu, res %d\n", nblocks, inf->path,
+                  (unsigned long long int)offset, res);
+        return -1;
+    }
+
+    if (block_cache_enabled()) {
+        for (i = 0; i < nblocks; i++) {
+            block_cache_update(inf->path, offset / inf->block_size + i, &buf[i * inf->block_size], inf->block_size);
+        }
+    }
+    fsize_set(inf->path, offset + size, 1, inf->block_size);
+
     return size;
 }
 
@@ -241,12 +678,35 @@ int split_into_blocks(int io_type, char *buf, size_t size, uint64_t aligned_offs
         // original request size minus bytes already processed
         uint64_t remaining_size_to_process = size - buffer_bytes_processed;
 
+        // Whole blocks go down together, only the head and tail of the request need the block by block path
+        if (coalesce_blocks && next_block_extra_offset == 0 && remaining_size_to_process >= inf->block_size) {
+            int nblocks = remaining_size_to_process / inf->block_size;
+            int res;
+
+            if (io_type == WRITE) {
+                res = write_full_blocks(&buf[buffer_bytes_processed], nblocks, next_offset_to_process, inf);
+            } else {
+                res = read_full_blocks(&buf[buffer_bytes_processed], nblocks, next_offset_to_process, inf);
+            }
+            if (res < 0) {
+                return res;
+            }
+
+            buffer_bytes_processed += res;
+            next_offset_to_process += (uint64_t)nblocks * inf->block_size;
+
+            if (res < nblocks * inf->block_size) {
+                return buffer_bytes_processed;
+            }
+            continue;
+        }
+
         // Check if remaining bytes to process fit or not in a single block.
         // We need to have in account if buffer bytes are written in the beggining of the block or not (extra_offset)
         // if the value is higher than BLKSIZE, process the corresponding block (remove the extra_offset bytes that are
         // not going to be read/written) and advance to the next block
-        int size_to_process_in_block = (remaining_size_to_process + next_block_extra_offset >= BLOCKSIZE)
-                                           ? BLOCKSIZE - next_block_extra_offset
+        int size_to_process_in_block = (remaining_size_to_process + next_block_extra_offset >= inf->block_size)
+                                           ? inf->block_size - next_block_extra_offset
                                            : remaining_size_to_process;
 
         DEBUG_MSG(
@@ -280,8 +740,8 @@ int split_into_blocks(int io_type, char *buf, size_t size, uint64_t aligned_offs
         // The buffer size processed is updated according to thre result of the previous function
         buffer_bytes_processed += res;
 
-        // The next offset to process is increased by the BLKSIZE (offset is always aligned with the BLOCKSIZE)
-        next_offset_to_process += BLOCKSIZE;
+        // The next offset to process is increased by the BLKSIZE (offset is always aligned with the block size)
+        next_offset_to_process += inf->block_size;
 
         // now the writes are aligned for sure so, extra_offset is zero.
         // Only the first block processed may have an extra_offset i.e., not being read/written at the beggining of the
@@ -303,14 +763,14 @@ int split_into_blocks(int io_type, char *buf, size_t size, uint64_t aligned_offs
     return buffer_bytes_processed;
 }
 
-int block_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi,
-                     struct fuse_operations nextlayer) {
+int block_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, int block_size,
+                     const struct fuse_operations *nextlayer) {
     DEBUG_MSG("Entering function block_align_read with the following arguments.\n");
     DEBUG_MSG("Path %s,  offset %llu, size %zu\n", path, (unsigned long long int)offset, size);
 
     // if the offset to write is not aligned with a block, we need to know where the write is positioned in the block
     // (extra_bytes)
-    uint64_t block_extra_offset = offset % BLOCKSIZE;
+    uint64_t block_extra_offset = offset % block_size;
 
     // the offset where the block starts is the offset to write minus the extra bytes
     uint64_t aligned_offset = offset - block_extra_offset;
@@ -319,18 +779,50 @@ int block_align_read(const char *path, char *buf, size_t size, off_t offset, voi
     inf.fi = fi;
     inf.path = path;
     inf.nextlayer = nextlayer;
+    inf.block_size = block_size;
+
+    int res = split_into_blocks(READ, buf, size, aligned_offset, block_extra_offset, &inf);
+
+    // there is nothing to read ahead past the end of the file
+    if (res == size && fi != NULL && readahead_enabled()) {
+        readahead_access(path, offset, size, block_size, fi, nextlayer);
+    }
+
+    return res;
+}
+
+// Writes zeros to [from, to) of the file, the caller holds the locks of the blocks
+static int write_zeros(uint64_t from, uint64_t to, struct io_info *inf) {
+    char zeros[inf->block_size];
 
-    return split_into_blocks(READ, buf, size, aligned_offset, block_extra_offset, &inf);
+    bzero(zeros, inf->block_size);
+    while (from < to) {
+        uint64_t block_extra_offset = from % inf->block_size;
+        int size = (to - from < inf->block_size - block_extra_offset) ? to - from : inf->block_size - block_extra_offset;
+
+        int res = split_into_blocks(WRITE, zeros, size, from - block_extra_offset, block_extra_offset, inf);
+        if (res < size) {
+            DEBUG_MSG("Failed write of zeros file Path %s, offset %llu, res %d\n", inf->path,
+                      (unsigned long long int)from, res);
+            return -1;
+        }
+        from += size;
+    }
+    return 0;
 }
 
-int block_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi,
-                      struct fuse_operations nextlayer) {
+int block_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi, int block_size,
+                      const struct fuse_operations *nextlayer) {
     DEBUG_MSG("Entering function block_align_write with the following arguments.\n");
     DEBUG_MSG("Path %s,  offset %llu, size %zu\n", path, (unsigned long long int)offset, size);
 
+    if (size == 0) {
+        return 0;
+    }
+
     // if the offset to write is not aligned with a block, we need to know where the write is positioned in the block
     // (extra_bytes)
-    uint64_t block_extra_offset = offset % BLOCKSIZE;
+    uint64_t block_extra_offset = offset % block_size;
 
     // the offset where the block starts is the offset to write minus the extra bytes
     uint64_t aligned_offset = offset - block_extra_offset;
@@ -339,24 +831,126 @@ int block_align_write(const char *path, const char *buf, size_t size, off_t offs
     inf.fi = fi;
     inf.path = path;
     inf.nextlayer = nextlayer;
+    inf.block_size = block_size;
+
+    // concurrent writes to the same blocks would overwrite each other's read-modify-write
+    struct block_lock lock;
+    uint64_t end_block = (offset + size + block_size - 1) / block_size;
+    uint64_t first_block = aligned_offset / block_size;
+    uint64_t file_size = block_align_get_file_size(path, fi, nextlayer);
+    int res;
+
+    // A write past the end of the file (e.g. merged by the writeback cache) first fills the gap with
+    // zeros, the blocks of the gap are locked with those of the write. The size is checked again once
+    // they are locked, the file may have been extended or truncated meanwhile.
+    while (1) {
+        if (file_size < offset && file_size / block_size < first_block) {
+            first_block = file_size / block_size;
+        }
+        block_lock_range(path, first_block, end_block - first_block, &lock);
+        if (file_size >= offset) {
+            break;
+        }
+        file_size = block_align_get_file_size(path, fi, nextlayer);
+        if (file_size >= offset || file_size / block_size >= first_block) {
+            break;
+        }
+        block_unlock_range(&lock);
+    }
+
+    if (file_size < offset && write_zeros(file_size, offset, &inf) < 0) {
+        block_unlock_range(&lock);
+        return -1;
+    }
+
+    res = split_into_blocks(WRITE, (char *)buf, size, aligned_offset, block_extra_offset, &inf);
+
+    block_unlock_range(&lock);
+
+    return res;
+}
+
+/*
+ * Extends a file from old_size to size without writing its new whole blocks. The last block is
+ * filled with zeros, the lower layer is truncated up to the last block boundary, leaving a hole
+ * that reads as zeros, and the final partial block is written. The blocks of the hole are
+ * remembered while the file is open so that reading them does not go down the stack.
+ */
+static int sparse_extend(const char *path, off_t old_size, off_t size, int block_size, struct fuse_file_info *fi,
+                         const struct fuse_operations *nextlayer) {
+    char zeros[block_size];
+    off_t tail_end = (old_size + block_size - 1) / block_size * block_size;
+    off_t hole_end = size / block_size * block_size;
+    int res;
+
+    bzero(zeros, block_size);
+
+    if (tail_end > size) {
+        tail_end = size;
+    }
+    if (tail_end > old_size) {
+        res = block_align_write(path, zeros, tail_end - old_size, old_size, fi, block_size, nextlayer);
+        if (res < tail_end - old_size) {
+            DEBUG_MSG("Failed write %s of the last block at %llu\n", path, (unsigned long long int)old_size);
+            return -1;
+        }
+    }
+
+    if (hole_end > tail_end) {
+        res = nextlayer->ftruncate(path, hole_end, fi);
+        if (res < 0) {
+            DEBUG_MSG("Failed truncate %s size is %llu\n", path, (unsigned long long int)hole_end);
+            return -1;
+        }
+        fsize_set(path, hole_end, 0, block_size);
+        fsize_add_zero_blocks(path, tail_end / block_size, hole_end / block_size);
+
+        if (size > hole_end) {
+            res = block_align_write(path, zeros, size - hole_end, hole_end, fi, block_size, nextlayer);
+            if (res < size - hole_end) {
+                DEBUG_MSG("Failed write %s of the new last block at %llu\n", path, (unsigned long long int)hole_end);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
 
-    return split_into_blocks(WRITE, (char *)buf, size, aligned_offset, block_extra_offset, &inf);
+// Releases the file opened by block_align_truncate when the caller did not pass one
+static int release_truncate_file(const char *path, struct fuse_file_info *fi, struct fuse_file_info *fi_in,
+                                 const struct fuse_operations *nextlayer) {
+    int res = 0;
+
+    if (fi_in == NULL) {
+        DEBUG_MSG("release new_path %s\n", path);
+        res = nextlayer->release(path, fi);
+        free(fi);
+    }
+    return res;
 }
 
-int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi_in, struct fuse_operations nextlayer) {
+int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi_in, int block_size,
+                         const struct fuse_operations *nextlayer) {
     struct stat stbuf;
     int res;
     struct fuse_file_info *fi;
+    uint64_t known_size;
 
-    int extra_bytes = size % BLOCKSIZE;
+    int extra_bytes = size % block_size;
     char buffer[extra_bytes];
-    uint64_t block_offset = size / BLOCKSIZE * BLOCKSIZE;
+    struct block_lock tail_lock;
+    int tail_locked = 0;
+    uint64_t block_offset = size / block_size * block_size;
 
     // Get file size
-    if (fi_in == NULL) {
-        res = nextlayer.getattr(path, &stbuf);
+    if (fsize_get(path, &known_size)) {
+        stbuf.st_size = known_size;
+        res = 0;
+    } else if (fi_in == NULL) {
+        res = nextlayer->getattr(path, &stbuf);
     } else {
-        res = nextlayer.fgetattr(path, &stbuf, fi_in);
+        res = nextlayer->fgetattr(path, &stbuf, fi_in);
     }
 
     if (res < 0) {
@@ -372,8 +966,8 @@ int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi
     } else {
         fi = malloc(sizeof(struct fuse_file_info));
         fi->flags = O_RDWR;
-        res = nextlayer.open(path, fi);
-        if (res == -1) {
+        res = nextlayer->open(path, fi);
+        if (res < 0) {
             DEBUG_MSG("Error truncate opening file %s truncate size is %lu\n", path, size);
             free(fi);
             return res;
@@ -382,7 +976,13 @@ int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi
 
     // CASE1
     // Size is higher than current file size
-    if (size > stbuf.st_size) {
+    if (size > stbuf.st_size && sparse_truncate) {
+        res = sparse_extend(path, stbuf.st_size, size, block_size, fi, nextlayer);
+        if (res < 0) {
+            release_truncate_file(path, fi, fi_in, nextlayer);
+            return -1;
+        }
+    } else if (size > stbuf.st_size) {
         off_t size_to_write = size - stbuf.st_size;
         off_t size_written = 0;
         int blocksize = 64 * 1024;
@@ -394,13 +994,11 @@ int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi
             int iter_size = (blocksize < (size_to_write - size_written)) ? blocksize : size_to_write - size_written;
 
             // Fill the file with zeroes
-            res = block_align_write(path, buff, iter_size, offset, fi, nextlayer);
+            res = block_align_write(path, buff, iter_size, offset, fi, block_size, nextlayer);
             if (res < iter_size) {
                 DEBUG_MSG("Failed write %s iter_size is %d offset is %llu\n", path, iter_size,
                           (unsigned long long int)offset);
-                if (fi_in == NULL) {
-                    free(fi);
-                }
+                release_truncate_file(path, fi, fi_in, nextlayer);
                 return -1;
             }
 
@@ -417,54 +1015,66 @@ int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi
             DEBUG_MSG("read %s extra_bytes is %d offset is %llu\n", path, extra_bytes,
                       (unsigned long long int)block_offset);
 
-            res = block_align_read(path, buffer, extra_bytes, block_offset, fi, nextlayer);
+            // the last block is read and written back, a write to it meanwhile would be lost
+            block_lock_range(path, block_offset / block_size, 1, &tail_lock);
+            tail_locked = 1;
+
+            // read without block_align_read, the read ahead it starts would keep the handle of the truncate
+            struct io_info inf;
+            inf.fi = fi;
+            inf.path = path;
+            inf.nextlayer = nextlayer;
+            inf.block_size = block_size;
+            res = split_into_blocks(READ, buffer, extra_bytes, block_offset, 0, &inf);
             if (res < extra_bytes) {
                 DEBUG_MSG("Failed read %s extra_bytes is %d offset is %llu\n", path, extra_bytes,
                           (unsigned long long int)block_offset);
-                if (fi_in == NULL) {
-                    free(fi);
-                }
+                block_unlock_range(&tail_lock);
+                release_truncate_file(path, fi, fi_in, nextlayer);
                 return -1;
             }
         }
     }
 
-    res = nextlayer.ftruncate(path, size, fi);
+    res = nextlayer->ftruncate(path, size, fi);
     if (res < 0) {
         DEBUG_MSG("Failed truncate %s size is %lu\n", path, size);
-        if (fi_in == NULL) {
-            free(fi);
+        if (tail_locked) {
+            block_unlock_range(&tail_lock);
         }
+        release_truncate_file(path, fi, fi_in, nextlayer);
         return -1;
     }
 
+    // the last block rewritten below keeps the same first bytes
+    if (block_cache_enabled()) {
+        block_cache_truncate(path, size, block_size);
+    }
+    fsize_set(path, size, 0, block_size);
+
     if (extra_bytes > 0 && size < stbuf.st_size) {
         struct io_info inf;
         inf.fi = fi;
         inf.path = path;
         inf.nextlayer = nextlayer;
+        inf.block_size = block_size;
 
         res = write_block(buffer, extra_bytes, block_offset, &inf);
         if (res < extra_bytes) {
             DEBUG_MSG("Failed write 2 %s iter_size is %d offset is %llu\n", path, extra_bytes,
                       (unsigned long long int)block_offset);
-            if (fi_in == NULL) {
-                free(fi);
-            }
+            block_unlock_range(&tail_lock);
+            release_truncate_file(path, fi, fi_in, nextlayer);
             return -1;
         }
     }
+    if (tail_locked) {
+        block_unlock_range(&tail_lock);
+    }
 
-    if (fi_in == NULL) {
-        DEBUG_MSG("release new_path %s\n", path);
-        res = nextlayer.release(path, fi);
-        if (res < 0) {
-            DEBUG_MSG("Failed releDase new_path %s\n", path);
-            free(fi);
-            return -1;
-        }
-
-        free(fi);
+    if (release_truncate_file(path, fi, fi_in, nextlayer) < 0) {
+        DEBUG_MSG("Failed release new_path %s\n", path);
+        return -1;
     }
 
     return 0;
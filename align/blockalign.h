@@ -21,18 +21,29 @@
 #define READ 0
 #define WRITE 1
 
-int block_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, struct fuse_operations);
-int block_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi, struct fuse_operations);
-int block_align_create(const char *path, mode_t mode, void *fi, struct fuse_operations nextlayer);
-int block_align_open(const char *path, void *fi, struct fuse_operations nextlayer);
-int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi, struct fuse_operations nextlayer);
+int block_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, int block_size,
+                     const struct fuse_operations *);
+int block_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi, int block_size,
+                      const struct fuse_operations *);
+int block_align_create(const char *path, mode_t mode, void *fi, const struct fuse_operations *nextlayer);
+int block_align_open(const char *path, void *fi, const struct fuse_operations *nextlayer);
+int block_align_truncate(const char *path, off_t size, struct fuse_file_info *fi, int block_size,
+                         const struct fuse_operations *nextlayer);
+int block_align_release(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer);
+int block_align_unlink(const char *path, const struct fuse_operations *nextlayer);
+int block_align_rename(const char *from, const char *to, const struct fuse_operations *nextlayer);
+int block_align_link(const char *from, const char *to, const struct fuse_operations *nextlayer);
 
 struct io_info {
     const char *path;
     void *fi;
-    struct fuse_operations nextlayer;
+    const struct fuse_operations *nextlayer;
+    // plaintext block size of the file
+    int block_size;
 };
 
-void define_block_size(block_align_config config);
+// erasure: the lower layers keep erasure coded stripes per write request, so every request must be a single block
+void init_block_align(block_align_config config, int erasure, int authenticated);
+void clean_block_align();
 
 #endif /* __BLOCKALIGN_H__ */
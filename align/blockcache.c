@@ -0,0 +1,331 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+
+#include "blockcache.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../logdef.h"
+#include "../map/map.h"
+#include "../stats/stats.h"
+
+struct cached_block {
+    char *path;
+    uint64_t block;
+    // valid bytes, smaller than the block size only for the last block of a file
+    int size;
+    char *data;
+    // position in the LRU list
+    GList *lru_link;
+    // position in the list of the blocks of its file
+    GList *file_link;
+};
+
+// struct cached_block -> struct cached_block, hashed by path and block index
+static GHashTable *blocks = NULL;
+// path -> GQueue of the struct cached_block of the file, so that a file is dropped without a scan
+static GHashTable *files = NULL;
+// Most recently used block at the head
+static GQueue lru = G_QUEUE_INIT;
+// Paths never cached
+static GHashTable *excluded = NULL;
+static GMutex cache_mutex;
+
+// Files may have different block sizes, the capacity is in bytes
+static uint64_t max_bytes = 0;
+static uint64_t cached_bytes = 0;
+static uint64_t hits = 0, misses = 0;
+
+// Bumped on every change to the blocks of the paths of a slot. A block read from the lower layer is
+// only cached if the slot of its path did not change meanwhile.
+#define CACHE_GENERATION_SLOTS 64
+static uint64_t cache_generation[CACHE_GENERATION_SLOTS];
+
+static int generation_slot(const char *path) { return g_str_hash(path) % CACHE_GENERATION_SLOTS; }
+
+static guint cached_block_hash(gconstpointer key) {
+    const struct cached_block *entry = key;
+    return g_str_hash(entry->path) ^ (guint)(entry->block * 2654435761u);
+}
+
+static gboolean cached_block_equal(gconstpointer a, gconstpointer b) {
+    const struct cached_block *entry_a = a;
+    const struct cached_block *entry_b = b;
+    return entry_a->block == entry_b->block && strcmp(entry_a->path, entry_b->path) == 0;
+}
+
+static void free_file_blocks(gpointer data) { g_queue_free(data); }
+
+static void free_cached_block(gpointer data) {
+    struct cached_block *entry = data;
+    GQueue *file_blocks = g_hash_table_lookup(files, entry->path);
+
+    g_queue_delete_link(file_blocks, entry->file_link);
+    if (g_queue_is_empty(file_blocks)) {
+        g_hash_table_remove(files, entry->path);
+    }
+    g_queue_delete_link(&lru, entry->lru_link);
+    cached_bytes -= entry->size;
+    free(entry->path);
+    free(entry->data);
+    free(entry);
+}
+
+static void block_cache_stats(GString *out) {
+    g_mutex_lock(&cache_mutex);
+    g_string_append_printf(out, "block_cache.hits %lu\n", (unsigned long)hits);
+    g_string_append_printf(out, "block_cache.misses %lu\n", (unsigned long)misses);
+    g_string_append_printf(out, "block_cache.bytes %lu\n", (unsigned long)cached_bytes);
+    g_string_append_printf(out, "block_cache.capacity %lu\n", (unsigned long)max_bytes);
+    g_mutex_unlock(&cache_mutex);
+}
+
+void init_block_cache(block_align_config config) {
+    if (config.cache_size <= 0) {
+        return;
+    }
+
+    max_bytes = (uint64_t)config.cache_size * 1024 * 1024;
+
+    g_mutex_init(&cache_mutex);
+    blocks = g_hash_table_new_full(cached_block_hash, cached_block_equal, NULL, free_cached_block);
+    files = g_hash_table_new_full(g_str_hash, g_str_equal, free, free_file_blocks);
+    excluded = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    register_stats_source(block_cache_stats);
+
+    DEBUG_MSG("Block cache of %lu bytes\n", (unsigned long)max_bytes);
+}
+
+void clean_block_cache() {
+    if (blocks == NULL) {
+        return;
+    }
+
+    DEBUG_MSG("Block cache hits %lu misses %lu\n", (unsigned long)hits, (unsigned long)misses);
+
+    // the blocks are removed from the lists of their files
+    g_hash_table_destroy(blocks);
+    g_hash_table_destroy(files);
+    g_hash_table_destroy(excluded);
+    g_mutex_clear(&cache_mutex);
+    blocks = NULL;
+    files = NULL;
+    excluded = NULL;
+}
+
+int block_cache_enabled() { return blocks != NULL; }
+
+static struct cached_block *lookup(const char *path, uint64_t block) {
+    struct cached_block key;
+    key.path = (char *)path;
+    key.block = block;
+    return g_hash_table_lookup(blocks, &key);
+}
+
+// Must be called with cache_mutex held
+static void store_block(const char *path, uint64_t block, const char *buf, int size) {
+    if (g_hash_table_contains(excluded, path)) {
+        return;
+    }
+
+    struct cached_block *entry = lookup(path, block);
+    if (entry != NULL) {
+        g_queue_unlink(&lru, entry->lru_link);
+        g_queue_push_head_link(&lru, entry->lru_link);
+        // the last block of a file grows with appends
+        if (size > entry->size) {
+            entry->data = realloc(entry->data, size);
+        }
+        cached_bytes -= entry->size;
+    } else {
+        GQueue *file_blocks = g_hash_table_lookup(files, path);
+        if (file_blocks == NULL) {
+            file_blocks = g_queue_new();
+            g_hash_table_insert(files, strdup(path), file_blocks);
+        }
+
+        entry = malloc(sizeof(struct cached_block));
+        entry->path = strdup(path);
+        entry->block = block;
+        entry->data = malloc(size);
+        g_queue_push_head(&lru, entry);
+        entry->lru_link = g_queue_peek_head_link(&lru);
+        g_queue_push_head(file_blocks, entry);
+        entry->file_link = g_queue_peek_head_link(file_blocks);
+        g_hash_table_add(blocks, entry);
+    }
+
+    memcpy(entry->data, buf, size);
+    entry->size = size;
+    cached_bytes += size;
+
+    // the block just stored is at the head and is only evicted if it is larger than the cache
+    while (cached_bytes > max_bytes && g_queue_peek_tail(&lru) != entry) {
+        g_hash_table_remove(blocks, g_queue_peek_tail(&lru));
+    }
+}
+
+int block_cache_get(const char *path, uint64_t block, char *buf, uint64_t *generation) {
+    int size = -1;
+
+    g_mutex_lock(&cache_mutex);
+    struct cached_block *entry = lookup(path, block);
+    if (entry != NULL) {
+        memcpy(buf, entry->data, entry->size);
+        size = entry->size;
+        g_queue_unlink(&lru, entry->lru_link);
+        g_queue_push_head_link(&lru, entry->lru_link);
+        hits++;
+    } else {
+        misses++;
+    }
+    if (generation != NULL) {
+        *generation = cache_generation[generation_slot(path)];
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    return size;
+}
+
+int block_cache_contains(const char *path, uint64_t block) {
+    g_mutex_lock(&cache_mutex);
+    int found = lookup(path, block) != NULL;
+    g_mutex_unlock(&cache_mutex);
+
+    return found;
+}
+
+uint64_t block_cache_generation(const char *path) {
+    g_mutex_lock(&cache_mutex);
+    uint64_t generation = cache_generation[generation_slot(path)];
+    g_mutex_unlock(&cache_mutex);
+
+    return generation;
+}
+
+uint64_t block_cache_capacity() { return max_bytes; }
+
+void block_cache_fill(const char *path, uint64_t block, const char *buf, int size, uint64_t generation) {
+    g_mutex_lock(&cache_mutex);
+    if (cache_generation[generation_slot(path)] == generation) {
+        store_block(path, block, buf, size);
+    }
+    g_mutex_unlock(&cache_mutex);
+}
+
+void block_cache_update(const char *path, uint64_t block, const char *buf, int size) {
+    g_mutex_lock(&cache_mutex);
+    cache_generation[generation_slot(path)]++;
+    store_block(path, block, buf, size);
+    g_mutex_unlock(&cache_mutex);
+}
+
+void block_cache_truncate(const char *path, off_t size, int block_size) {
+    GQueue *file_blocks;
+    GList *link;
+
+    g_mutex_lock(&cache_mutex);
+    cache_generation[generation_slot(path)]++;
+    file_blocks = g_hash_table_lookup(files, path);
+    link = (file_blocks != NULL) ? file_blocks->head : NULL;
+    while (link != NULL) {
+        struct cached_block *entry = link->data;
+        uint64_t block_offset = entry->block * block_size;
+
+        // the list of the file is freed with its last block, which is then the last link
+        link = link->next;
+        if (block_offset >= size) {
+            g_hash_table_remove(blocks, entry);
+        } else if (block_offset + entry->size > size) {
+            cached_bytes -= entry->size - (size - block_offset);
+            entry->size = size - block_offset;
+        }
+    }
+    g_mutex_unlock(&cache_mutex);
+}
+
+// Must be called with cache_mutex held
+static void remove_file_blocks(const char *path) {
+    GQueue *file_blocks;
+
+    // the list of the file is freed with its last block
+    while ((file_blocks = g_hash_table_lookup(files, path)) != NULL) {
+        g_hash_table_remove(blocks, g_queue_peek_head(file_blocks));
+    }
+}
+
+static gboolean path_under_prefix(gpointer key, gpointer value, gpointer prefix) {
+    return path_has_prefix((const char *)key, (const char *)prefix);
+}
+
+// Must be called with cache_mutex held
+static void remove_tree_blocks(const char *path) {
+    GList *paths = NULL;
+    GList *current;
+    GHashTableIter iter;
+    gpointer key;
+    int i;
+
+    // a directory changes the slots of every path below it
+    for (i = 0; i < CACHE_GENERATION_SLOTS; i++) {
+        cache_generation[i]++;
+    }
+
+    // the files are removed after the walk, removing their last block changes the table of files
+    g_hash_table_iter_init(&iter, files);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (path_has_prefix(key, path)) {
+            paths = g_list_prepend(paths, strdup(key));
+        }
+    }
+    for (current = paths; current != NULL; current = current->next) {
+        remove_file_blocks(current->data);
+    }
+    g_list_free_full(paths, free);
+    g_hash_table_foreach_remove(excluded, path_under_prefix, (gpointer)path);
+}
+
+void block_cache_remove(const char *path) {
+    g_mutex_lock(&cache_mutex);
+    cache_generation[generation_slot(path)]++;
+    remove_file_blocks(path);
+    g_hash_table_remove(excluded, path);
+    g_mutex_unlock(&cache_mutex);
+}
+
+void block_cache_rename(const char *from, const char *to, int is_directory) {
+    int from_excluded;
+
+    g_mutex_lock(&cache_mutex);
+    from_excluded = g_hash_table_contains(excluded, from);
+
+    if (is_directory) {
+        remove_tree_blocks(from);
+        remove_tree_blocks(to);
+    } else {
+        cache_generation[generation_slot(from)]++;
+        cache_generation[generation_slot(to)]++;
+        remove_file_blocks(from);
+        remove_file_blocks(to);
+        g_hash_table_remove(excluded, from);
+        g_hash_table_remove(excluded, to);
+    }
+    if (from_excluded) {
+        g_hash_table_add(excluded, strdup(to));
+    }
+    g_mutex_unlock(&cache_mutex);
+}
+
+void block_cache_exclude(const char *path) {
+    g_mutex_lock(&cache_mutex);
+    if (!g_hash_table_contains(excluded, path)) {
+        g_hash_table_add(excluded, strdup(path));
+    }
+    cache_generation[generation_slot(path)]++;
+    remove_file_blocks(path);
+    g_mutex_unlock(&cache_mutex);
+}
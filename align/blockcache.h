@@ -0,0 +1,67 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * LRU cache of plaintext blocks used by the block_align layer.
+ * Blocks are identified by the path of their file and their index. The cache is write-through:
+ * every block written to the lower layer is also stored here, so that later partial writes and
+ * small reads of the same block do not go down the stack.
+ */
+
+#ifndef __BLOCKCACHE_H__
+#define __BLOCKCACHE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "../SFSConfig.h"
+
+void init_block_cache(block_align_config config);
+
+void clean_block_cache();
+
+int block_cache_enabled();
+
+// Maximum number of cached bytes
+uint64_t block_cache_capacity();
+
+/**
+ * Copies a cached block to buf.
+ * @param generation If not NULL, receives the token to give to block_cache_fill when the block is missing
+ * @return Number of valid bytes of the block, -1 if it is not cached
+ */
+int block_cache_get(const char *path, uint64_t block, char *buf, uint64_t *generation);
+
+// Returns 1 if the block is cached, without changing its position in the LRU list
+int block_cache_contains(const char *path, uint64_t block);
+
+// Token to give to block_cache_fill for blocks of path read from now on
+uint64_t block_cache_generation(const char *path);
+
+/**
+ * Caches a block read from the lower layer. Nothing is done if the file was modified since the
+ * block_cache_get that returned generation.
+ */
+void block_cache_fill(const char *path, uint64_t block, const char *buf, int size, uint64_t generation);
+
+// Caches the new content of a block written to the lower layer
+void block_cache_update(const char *path, uint64_t block, const char *buf, int size);
+
+// Drops the cached bytes past size, block_size is the block size of the file
+void block_cache_truncate(const char *path, off_t size, int block_size);
+
+// Drops the blocks of the file at path, which is cached again if it was excluded
+void block_cache_remove(const char *path);
+
+/**
+ * Drops the blocks of both paths. If from was excluded, to is excluded instead.
+ * @param is_directory If set, the files below both paths are dropped too
+ */
+void block_cache_rename(const char *from, const char *to, int is_directory);
+
+// Stops caching path, used for files with hard links since their blocks can be changed through other paths
+void block_cache_exclude(const char *path);
+
+#endif /* __BLOCKCACHE_H__ */
@@ -0,0 +1,64 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+
+#include "blocklock.h"
+#include <glib.h>
+#include <string.h>
+
+static GMutex stripes[BLOCK_LOCK_STRIPES];
+
+void init_block_locks() {
+    int i;
+    for (i = 0; i < BLOCK_LOCK_STRIPES; i++) {
+        g_mutex_init(&stripes[i]);
+    }
+}
+
+void clean_block_locks() {
+    int i;
+    for (i = 0; i < BLOCK_LOCK_STRIPES; i++) {
+        g_mutex_clear(&stripes[i]);
+    }
+}
+
+void block_lock_range(const char *path, uint64_t first_block, uint64_t nblocks, struct block_lock *lock) {
+    guint path_hash = g_str_hash(path);
+    uint64_t block;
+    int word, bit;
+
+    memset(lock->stripes, 0, sizeof(lock->stripes));
+
+    // consecutive blocks of a file fall on different stripes, so a request over more blocks than
+    // stripes takes all of them
+    if (nblocks > BLOCK_LOCK_STRIPES) {
+        nblocks = BLOCK_LOCK_STRIPES;
+    }
+    for (block = first_block; block < first_block + nblocks; block++) {
+        int stripe = (path_hash + block * 2654435761u) % BLOCK_LOCK_STRIPES;
+        lock->stripes[stripe / 64] |= (uint64_t)1 << (stripe % 64);
+    }
+
+    for (word = 0; word < BLOCK_LOCK_STRIPES / 64; word++) {
+        for (bit = 0; bit < 64; bit++) {
+            if (lock->stripes[word] & ((uint64_t)1 << bit)) {
+                g_mutex_lock(&stripes[word * 64 + bit]);
+            }
+        }
+    }
+}
+
+void block_unlock_range(struct block_lock *lock) {
+    int word, bit;
+
+    for (word = 0; word < BLOCK_LOCK_STRIPES / 64; word++) {
+        for (bit = 0; bit < 64; bit++) {
+            if (lock->stripes[word] & ((uint64_t)1 << bit)) {
+                g_mutex_unlock(&stripes[word * 64 + bit]);
+            }
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Block granular locks for the block_align layer.
+ * Writes lock the blocks they touch so that concurrent read-modify-writes of the same block cannot
+ * lose each other's bytes. Blocks are mapped by path and index to a fixed table of mutexes, which
+ * are always taken in increasing order so that requests over several blocks cannot deadlock.
+ */
+
+#ifndef __BLOCKLOCK_H__
+#define __BLOCKLOCK_H__
+
+#include <stdint.h>
+
+#define BLOCK_LOCK_STRIPES 1024
+
+// Mutexes held by a request, kept by the caller (usually on its stack)
+struct block_lock {
+    uint64_t stripes[BLOCK_LOCK_STRIPES / 64];
+};
+
+void init_block_locks();
+
+void clean_block_locks();
+
+// Locks the blocks [first_block, first_block + nblocks) of path
+void block_lock_range(const char *path, uint64_t first_block, uint64_t nblocks, struct block_lock *lock);
+
+void block_unlock_range(struct block_lock *lock);
+
+#endif /* __BLOCKLOCK_H__ */
@@ -7,42 +7,58 @@
 
 #include "nopalign.h"
 
-int nop_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, struct fuse_operations nextlayer) {
-    return nextlayer.read(path, buf, size, offset, fi);
+int nop_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, int block_size,
+                   const struct fuse_operations *nextlayer) {
+    return nextlayer->read(path, buf, size, offset, fi);
 }
 
-int nop_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi,
-                    struct fuse_operations nextlayer) {
-    return nextlayer.write(path, buf, size, offset, fi);
+int nop_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi, int block_size,
+                    const struct fuse_operations *nextlayer) {
+    return nextlayer->write(path, buf, size, offset, fi);
 }
 
-int nop_align_create(const char *path, mode_t mode, void *fi, struct fuse_operations nextlayer) {
-    return nextlayer.create(path, mode, fi);
+int nop_align_create(const char *path, mode_t mode, void *fi, const struct fuse_operations *nextlayer) {
+    return nextlayer->create(path, mode, fi);
 }
 
-int nop_align_open(const char *path, void *fi, struct fuse_operations nextlayer) { return nextlayer.open(path, fi); }
+int nop_align_open(const char *path, void *fi, const struct fuse_operations *nextlayer) { return nextlayer->open(path, fi); }
 
-off_t nop_align_get_file_size(const char *path, struct fuse_file_info *fi, struct fuse_operations nextlayer) {
+off_t nop_align_get_file_size(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer) {
     struct stat st;
 
     if (fi != NULL) {
-        nextlayer.fgetattr(path, &st, fi);
+        nextlayer->fgetattr(path, &st, fi);
         DEBUG_MSG("nop align fi is not null\n");
     } else {
-        nextlayer.getattr(path, &st);
+        nextlayer->getattr(path, &st);
         DEBUG_MSG("nop align fi is null\n");
     }
 
     return st.st_size;
 }
 
-int nop_align_truncate(const char *path, off_t size, struct fuse_file_info *fi_in, struct fuse_operations nextlayer) {
+int nop_align_truncate(const char *path, off_t size, struct fuse_file_info *fi_in, int block_size,
+                       const struct fuse_operations *nextlayer) {
     int res;
 
     if (fi_in == NULL) {
-        res = nextlayer.truncate(path, size);
+        res = nextlayer->truncate(path, size);
     } else {
-        res = nextlayer.ftruncate(path, size, fi_in);
+        res = nextlayer->ftruncate(path, size, fi_in);
     }
     return res;
-}
\ No newline at end of file
+}
+
+int nop_align_release(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer) {
+    return nextlayer->release(path, fi);
+}
+
+int nop_align_unlink(const char *path, const struct fuse_operations *nextlayer) { return nextlayer->unlink(path); }
+
+int nop_align_rename(const char *from, const char *to, const struct fuse_operations *nextlayer) {
+    return nextlayer->rename(from, to);
+}
+
+int nop_align_link(const char *from, const char *to, const struct fuse_operations *nextlayer) {
+    return nextlayer->link(from, to);
+}
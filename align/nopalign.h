@@ -15,11 +15,17 @@
 #include <fuse.h>
 #include <stdio.h>
 
-int nop_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, struct fuse_operations nextlayer);
-int nop_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi,
-                    struct fuse_operations nextlayer);
-int nop_align_create(const char *path, mode_t mode, void *fi, struct fuse_operations nextlayer);
-int nop_align_open(const char *path, void *fi, struct fuse_operations nextlayer);
-int nop_align_truncate(const char *path, off_t size, struct fuse_file_info *fi, struct fuse_operations nextlayer);
+int nop_align_read(const char *path, char *buf, size_t size, off_t offset, void *fi, int block_size,
+                   const struct fuse_operations *nextlayer);
+int nop_align_write(const char *path, const char *buf, size_t size, off_t offset, void *fi, int block_size,
+                    const struct fuse_operations *nextlayer);
+int nop_align_create(const char *path, mode_t mode, void *fi, const struct fuse_operations *nextlayer);
+int nop_align_open(const char *path, void *fi, const struct fuse_operations *nextlayer);
+int nop_align_truncate(const char *path, off_t size, struct fuse_file_info *fi, int block_size,
+                       const struct fuse_operations *nextlayer);
+int nop_align_release(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer);
+int nop_align_unlink(const char *path, const struct fuse_operations *nextlayer);
+int nop_align_rename(const char *from, const char *to, const struct fuse_operations *nextlayer);
+int nop_align_link(const char *from, const char *to, const struct fuse_operations *nextlayer);
 
 #endif /* __NOPALIGN_H__ */
@@ -0,0 +1,259 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+
+#include "readahead.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "../logdef.h"
+#include "../stats/stats.h"
+
+#define RA_THREADS 4
+// Window, in blocks, of the first read-ahead of a sequential stream
+#define RA_INITIAL_WINDOW 4
+
+struct ra_stream {
+    // key of the streams table
+    uint64_t fh;
+    char *path;
+    struct fuse_file_info fi;
+    const struct fuse_operations *nextlayer;
+    int block_size;
+    // offset of the next read if the access is sequential
+    uint64_t next_offset;
+    // current window in blocks, 0 while the access is not sequential
+    uint64_t window;
+    // first block not requested yet
+    uint64_t ra_end;
+    // bumped on seek and close, requests of an older generation are dropped
+    uint64_t generation;
+    // requests queued or running
+    int inflight;
+};
+
+struct ra_request {
+    struct ra_stream *stream;
+    char *path;
+    struct fuse_file_info fi;
+    const struct fuse_operations *nextlayer;
+    int block_size;
+    uint64_t first_block;
+    uint64_t nblocks;
+    uint64_t generation;
+};
+
+// fh -> struct ra_stream
+static GHashTable *streams = NULL;
+static GMutex ra_mutex;
+static GCond ra_cond;
+static GThreadPool *ra_pool = NULL;
+
+// Bytes of the largest window, files with larger blocks read ahead fewer blocks
+static uint64_t max_window_bytes = 0;
+// The blocks of a window are read from the lower layer with a single request, instead of one request per block
+static int coalesce_requests = 0;
+
+static void free_stream(gpointer data) {
+    struct ra_stream *stream = data;
+    free(stream->path);
+    free(stream);
+}
+
+// Reads the blocks of the request that are not cached yet
+static void prefetch_blocks(struct ra_request *request) {
+    uint64_t first = request->first_block;
+    uint64_t last = request->first_block + request->nblocks;
+    uint64_t max_request_blocks = coalesce_requests ? request->nblocks : 1;
+    int block_size = request->block_size;
+
+    while (first < last && block_cache_contains(request->path, first)) {
+        first++;
+    }
+    while (last > first && block_cache_contains(request->path, last - 1)) {
+        last--;
+    }
+
+    while (first < last) {
+        uint64_t nblocks = (last - first < max_request_blocks) ? last - first : max_request_blocks;
+        size_t size = nblocks * block_size;
+        uint64_t generation = block_cache_generation(request->path);
+        char *buf = malloc(size);
+
+        int res = request->nextlayer->read(request->path, buf, size, first * block_size, &request->fi);
+        if (res < 0) {
+            DEBUG_MSG("Read-ahead of %s block %llu failed %d\n", request->path, (unsigned long long int)first, res);
+            free(buf);
+            return;
+        }
+
+        uint64_t i;
+        for (i = 0; i * block_size < res; i++) {
+            int fill_size = (res - i * block_size < block_size) ? res - i * block_size : block_size;
+            block_cache_fill(request->path, first + i, &buf[i * block_size], fill_size, generation);
+        }
+        free(buf);
+
+        // end of the file
+        if (res < size) {
+            return;
+        }
+        first += nblocks;
+    }
+}
+
+static void readahead_func(gpointer data, gpointer user_data) {
+    struct ra_request *request = data;
+    struct ra_stream *stream = request->stream;
+
+    g_mutex_lock(&ra_mutex);
+    int cancelled = request->generation != stream->generation;
+    g_mutex_unlock(&ra_mutex);
+
+    if (!cancelled) {
+        prefetch_blocks(request);
+    }
+
+    g_mutex_lock(&ra_mutex);
+    stream->inflight--;
+    g_cond_broadcast(&ra_cond);
+    g_mutex_unlock(&ra_mutex);
+
+    free(request->path);
+    free(request);
+}
+
+static void readahead_stats(GString *out) {
+    g_string_append_printf(out, "readahead.queue_depth %u\n", (ra_pool != NULL) ? g_thread_pool_unprocessed(ra_pool) : 0);
+}
+
+void init_readahead(block_align_config config, int coalesce) {
+    if (config.readahead <= 0 || !block_cache_enabled()) {
+        if (config.readahead > 0) {
+            ERROR_MSG("block_align readahead needs cache_size, read-ahead disabled\n");
+        }
+        return;
+    }
+
+    max_window_bytes = (uint64_t)config.readahead * 1024;
+    // blocks read ahead must not evict each other before being read
+    if (max_window_bytes > block_cache_capacity() / 4) {
+        max_window_bytes = block_cache_capacity() / 4;
+    }
+    coalesce_requests = coalesce;
+
+    g_mutex_init(&ra_mutex);
+    g_cond_init(&ra_cond);
+    streams = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free_stream);
+    ra_pool = g_thread_pool_new((GFunc)readahead_func, NULL, RA_THREADS, FALSE, NULL);
+    register_stats_source(readahead_stats);
+
+    DEBUG_MSG("Read-ahead window up to %lu bytes\n", (unsigned long)max_window_bytes);
+}
+
+void clean_readahead() {
+    if (streams == NULL) {
+        return;
+    }
+
+    // waits for the queued requests
+    g_thread_pool_free(ra_pool, FALSE, TRUE);
+    g_hash_table_destroy(streams);
+    g_cond_clear(&ra_cond);
+    g_mutex_clear(&ra_mutex);
+    streams = NULL;
+    ra_pool = NULL;
+}
+
+int readahead_enabled() { return streams != NULL; }
+
+// Must be called with ra_mutex held
+static void queue_request(struct ra_stream *stream, uint64_t first_block, uint64_t nblocks) {
+    struct ra_request *request = malloc(sizeof(struct ra_request));
+    request->stream = stream;
+    request->path = strdup(stream->path);
+    request->fi = stream->fi;
+    request->nextlayer = stream->nextlayer;
+    request->block_size = stream->block_size;
+    request->first_block = first_block;
+    request->nblocks = nblocks;
+    request->generation = stream->generation;
+
+    stream->inflight++;
+    g_thread_pool_push(ra_pool, request, NULL);
+}
+
+void readahead_access(const char *path, uint64_t offset, size_t size, int block_size, struct fuse_file_info *fi,
+                      const struct fuse_operations *nextlayer) {
+    uint64_t fh = fi->fh;
+    uint64_t max_window = max_window_bytes / block_size;
+
+    if (max_window == 0) {
+        max_window = 1;
+    }
+
+    g_mutex_lock(&ra_mutex);
+    struct ra_stream *stream = g_hash_table_lookup(streams, &fh);
+    if (stream == NULL) {
+        stream = calloc(1, sizeof(struct ra_stream));
+        stream->fh = fh;
+        stream->path = strdup(path);
+        g_hash_table_insert(streams, &stream->fh, stream);
+    } else if (strcmp(stream->path, path) != 0) {
+        // renamed while open
+        free(stream->path);
+        stream->path = strdup(path);
+    }
+    stream->fi = *fi;
+    stream->nextlayer = nextlayer;
+    stream->block_size = block_size;
+
+    if (offset != stream->next_offset) {
+        // seek, the blocks not read yet are not needed anymore
+        if (stream->window > 0) {
+            stream->generation++;
+        }
+        stream->window = 0;
+        stream->ra_end = 0;
+    } else if (stream->window == 0) {
+        stream->window = RA_INITIAL_WINDOW;
+    } else {
+        stream->window *= 2;
+    }
+    if (stream->window > max_window) {
+        stream->window = max_window;
+    }
+    stream->next_offset = offset + size;
+
+    if (stream->window > 0) {
+        uint64_t end_block = (stream->next_offset + block_size - 1) / block_size;
+        if (stream->ra_end < end_block) {
+            stream->ra_end = end_block;
+        }
+        // the next window is requested once half of the current one was consumed
+        if (stream->ra_end - end_block <= stream->window / 2) {
+            queue_request(stream, stream->ra_end, end_block + stream->window - stream->ra_end);
+            stream->ra_end = end_block + stream->window;
+        }
+    }
+    g_mutex_unlock(&ra_mutex);
+}
+
+void readahead_release(struct fuse_file_info *fi) {
+    uint64_t fh = fi->fh;
+
+    g_mutex_lock(&ra_mutex);
+    struct ra_stream *stream = g_hash_table_lookup(streams, &fh);
+    if (stream != NULL) {
+        stream->generation++;
+        while (stream->inflight > 0) {
+            g_cond_wait(&ra_cond, &ra_mutex);
+        }
+        g_hash_table_remove(streams, &fh);
+    }
+    g_mutex_unlock(&ra_mutex);
+}
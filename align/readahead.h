@@ -0,0 +1,43 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Sequential read-ahead for the block_align layer.
+ * Each open file keeps track of where its next read is expected. While reads are sequential a window
+ * of upcoming blocks, doubled on every read up to the configured maximum, is read from the lower
+ * layers by background threads and stored in the block cache. A read elsewhere in the file, or
+ * closing it, cancels the blocks not fetched yet.
+ */
+
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#ifdef __linux__
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 26
+#endif /* FUSE_USE_VERSION */
+#endif /* __linux__ */
+
+#include <fuse.h>
+#include <stdint.h>
+#include "../SFSConfig.h"
+
+// Must be called after init_block_cache, read-ahead is only enabled along with the cache
+// coalesce: blocks may be read from the lower layer with multi-block requests
+void init_readahead(block_align_config config, int coalesce);
+
+void clean_readahead();
+
+int readahead_enabled();
+
+// Called after each read of size bytes at offset that did not reach the end of the file
+void readahead_access(const char *path, uint64_t offset, size_t size, int block_size, struct fuse_file_info *fi,
+                      const struct fuse_operations *nextlayer);
+
+// Cancels the read-ahead of the file and waits for the blocks being read for it
+void readahead_release(struct fuse_file_info *fi);
+
+#endif /* __READAHEAD_H__ */
@@ -11,9 +11,13 @@
 
 #include "alignfuse.h"
 #include "timestamps/timestamps.h"
+#include "trace/trace.h"
+#include "geometry/geometry.h"
+#include "handles/handles.h"
+#include "sfuse.h"
 
-// struct with original operations from mounted filesystem
-static struct fuse_operations *originalfs_oper;
+// operations of the layer below, private_data is the align driver
+static struct layer_context align_layer;
 
 // struct with alignfuse operations
 static struct fuse_operations alignfuse_oper;
@@ -21,37 +25,70 @@ static struct fuse_operations alignfuse_oper;
 // struct with align algorithms
 static struct align_driver align_driver;
 
-GSList *align_write_list = NULL, *align_read_list = NULL;
+#define ALIGN_DRIVER ((const struct align_driver *)align_layer.private_data)
+
+static struct latency_histogram *align_write_latency, *align_read_latency;
+
+// State of a file opened through the layer, fi->fh points to it (see handles/handles.h)
+struct align_file {
+    struct layer_file lower;
+    // plaintext block size, looked up once per open
+    int block_size;
+};
+
+// Block size of the file of a request, looked up if it is not open
+static int request_block_size(const char *path, struct fuse_file_info *fi) {
+    if (fi != NULL) {
+        return ((struct align_file *)layer_file_of(fi))->block_size;
+    }
+    return geometry_block_size(path, align_layer.next);
+}
+
+// Keeps the block size of a file the driver opened or created
+static void attach_align_file(const char *path, struct fuse_file_info *fi) {
+    struct align_file *file = malloc(sizeof(struct align_file));
+    file->block_size = geometry_block_size(path, align_layer.next);
+    layer_file_attach(fi, &file->lower);
+}
 
 static int alignfuse_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    struct timeval tstop, tstart;
-    gettimeofday(&tstart, NULL);
+    uint64_t tstart = latency_now();
+    struct trace_span span;
+
+    trace_span_begin(&span);
 
     DEBUG_MSG("Entering function alignfuse_read.\n");
     DEBUG_MSG("Going to read offset %ld with size %lu\n", offset, size);
-    int res = align_driver.align_read(path, buf, size, offset, (void *)fi, *originalfs_oper);
+    struct fuse_file_info lower;
+    int block_size = request_block_size(path, fi);
+    int res = ALIGN_DRIVER->align_read(path, buf, size, offset, (void *)layer_file_lower(fi, &lower), block_size,
+                                       align_layer.next);
     DEBUG_MSG("Exiting function alignfuse_read align fuse. res is %d\n", res);
 
-    gettimeofday(&tstop, NULL);
-
-    store(&align_read_list, tstart, tstop);
+    store_io(align_read_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "align.read", -1);
 
     return res;
 }
 
 static int alignfuse_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    struct timeval tstop, tstart;
-    gettimeofday(&tstart, NULL);
+    uint64_t tstart = latency_now();
+    struct trace_span span;
+
+    trace_span_begin(&span);
 
     DEBUG_MSG("Entering function alignfuse_write.\n");
     DEBUG_MSG("Going to write offset %ld with size %lu\n", offset, size);
 
-    int res = align_driver.align_write(path, buf, size, offset, (void *)fi, *originalfs_oper);
+    struct fuse_file_info lower;
+    int block_size = request_block_size(path, fi);
+    int res = ALIGN_DRIVER->align_write(path, buf, size, offset, (void *)layer_file_lower(fi, &lower), block_size,
+                                        align_layer.next);
 
     DEBUG_MSG("Exiting function alignfuse_write align fuse write. res is %d\n", res);
 
-    gettimeofday(&tstop, NULL);
-    store(&align_write_list, tstart, tstop);
+    store_io(align_write_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "align.write", -1);
 
     return res;
 }
@@ -59,28 +96,34 @@ static int alignfuse_write(const char *path, const char *buf, size_t size, off_t
 static int alignfuse_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     DEBUG_MSG("Alignfuse create path %s\n", path);
 
-    int res = align_driver.align_create(path, mode, (void *)fi, *originalfs_oper);
+    int res = ALIGN_DRIVER->align_create(path, mode, (void *)fi, align_layer.next);
     if (res == -1) {
         return -errno;
     }
-    return 0;
+    if (res == 0) {
+        attach_align_file(path, fi);
+    }
+    return res;
 }
 
 static int alignfuse_open(const char *path, struct fuse_file_info *fi) {
     DEBUG_MSG("Align fuse open path %s\n", path);
 
-    int res = align_driver.align_open(path, (void *)fi, *originalfs_oper);
+    int res = ALIGN_DRIVER->align_open(path, (void *)fi, align_layer.next);
     if (res == -1) {
         return -errno;
     }
-    return 0;
+    if (res == 0) {
+        attach_align_file(path, fi);
+    }
+    return res;
 }
 
 static int alignfuse_truncate(const char *path, off_t size) {
     DEBUG_MSG("align truncate path %s %lu\n", path, size);
     int res;
     // This function re-reads any blocks if necessary and truncates them
-    res = align_driver.align_truncate(path, size, NULL, *originalfs_oper);
+    res = ALIGN_DRIVER->align_truncate(path, size, NULL, geometry_block_size(path, align_layer.next), align_layer.next);
     if (res == -1) {
         return -errno;
     }
@@ -89,26 +132,80 @@ static int alignfuse_truncate(const char *path, off_t size) {
 
 static int alignfuse_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
     DEBUG_MSG("align ftruncate path %s %lu\n", path, size);
+    struct fuse_file_info lower;
     int res;
-    res = align_driver.align_truncate(path, size, fi, *originalfs_oper);
+    res = ALIGN_DRIVER->align_truncate(path, size, layer_file_lower(fi, &lower), request_block_size(path, fi),
+                                       align_layer.next);
     if (res == -1) {
         return -errno;
     }
     return 0;
 }
 
+static int alignfuse_release(const char *path, struct fuse_file_info *fi) {
+    DEBUG_MSG("align release path %s\n", path);
+    struct layer_file *file = layer_file_detach(fi);
+    int res = ALIGN_DRIVER->align_release(path, fi, align_layer.next);
+    free(file);
+    return res;
+}
+
+static int alignfuse_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return align_layer.next->fgetattr(path, stbuf, layer_file_lower(fi, &lower));
+}
+
+static int alignfuse_flush(const char *path, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return align_layer.next->flush(path, layer_file_lower(fi, &lower));
+}
+
+static int alignfuse_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return align_layer.next->fsync(path, isdatasync, layer_file_lower(fi, &lower));
+}
+
+static int alignfuse_unlink(const char *path) {
+    DEBUG_MSG("align unlink path %s\n", path);
+    return ALIGN_DRIVER->align_unlink(path, align_layer.next);
+}
+
+static int alignfuse_rename(const char *from, const char *to) {
+    DEBUG_MSG("align rename path %s to %s\n", from, to);
+    return ALIGN_DRIVER->align_rename(from, to, align_layer.next);
+}
+
+static int alignfuse_link(const char *from, const char *to) {
+    DEBUG_MSG("align link path %s to %s\n", from, to);
+    return ALIGN_DRIVER->align_link(from, to, align_layer.next);
+}
+
+static int alignfuse_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    return geometry_setxattr(path, name, value, size, flags, align_layer.next);
+}
+
+static int alignfuse_listxattr(const char *path, char *list, size_t size) {
+    return geometry_listxattr(path, list, size, align_layer.next);
+}
+
+static int alignfuse_removexattr(const char *path, const char *name) {
+    return geometry_removexattr(path, name, align_layer.next);
+}
+
 int init_align_driver(struct fuse_operations **fuse_operations, configuration config) {
     DEBUG_MSG("Going to init align_driver");
 
     // this is received from sfuse
-    originalfs_oper = *fuse_operations;
+    const struct fuse_operations *originalfs_oper = *fuse_operations;
+    align_layer.next = originalfs_oper;
+    align_layer.private_data = &align_driver;
 
     // TODO:
     // Maybe this could be initialized with the alignfuse_oper struct
     alignfuse_oper.init = originalfs_oper->init;
     alignfuse_oper.destroy = originalfs_oper->destroy;
     alignfuse_oper.getattr = originalfs_oper->getattr;
-    alignfuse_oper.fgetattr = originalfs_oper->fgetattr;
+    alignfuse_oper.fgetattr = alignfuse_fgetattr;
     alignfuse_oper.access = originalfs_oper->access;
     alignfuse_oper.readlink = originalfs_oper->readlink;
     alignfuse_oper.opendir = originalfs_oper->opendir;
@@ -117,26 +214,27 @@ int init_align_driver(struct fuse_operations **fuse_operations, configuration co
     alignfuse_oper.mknod = originalfs_oper->mknod;
     alignfuse_oper.mkdir = originalfs_oper->mkdir;
     alignfuse_oper.symlink = originalfs_oper->symlink;
-    alignfuse_oper.unlink = originalfs_oper->unlink;
+    alignfuse_oper.unlink = alignfuse_unlink;
     alignfuse_oper.rmdir = originalfs_oper->rmdir;
-    alignfuse_oper.rename = originalfs_oper->rename;
-    alignfuse_oper.link = originalfs_oper->link;
+    alignfuse_oper.rename = alignfuse_rename;
+    alignfuse_oper.link = alignfuse_link;
     alignfuse_oper.create = alignfuse_create;
     alignfuse_oper.open = alignfuse_open;
     alignfuse_oper.read = alignfuse_read;
     alignfuse_oper.write = alignfuse_write;
     alignfuse_oper.statfs = originalfs_oper->statfs;
-    alignfuse_oper.flush = originalfs_oper->flush;
-    alignfuse_oper.release = originalfs_oper->release;
-    alignfuse_oper.fsync = originalfs_oper->fsync;
+    alignfuse_oper.flush = (originalfs_oper->flush != NULL) ? alignfuse_flush : NULL;
+    alignfuse_oper.release = alignfuse_release;
+    alignfuse_oper.fsync = (originalfs_oper->fsync != NULL) ? alignfuse_fsync : NULL;
     alignfuse_oper.truncate = alignfuse_truncate;
     alignfuse_oper.ftruncate = alignfuse_ftruncate;
     alignfuse_oper.chown = originalfs_oper->chown;
     alignfuse_oper.chmod = originalfs_oper->chmod;
-    // alignfuse_oper.setxattr    = originalfs_oper->setxattr;
-    // alignfuse_oper.getxattr    = originalfs_oper->getxattr;
-    // alignfuse_oper.listxattr   = originalfs_oper->listxattr;
-    // alignfuse_oper.removexattr = originalfs_oper->removexattr;
+    // the attributes recorded in the files by the layers can only be changed by them
+    alignfuse_oper.setxattr = (originalfs_oper->setxattr != NULL) ? alignfuse_setxattr : NULL;
+    alignfuse_oper.getxattr = originalfs_oper->getxattr;
+    alignfuse_oper.listxattr = (originalfs_oper->listxattr != NULL) ? alignfuse_listxattr : NULL;
+    alignfuse_oper.removexattr = (originalfs_oper->removexattr != NULL) ? alignfuse_removexattr : NULL;
 
     switch (config.block_config.mode) {
         case NOP:
@@ -145,6 +243,10 @@ int init_align_driver(struct fuse_operations **fuse_operations, configuration co
             align_driver.align_create = nop_align_create;
             align_driver.align_open = nop_align_open;
             align_driver.align_truncate = nop_align_truncate;
+            align_driver.align_release = nop_align_release;
+            align_driver.align_unlink = nop_align_unlink;
+            align_driver.align_rename = nop_align_rename;
+            align_driver.align_link = nop_align_link;
             break;
         case BLOCK:
             align_driver.align_read = block_align_read;
@@ -152,16 +254,30 @@ int init_align_driver(struct fuse_operations **fuse_operations, configuration co
             align_driver.align_create = block_align_create;
             align_driver.align_open = block_align_open;
             align_driver.align_truncate = block_align_truncate;
-            define_block_size(config.block_config);
+            align_driver.align_release = block_align_release;
+            align_driver.align_unlink = block_align_unlink;
+            align_driver.align_rename = block_align_rename;
+            align_driver.align_link = block_align_link;
+            init_block_align(config.block_config,
+                             g_slist_find(config.layers, GINT_TO_POINTER(MULTI_LOOPBACK)) != NULL &&
+                                 config.m_loop_config.mode == MULTI_LOOP_ERASURE,
+                             g_slist_find(config.layers, GINT_TO_POINTER(SFUSE)) != NULL &&
+                                 sfuse_authenticated(config.enc_config));
     }
 
+    align_write_latency = new_latency_histogram("align", "write");
+    align_read_latency = new_latency_histogram("align", "read");
+
     *fuse_operations = &alignfuse_oper;
 
     return 0;
 }
 int clean_align_driver(configuration config) {
     // DEBUG_MSG("Going to clean multi_loopback drivers\n");
-    print_latencies(align_write_list, "align", "write");
-    print_latencies(align_read_list, "align", "read");
+    print_latencies(align_write_latency);
+    print_latencies(align_read_latency);
+    if (config.block_config.mode == BLOCK) {
+        clean_block_align();
+    }
     return 0;
 }
\ No newline at end of file
@@ -35,11 +35,15 @@ typedef unsigned long u_long;
 #include "layers_def.h"
 #include "align/nopalign.h"
 #include "align/blockalign.h"
+#include "align/blockcache.h"
 #include "logdef.h"
 
 #define NOP 0
 #define BLOCK 1
 
+// ERASURE mode of multi_loopback.h
+#define MULTI_LOOP_ERASURE 2
+
 int init_align_driver(struct fuse_operations** originop, configuration config);
 int clean_align_driver(configuration config);
 
@@ -0,0 +1,98 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "async.h"
+#include "../logdef.h"
+#include <errno.h>
+
+// one entry per layer type at most, compose_layers rejects repeated layers
+#define MAX_ASYNC_LAYERS 8
+
+static struct {
+    const struct fuse_operations *oper;
+    const struct layer_async_operations *async_oper;
+} async_layers[MAX_ASYNC_LAYERS];
+static int nasync_layers = 0;
+
+void layer_future_init(struct layer_future *future) {
+    pthread_mutex_init(&future->lock, 0);
+    pthread_cond_init(&future->cond, 0);
+    future->done = 0;
+    future->res = 0;
+}
+
+void layer_future_complete(int res, void *user_data) {
+    struct layer_future *future = (struct layer_future *)user_data;
+
+    pthread_mutex_lock(&future->lock);
+    future->res = res;
+    future->done = 1;
+    pthread_cond_signal(&future->cond);
+    pthread_mutex_unlock(&future->lock);
+}
+
+int layer_future_wait(struct layer_future *future) {
+    pthread_mutex_lock(&future->lock);
+    while (!future->done) {
+        pthread_cond_wait(&future->cond, &future->lock);
+    }
+    pthread_mutex_unlock(&future->lock);
+
+    pthread_mutex_destroy(&future->lock);
+    pthread_cond_destroy(&future->cond);
+
+    return future->res;
+}
+
+int register_async_operations(const struct fuse_operations *oper, const struct layer_async_operations *async_oper) {
+    if (nasync_layers == MAX_ASYNC_LAYERS) {
+        ERROR_MSG("Too many layers with asynchronous operations\n");
+        return -1;
+    }
+    async_layers[nasync_layers].oper = oper;
+    async_layers[nasync_layers].async_oper = async_oper;
+    nasync_layers++;
+    return 0;
+}
+
+const struct layer_async_operations *find_async_operations(const struct fuse_operations *oper) {
+    int i;
+    for (i = 0; i < nasync_layers; i++) {
+        if (async_layers[i].oper == oper) {
+            return async_layers[i].async_oper;
+        }
+    }
+    return NULL;
+}
+
+void layer_read_async(const struct layer_context *layer, const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi, layer_callback callback, void *user_data) {
+    if (layer->next_async != NULL && layer->next_async->read != NULL) {
+        layer->next_async->read(path, buf, size, offset, fi, callback, user_data);
+    } else {
+        callback(layer->next->read(path, buf, size, offset, fi), user_data);
+    }
+}
+
+void layer_write_async(const struct layer_context *layer, const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi, layer_callback callback, void *user_data) {
+    if (layer->next_async != NULL && layer->next_async->write != NULL) {
+        layer->next_async->write(path, buf, size, offset, fi, callback, user_data);
+    } else {
+        callback(layer->next->write(path, buf, size, offset, fi), user_data);
+    }
+}
+
+void layer_fsync_async(const struct layer_context *layer, const char *path, int isdatasync,
+                       struct fuse_file_info *fi, layer_callback callback, void *user_data) {
+    if (layer->next_async != NULL && layer->next_async->fsync != NULL) {
+        layer->next_async->fsync(path, isdatasync, fi, callback, user_data);
+    } else if (layer->next->fsync != NULL) {
+        callback(layer->next->fsync(path, isdatasync, fi), user_data);
+    } else {
+        callback(-ENOSYS, user_data);
+    }
+}
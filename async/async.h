@@ -0,0 +1,55 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Asynchronous layer operations.
+ * A layer that implements struct layer_async_operations registers them next to its fuse operations,
+ * and the layer above finds them at init with find_async_operations. The layer_*_async helpers fall
+ * back to the synchronous operation of the layer below when it has no asynchronous variant, and
+ * struct layer_future turns an asynchronous operation back into a synchronous one.
+ */
+
+#ifndef __LAYER_ASYNC_H__
+#define __LAYER_ASYNC_H__
+
+#include <pthread.h>
+#include "../layers_def.h"
+
+struct layer_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int res;
+};
+
+void layer_future_init(struct layer_future *future);
+
+// layer_callback completing the struct layer_future passed as user_data
+void layer_future_complete(int res, void *user_data);
+
+// Waits for the future to complete, releases it and returns its result
+int layer_future_wait(struct layer_future *future);
+
+/**
+ * Makes the asynchronous operations of a layer known to the layers above.
+ * @param oper The operations returned by the init function of the layer
+ * @return 0 on success, -1 if too many layers registered operations
+ */
+int register_async_operations(const struct fuse_operations *oper, const struct layer_async_operations *async_oper);
+
+// Returns the asynchronous operations registered for oper, NULL if there are none
+const struct layer_async_operations *find_async_operations(const struct fuse_operations *oper);
+
+void layer_read_async(const struct layer_context *layer, const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi, layer_callback callback, void *user_data);
+
+void layer_write_async(const struct layer_context *layer, const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi, layer_callback callback, void *user_data);
+
+void layer_fsync_async(const struct layer_context *layer, const char *path, int isdatasync,
+                       struct fuse_file_info *fi, layer_callback callback, void *user_data);
+
+#endif /* __LAYER_ASYNC_H__ */
@@ -0,0 +1,695 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Replay of the operations recorded by the capture layer (see capture/capture.h) against a layer
+ * stack, without FUSE.
+ *
+ * The layers of a configuration file are composed as when mounting. Each thread id of the capture is
+ * replayed by a thread of its own, which issues the operations of the captured thread in order, at the
+ * time they started in the capture divided by the speed, or one after the other with speed 0. An
+ * operation on a file or directory waits for the open it used in the capture, which may be issued by
+ * another thread, and a release waits for the operations on its file. Data is not captured, writes and
+ * setxattr write a fixed pattern. Results are printed as CSV on stdout, one line per operation:
+ *
+ *   op,count,mismatches,skipped,captured_mean_ns,captured_p99_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+ *
+ * mismatches counts the operations that failed in the capture and not in the replay or the other way
+ * around, and skipped the operations on files opened before the capture started or whose open failed.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../SFSConfig.h"
+#include "../capture/capture.h"
+#include "../compose/compose.h"
+#include "../plugins/plugin.h"
+#include "../timestamps/timestamps.h"
+
+// states of a replay_file
+#define FILE_PENDING 0
+#define FILE_OPEN 1
+#define FILE_CLOSED 2
+
+// Operations of a captured thread
+struct replay_thread {
+    struct capture_record *records;
+    size_t nrecords;
+    char *buf;
+    size_t buf_size;
+    pthread_t tid;
+};
+
+// File or directory of an open, create or opendir of the capture
+struct replay_file {
+    struct fuse_file_info fi;
+    const char *path;
+    int state;
+    // operations of the capture on the file not replayed yet, the release waits for them
+    size_t pending;
+};
+
+struct replay_stats {
+    uint64_t mismatches;
+    uint64_t skipped;
+    struct latency_histogram *captured;
+    struct latency_histogram *replayed;
+};
+
+static struct fuse_operations *operations;
+static const char *directory = "";
+static double speed = 1;
+
+// paths of the capture by id, with the directory of the replay
+static GPtrArray *paths;
+
+// files by open, the file of the records loaded is the index of their open plus one
+static struct replay_file *files;
+static size_t nfiles;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t files_cond = PTHREAD_COND_INITIALIZER;
+
+static struct replay_stats stats[CAPTURE_OPS];
+static pthread_barrier_t start_barrier;
+static uint64_t replay_start;
+
+static const char *replay_path(uint32_t id) { return (id < paths->len) ? g_ptr_array_index(paths, id) : NULL; }
+
+static int fill_dir(void *buf, const char *name, const struct stat *stbuf, off_t off) { return 0; }
+
+// File opened by the open of id, waiting for the thread issuing the open if needed
+static struct replay_file *find_file(uint64_t id) {
+    struct replay_file *replay_file = NULL;
+
+    if (id == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&files_lock);
+    while (files[id - 1].state == FILE_PENDING) {
+        pthread_cond_wait(&files_cond, &files_lock);
+    }
+    if (files[id - 1].state == FILE_OPEN) {
+        replay_file = &files[id - 1];
+    }
+    pthread_mutex_unlock(&files_lock);
+    return replay_file;
+}
+
+// Release of the open of id, once the operations on the file before it were replayed
+static struct replay_file *find_released_file(uint64_t id) {
+    struct replay_file *replay_file = find_file(id);
+
+    if (replay_file != NULL) {
+        pthread_mutex_lock(&files_lock);
+        while (replay_file->pending > 0) {
+            pthread_cond_wait(&files_cond, &files_lock);
+        }
+        pthread_mutex_unlock(&files_lock);
+    }
+    return replay_file;
+}
+
+static void file_op_done(struct replay_file *replay_file) {
+    pthread_mutex_lock(&files_lock);
+    if (--replay_file->pending == 0) {
+        pthread_cond_broadcast(&files_cond);
+    }
+    pthread_mutex_unlock(&files_lock);
+}
+
+static void set_file_state(uint64_t id, int state) {
+    pthread_mutex_lock(&files_lock);
+    files[id - 1].state = state;
+    pthread_cond_broadcast(&files_cond);
+    pthread_mutex_unlock(&files_lock);
+}
+
+static char *thread_buffer(struct replay_thread *thread, size_t size) {
+    if (size > thread->buf_size) {
+        thread->buf = realloc(thread->buf, size);
+        memset(thread->buf + thread->buf_size, 'x', size - thread->buf_size);
+        thread->buf_size = size;
+    }
+    return thread->buf;
+}
+
+static void to_timespec(uint64_t ns, struct timespec *ts) {
+    if (ns == CAPTURE_TIME_NOW || ns == CAPTURE_TIME_OMIT) {
+        ts->tv_sec = 0;
+        ts->tv_nsec = (ns == CAPTURE_TIME_NOW) ? UTIME_NOW : UTIME_OMIT;
+    } else {
+        ts->tv_sec = ns / 1000000000;
+        ts->tv_nsec = ns % 1000000000;
+    }
+}
+
+// Operation on a file opened by open or create
+static int replay_file_op(const struct capture_record *record, struct replay_file *replay_file,
+                          struct replay_thread *thread) {
+    struct fuse_file_info *fi = &replay_file->fi;
+    const char *path = replay_file->path;
+    struct stat stbuf;
+
+    switch (record->op) {
+        case CAPTURE_FGETATTR:
+            return (operations->fgetattr != NULL) ? operations->fgetattr(path, &stbuf, fi)
+                                                  : operations->getattr(path, &stbuf);
+        case CAPTURE_FTRUNCATE:
+            return (operations->ftruncate != NULL) ? operations->ftruncate(path, record->arg0, fi)
+                                                   : operations->truncate(path, record->arg0);
+        case CAPTURE_READ:
+            return operations->read(path, thread_buffer(thread, record->arg1), record->arg1, record->arg0, fi);
+        case CAPTURE_WRITE:
+            return operations->write(path, thread_buffer(thread, record->arg1), record->arg1, record->arg0, fi);
+        case CAPTURE_FLUSH:
+            return (operations->flush != NULL) ? operations->flush(path, fi) : 0;
+        case CAPTURE_FSYNC:
+            return (operations->fsync != NULL) ? operations->fsync(path, record->arg0, fi) : 0;
+        case CAPTURE_RELEASE:
+            return (operations->release != NULL) ? operations->release(path, fi) : 0;
+        case CAPTURE_READDIR:
+            return operations->readdir(path, NULL, fill_dir, record->arg0, fi);
+        case CAPTURE_RELEASEDIR:
+            return (operations->releasedir != NULL) ? operations->releasedir(path, fi) : 0;
+        default:
+            return -ENOSYS;
+    }
+}
+
+static int replay_open(const struct capture_record *record, const char *path) {
+    struct fuse_file_info fi;
+    int res;
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = record->arg1;
+    if (record->op == CAPTURE_CREATE) {
+        res = operations->create(path, record->arg0, &fi);
+    } else if (record->op == CAPTURE_OPENDIR) {
+        res = (operations->opendir != NULL) ? operations->opendir(path, &fi) : 0;
+    } else {
+        res = (operations->open != NULL) ? operations->open(path, &fi) : 0;
+    }
+
+    if (record->file == 0) {
+        // the open failed in the capture, the file is not used again
+        if (res == 0 && record->op == CAPTURE_OPENDIR) {
+            if (operations->releasedir != NULL) {
+                operations->releasedir(path, &fi);
+            }
+        } else if (res == 0 && operations->release != NULL) {
+            operations->release(path, &fi);
+        }
+    } else if (res == 0) {
+        files[record->file - 1].fi = fi;
+        files[record->file - 1].path = path;
+        set_file_state(record->file, FILE_OPEN);
+    } else {
+        set_file_state(record->file, FILE_CLOSED);
+    }
+    return res;
+}
+
+static int replay_readdir(const char *path, off_t offset) {
+    struct fuse_file_info fi;
+    int res;
+
+    memset(&fi, 0, sizeof(fi));
+    if (operations->opendir != NULL && (res = operations->opendir(path, &fi)) != 0) {
+        return res;
+    }
+    res = operations->readdir(path, NULL, fill_dir, offset, &fi);
+    if (operations->releasedir != NULL) {
+        operations->releasedir(path, &fi);
+    }
+    return res;
+}
+
+static int is_open(int op) { return op == CAPTURE_CREATE || op == CAPTURE_OPEN || op == CAPTURE_OPENDIR; }
+
+static int is_release(int op) { return op == CAPTURE_RELEASE || op == CAPTURE_RELEASEDIR; }
+
+// Operations the replayed stack does not have are skipped
+static int supported(int op) {
+    switch (op) {
+        case CAPTURE_ACCESS:
+        case CAPTURE_FGETATTR:
+        case CAPTURE_FTRUNCATE:
+        case CAPTURE_OPEN:
+        case CAPTURE_FLUSH:
+        case CAPTURE_RELEASE:
+        case CAPTURE_FSYNC:
+        case CAPTURE_OPENDIR:
+        case CAPTURE_RELEASEDIR:
+            // replayed with an equivalent operation or as a success
+            return 1;
+        case CAPTURE_GETATTR:
+            return operations->getattr != NULL;
+        case CAPTURE_READLINK:
+            return operations->readlink != NULL;
+        case CAPTURE_READDIR:
+            return operations->readdir != NULL;
+        case CAPTURE_MKNOD:
+            return operations->mknod != NULL;
+        case CAPTURE_MKDIR:
+            return operations->mkdir != NULL;
+        case CAPTURE_SYMLINK:
+            return operations->symlink != NULL;
+        case CAPTURE_UNLINK:
+            return operations->unlink != NULL;
+        case CAPTURE_RMDIR:
+            return operations->rmdir != NULL;
+        case CAPTURE_RENAME:
+            return operations->rename != NULL;
+        case CAPTURE_LINK:
+            return operations->link != NULL;
+        case CAPTURE_CHMOD:
+            return operations->chmod != NULL;
+        case CAPTURE_CHOWN:
+            return operations->chown != NULL;
+        case CAPTURE_TRUNCATE:
+            return operations->truncate != NULL;
+        case CAPTURE_UTIMENS:
+            return operations->utimens != NULL;
+        case CAPTURE_CREATE:
+            return operations->create != NULL;
+        case CAPTURE_READ:
+            return operations->read != NULL;
+        case CAPTURE_WRITE:
+            return operations->write != NULL;
+        case CAPTURE_STATFS:
+            return operations->statfs != NULL;
+        case CAPTURE_SETXATTR:
+            return operations->setxattr != NULL;
+        case CAPTURE_GETXATTR:
+            return operations->getxattr != NULL;
+        case CAPTURE_LISTXATTR:
+            return operations->listxattr != NULL;
+        case CAPTURE_REMOVEXATTR:
+            return operations->removexattr != NULL;
+        default:
+            return 0;
+    }
+}
+
+// Waits for the file of record to be opened, or for the operations before its release, returns -1 if
+// record cannot be replayed
+static int wait_for_file(const struct capture_record *record, struct replay_file **replay_file) {
+    *replay_file = NULL;
+
+    int named = record->op == CAPTURE_SETXATTR || record->op == CAPTURE_GETXATTR || record->op == CAPTURE_REMOVEXATTR;
+    if (replay_path(record->path) == NULL || (named && replay_path(record->path2) == NULL) || !supported(record->op)) {
+        if (is_open(record->op) && record->file != 0) {
+            set_file_state(record->file, FILE_CLOSED);
+        }
+        return -1;
+    }
+
+    switch (record->op) {
+        case CAPTURE_READDIR:
+            // directories opened before the capture are opened for the readdir
+            if (record->file == 0) {
+                return 0;
+            }
+            // fall through
+        case CAPTURE_FGETATTR:
+        case CAPTURE_FTRUNCATE:
+        case CAPTURE_READ:
+        case CAPTURE_WRITE:
+        case CAPTURE_FLUSH:
+        case CAPTURE_FSYNC:
+            *replay_file = find_file(record->file);
+            return (*replay_file != NULL) ? 0 : -1;
+        case CAPTURE_RELEASE:
+        case CAPTURE_RELEASEDIR:
+            *replay_file = find_released_file(record->file);
+            return (*replay_file != NULL) ? 0 : -1;
+        default:
+            return 0;
+    }
+}
+
+// Issues the operation of record on replay_file for the operations on files, returns what it returned
+static int replay_op(const struct capture_record *record, struct replay_file *replay_file,
+                     struct replay_thread *thread) {
+    const char *path = replay_path(record->path);
+    const char *path2 = replay_path(record->path2);
+    struct timespec ts[2];
+    struct statvfs stvfs;
+    struct stat stbuf;
+    int res;
+
+    switch (record->op) {
+        case CAPTURE_GETATTR:
+            return operations->getattr(path, &stbuf);
+        case CAPTURE_ACCESS:
+            return (operations->access != NULL) ? operations->access(path, record->arg0) : 0;
+        case CAPTURE_READLINK:
+            return operations->readlink(path, thread_buffer(thread, record->arg0), record->arg0);
+        case CAPTURE_READDIR:
+            if (replay_file == NULL) {
+                return replay_readdir(path, record->arg0);
+            }
+            res = replay_file_op(record, replay_file, thread);
+            file_op_done(replay_file);
+            return res;
+        case CAPTURE_MKNOD:
+            return operations->mknod(path, record->arg0, record->arg1);
+        case CAPTURE_MKDIR:
+            return operations->mkdir(path, record->arg0);
+        case CAPTURE_SYMLINK:
+            // the target is the content of the link, it is not moved to the directory of the replay
+            return operations->symlink(path + strlen(directory), path2);
+        case CAPTURE_UNLINK:
+            return operations->unlink(path);
+        case CAPTURE_RMDIR:
+            return operations->rmdir(path);
+        case CAPTURE_RENAME:
+            return operations->rename(path, path2);
+        case CAPTURE_LINK:
+            return operations->link(path, path2);
+        case CAPTURE_CHMOD:
+            return operations->chmod(path, record->arg0);
+        case CAPTURE_CHOWN:
+            return operations->chown(path, record->arg0, record->arg1);
+        case CAPTURE_TRUNCATE:
+            return operations->truncate(path, record->arg0);
+        case CAPTURE_UTIMENS:
+            to_timespec(record->arg0, &ts[0]);
+            to_timespec(record->arg1, &ts[1]);
+            return operations->utimens(path, ts);
+        case CAPTURE_CREATE:
+        case CAPTURE_OPEN:
+        case CAPTURE_OPENDIR:
+            return replay_open(record, path);
+        case CAPTURE_STATFS:
+            return operations->statfs(path, &stvfs);
+        // the names of the attributes are not moved to the directory of the replay
+        case CAPTURE_SETXATTR:
+            return operations->setxattr(path, path2 + strlen(directory), thread_buffer(thread, record->arg0),
+                                        record->arg0, record->arg1);
+        case CAPTURE_GETXATTR:
+            return operations->getxattr(path, path2 + strlen(directory), thread_buffer(thread, record->arg0),
+                                        record->arg0);
+        case CAPTURE_LISTXATTR:
+            return operations->listxattr(path, thread_buffer(thread, record->arg0), record->arg0);
+        case CAPTURE_REMOVEXATTR:
+            return operations->removexattr(path, path2 + strlen(directory));
+        case CAPTURE_RELEASE:
+        case CAPTURE_RELEASEDIR:
+            res = replay_file_op(record, replay_file, thread);
+            set_file_state(record->file, FILE_CLOSED);
+            return res;
+        default:
+            res = replay_file_op(record, replay_file, thread);
+            file_op_done(replay_file);
+            return res;
+    }
+}
+
+static void wait_until(uint64_t capture_time) {
+    if (speed <= 0) {
+        return;
+    }
+
+    uint64_t target = replay_start + (uint64_t)(capture_time / speed);
+    uint64_t now = latency_now();
+    if (target > now) {
+        struct timespec ts;
+        ts.tv_sec = (target - now) / 1000000000;
+        ts.tv_nsec = (target - now) % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *replay_func(void *data) {
+    struct replay_thread *thread = data;
+    size_t i;
+
+    pthread_barrier_wait(&start_barrier);
+    for (i = 0; i < thread->nrecords; i++) {
+        const struct capture_record *record = &thread->records[i];
+        struct replay_stats *op_stats = &stats[record->op];
+        struct replay_file *replay_file;
+
+        wait_until(record->start);
+        if (wait_for_file(record, &replay_file) != 0) {
+            __atomic_add_fetch(&op_stats->skipped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        uint64_t start = latency_now();
+        int res = replay_op(record, replay_file, thread);
+        store(op_stats->replayed, start);
+        if ((res < 0) != (record->result < 0)) {
+            __atomic_add_fetch(&op_stats->mismatches, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// Orders the records by the end of their operation
+static gint compare_ends(gconstpointer a, gconstpointer b) {
+    const struct capture_record *first = a;
+    const struct capture_record *second = b;
+    uint64_t first_end = first->start + first->duration;
+    uint64_t second_end = second->start + second->duration;
+
+    if (first_end != second_end) {
+        return (first_end < second_end) ? -1 : 1;
+    }
+    return (first->start < second->start) ? -1 : (first->start > second->start);
+}
+
+// Reads the capture file into the operations of each captured thread, returns the number of threads
+static int load_capture(const char *path, struct replay_thread **threads) {
+    struct capture_header header;
+    struct capture_record record;
+    GArray *captured = g_array_new(FALSE, FALSE, sizeof(struct capture_record));
+    GPtrArray *records = g_ptr_array_new();
+    // index of each open id of the capture, once sorted by their end an operation on a file comes after
+    // its open. The records of an open that was not captured are skipped.
+    GHashTable *opens = g_hash_table_new(g_direct_hash, g_direct_equal);
+    int nthreads = 0;
+    size_t j;
+    int i;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) ||
+        header.version != CAPTURE_VERSION || header.record_size != sizeof(struct capture_record)) {
+        fprintf(stderr, "%s is not a capture file of this version of SafeFS\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    paths = g_ptr_array_new_with_free_func(free);
+    g_ptr_array_add(paths, NULL);
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.op == CAPTURE_PATH) {
+            char captured[record.arg0 + 1];
+            if (record.path != paths->len || fread(captured, record.arg0, 1, file) != 1) {
+                break;
+            }
+            captured[record.arg0] = '\0';
+            g_ptr_array_add(paths, g_strconcat(directory, captured, NULL));
+            continue;
+        }
+        if (record.op >= CAPTURE_OPS) {
+            break;
+        }
+        g_array_append_val(captured, record);
+    }
+    if (!feof(file)) {
+        fprintf(stderr, "%s is truncated or corrupted, replaying the operations before\n", path);
+    }
+    fclose(file);
+
+    // the threads write their records in batches
+    g_array_sort(captured, compare_ends);
+
+    for (j = 0; j < captured->len; j++) {
+        record = g_array_index(captured, struct capture_record, j);
+
+        if (is_open(record.op) && record.file != 0) {
+            g_hash_table_insert(opens, GSIZE_TO_POINTER(record.file), GSIZE_TO_POINTER(++nfiles));
+            record.file = nfiles;
+        } else if (record.file != 0) {
+            record.file = GPOINTER_TO_SIZE(g_hash_table_lookup(opens, GSIZE_TO_POINTER(record.file)));
+        }
+
+        // the records of each thread, in the order the thread issued them
+        while (record.thread >= records->len) {
+            g_ptr_array_add(records, g_array_new(FALSE, FALSE, sizeof(struct capture_record)));
+        }
+        g_array_append_val(g_ptr_array_index(records, record.thread), record);
+        // only the operations of the capture get histograms, to leave some to the layers
+        if (stats[record.op].captured == NULL) {
+            stats[record.op].captured = new_latency_histogram("capture", capture_op_name(record.op));
+            stats[record.op].replayed = new_latency_histogram("replay", capture_op_name(record.op));
+        }
+        store_latency(stats[record.op].captured, record.duration);
+    }
+    g_array_free(captured, TRUE);
+    g_hash_table_destroy(opens);
+    files = calloc(nfiles, sizeof(struct replay_file));
+
+    *threads = calloc(records->len, sizeof(struct replay_thread));
+    for (i = 0; i < records->len; i++) {
+        GArray *thread_records = g_ptr_array_index(records, i);
+        if (thread_records->len > 0) {
+            (*threads)[nthreads].nrecords = thread_records->len;
+            (*threads)[nthreads].records = (struct capture_record *)g_array_free(thread_records, FALSE);
+            for (j = 0; j < (*threads)[nthreads].nrecords; j++) {
+                struct capture_record *thread_record = &(*threads)[nthreads].records[j];
+                if (thread_record->file != 0 && !is_open(thread_record->op) && !is_release(thread_record->op)) {
+                    files[thread_record->file - 1].pending++;
+                }
+            }
+            nthreads++;
+        } else {
+            g_array_free(thread_records, TRUE);
+        }
+    }
+    g_ptr_array_free(records, TRUE);
+
+    return nthreads;
+}
+
+static void print_stats() {
+    struct latency_snapshot *captured = malloc(sizeof(struct latency_snapshot));
+    struct latency_snapshot *replayed = malloc(sizeof(struct latency_snapshot));
+    int op;
+
+    printf("op,count,mismatches,skipped,captured_mean_ns,captured_p99_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    for (op = CAPTURE_PATH + 1; op < CAPTURE_OPS; op++) {
+        if (stats[op].captured == NULL || stats[op].replayed == NULL) {
+            continue;
+        }
+        latency_snapshot(stats[op].captured, captured);
+        latency_snapshot(stats[op].replayed, replayed);
+        printf("%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", capture_op_name(op), (unsigned long)captured->count,
+               (unsigned long)stats[op].mismatches, (unsigned long)stats[op].skipped,
+               (unsigned long)(captured->sum / captured->count), (unsigned long)latency_percentile(captured, 99),
+               (unsigned long)((replayed->count > 0) ? replayed->sum / replayed->count : 0),
+               (unsigned long)latency_percentile(replayed, 50), (unsigned long)latency_percentile(replayed, 90),
+               (unsigned long)latency_percentile(replayed, 99), (unsigned long)latency_percentile(replayed, 99.9),
+               (unsigned long)replayed->max);
+    }
+
+    free(captured);
+    free(replayed);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-c configuration] [-s speed] [-p directory] capture_file\n"
+            "  -c  configuration file of the stack (default %s)\n"
+            "  -s  speed of the replay, 1 replays at the captured times, 2 twice as fast, 0 without waiting\n"
+            "      (default 1)\n"
+            "  -p  directory the captured paths are replayed in, e.g. the directory of a stack of [stacks]\n"
+            "      (default /)\n",
+            program, LOCAL_SDSCONFIG_PATH);
+}
+
+int main(int argc, char *argv[]) {
+    const char *config_path = LOCAL_SDSCONFIG_PATH;
+    struct replay_thread *threads;
+    configuration *config;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "c:s:p:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'p':
+                directory = (strcmp(optarg, "/") == 0) ? "" : optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int nthreads = load_capture(argv[optind], &threads);
+
+    // logging is left disabled, LOG_INIT reads the configuration of the mount
+    if (init_config((char *)config_path, &config) != 0) {
+        fprintf(stderr, "Could not load the configuration file %s\n", config_path);
+        return EXIT_FAILURE;
+    }
+    int res = (config->stacks != NULL) ? compose_stacks(&operations, *config) : compose_layers(&operations, *config);
+    if (res != 0) {
+        fprintf(stderr, "Could not compose the layers of the configuration\n");
+        return EXIT_FAILURE;
+    }
+    if (operations->init != NULL) {
+        struct fuse_conn_info conn;
+        memset(&conn, 0, sizeof(conn));
+        operations->init(&conn);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i].tid, NULL, replay_func, &threads[i]);
+    }
+    replay_start = latency_now();
+    pthread_barrier_wait(&start_barrier);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        free(threads[i].records);
+        free(threads[i].buf);
+    }
+    double seconds = (latency_now() - replay_start) / 1e9;
+    pthread_barrier_destroy(&start_barrier);
+
+    print_stats();
+    fprintf(stderr, "Replayed %d threads in %.3f seconds\n", nthreads, seconds);
+
+    // files left open by the capture
+    for (i = 0; i < nfiles; i++) {
+        if (files[i].state == FILE_OPEN && operations->release != NULL) {
+            operations->release(files[i].path, &files[i].fi);
+        }
+    }
+    free(files);
+    free(threads);
+    g_ptr_array_free(paths, TRUE);
+
+    if (operations->destroy != NULL) {
+        operations->destroy(NULL);
+    }
+    if (config->stacks != NULL) {
+        clean_stacks(*config);
+    } else {
+        clean_layers(*config);
+    }
+    clean_plugins();
+    clean_latencies();
+    clean_config(config);
+
+    return EXIT_SUCCESS;
+}
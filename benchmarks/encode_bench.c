@@ -0,0 +1,443 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Microbenchmark of the sfuse encode drivers and of the multi_loop drivers.
+ *
+ * Every driver is called directly, without FUSE nor any layer, for each combination of block size,
+ * key size and number of threads. Each thread works on its own buffers. Results are printed as CSV
+ * on stdout, one line per driver, operation and combination:
+ *
+ *   kind,driver,op,block_size,key_size,threads,calls,bytes,seconds,mib_per_s,ns_per_byte,allocs_per_call
+ *
+ * ns_per_byte is the time spent per byte by one thread (elapsed time * threads / bytes).
+ * allocs_per_call counts the malloc/calloc/realloc calls made by the SafeFS code itself (the
+ * allocations done inside OpenSSL or liberasurecode are not seen).
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../logdef.h"
+#include "../crypto/chacha_symmetric.h"
+#include "../crypto/det_symmetric.h"
+#include "../crypto/nopcrypt.h"
+#include "../crypto/nopcrypt_padded.h"
+#include "../crypto/rand_symmetric.h"
+#include "../multi_loop_drivers/erasure.h"
+#include "../multi_loop_drivers/rep.h"
+#include "../multi_loop_drivers/xor.h"
+#include "../utils.h"
+
+#define MAX_VALUES 32
+// Room for the padding, IV, tag or nonce appended by the encode drivers
+#define MAX_PADSIZE 64
+
+static char BENCH_KEY[] = "C53C0E2F1B0B19AC53C0E2F1B0B19A0";
+static char BENCH_IV[] = "C53C0E2F1B0B19A";
+static const char *BENCH_PATH = "/encode_bench";
+
+// The drivers log through logdef, which needs a mounted configuration. Logging is dropped here.
+int sfs_log_level = LOG_LEVEL_NONE;
+void log_debug(const char *format, ...) {}
+void log_error(const char *format, ...) {}
+void log_screen(const char *format, ...) {}
+
+/*
+ * Allocation counting. The binary is linked with --wrap so that the allocations made by the
+ * driver objects go through these functions.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static uint64_t allocations = 0;
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+struct bench_options {
+    int block_sizes[MAX_VALUES];
+    int nblock_sizes;
+    int key_sizes[MAX_VALUES];
+    int nkey_sizes;
+    int threads[MAX_VALUES];
+    int nthreads;
+    double duration;
+    int ndevs;
+    const char *only;
+};
+
+// State of one benchmark thread
+struct worker {
+    int block_size;
+    int ndevs;
+    unsigned char *src;
+    unsigned char *encoded;
+    int encoded_size;
+    unsigned char *decoded;
+    struct io_request *requests;
+    uint64_t calls;
+    int (*iteration)(struct worker *);
+    volatile int *stop;
+    pthread_barrier_t *start;
+};
+
+struct encode_bench_driver {
+    const char *name;
+    // key sizes only matter for the AES drivers
+    int uses_key_size;
+    int (*init)(int block_size, int key_size);
+    int (*encode)(unsigned char *dest, const unsigned char *src, int size, void *ident);
+    int (*decode)(unsigned char *dest, const unsigned char *src, int size, void *ident);
+};
+
+struct multi_bench_driver {
+    const char *name;
+    void (*encode)(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
+                   int ndevs);
+    void (*decode)(unsigned char *block, struct io_request *requests, int size, int ndevs);
+};
+
+static int bench_nop_init(int block_size, int key_size) { return 0; }
+
+static int bench_rand_init(int block_size, int key_size) { return rand_init(BENCH_KEY, key_size); }
+
+static int bench_det_init(int block_size, int key_size) {
+    return det_init(BENCH_KEY, (unsigned char *)BENCH_IV, key_size, 0);
+}
+
+static int bench_det_derived_init(int block_size, int key_size) {
+    return det_init(BENCH_KEY, (unsigned char *)BENCH_IV, key_size, 1);
+}
+
+static int bench_chacha_init(int block_size, int key_size) { return chacha_init(BENCH_KEY); }
+
+static struct encode_bench_driver encode_drivers[] = {
+    {"nop", 0, bench_nop_init, nop_encode, nop_decode},
+    {"nop_padded", 0, bench_nop_init, nop_encode_padded, nop_decode_padded},
+    {"rand", 1, bench_rand_init, rand_encode, rand_decode},
+    {"det", 1, bench_det_init, det_encode, det_decode},
+    {"det_derived", 1, bench_det_derived_init, det_encode, det_decode},
+    {"chacha", 0, bench_chacha_init, chacha_encode, chacha_decode},
+};
+
+static struct multi_bench_driver multi_drivers[] = {
+    {"rep", rep_encode, rep_decode},
+    {"xor", encode_xor, decode_xor},
+    {"erasure", erasure_encode, erasure_decode},
+};
+
+static struct encode_bench_driver *current_encode_driver;
+static struct multi_bench_driver *current_multi_driver;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int encode_iteration(struct worker *w) {
+    struct key_info info = {BENCH_PATH, 0, NULL, w->block_size};
+    return current_encode_driver->encode(w->encoded, w->src, w->block_size, &info);
+}
+
+static int decode_iteration(struct worker *w) {
+    struct key_info info = {BENCH_PATH, 0, NULL, w->block_size};
+    return current_encode_driver->decode(w->decoded, w->encoded, w->encoded_size, &info);
+}
+
+static void clean_requests(struct worker *w) {
+    int i;
+    for (i = 0; i < w->ndevs; i++) {
+        io_request_clean(&w->requests[i]);
+    }
+}
+
+static int multi_encode_iteration(struct worker *w) {
+    current_multi_driver->encode(BENCH_PATH, w->requests, w->src, 0, w->block_size, w->ndevs);
+    clean_requests(w);
+    return w->block_size;
+}
+
+static int multi_decode_iteration(struct worker *w) {
+    current_multi_driver->decode(w->decoded, w->requests, w->encoded_size, w->ndevs);
+    return w->block_size;
+}
+
+static void *worker_func(void *data) {
+    struct worker *w = (struct worker *)data;
+
+    pthread_barrier_wait(w->start);
+    while (!*w->stop) {
+        if (w->iteration(w) < 0) {
+            fprintf(stderr, "driver call failed\n");
+            exit(EXIT_FAILURE);
+        }
+        w->calls++;
+    }
+    return NULL;
+}
+
+static struct worker *new_workers(int nthreads, int block_size, int ndevs) {
+    struct worker *workers = calloc(nthreads, sizeof(struct worker));
+    int i, j;
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].block_size = block_size;
+        workers[i].ndevs = ndevs;
+        workers[i].src = malloc(block_size + MAX_PADSIZE);
+        workers[i].encoded = malloc(block_size + MAX_PADSIZE);
+        workers[i].decoded = malloc(block_size + MAX_PADSIZE);
+        workers[i].requests = calloc(ndevs, sizeof(struct io_request));
+        generate_random_block(workers[i].src, block_size + MAX_PADSIZE);
+        for (j = 0; j < ndevs; j++) {
+            io_request_init(&workers[i].requests[j]);
+        }
+    }
+    return workers;
+}
+
+static void free_workers(struct worker *workers, int nthreads) {
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        clean_requests(&workers[i]);
+        free(workers[i].requests);
+        free(workers[i].src);
+        free(workers[i].encoded);
+        free(workers[i].decoded);
+    }
+    free(workers);
+}
+
+// Runs iteration on every worker for the configured duration and prints the result line
+static void run_case(const char *kind, const char *driver, const char *op, int key_size, struct worker *workers,
+                     int nthreads, int (*iteration)(struct worker *), struct bench_options *options) {
+    pthread_t tids[nthreads];
+    pthread_barrier_t start;
+    volatile int stop = 0;
+    uint64_t calls = 0;
+    int i;
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].calls = 0;
+        workers[i].iteration = iteration;
+        workers[i].stop = &stop;
+        workers[i].start = &start;
+        pthread_create(&tids[i], NULL, worker_func, &workers[i]);
+    }
+
+    __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&start);
+    double begin = now();
+    usleep((useconds_t)(options->duration * 1e6));
+    stop = 1;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        calls += workers[i].calls;
+    }
+    double seconds = now() - begin;
+    uint64_t allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    pthread_barrier_destroy(&start);
+
+    int block_size = workers[0].block_size;
+    double bytes = (double)calls * block_size;
+    printf("%s,%s,%s,%d,%d,%d,%lu,%.0f,%.6f,%.2f,%.4f,%.2f\n", kind, driver, op, block_size, key_size, nthreads,
+           (unsigned long)calls, bytes, seconds, bytes / seconds / (1024 * 1024),
+           (bytes > 0) ? seconds * 1e9 * nthreads / bytes : 0, (calls > 0) ? (double)allocs / calls : 0);
+    fflush(stdout);
+}
+
+static int selected(struct bench_options *options, const char *driver) {
+    if (options->only == NULL) {
+        return 1;
+    }
+    char list[strlen(options->only) + 1];
+    strcpy(list, options->only);
+    char *saveptr = NULL;
+    char *name;
+    for (name = strtok_r(list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(name, driver) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bench_encode_driver(struct encode_bench_driver *driver, struct bench_options *options) {
+    int b, k, t;
+    int nkey_sizes = driver->uses_key_size ? options->nkey_sizes : 1;
+
+    for (k = 0; k < nkey_sizes; k++) {
+        int key_size = driver->uses_key_size ? options->key_sizes[k] : 0;
+
+        for (b = 0; b < options->nblock_sizes; b++) {
+            int block_size = options->block_sizes[b];
+
+            if (driver->init(block_size, driver->uses_key_size ? key_size : 16) < 0) {
+                fprintf(stderr, "Could not init driver %s, skipping it\n", driver->name);
+                return;
+            }
+            current_encode_driver = driver;
+
+            for (t = 0; t < options->nthreads; t++) {
+                int nthreads = options->threads[t];
+                struct worker *workers = new_workers(nthreads, block_size, 0);
+                int i;
+
+                run_case("encode", driver->name, "encode", key_size, workers, nthreads, encode_iteration, options);
+
+                for (i = 0; i < nthreads; i++) {
+                    workers[i].encoded_size = encode_iteration(&workers[i]);
+                }
+                run_case("encode", driver->name, "decode", key_size, workers, nthreads, decode_iteration, options);
+
+                free_workers(workers, nthreads);
+            }
+        }
+    }
+}
+
+static void bench_multi_driver(struct multi_bench_driver *driver, struct bench_options *options) {
+    int b, t;
+
+    current_multi_driver = driver;
+    for (b = 0; b < options->nblock_sizes; b++) {
+        int block_size = options->block_sizes[b];
+
+        for (t = 0; t < options->nthreads; t++) {
+            int nthreads = options->threads[t];
+            struct worker *workers = new_workers(nthreads, block_size, options->ndevs);
+            int i;
+
+            run_case("multi", driver->name, "encode", 0, workers, nthreads, multi_encode_iteration, options);
+
+            // decode the blocks produced by one encode call
+            for (i = 0; i < nthreads; i++) {
+                driver->encode(BENCH_PATH, workers[i].requests, workers[i].src, 0, block_size, options->ndevs);
+                // erasure fragments are larger than the block
+                workers[i].encoded_size = io_request_size(&workers[i].requests[0]);
+            }
+            run_case("multi", driver->name, "decode", 0, workers, nthreads, multi_decode_iteration, options);
+
+            free_workers(workers, nthreads);
+        }
+    }
+}
+
+static int parse_list(const char *arg, int *values) {
+    char list[strlen(arg) + 1];
+    strcpy(list, arg);
+    char *saveptr = NULL;
+    char *value;
+    int n = 0;
+    for (value = strtok_r(list, ",", &saveptr); value != NULL && n < MAX_VALUES;
+         value = strtok_r(NULL, ",", &saveptr)) {
+        values[n] = atoi(value);
+        if (values[n] <= 0) {
+            fprintf(stderr, "Invalid value %s\n", value);
+            exit(EXIT_FAILURE);
+        }
+        n++;
+    }
+    return n;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-b block_sizes] [-k key_sizes] [-t threads] [-d seconds] [-m ndevs] [-o drivers]\n"
+            "  -b  comma separated block sizes in bytes (default 512,4096,65536,1048576)\n"
+            "  -k  comma separated AES key sizes in bytes (default 16,24,32)\n"
+            "  -t  comma separated thread counts (default 1)\n"
+            "  -d  duration of each measurement in seconds (default 1)\n"
+            "  -m  number of devices for the multi_loop drivers (default 3, erasure always uses 3)\n"
+            "  -o  comma separated list of drivers to run (default all):\n"
+            "      nop,nop_padded,rand,det,det_derived,chacha,rep,xor,erasure\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_options options;
+    int opt;
+    int i;
+
+    options.nblock_sizes = parse_list("512,4096,65536,1048576", options.block_sizes);
+    options.nkey_sizes = parse_list("16,24,32", options.key_sizes);
+    options.nthreads = parse_list("1", options.threads);
+    options.duration = 1;
+    options.ndevs = 3;
+    options.only = NULL;
+
+    while ((opt = getopt(argc, argv, "b:k:t:d:m:o:h")) != -1) {
+        switch (opt) {
+            case 'b':
+                options.nblock_sizes = parse_list(optarg, options.block_sizes);
+                break;
+            case 'k':
+                options.nkey_sizes = parse_list(optarg, options.key_sizes);
+                break;
+            case 't':
+                options.nthreads = parse_list(optarg, options.threads);
+                break;
+            case 'd':
+                options.duration = atof(optarg);
+                break;
+            case 'm':
+                options.ndevs = atoi(optarg);
+                break;
+            case 'o':
+                options.only = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("kind,driver,op,block_size,key_size,threads,calls,bytes,seconds,mib_per_s,ns_per_byte,allocs_per_call\n");
+
+    for (i = 0; i < sizeof(encode_drivers) / sizeof(encode_drivers[0]); i++) {
+        if (selected(&options, encode_drivers[i].name)) {
+            bench_encode_driver(&encode_drivers[i], &options);
+        }
+    }
+
+    int ndevs = options.ndevs;
+    for (i = 0; i < sizeof(multi_drivers) / sizeof(multi_drivers[0]); i++) {
+        if (!selected(&options, multi_drivers[i].name)) {
+            continue;
+        }
+        if (multi_drivers[i].encode == erasure_encode) {
+            // multi_loop always runs the erasure driver with k = 2 and m = 1
+            init_erasure(2, 1);
+            options.ndevs = 3;
+        }
+        bench_multi_driver(&multi_drivers[i], &options);
+        options.ndevs = ndevs;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,504 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Benchmark of a whole layer stack, without FUSE.
+ *
+ * The layers of a configuration file are composed as when mounting and their fuse_operations are
+ * called directly by the benchmark threads, so the results do not include the kernel nor the FUSE
+ * front end. Each thread works on a file of its own, created and filled before the measurements.
+ * Results are printed as CSV on stdout, one line per workload and combination:
+ *
+ *   workload,block_size,threads,ops,bytes,seconds,ops_per_s,mib_per_s,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+ *
+ * Latencies are those of each call to the stack. The metadata workload creates, stats and removes
+ * empty files, each of the three calls counts as an operation, and is run once per thread count.
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../SFSConfig.h"
+#include "../compose/compose.h"
+#include "../plugins/plugin.h"
+#include "../timestamps/timestamps.h"
+#include "../utils.h"
+
+#define MAX_VALUES 32
+// size of the writes filling the files, a multiple of the block sizes of the layers
+#define FILL_SIZE (128 * 1024)
+
+struct bench_options {
+    const char *config_path;
+    const char *directory;
+    const char *only;
+    int block_sizes[MAX_VALUES];
+    int nblock_sizes;
+    int threads[MAX_VALUES];
+    int nthreads;
+    double duration;
+    off_t file_size;
+    int read_percent;
+};
+
+// State of one benchmark thread
+struct worker {
+    int id;
+    int block_size;
+    off_t file_size;
+    int read_percent;
+    char path[PATH_MAX];
+    struct fuse_file_info fi;
+    char *buf;
+    off_t offset;
+    unsigned int seed;
+    uint64_t ops;
+    uint64_t bytes;
+    struct latency_histogram *histogram;
+    int (*iteration)(struct worker *);
+    volatile int *stop;
+    pthread_barrier_t *start;
+};
+
+struct workload {
+    const char *name;
+    // the workload reads or writes the file of each thread, with the block sizes of the options
+    int uses_file;
+    int (*iteration)(struct worker *);
+};
+
+static const char *bench_directory;
+static struct fuse_operations *operations;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static off_t random_offset(struct worker *w) {
+    off_t nblocks = w->file_size / w->block_size;
+    off_t block = (((off_t)rand_r(&w->seed) << 31) | rand_r(&w->seed)) % nblocks;
+    return block * w->block_size;
+}
+
+static off_t sequential_offset(struct worker *w) {
+    off_t offset = w->offset;
+    w->offset = (offset + 2 * w->block_size <= w->file_size) ? offset + w->block_size : 0;
+    return offset;
+}
+
+static int timed_read(struct worker *w, off_t offset) {
+    uint64_t start = latency_now();
+    int res = operations->read(w->path, w->buf, w->block_size, offset, &w->fi);
+    store_io(w->histogram, start, (res > 0) ? res : 0);
+    w->ops++;
+    w->bytes += (res > 0) ? res : 0;
+    return res;
+}
+
+static int timed_write(struct worker *w, off_t offset) {
+    uint64_t start = latency_now();
+    int res = operations->write(w->path, w->buf, w->block_size, offset, &w->fi);
+    store_io(w->histogram, start, (res > 0) ? res : 0);
+    w->ops++;
+    w->bytes += (res > 0) ? res : 0;
+    return res;
+}
+
+static int seqread_iteration(struct worker *w) { return timed_read(w, sequential_offset(w)); }
+
+static int seqwrite_iteration(struct worker *w) { return timed_write(w, sequential_offset(w)); }
+
+static int randread_iteration(struct worker *w) { return timed_read(w, random_offset(w)); }
+
+static int randwrite_iteration(struct worker *w) { return timed_write(w, random_offset(w)); }
+
+static int mixed_iteration(struct worker *w) {
+    if (rand_r(&w->seed) % 100 < w->read_percent) {
+        return timed_read(w, random_offset(w));
+    }
+    return timed_write(w, random_offset(w));
+}
+
+static int metadata_iteration(struct worker *w) {
+    char path[PATH_MAX];
+    struct fuse_file_info fi;
+    struct stat stbuf;
+    uint64_t start;
+    int res;
+
+    snprintf(path, sizeof(path), "%s/stack_bench.%d.meta.%lu", bench_directory, w->id, (unsigned long)w->ops);
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_CREAT | O_WRONLY;
+
+    start = latency_now();
+    res = operations->create(path, 0644, &fi);
+    if (res == 0 && operations->release != NULL) {
+        operations->release(path, &fi);
+    }
+    store(w->histogram, start);
+    if (res < 0) {
+        return res;
+    }
+
+    start = latency_now();
+    res = operations->getattr(path, &stbuf);
+    store(w->histogram, start);
+    if (res < 0) {
+        return res;
+    }
+
+    start = latency_now();
+    res = operations->unlink(path);
+    store(w->histogram, start);
+
+    w->ops += 3;
+    return res;
+}
+
+static struct workload workloads[] = {
+    {"seqwrite", 1, seqwrite_iteration},
+    {"seqread", 1, seqread_iteration},
+    {"randwrite", 1, randwrite_iteration},
+    {"randread", 1, randread_iteration},
+    {"mixed", 1, mixed_iteration},
+    {"metadata", 0, metadata_iteration},
+};
+
+static void *worker_func(void *data) {
+    struct worker *w = (struct worker *)data;
+
+    pthread_barrier_wait(w->start);
+    while (!*w->stop) {
+        int res = w->iteration(w);
+        if (res < 0) {
+            fprintf(stderr, "%s: stack call failed: %s\n", w->path, strerror(-res));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return NULL;
+}
+
+static void open_file(struct worker *w) {
+    int res;
+
+    memset(&w->fi, 0, sizeof(w->fi));
+    w->fi.flags = O_RDWR;
+    res = (operations->open != NULL) ? operations->open(w->path, &w->fi) : 0;
+    if (res < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", w->path, strerror(-res));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void close_file(struct worker *w) {
+    if (operations->flush != NULL) {
+        operations->flush(w->path, &w->fi);
+    }
+    if (operations->release != NULL) {
+        operations->release(w->path, &w->fi);
+    }
+}
+
+// Creates the file of each thread, filled with file_size random bytes
+static void create_files(int nthreads, struct bench_options *options) {
+    char *buf = malloc(FILL_SIZE);
+    int i;
+
+    generate_random_block((unsigned char *)buf, FILL_SIZE);
+    for (i = 0; i < nthreads; i++) {
+        char path[PATH_MAX];
+        struct fuse_file_info fi;
+        off_t offset;
+
+        snprintf(path, sizeof(path), "%s/stack_bench.%d", options->directory, i);
+        memset(&fi, 0, sizeof(fi));
+        fi.flags = O_CREAT | O_RDWR;
+        if (operations->create(path, 0644, &fi) < 0) {
+            fprintf(stderr, "Could not create %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        for (offset = 0; offset < options->file_size; offset += FILL_SIZE) {
+            if (operations->write(path, buf, FILL_SIZE, offset, &fi) != FILL_SIZE) {
+                fprintf(stderr, "Could not write %s\n", path);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (operations->release != NULL) {
+            operations->release(path, &fi);
+        }
+    }
+    free(buf);
+}
+
+static void remove_files(int nthreads, struct bench_options *options) {
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/stack_bench.%d", options->directory, i);
+        operations->unlink(path);
+    }
+}
+
+static struct worker *new_workers(int nthreads, int block_size, struct bench_options *options) {
+    struct worker *workers = calloc(nthreads, sizeof(struct worker));
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].block_size = block_size;
+        workers[i].file_size = options->file_size;
+        workers[i].read_percent = options->read_percent;
+        workers[i].seed = i + 1;
+        workers[i].buf = malloc(block_size);
+        generate_random_block((unsigned char *)workers[i].buf, block_size);
+        snprintf(workers[i].path, sizeof(workers[i].path), "%s/stack_bench.%d", options->directory, i);
+    }
+    return workers;
+}
+
+static void free_workers(struct worker *workers, int nthreads) {
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        free(workers[i].buf);
+    }
+    free(workers);
+}
+
+// Runs workload on every worker for the configured duration and prints the result line
+static void run_case(struct workload *workload, struct worker *workers, int nthreads, struct bench_options *options) {
+    struct latency_histogram *histogram = new_latency_histogram("stack_bench", workload->name);
+    struct latency_snapshot *after = malloc(sizeof(struct latency_snapshot));
+    pthread_t tids[nthreads];
+    pthread_barrier_t start;
+    volatile int stop = 0;
+    uint64_t ops = 0, bytes = 0;
+    int i;
+
+    // the histogram is shared by the cases of the workload, the workers of the previous case are joined
+    latency_reset(histogram);
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].ops = 0;
+        workers[i].bytes = 0;
+        workers[i].offset = 0;
+        workers[i].histogram = histogram;
+        workers[i].iteration = workload->iteration;
+        workers[i].stop = &stop;
+        workers[i].start = &start;
+        if (workload->uses_file) {
+            open_file(&workers[i]);
+        }
+        pthread_create(&tids[i], NULL, worker_func, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    double begin = now();
+    usleep((useconds_t)(options->duration * 1e6));
+    stop = 1;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        ops += workers[i].ops;
+        bytes += workers[i].bytes;
+        if (workload->uses_file) {
+            close_file(&workers[i]);
+        }
+    }
+    double seconds = now() - begin;
+    latency_snapshot(histogram, after);
+    pthread_barrier_destroy(&start);
+
+    printf("%s,%d,%d,%lu,%lu,%.6f,%.2f,%.2f,%lu,%lu,%lu,%lu,%lu,%lu\n", workload->name,
+           workload->uses_file ? workers[0].block_size : 0, nthreads, (unsigned long)ops, (unsigned long)bytes, seconds,
+           ops / seconds, bytes / seconds / (1024 * 1024),
+           (unsigned long)((after->count > 0) ? after->sum / after->count : 0),
+           (unsigned long)latency_percentile(after, 50), (unsigned long)latency_percentile(after, 90),
+           (unsigned long)latency_percentile(after, 99), (unsigned long)latency_percentile(after, 99.9),
+           (unsigned long)latency_percentile(after, 100));
+    fflush(stdout);
+
+    free(after);
+}
+
+static int selected(struct bench_options *options, const char *workload) {
+    if (options->only == NULL) {
+        return 1;
+    }
+    char list[strlen(options->only) + 1];
+    strcpy(list, options->only);
+    char *saveptr = NULL;
+    char *name;
+    for (name = strtok_r(list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(name, workload) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bench_workload(struct workload *workload, struct bench_options *options) {
+    int b, t;
+    int nblock_sizes = workload->uses_file ? options->nblock_sizes : 1;
+
+    for (b = 0; b < nblock_sizes; b++) {
+        int block_size = options->block_sizes[b];
+
+        if (workload->uses_file && options->file_size % block_size != 0) {
+            fprintf(stderr, "The file size is not a multiple of block size %d, skipping it\n", block_size);
+            continue;
+        }
+        for (t = 0; t < options->nthreads; t++) {
+            int nthreads = options->threads[t];
+            struct worker *workers = new_workers(nthreads, block_size, options);
+
+            run_case(workload, workers, nthreads, options);
+            free_workers(workers, nthreads);
+        }
+    }
+}
+
+static int parse_list(const char *arg, int *values) {
+    char list[strlen(arg) + 1];
+    strcpy(list, arg);
+    char *saveptr = NULL;
+    char *value;
+    int n = 0;
+    for (value = strtok_r(list, ",", &saveptr); value != NULL && n < MAX_VALUES;
+         value = strtok_r(NULL, ",", &saveptr)) {
+        values[n] = atoi(value);
+        if (values[n] <= 0) {
+            fprintf(stderr, "Invalid value %s\n", value);
+            exit(EXIT_FAILURE);
+        }
+        n++;
+    }
+    return n;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-c configuration] [-w workloads] [-b block_sizes] [-t threads] [-d seconds] [-s MiB]\n"
+            "          [-r read_percent] [-p directory]\n"
+            "  -c  configuration file of the stack (default %s)\n"
+            "  -w  comma separated list of workloads to run (default all):\n"
+            "      seqwrite,seqread,randwrite,randread,mixed,metadata\n"
+            "  -b  comma separated block sizes in bytes (default 4096,131072)\n"
+            "  -t  comma separated thread counts (default 1,4)\n"
+            "  -d  duration of each measurement in seconds (default 1)\n"
+            "  -s  size of the file of each thread in MiB (default 64)\n"
+            "  -r  percentage of reads of the mixed workload (default 70)\n"
+            "  -p  directory of the files, e.g. the directory of a stack of [stacks] (default /)\n",
+            program, LOCAL_SDSCONFIG_PATH);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_options options;
+    configuration *config;
+    int opt;
+    int i;
+
+    options.config_path = LOCAL_SDSCONFIG_PATH;
+    options.directory = "";
+    options.only = NULL;
+    options.nblock_sizes = parse_list("4096,131072", options.block_sizes);
+    options.nthreads = parse_list("1,4", options.threads);
+    options.duration = 1;
+    options.file_size = 64 * 1024 * 1024;
+    options.read_percent = 70;
+
+    while ((opt = getopt(argc, argv, "c:w:b:t:d:s:r:p:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.config_path = optarg;
+                break;
+            case 'w':
+                options.only = optarg;
+                break;
+            case 'b':
+                options.nblock_sizes = parse_list(optarg, options.block_sizes);
+                break;
+            case 't':
+                options.nthreads = parse_list(optarg, options.threads);
+                break;
+            case 'd':
+                options.duration = atof(optarg);
+                break;
+            case 's':
+                options.file_size = (off_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'r':
+                options.read_percent = atoi(optarg);
+                break;
+            case 'p':
+                // paths are built as directory/name
+                options.directory = (strcmp(optarg, "/") == 0) ? "" : optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    bench_directory = options.directory;
+    if (options.file_size <= 0 || options.file_size % FILL_SIZE != 0) {
+        fprintf(stderr, "The file size must be a positive number of MiB\n");
+        return EXIT_FAILURE;
+    }
+
+    // logging is left disabled, LOG_INIT reads the configuration of the mount
+    if (init_config((char *)options.config_path, &config) != 0) {
+        fprintf(stderr, "Could not load the configuration file %s\n", options.config_path);
+        return EXIT_FAILURE;
+    }
+    int res = (config->stacks != NULL) ? compose_stacks(&operations, *config) : compose_layers(&operations, *config);
+    if (res != 0) {
+        fprintf(stderr, "Could not compose the layers of the configuration\n");
+        return EXIT_FAILURE;
+    }
+    if (operations->init != NULL) {
+        struct fuse_conn_info conn;
+        memset(&conn, 0, sizeof(conn));
+        operations->init(&conn);
+    }
+
+    int max_threads = 0;
+    for (i = 0; i < options.nthreads; i++) {
+        max_threads = (options.threads[i] > max_threads) ? options.threads[i] : max_threads;
+    }
+    create_files(max_threads, &options);
+
+    printf("workload,block_size,threads,ops,bytes,seconds,ops_per_s,mib_per_s,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,"
+           "max_ns\n");
+    for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (selected(&options, workloads[i].name)) {
+            bench_workload(&workloads[i], &options);
+        }
+    }
+
+    remove_files(max_threads, &options);
+    if (operations->destroy != NULL) {
+        operations->destroy(NULL);
+    }
+    if (config->stacks != NULL) {
+        clean_stacks(*config);
+    } else {
+        clean_layers(*config);
+    }
+    clean_plugins();
+    clean_latencies();
+    clean_config(config);
+
+    return EXIT_SUCCESS;
+}
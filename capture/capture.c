@@ -0,0 +1,468 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "capture.h"
+#include "../handles/handles.h"
+#include "../logdef.h"
+#include "../timestamps/timestamps.h"
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// operations of the layer below
+static struct layer_context capture_layer;
+static struct fuse_operations capture_oper;
+
+// State of a file or directory opened through the layer, fi->fh points to it (see handles/handles.h)
+struct capture_file {
+    struct layer_file lower;
+    // id of the open in the records
+    uint64_t id;
+};
+
+// last id given to an open, the ids are never reused
+static uint64_t last_file_id = 0;
+
+/*
+ * Records of a thread, written to the file in one batch when the buffer is full, when the oldest one
+ * was buffered flush_interval ago, after a fsync or a release and when the thread exits. The ids of
+ * the paths already seen by the thread are cached, the other ones are looked up in capture_paths.
+ */
+struct capture_thread {
+    uint16_t id;
+    // capture_generation when the thread started recording
+    int generation;
+    size_t used;
+    // when the first record of the buffer was added
+    uint64_t buffered_since;
+    GHashTable *paths;
+    struct capture_thread *next;
+    char records[];
+};
+
+// the file, the paths, the thread ids and the list of threads are used under capture_lock
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *capture_file = NULL;
+// path to id, the ids start at 1
+static GHashTable *capture_paths = NULL;
+static uint64_t capture_start;
+static uint64_t capture_errors = 0;
+static size_t batch_size;
+// nanoseconds, 0 to only write full buffers
+static uint64_t flush_interval;
+
+static struct capture_thread *capture_threads = NULL;
+// the ids of exited threads are reused, the replay starts one thread per id
+static char thread_ids[CAPTURE_MAX_THREADS];
+static int shared_ids = 0;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+// bumped when a capture is over, the threads then start a new buffer for the next one
+static int capture_generation = 0;
+static __thread struct capture_thread *current_thread = NULL;
+static __thread int current_generation = -1;
+
+static const char *op_names[CAPTURE_OPS] = {
+    [CAPTURE_PATH] = "path",             [CAPTURE_GETATTR] = "getattr",         [CAPTURE_FGETATTR] = "fgetattr",
+    [CAPTURE_ACCESS] = "access",         [CAPTURE_READLINK] = "readlink",       [CAPTURE_READDIR] = "readdir",
+    [CAPTURE_MKNOD] = "mknod",           [CAPTURE_MKDIR] = "mkdir",             [CAPTURE_SYMLINK] = "symlink",
+    [CAPTURE_UNLINK] = "unlink",         [CAPTURE_RMDIR] = "rmdir",             [CAPTURE_RENAME] = "rename",
+    [CAPTURE_LINK] = "link",             [CAPTURE_CHMOD] = "chmod",             [CAPTURE_CHOWN] = "chown",
+    [CAPTURE_TRUNCATE] = "truncate",     [CAPTURE_FTRUNCATE] = "ftruncate",     [CAPTURE_UTIMENS] = "utimens",
+    [CAPTURE_CREATE] = "create",         [CAPTURE_OPEN] = "open",               [CAPTURE_READ] = "read",
+    [CAPTURE_WRITE] = "write",           [CAPTURE_STATFS] = "statfs",           [CAPTURE_FLUSH] = "flush",
+    [CAPTURE_RELEASE] = "release",       [CAPTURE_FSYNC] = "fsync",             [CAPTURE_OPENDIR] = "opendir",
+    [CAPTURE_RELEASEDIR] = "releasedir", [CAPTURE_SETXATTR] = "setxattr",       [CAPTURE_GETXATTR] = "getxattr",
+    [CAPTURE_LISTXATTR] = "listxattr",   [CAPTURE_REMOVEXATTR] = "removexattr",
+};
+
+const char *capture_op_name(int op) { return (op >= 0 && op < CAPTURE_OPS) ? op_names[op] : "unknown"; }
+
+static void write_capture(const void *data, size_t size) {
+    if (fwrite(data, size, 1, capture_file) != 1 && capture_errors++ == 0) {
+        ERROR_MSG("Could not write the capture file: %s\n", strerror(errno));
+    }
+}
+
+// Writes the records of thread, called with capture_lock held
+static void flush_thread(struct capture_thread *thread) {
+    if (thread->used > 0 && capture_file != NULL) {
+        write_capture(thread->records, thread->used);
+        thread->used = 0;
+        if (fflush(capture_file) != 0 && capture_errors++ == 0) {
+            ERROR_MSG("Could not write the capture file: %s\n", strerror(errno));
+        }
+    }
+}
+
+static void free_thread(struct capture_thread *thread) {
+    g_hash_table_destroy(thread->paths);
+    free(thread);
+}
+
+// Flushes the records of an exiting thread and releases its id
+static void release_thread(void *data) {
+    struct capture_thread *thread = data;
+    struct capture_thread **current;
+
+    pthread_mutex_lock(&capture_lock);
+    for (current = &capture_threads; *current != NULL; current = &(*current)->next) {
+        if (*current == thread) {
+            *current = thread->next;
+            break;
+        }
+    }
+    flush_thread(thread);
+    if (thread->generation == capture_generation) {
+        thread_ids[thread->id] = 0;
+    }
+    pthread_mutex_unlock(&capture_lock);
+    free_thread(thread);
+}
+
+static void create_thread_key() { pthread_key_create(&thread_key, release_thread); }
+
+// Lowest id not used by a running thread. Called with capture_lock held.
+static uint16_t new_thread_id() {
+    int i;
+
+    for (i = 0; i < CAPTURE_MAX_THREADS; i++) {
+        if (!thread_ids[i]) {
+            thread_ids[i] = 1;
+            return i;
+        }
+    }
+    if (shared_ids++ == 0) {
+        ERROR_MSG("More than %d threads, the capture shares the last thread id\n", CAPTURE_MAX_THREADS);
+    }
+    return CAPTURE_MAX_THREADS - 1;
+}
+
+static struct capture_thread *get_thread() {
+    if (current_thread != NULL && current_generation == __atomic_load_n(&capture_generation, __ATOMIC_ACQUIRE)) {
+        return current_thread;
+    }
+
+    struct capture_thread *thread = malloc(sizeof(struct capture_thread) + batch_size);
+    thread->used = 0;
+    thread->paths = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+    pthread_once(&thread_key_once, create_thread_key);
+    pthread_mutex_lock(&capture_lock);
+    thread->id = new_thread_id();
+    thread->generation = capture_generation;
+    thread->next = capture_threads;
+    capture_threads = thread;
+    current_generation = capture_generation;
+    pthread_mutex_unlock(&capture_lock);
+
+    // the buffer of a previous capture is empty, it is replaced
+    if (current_thread != NULL) {
+        release_thread(current_thread);
+    }
+    pthread_setspecific(thread_key, thread);
+    current_thread = thread;
+    return thread;
+}
+
+// Id of path, defined in the file the first time a thread sees it
+static uint32_t path_id(struct capture_thread *thread, const char *path) {
+    if (path == NULL) {
+        return 0;
+    }
+
+    uint32_t id = GPOINTER_TO_UINT(g_hash_table_lookup(thread->paths, path));
+    if (id != 0) {
+        return id;
+    }
+
+    pthread_mutex_lock(&capture_lock);
+    id = GPOINTER_TO_UINT(g_hash_table_lookup(capture_paths, path));
+    if (id == 0) {
+        struct capture_record record;
+
+        id = g_hash_table_size(capture_paths) + 1;
+        g_hash_table_insert(capture_paths, strdup(path), GUINT_TO_POINTER(id));
+
+        // written before any record using it, which are buffered until this returns
+        memset(&record, 0, sizeof(record));
+        record.op = CAPTURE_PATH;
+        record.path = id;
+        record.arg0 = strlen(path);
+        write_capture(&record, sizeof(record));
+        write_capture(path, record.arg0);
+    }
+    pthread_mutex_unlock(&capture_lock);
+
+    g_hash_table_insert(thread->paths, strdup(path), GUINT_TO_POINTER(id));
+    return id;
+}
+
+static void record_op(int op, uint64_t start, int result, const char *path, const char *path2, uint64_t file,
+                      uint64_t arg0, uint64_t arg1) {
+    struct capture_thread *thread = get_thread();
+    struct capture_record record;
+    uint64_t end = latency_now();
+
+    memset(&record, 0, sizeof(record));
+    record.op = op;
+    record.start = start - capture_start;
+    record.duration = end - start;
+    record.file = file;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+    record.result = result;
+    record.thread = thread->id;
+    record.path = path_id(thread, path);
+    record.path2 = path_id(thread, path2);
+
+    if (thread->used + sizeof(record) > batch_size) {
+        pthread_mutex_lock(&capture_lock);
+        flush_thread(thread);
+        pthread_mutex_unlock(&capture_lock);
+    }
+    if (thread->used == 0) {
+        thread->buffered_since = end;
+    }
+    memcpy(thread->records + thread->used, &record, sizeof(record));
+    thread->used += sizeof(record);
+
+    // the records of a thread that is rarely called, or of files being made durable, are not left behind
+    if (op == CAPTURE_FSYNC || op == CAPTURE_RELEASE || op == CAPTURE_RELEASEDIR ||
+        (flush_interval > 0 && end - thread->buffered_since >= flush_interval)) {
+        pthread_mutex_lock(&capture_lock);
+        flush_thread(thread);
+        pthread_mutex_unlock(&capture_lock);
+    }
+}
+
+// Gives an id to a file or directory the layer below opened
+static uint64_t attach_file(struct fuse_file_info *fi) {
+    struct capture_file *file = malloc(sizeof(struct capture_file));
+    file->id = __atomic_add_fetch(&last_file_id, 1, __ATOMIC_RELAXED);
+    layer_file_attach(fi, &file->lower);
+    return file->id;
+}
+
+static uint64_t file_id(const struct fuse_file_info *fi) { return ((struct capture_file *)layer_file_of(fi))->id; }
+
+static uint64_t timespec_ns(const struct timespec *ts) {
+    if (ts->tv_nsec == UTIME_NOW) {
+        return CAPTURE_TIME_NOW;
+    }
+    if (ts->tv_nsec == UTIME_OMIT) {
+        return CAPTURE_TIME_OMIT;
+    }
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// Recorded operations on paths, path and path2 are the parameters holding the paths of the record
+#define CAPTURE_OPERATION(operation, op, path, path2, arg0, arg1)                 \
+    static int capture_##operation LAYER_PARAMS(operation) {                      \
+        uint64_t start = latency_now();                                           \
+        int res = capture_layer.next->operation LAYER_ARGS(operation, fi);        \
+        record_op(op, start, res, path, path2, 0, arg0, arg1);                    \
+        return res;                                                               \
+    }
+
+// Recorded operations on open files, the layer below gets its own handle
+#define CAPTURE_FILE_OPERATION(operation, op, arg0, arg1)                                              \
+    static int capture_##operation LAYER_PARAMS(operation) {                                           \
+        uint64_t start = latency_now();                                                                \
+        struct fuse_file_info lower;                                                                   \
+        int res = capture_layer.next->operation LAYER_ARGS(operation, layer_file_lower(fi, &lower));   \
+        record_op(op, start, res, path, NULL, file_id(fi), arg0, arg1);                                \
+        return res;                                                                                    \
+    }
+
+CAPTURE_OPERATION(getattr, CAPTURE_GETATTR, path, NULL, 0, 0)
+CAPTURE_FILE_OPERATION(fgetattr, CAPTURE_FGETATTR, 0, 0)
+CAPTURE_OPERATION(access, CAPTURE_ACCESS, path, NULL, mask, 0)
+CAPTURE_OPERATION(readlink, CAPTURE_READLINK, path, NULL, size, 0)
+CAPTURE_FILE_OPERATION(readdir, CAPTURE_READDIR, offset, 0)
+CAPTURE_OPERATION(mknod, CAPTURE_MKNOD, path, NULL, mode, rdev)
+CAPTURE_OPERATION(mkdir, CAPTURE_MKDIR, path, NULL, mode, 0)
+CAPTURE_OPERATION(symlink, CAPTURE_SYMLINK, from, to, 0, 0)
+CAPTURE_OPERATION(unlink, CAPTURE_UNLINK, path, NULL, 0, 0)
+CAPTURE_OPERATION(rmdir, CAPTURE_RMDIR, path, NULL, 0, 0)
+CAPTURE_OPERATION(rename, CAPTURE_RENAME, from, to, 0, 0)
+CAPTURE_OPERATION(link, CAPTURE_LINK, from, to, 0, 0)
+CAPTURE_OPERATION(chmod, CAPTURE_CHMOD, path, NULL, mode, 0)
+CAPTURE_OPERATION(chown, CAPTURE_CHOWN, path, NULL, uid, gid)
+CAPTURE_OPERATION(truncate, CAPTURE_TRUNCATE, path, NULL, size, 0)
+CAPTURE_FILE_OPERATION(ftruncate, CAPTURE_FTRUNCATE, size, 0)
+CAPTURE_OPERATION(utimens, CAPTURE_UTIMENS, path, NULL, timespec_ns(&tv[0]), timespec_ns(&tv[1]))
+
+static int capture_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    uint64_t start = latency_now();
+    int res = capture_layer.next->create(path, mode, fi);
+    record_op(CAPTURE_CREATE, start, res, path, NULL, (res == 0) ? attach_file(fi) : 0, mode, fi->flags);
+    return res;
+}
+
+static int capture_open(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = latency_now();
+    int res = (capture_layer.next->open != NULL) ? capture_layer.next->open(path, fi) : 0;
+    record_op(CAPTURE_OPEN, start, res, path, NULL, (res == 0) ? attach_file(fi) : 0, 0, fi->flags);
+    return res;
+}
+
+CAPTURE_FILE_OPERATION(read, CAPTURE_READ, offset, size)
+CAPTURE_FILE_OPERATION(write, CAPTURE_WRITE, offset, size)
+CAPTURE_OPERATION(statfs, CAPTURE_STATFS, path, NULL, 0, 0)
+CAPTURE_FILE_OPERATION(flush, CAPTURE_FLUSH, 0, 0)
+
+static int capture_release(const char *path, struct fuse_file_info *fi) {
+    struct capture_file *file = (struct capture_file *)layer_file_detach(fi);
+    uint64_t start = latency_now();
+    int res = (capture_layer.next->release != NULL) ? capture_layer.next->release(path, fi) : 0;
+    record_op(CAPTURE_RELEASE, start, res, path, NULL, file->id, 0, 0);
+    free(file);
+    return res;
+}
+
+CAPTURE_FILE_OPERATION(fsync, CAPTURE_FSYNC, isdatasync, 0)
+
+static int capture_opendir(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = latency_now();
+    int res = (capture_layer.next->opendir != NULL) ? capture_layer.next->opendir(path, fi) : 0;
+    record_op(CAPTURE_OPENDIR, start, res, path, NULL, (res == 0) ? attach_file(fi) : 0, 0, 0);
+    return res;
+}
+
+static int capture_releasedir(const char *path, struct fuse_file_info *fi) {
+    struct capture_file *dir = (struct capture_file *)layer_file_detach(fi);
+    uint64_t start = latency_now();
+    int res = (capture_layer.next->releasedir != NULL) ? capture_layer.next->releasedir(path, fi) : 0;
+    record_op(CAPTURE_RELEASEDIR, start, res, path, NULL, dir->id, 0, 0);
+    free(dir);
+    return res;
+}
+
+// Operations on open files that are not recorded, the layer below gets its own handle
+
+static int capture_fsyncdir(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return capture_layer.next->fsyncdir(path, isdatasync, layer_file_lower(fi, &lower));
+}
+
+static int capture_posix_lock(const char *path, struct fuse_file_info *fi, int cmd, struct flock *lock) {
+    struct fuse_file_info lower;
+    return capture_layer.next->lock(path, layer_file_lower(fi, &lower), cmd, lock);
+}
+
+CAPTURE_OPERATION(setxattr, CAPTURE_SETXATTR, path, name, size, flags)
+CAPTURE_OPERATION(getxattr, CAPTURE_GETXATTR, path, name, size, 0)
+CAPTURE_OPERATION(listxattr, CAPTURE_LISTXATTR, path, NULL, size, 0)
+CAPTURE_OPERATION(removexattr, CAPTURE_REMOVEXATTR, path, name, 0, 0)
+
+int init_capture_layer(struct fuse_operations **originop, configuration data) {
+    const struct fuse_operations *originalfs_oper = *originop;
+    const capture_conf *config = &data.capture_config;
+    struct capture_header header;
+
+    if (capture_file != NULL) {
+        ERROR_MSG("The capture layer can only be used once\n");
+        return 1;
+    }
+    if (config->path == NULL) {
+        ERROR_MSG("[capture] has no path\n");
+        return 1;
+    }
+    capture_file = fopen(config->path, "w");
+    if (capture_file == NULL) {
+        ERROR_MSG("Could not open the capture file %s: %s\n", config->path, strerror(errno));
+        return 1;
+    }
+    batch_size = (config->buffer_size > 0) ? (size_t)config->buffer_size * 1024 : sizeof(struct capture_record);
+    flush_interval = (config->flush_interval > 0) ? (uint64_t)config->flush_interval * 1000000 : 0;
+    if (batch_size < sizeof(struct capture_record)) {
+        batch_size = sizeof(struct capture_record);
+    }
+    capture_paths = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    capture_start = latency_now();
+    capture_errors = 0;
+    last_file_id = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version = CAPTURE_VERSION;
+    header.record_size = sizeof(struct capture_record);
+    write_capture(&header, sizeof(header));
+
+    DEBUG_MSG("Going to capture the operations to %s\n", config->path);
+
+    capture_layer.next = originalfs_oper;
+    capture_layer.next_async = NULL;
+    capture_layer.private_data = NULL;
+
+    // operations of the layer below that are not captured are handed over, the missing ones stay unset.
+    // Opens are always captured, so that every open file and directory has an id.
+    capture_oper = *originalfs_oper;
+    LAYER_WRAP(capture, originalfs_oper, getattr);
+    LAYER_WRAP(capture, originalfs_oper, fgetattr);
+    LAYER_WRAP(capture, originalfs_oper, access);
+    LAYER_WRAP(capture, originalfs_oper, readlink);
+    LAYER_WRAP(capture, originalfs_oper, readdir);
+    LAYER_WRAP(capture, originalfs_oper, mknod);
+    LAYER_WRAP(capture, originalfs_oper, mkdir);
+    LAYER_WRAP(capture, originalfs_oper, symlink);
+    LAYER_WRAP(capture, originalfs_oper, unlink);
+    LAYER_WRAP(capture, originalfs_oper, rmdir);
+    LAYER_WRAP(capture, originalfs_oper, rename);
+    LAYER_WRAP(capture, originalfs_oper, link);
+    LAYER_WRAP(capture, originalfs_oper, chmod);
+    LAYER_WRAP(capture, originalfs_oper, chown);
+    LAYER_WRAP(capture, originalfs_oper, truncate);
+    LAYER_WRAP(capture, originalfs_oper, ftruncate);
+    LAYER_WRAP(capture, originalfs_oper, utimens);
+    LAYER_WRAP(capture, originalfs_oper, create);
+    capture_oper.open = capture_open;
+    LAYER_WRAP(capture, originalfs_oper, read);
+    LAYER_WRAP(capture, originalfs_oper, write);
+    LAYER_WRAP(capture, originalfs_oper, statfs);
+    LAYER_WRAP(capture, originalfs_oper, flush);
+    capture_oper.release = capture_release;
+    LAYER_WRAP(capture, originalfs_oper, fsync);
+    capture_oper.opendir = capture_opendir;
+    capture_oper.releasedir = capture_releasedir;
+    LAYER_WRAP(capture, originalfs_oper, fsyncdir);
+    capture_oper.lock = (originalfs_oper->lock != NULL) ? capture_posix_lock : NULL;
+    LAYER_WRAP(capture, originalfs_oper, setxattr);
+    LAYER_WRAP(capture, originalfs_oper, getxattr);
+    LAYER_WRAP(capture, originalfs_oper, listxattr);
+    LAYER_WRAP(capture, originalfs_oper, removexattr);
+
+    *originop = &capture_oper;
+
+    return 0;
+}
+
+int clean_capture_layer(configuration data) {
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file != NULL) {
+        // the threads still running have their last records buffered, they are freed when they exit
+        struct capture_thread *thread;
+        for (thread = capture_threads; thread != NULL; thread = thread->next) {
+            flush_thread(thread);
+        }
+        __atomic_add_fetch(&capture_generation, 1, __ATOMIC_RELEASE);
+        memset(thread_ids, 0, sizeof(thread_ids));
+        shared_ids = 0;
+
+        if (fclose(capture_file) != 0 || capture_errors > 0) {
+            ERROR_MSG("The capture file %s is incomplete\n", data.capture_config.path);
+        }
+        capture_file = NULL;
+        g_hash_table_destroy(capture_paths);
+        capture_paths = NULL;
+    }
+    pthread_mutex_unlock(&capture_lock);
+    return 0;
+}
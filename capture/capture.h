@@ -0,0 +1,132 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Capture layer, records every operation going through it to a binary file that capture_replay
+ * issues again against another stack (see benchmarks/capture_replay.c).
+ *
+ * The file starts with a struct capture_header followed by struct capture_record entries, in the
+ * byte order of the capturing machine. Each thread buffers its records and writes them in batches, so
+ * the records are sorted by thread but not across threads, the end of an operation (start plus
+ * duration) orders them. The path of a record is the id of a CAPTURE_PATH record written before it,
+ * which is followed by the path itself. Each successful open, create or opendir gets an id, counted
+ * from 1 and never reused, that identifies the file or directory in the records until its release.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+#define CAPTURE_MAGIC "SFSCAPT"
+#define CAPTURE_VERSION 3
+
+// thread ids, the ids of exited threads are reused
+#define CAPTURE_MAX_THREADS 1024
+
+// times of utimens set to UTIME_NOW and UTIME_OMIT
+#define CAPTURE_TIME_NOW (UINT64_MAX - 1)
+#define CAPTURE_TIME_OMIT UINT64_MAX
+
+// Arguments of each operation, the fields not listed are 0
+enum capture_op {
+    // defines path id, arg0 bytes long, the bytes of the path follow the record
+    CAPTURE_PATH = 0,
+    CAPTURE_GETATTR,
+    // file
+    CAPTURE_FGETATTR,
+    // arg0 mask
+    CAPTURE_ACCESS,
+    // arg0 size
+    CAPTURE_READLINK,
+    // directory, arg0 offset
+    CAPTURE_READDIR,
+    // arg0 mode, arg1 rdev
+    CAPTURE_MKNOD,
+    // arg0 mode
+    CAPTURE_MKDIR,
+    // path is the target, path2 the link
+    CAPTURE_SYMLINK,
+    CAPTURE_UNLINK,
+    CAPTURE_RMDIR,
+    // path2
+    CAPTURE_RENAME,
+    // path2
+    CAPTURE_LINK,
+    // arg0 mode
+    CAPTURE_CHMOD,
+    // arg0 uid, arg1 gid
+    CAPTURE_CHOWN,
+    // arg0 size
+    CAPTURE_TRUNCATE,
+    // file, arg0 size
+    CAPTURE_FTRUNCATE,
+    // arg0 access and arg1 modification time, in nanoseconds
+    CAPTURE_UTIMENS,
+    // file opened, arg0 mode, arg1 flags
+    CAPTURE_CREATE,
+    // file opened, arg1 flags
+    CAPTURE_OPEN,
+    // file, arg0 offset, arg1 size
+    CAPTURE_READ,
+    // file, arg0 offset, arg1 size
+    CAPTURE_WRITE,
+    CAPTURE_STATFS,
+    // file
+    CAPTURE_FLUSH,
+    // file
+    CAPTURE_RELEASE,
+    // file, arg0 isdatasync
+    CAPTURE_FSYNC,
+    // directory opened
+    CAPTURE_OPENDIR,
+    // directory
+    CAPTURE_RELEASEDIR,
+    // path2 the name of the attribute, arg0 size of the value, arg1 flags
+    CAPTURE_SETXATTR,
+    // path2 the name of the attribute, arg0 size
+    CAPTURE_GETXATTR,
+    // arg0 size
+    CAPTURE_LISTXATTR,
+    // path2 the name of the attribute
+    CAPTURE_REMOVEXATTR,
+    CAPTURE_OPS
+};
+
+struct capture_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct capture_record {
+    // nanoseconds since the capture started
+    uint64_t start;
+    uint64_t duration;
+    // id of the open of the file or directory, 0 for the operations on paths and the failed opens
+    uint64_t file;
+    // arguments of the operation, see enum capture_op
+    uint64_t arg0;
+    uint64_t arg1;
+    uint32_t path;
+    // second path of rename, link and symlink (the destination), name of the extended attributes
+    uint32_t path2;
+    // what the layer below returned
+    int32_t result;
+    uint16_t op;
+    // capturing thread, operations of a thread were issued one after the other
+    uint16_t thread;
+};
+
+// Name of op, e.g. "read"
+const char *capture_op_name(int op);
+
+int init_capture_layer(struct fuse_operations **fuse_operations, configuration data);
+int clean_capture_layer(configuration data);
+
+#endif /* __CAPTURE_H__ */
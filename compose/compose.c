@@ -0,0 +1,219 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "compose.h"
+#include "../alignfuse.h"
+#include "../sfuse.h"
+#include "../multi_loopback.h"
+#include "../nopfuse.h"
+#include "../capture/capture.h"
+#include "../router/router.h"
+#include "../plugins/plugin.h"
+
+// Plugin of the layer id, NULL if it is not a plugin layer
+static const struct sfs_plugin* layer_plugin(int layer, configuration config,
+                                             const struct plugin_configuration** pconfig) {
+    struct plugin_configuration* plugin = g_slist_nth_data(config.plugins, layer - PLUGIN_LAYER);
+    if (layer < PLUGIN_LAYER || plugin == NULL) {
+        return NULL;
+    }
+    return find_plugin(plugin->name, SFS_PLUGIN_LAYER, &config, pconfig);
+}
+
+static int init_plugin_layer(struct fuse_operations** operations, int layer, configuration config) {
+    const struct plugin_configuration* pconfig;
+    const struct sfs_plugin* plugin = layer_plugin(layer, config, &pconfig);
+
+    if (plugin == NULL || plugin->init_layer(operations, &config, pconfig) != 0) {
+        return 1;
+    }
+    if ((plugin->capabilities & SFS_CAP_ASYNC) && find_async_operations(*operations) == NULL) {
+        ERROR_MSG("Layer %s declares asynchronous operations but did not register them\n", pconfig->name);
+    }
+    return 0;
+}
+
+int compose_layers(struct fuse_operations** operations, configuration config) {
+    DEBUG_MSG("Going to compose layers\n");
+
+    if (load_plugins(config) != 0) {
+        return 1;
+    }
+
+    GSList* current = config.layers;
+    do {
+        // DEBUG_MSG("Going to read layer number %p\n", current);
+
+        int layer = GPOINTER_TO_INT(current->data);
+        int res;
+        DEBUG_MSG("Going to init driver %d\n", layer);
+
+        // the context and caches of a layer are kept per layer type
+        if (g_slist_find(current->next, current->data) != NULL) {
+            ERROR_MSG("Layer %d can only appear once in the stack\n", layer);
+            return 1;
+        }
+
+        switch (layer) {
+            case BLOCK_ALIGN:
+                res = init_align_driver(operations, config);
+                break;
+            case SFUSE:
+                res = init_sfuse_driver(operations, config);
+                break;
+            case MULTI_LOOPBACK:
+                res = init_multi_loopback_driver(operations, config);
+                break;
+            case NOPFUSE:
+                res = init_nop_layer(operations, config);
+                break;
+            case CAPTURE:
+                res = init_capture_layer(operations, config);
+                break;
+            default:
+                res = init_plugin_layer(operations, layer, config);
+                break;
+        }
+        if (res != 0) {
+            ERROR_MSG("Could not init layer %d\n", layer);
+            return 1;
+        }
+        current = current->next;
+
+    } while (current != NULL);
+
+    return 0;
+}
+
+// Built-in layers are compared by id and plugin layers by name
+static gint compare_layers(gconstpointer a, gconstpointer b) {
+    if (GPOINTER_TO_SIZE(a) < PLUGIN_LAYER || GPOINTER_TO_SIZE(b) < PLUGIN_LAYER) {
+        return a != b;
+    }
+    return strcmp(a, b);
+}
+
+// Composes the stacks of config.stacks below the router. Only multi_loopback keeps a context per
+// stack, the other layers keep theirs per layer type and can only be used by one stack (see the
+// [stacks] section of the README).
+int compose_stacks(struct fuse_operations** operations, configuration config) {
+    GSList* current;
+    GSList* used_layers = NULL;
+
+    for (current = config.stacks; current != NULL; current = current->next) {
+        struct stack_configuration* stack = current->data;
+        struct fuse_operations* stack_operations;
+        GSList* layer;
+
+        if (stack->config->layers == NULL) {
+            ERROR_MSG("Stack %s has no layers\n", stack->prefix);
+            g_slist_free(used_layers);
+            return 1;
+        }
+        for (layer = stack->config->layers; layer != NULL; layer = layer->next) {
+            int id = GPOINTER_TO_INT(layer->data);
+            gpointer key = layer->data;
+
+            if (id == MULTI_LOOPBACK) {
+                continue;
+            }
+            // the ids of plugin layers depend on the order of the plugins of each stack
+            if (id >= PLUGIN_LAYER) {
+                key = ((struct plugin_configuration*)g_slist_nth_data(stack->config->plugins, id - PLUGIN_LAYER))->name;
+            }
+            if (g_slist_find_custom(used_layers, key, compare_layers) != NULL) {
+                ERROR_MSG("Layer %d of stack %s is already used by another stack, only multi_loopback can be used by several stacks\n",
+                          id, stack->prefix);
+                g_slist_free(used_layers);
+                return 1;
+            }
+            used_layers = g_slist_prepend(used_layers, key);
+        }
+
+        DEBUG_MSG("Going to compose stack %s\n", stack->prefix);
+        if (compose_layers(&stack_operations, *stack->config) != 0 ||
+            router_add_stack(stack->prefix, stack_operations) != 0) {
+            g_slist_free(used_layers);
+            return 1;
+        }
+    }
+    g_slist_free(used_layers);
+
+    return init_router(operations);
+}
+
+// The kernel writeback cache merges writes into requests of any offset and size, which the stack
+// handles when block_align aligns them on top of it or when no layer works on blocks
+int handles_unaligned_writes(configuration config) {
+    guint nlayers = g_slist_length(config.layers);
+    int top = GPOINTER_TO_INT(g_slist_nth_data(config.layers, nlayers - 1));
+
+    // the capture layer hands the requests over unchanged
+    if (top == CAPTURE && nlayers > 1) {
+        top = GPOINTER_TO_INT(g_slist_nth_data(config.layers, nlayers - 2));
+    }
+
+    if (top == BLOCK_ALIGN) {
+        return config.block_config.mode == BLOCK;
+    }
+    return g_slist_find(config.layers, GINT_TO_POINTER(SFUSE)) == NULL &&
+           g_slist_find(config.layers, GINT_TO_POINTER(BLOCK_ALIGN)) == NULL &&
+           config.m_loop_config.mode != MULTI_LOOP_ERASURE;
+}
+
+// Writeback cache of a configuration hosting stacks, all of them must handle the merged writes
+int stacks_handle_unaligned_writes(configuration config) {
+    GSList* current;
+    for (current = config.stacks; current != NULL; current = current->next) {
+        if (!handles_unaligned_writes(*((struct stack_configuration*)current->data)->config)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int clean_layers(configuration config) {
+    DEBUG_MSG("Going to clean layers\n");
+
+    GSList* current = config.layers;
+    do {
+        int layer = GPOINTER_TO_INT(current->data);
+        DEBUG_MSG("Going to clean drivers %d\n", layer);
+
+        switch (layer) {
+            case BLOCK_ALIGN:
+                clean_align_driver(config);
+                break;
+            case SFUSE:
+                clean_sfuse_driver(config);
+                break;
+            case MULTI_LOOPBACK:
+                clean_multi_loopback_driver(config);
+                break;
+            case NOPFUSE:
+                clean_nop_layer(config);
+                break;
+            case CAPTURE:
+                clean_capture_layer(config);
+                break;
+            default:
+                // plugins are cleaned when they are unloaded
+                break;
+        }
+        current = current->next;
+
+    } while (current != NULL);
+    return 0;
+}
+
+int clean_stacks(configuration config) {
+    GSList* current;
+    for (current = config.stacks; current != NULL; current = current->next) {
+        clean_layers(*((struct stack_configuration*)current->data)->config);
+    }
+    clean_router();
+    return 0;
+}
@@ -0,0 +1,31 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Composition of the layers of a configuration into the fuse_operations served by SafeFS.
+ * Used by the mount and by the benchmarks that drive a stack without FUSE.
+ */
+
+#ifndef __COMPOSE_H__
+#define __COMPOSE_H__
+
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+// Initializes the layers of config.layers, bottom first, *operations is set to the top layer
+int compose_layers(struct fuse_operations** operations, configuration config);
+
+// Composes the stacks of config.stacks below the router
+int compose_stacks(struct fuse_operations** operations, configuration config);
+
+// The stack handles writes of any offset and size, as merged by the kernel writeback cache
+int handles_unaligned_writes(configuration config);
+int stacks_handle_unaligned_writes(configuration config);
+
+int clean_layers(configuration config);
+int clean_stacks(configuration config);
+
+#endif /* __COMPOSE_H__ */
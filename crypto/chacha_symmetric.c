@@ -0,0 +1,124 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "chacha_symmetric.h"
+#include <openssl/sha.h>
+
+unsigned char CHACHA_KEY[AEAD_KEY_SIZE];
+
+int chacha_supported() { return openssl_aead_supported(); }
+
+int chacha_init(char* key) {
+    if (key == NULL || !chacha_supported()) {
+        return -1;
+    }
+
+    // ChaCha20 takes a 256 bit key whatever the configured key_size, it is derived from the configured key
+    SHA256((unsigned char*)key, strlen(key), CHACHA_KEY);
+
+    return 0;
+}
+
+// Identity of the file followed by the big-endian index of the block
+#define CHACHA_AAD_SIZE (FILE_ID_SIZE + 8)
+
+// The tag of a block covers its file and position, a block copied elsewhere does not authenticate
+static void block_aad(const struct key_info* info, unsigned char* aad) {
+    uint64_t block = info->offset / chacha_get_cyphered_block_size(info->block_size);
+    int i;
+
+    if (info->file_id != NULL) {
+        memcpy(aad, info->file_id, FILE_ID_SIZE);
+    } else {
+        memset(aad, 0, FILE_ID_SIZE);
+    }
+    for (i = 0; i < 8; i++) {
+        aad[FILE_ID_SIZE + i] = block >> (56 - 8 * i);
+    }
+}
+
+// size here comes without pad
+int chacha_encode(unsigned char* dest, const unsigned char* src, int size, void* ident) {
+    unsigned char* nonce = &dest[size + AEAD_TAG_SIZE];
+    unsigned char aad[CHACHA_AAD_SIZE];
+
+    if (RAND_bytes(nonce, AEAD_NONCE_SIZE) != 1) {
+        ERROR_MSG("Could not generate a nonce\n");
+        return -1;
+    }
+
+    block_aad(ident, aad);
+    int res = openssl_aead_encode(CHACHA_KEY, nonce, aad, CHACHA_AAD_SIZE, dest, src, size, &dest[size]);
+    if (res < 0) {
+        return -1;
+    }
+
+    DEBUG_MSG("Inside chacha encoding %d, returning size %d\n", size, res + CHACHA_PADSIZE);
+
+    return res + CHACHA_PADSIZE;
+}
+
+// size here comes with pad
+int chacha_decode(unsigned char* dest, const unsigned char* src, int size, void* ident) {
+    int size_to_decode = size - CHACHA_PADSIZE;
+    unsigned char aad[CHACHA_AAD_SIZE];
+
+    if (size_to_decode < 0) {
+        ERROR_MSG("Ciphered block of %d bytes is too short\n", size);
+        return -1;
+    }
+
+    block_aad(ident, aad);
+    int res = openssl_aead_decode(CHACHA_KEY, &src[size_to_decode + AEAD_TAG_SIZE], aad, CHACHA_AAD_SIZE, dest, src,
+                                  size_to_decode, &src[size_to_decode]);
+    if (res < 0) {
+        ERROR_MSG("Ciphered block of %d bytes failed authentication\n", size);
+        return -1;
+    }
+
+    DEBUG_MSG("Inside chacha decoding %d, returning res %d\n", size_to_decode, res);
+
+    return res;
+}
+
+int chacha_clean() { return 0; }
+
+// The stream cipher does not pad blocks, so the size is known without reading the last block
+off_t chacha_get_file_size(const char* path, off_t original_size, struct fuse_file_info* fi,
+                           const struct fuse_operations *nextlayer, int block_size) {
+    uint64_t nr_complete_blocks = original_size / (block_size + CHACHA_PADSIZE);
+    int last_incomplete_block_size = original_size % (block_size + CHACHA_PADSIZE);
+    int last_block_real_size = (last_incomplete_block_size > CHACHA_PADSIZE)
+                                   ? last_incomplete_block_size - CHACHA_PADSIZE
+                                   : 0;
+
+    DEBUG_MSG("size for file %s , last block real size is %d and file real size is %lu.\n", path,
+              last_block_real_size, nr_complete_blocks * block_size + last_block_real_size);
+
+    return nr_complete_blocks * block_size + last_block_real_size;
+}
+
+int chacha_get_cyphered_block_size(int origin_size) { return origin_size + CHACHA_PADSIZE; }
+
+uint64_t chacha_get_cyphered_block_offset(uint64_t origin_offset, int block_size) {
+    uint64_t blockid = origin_offset / block_size;
+
+    return blockid * (block_size + CHACHA_PADSIZE);
+}
+
+off_t chacha_get_truncate_size(off_t size, int block_size) {
+    uint64_t nr_blocks = size / block_size;
+    uint64_t extra_bytes = size % block_size;
+
+    off_t truncate_size = nr_blocks * (block_size + CHACHA_PADSIZE);
+
+    if (extra_bytes > 0) {
+        truncate_size += chacha_get_cyphered_block_size(extra_bytes);
+    }
+
+    DEBUG_MSG("truncating file sfuse to %lu\n", truncate_size);
+    return truncate_size;
+}
@@ -0,0 +1,42 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#ifndef __CHACHA_SYMMETRIC_H__
+#define __CHACHA_SYMMETRIC_H__
+
+#include "openssl/aead.h"
+#include "../logdef.h"
+#include "../layers_def.h"
+#include <fuse.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "../SFSConfig.h"
+
+// Each ciphered block is followed by its Poly1305 tag and the nonce used to encrypt it
+#define CHACHA_PADSIZE (AEAD_TAG_SIZE + AEAD_NONCE_SIZE)
+
+int chacha_supported();
+
+int chacha_init(char* key);
+
+int chacha_encode(unsigned char* dest, const unsigned char* src, int size, void* ident);
+
+int chacha_decode(unsigned char* dest, const unsigned char* src, int size, void* ident);
+
+off_t chacha_get_file_size(const char* path, off_t origin_size, struct fuse_file_info* fi,
+                           const struct fuse_operations *nextlayer, int block_size);
+
+int chacha_get_cyphered_block_size(int origin_size);
+
+uint64_t chacha_get_cyphered_block_offset(uint64_t origin_size, int block_size);
+
+off_t chacha_get_truncate_size(off_t size, int block_size);
+
+int chacha_clean();
+
+#endif
@@ -0,0 +1,33 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+
+int cpu_has_aes_instructions() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ecx & bit_AES) != 0;
+}
+
+#elif defined(__aarch64__) && defined(__linux__)
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+int cpu_has_aes_instructions() { return (getauxval(AT_HWCAP) & HWCAP_AES) != 0; }
+
+#else
+
+int cpu_has_aes_instructions() { return 0; }
+
+#endif
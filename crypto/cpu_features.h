@@ -0,0 +1,16 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#ifndef __CPU_FEATURES_H__
+#define __CPU_FEATURES_H__
+
+/**
+ * Checks if the processor has AES instructions (AES-NI on x86, the ARMv8 crypto extensions on aarch64)
+ * @return 1 if AES is hardware accelerated, 0 otherwise
+ */
+int cpu_has_aes_instructions();
+
+#endif /* __CPU_FEATURES_H__ */
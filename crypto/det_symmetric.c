@@ -6,15 +6,33 @@
 
 
 #include "det_symmetric.h"
+#include <openssl/sha.h>
 
 unsigned char* iv = NULL;
-int DET_BLOCKSIZE = 0;
 
-int det_init(char* key, unsigned char* arg_iv, int key_size, block_align_config config) {
-    DET_BLOCKSIZE = config.block_size;
+// When set, each block is encrypted with an IV derived from its path and index instead of iv
+int DET_DERIVE_IVS = 0;
+// Key of the IV derivation, kept apart from the encryption key
+unsigned char DET_IV_KEY[DERIVED_IV_SIZE];
 
+#define DET_IV_KEY_LABEL "safefs det iv"
+
+int det_init(char* key, unsigned char* arg_iv, int key_size, int derive_ivs) {
     iv = arg_iv;
 
+    DET_DERIVE_IVS = derive_ivs;
+    if (DET_DERIVE_IVS) {
+        int label_size = strlen(DET_IV_KEY_LABEL);
+        int key_len = strlen(key);
+        unsigned char key_material[label_size + key_len];
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+
+        memcpy(key_material, DET_IV_KEY_LABEL, label_size);
+        memcpy(key_material + label_size, key, key_len);
+        SHA256(key_material, label_size + key_len, digest);
+        memcpy(DET_IV_KEY, digest, DERIVED_IV_SIZE);
+    }
+
     int init_sym_val = openssl_init(key, key_size);
 
     if (init_sym_val < 0) {
@@ -24,13 +42,61 @@ int det_init(char* key, unsigned char* arg_iv, int key_size, block_align_config
     }
 }
 
+/*
+ * IV of block number first_block + i is AES-ECB(DET_IV_KEY, H(path)[0..7] || i), so it never has to
+ * be stored. All the IVs are encrypted with a single call.
+ */
+int det_derive_ivs(const char* path, uint64_t first_block, int nblocks, unsigned char* ivs) {
+    unsigned char path_digest[SHA256_DIGEST_LENGTH];
+    int i, j;
+
+    SHA256((const unsigned char*)path, strlen(path), path_digest);
+
+    for (i = 0; i < nblocks; i++) {
+        unsigned char* block_iv = &ivs[i * DERIVED_IV_SIZE];
+        uint64_t block = first_block + i;
+
+        memcpy(block_iv, path_digest, 8);
+        for (j = 0; j < 8; j++) {
+            block_iv[15 - j] = (block >> (8 * j)) & 0xff;
+        }
+    }
+
+    return openssl_ecb_encode(DET_IV_KEY, ivs, ivs, nblocks);
+}
+
+// IV to use for the block described by ident, derived_iv is used as storage if it must be computed
+static unsigned char* det_block_iv(void* ident, unsigned char* derived_iv) {
+    struct key_info* info = (struct key_info*)ident;
+
+    if (!DET_DERIVE_IVS) {
+        return iv;
+    }
+    if (info == NULL) {
+        ERROR_MSG("deterministic driver called without the block to derive its IV\n");
+        return NULL;
+    }
+    if (info->iv != NULL) {
+        return (unsigned char*)info->iv;
+    }
+
+    det_derive_ivs(info->path, info->offset / (info->block_size + DET_PADSIZE), 1, derived_iv);
+    return derived_iv;
+}
+
 // size here comes without pad
 int det_encode(unsigned char* dest, const unsigned char* src, int size, void* ident) {
     DEBUG_MSG("Inside deterministic encoding %d\n", size);
 
+    unsigned char derived_iv[DERIVED_IV_SIZE];
+    unsigned char* block_iv = det_block_iv(ident, derived_iv);
+    if (block_iv == NULL) {
+        return -1;
+    }
+
     unsigned char* cypherbuffer = malloc(size + DET_PADSIZE);
 
-    int res = openssl_encode(iv, cypherbuffer, src, size);
+    int res = openssl_encode(block_iv, cypherbuffer, src, size);
 
     memcpy(dest, cypherbuffer, res);
 
@@ -43,8 +109,14 @@ int det_encode(unsigned char* dest, const unsigned char* src, int size, void* id
 
 // size here comes with pad
 int det_decode(unsigned char* dest, const unsigned char* src, int size, void* ident) {
+    unsigned char derived_iv[DERIVED_IV_SIZE];
+    unsigned char* block_iv = det_block_iv(ident, derived_iv);
+    if (block_iv == NULL) {
+        return -1;
+    }
+
     unsigned char* plainbuffer = malloc(size);
-    int res = openssl_decode(iv, plainbuffer, src, size);
+    int res = openssl_decode(block_iv, plainbuffer, src, size);
     memcpy(dest, plainbuffer, res);
     free(plainbuffer);
 
@@ -55,9 +127,9 @@ int det_decode(unsigned char* dest, const unsigned char* src, int size, void* id
 int det_clean() { return openssl_clean(); }
 
 off_t det_get_file_size(const char* path, off_t original_size, struct fuse_file_info* fi_in,
-                        struct fuse_operations nextlayer) {
-    uint64_t nr_complete_blocks = original_size / (DET_BLOCKSIZE + DET_PADSIZE);
-    int last_incomplete_block_size = original_size % (DET_BLOCKSIZE + DET_PADSIZE);
+                        const struct fuse_operations *nextlayer, int block_size) {
+    uint64_t nr_complete_blocks = original_size / (block_size + DET_PADSIZE);
+    int last_incomplete_block_size = original_size % (block_size + DET_PADSIZE);
     uint64_t last_block_address = original_size - last_incomplete_block_size;
     int last_block_real_size = 0;
 
@@ -80,7 +152,7 @@ off_t det_get_file_size(const char* path, off_t original_size, struct fuse_file_
 
             // TODO: add -D_GNU_SOURCE for O_LARGEFILE
             fi->flags = O_RDONLY;
-            res = nextlayer.open(path, fi);
+            res = nextlayer->open(path, fi);
             if (res == -1) {
                 DEBUG_MSG("Failed open %s original size is %lu last block size is %d, last_block_address is %llu\n",
                           path, original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -92,7 +164,7 @@ off_t det_get_file_size(const char* path, off_t original_size, struct fuse_file_
                   original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
 
         // read the block and decode to understand the number of bytes actually written
-        res = nextlayer.read(path, aux_cyphered_buf, last_incomplete_block_size, last_block_address, fi);
+        res = nextlayer->read(path, aux_cyphered_buf, last_incomplete_block_size, last_block_address, fi);
         if (res < last_incomplete_block_size) {
             DEBUG_MSG("Failed read %s original size is %lu last block size is %d, last_block_address is %llu\n", path,
                       original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -100,7 +172,7 @@ off_t det_get_file_size(const char* path, off_t original_size, struct fuse_file_
         }
 
         if (fi_in == NULL) {
-            res = nextlayer.release(path, fi);
+            res = nextlayer->release(path, fi);
             if (res == -1) {
                 DEBUG_MSG("Failed close %s original size is %lu last block size is %d, last_block_address is %llu\n",
                           path, original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -112,14 +184,23 @@ off_t det_get_file_size(const char* path, off_t original_size, struct fuse_file_
         DEBUG_MSG("bedore decode read %s original size is %lu last block size is %d, last_block_address is %llu\n",
                   path, original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
 
+        struct key_info info;
+        info.path = path;
+        info.offset = last_block_address;
+        info.iv = NULL;
+        info.block_size = block_size;
+
         last_block_real_size =
-            det_decode(aux_plain_buf, (unsigned char*)aux_cyphered_buf, last_incomplete_block_size, NULL);
+            det_decode(aux_plain_buf, (unsigned char*)aux_cyphered_buf, last_incomplete_block_size, &info);
+        if (last_block_real_size < 0) {
+            return -1;
+        }
     }
 
     DEBUG_MSG("size for file %s , last block real size is %d and file real size is %lu.\n", path, last_block_real_size,
-              nr_complete_blocks * (DET_BLOCKSIZE) + last_block_real_size);
+              nr_complete_blocks * (block_size) + last_block_real_size);
 
-    return nr_complete_blocks * DET_BLOCKSIZE + last_block_real_size;
+    return nr_complete_blocks * block_size + last_block_real_size;
 }
 
 int det_get_cyphered_block_size(int origin_size) {
@@ -128,19 +209,19 @@ int det_get_cyphered_block_size(int origin_size) {
     return offset_block_aligned + DET_PADSIZE;
 }
 
-uint64_t det_get_cyphered_block_offset(uint64_t origin_offset) {
-    DEBUG_MSG("DET_BLOCKSIZE is  %d.\n", DET_BLOCKSIZE);
+uint64_t det_get_cyphered_block_offset(uint64_t origin_offset, int block_size) {
+    DEBUG_MSG("Block size is  %d.\n", block_size);
 
-    uint64_t blockid = origin_offset / DET_BLOCKSIZE;
+    uint64_t blockid = origin_offset / block_size;
 
-    return blockid * (DET_BLOCKSIZE + DET_PADSIZE);
+    return blockid * (block_size + DET_PADSIZE);
 }
 
-off_t det_get_truncate_size(off_t size) {
-    uint64_t nr_blocks = size / DET_BLOCKSIZE;
-    uint64_t extra_bytes = size % DET_BLOCKSIZE;
+off_t det_get_truncate_size(off_t size, int block_size) {
+    uint64_t nr_blocks = size / block_size;
+    uint64_t extra_bytes = size % block_size;
 
-    off_t truncate_size = nr_blocks * (DET_BLOCKSIZE + DET_PADSIZE);
+    off_t truncate_size = nr_blocks * (block_size + DET_PADSIZE);
 
     if (extra_bytes > 0) {
         truncate_size += det_get_cyphered_block_size(extra_bytes);
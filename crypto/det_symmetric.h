@@ -19,21 +19,22 @@
 
 #define DET_PADSIZE 16
 
-int det_init(char* key, unsigned char* arg_iv, int block_size, block_align_config config);
+int det_init(char* key, unsigned char* arg_iv, int key_size, int derive_ivs);
 
 int det_encode(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 int det_decode(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 off_t det_get_file_size(const char* path, off_t origin_size, struct fuse_file_info* fi,
-                        struct fuse_operations nextlayer);
+                        const struct fuse_operations *nextlayer, int block_size);
 
 int det_get_cyphered_block_size(int origin_size);
 
-uint64_t det_get_cyphered_block_offset(uint64_t origin_size);
+uint64_t det_get_cyphered_block_offset(uint64_t origin_size, int block_size);
 
-off_t det_get_truncate_size(off_t size);
+off_t det_get_truncate_size(off_t size, int block_size);
 
+int det_derive_ivs(const char* path, uint64_t first_block, int nblocks, unsigned char* ivs);
 int det_clean();
 
 #endif
@@ -28,12 +28,12 @@ int nop_decode(unsigned char* dest, const unsigned char* src, int size, void* id
 }
 
 off_t nop_get_file_size(const char* path, off_t origin_size, struct fuse_file_info* fi,
-                        struct fuse_operations nextlayer) {
+                        const struct fuse_operations *nextlayer, int block_size) {
     return origin_size;
 }
 
 int nop_get_cyphered_block_size(int origin_size) { return origin_size; }
 
-uint64_t nop_get_cyphered_block_offset(uint64_t origin_offset) { return origin_offset; }
+uint64_t nop_get_cyphered_block_offset(uint64_t origin_offset, int block_size) { return origin_offset; }
 
-off_t nop_get_truncate_size(off_t size) { return size; }
+off_t nop_get_truncate_size(off_t size, int block_size) { return size; }
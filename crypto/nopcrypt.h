@@ -21,11 +21,11 @@ int nop_encode(unsigned char* dest, const unsigned char* src, int size, void* id
 int nop_decode(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 off_t nop_get_file_size(const char* path, off_t origin_size, struct fuse_file_info* fi,
-                        struct fuse_operations nextlayer);
+                        const struct fuse_operations *nextlayer, int block_size);
 
 int nop_get_cyphered_block_size(int origin_size);
-uint64_t nop_get_cyphered_block_offset(uint64_t origin_size);
+uint64_t nop_get_cyphered_block_offset(uint64_t origin_size, int block_size);
 
-off_t nop_get_truncate_size(off_t size);
+off_t nop_get_truncate_size(off_t size, int block_size);
 
 #endif /* __NOCRYPT_H__ */
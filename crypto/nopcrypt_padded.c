@@ -8,10 +8,6 @@
 
 #include <string.h>
 
-int NOP_BLOCKSIZE = 0;
-
-void nop_padded_init(block_align_config config) { NOP_BLOCKSIZE = config.block_size; }
-
 // Size here comes without pad
 int nop_encode_padded(unsigned char* dest, const unsigned char* src, int size, void* ident) {
     DEBUG_MSG("Entering nop_encode function.\n");
@@ -35,11 +31,11 @@ int nop_decode_padded(unsigned char* dest, const unsigned char* src, int size, v
 }
 
 off_t nop_get_file_size_padded(const char* path, off_t original_size, struct fuse_file_info* fi,
-                               struct fuse_operations nextlayer) {
+                               const struct fuse_operations *nextlayer, int block_size) {
     DEBUG_MSG("Got size %s %lu.\n", path, original_size);
 
-    uint64_t nrblocks = original_size / (NOP_BLOCKSIZE + NOP_PADSIZE);
-    if (original_size % (NOP_BLOCKSIZE + NOP_PADSIZE) > 0) {
+    uint64_t nrblocks = original_size / (block_size + NOP_PADSIZE);
+    if (original_size % (block_size + NOP_PADSIZE) > 0) {
         nrblocks += 1;
     }
 
@@ -50,19 +46,19 @@ off_t nop_get_file_size_padded(const char* path, off_t original_size, struct fus
 
 int nop_get_cyphered_block_size_padded(int origin_size) { return origin_size + NOP_PADSIZE; }
 
-uint64_t nop_get_cyphered_block_offset_padded(uint64_t origin_offset) {
-    DEBUG_MSG("NOP_BLOCKSIZE is  %d.\n", NOP_BLOCKSIZE);
+uint64_t nop_get_cyphered_block_offset_padded(uint64_t origin_offset, int block_size) {
+    DEBUG_MSG("Block size is  %d.\n", block_size);
 
-    uint64_t blockid = origin_offset / NOP_BLOCKSIZE;
+    uint64_t blockid = origin_offset / block_size;
 
-    return blockid * (NOP_BLOCKSIZE + NOP_PADSIZE);
+    return blockid * (block_size + NOP_PADSIZE);
 }
 
-off_t nop_get_truncate_size_padded(off_t size) {
-    uint64_t nr_blocks = size / NOP_BLOCKSIZE;
-    uint64_t extra_bytes = size % NOP_BLOCKSIZE;
+off_t nop_get_truncate_size_padded(off_t size, int block_size) {
+    uint64_t nr_blocks = size / block_size;
+    uint64_t extra_bytes = size % block_size;
 
-    off_t truncate_size = nr_blocks * (NOP_BLOCKSIZE + NOP_PADSIZE);
+    off_t truncate_size = nr_blocks * (block_size + NOP_PADSIZE);
 
     if (extra_bytes > 0) {
         truncate_size += nop_get_cyphered_block_size_padded(extra_bytes);
@@ -24,14 +24,12 @@ int nop_encode_padded(unsigned char* dest, const unsigned char* src, int size, v
 int nop_decode_padded(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 off_t nop_get_file_size_padded(const char* path, off_t origin_size, struct fuse_file_info* fi,
-                               struct fuse_operations nextlayer);
+                               const struct fuse_operations *nextlayer, int block_size);
 
 int nop_get_cyphered_block_size_padded(int origin_size);
 
-uint64_t nop_get_cyphered_block_offset_padded(uint64_t origin_size);
+uint64_t nop_get_cyphered_block_offset_padded(uint64_t origin_size, int block_size);
 
-void nop_padded_init(block_align_config config);
-
-off_t nop_get_truncate_size_padded(off_t size);
+off_t nop_get_truncate_size_padded(off_t size, int block_size);
 
 #endif /* __NOCRYPT_PADDED_H__ */
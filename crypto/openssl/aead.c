@@ -0,0 +1,98 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "aead.h"
+
+#ifdef HAVE_CHACHA20_POLY1305
+
+int openssl_aead_supported() { return 1; }
+
+int openssl_aead_encode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx;
+    int len;
+    int ciphertext_len;
+
+    if (!(ctx = EVP_CIPHER_CTX_new())) return -1;
+
+    if (1 != EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, AEAD_NONCE_SIZE, NULL) ||
+        1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    /* The additional data goes in before the block, without output */
+    if ((aad_size > 0 && 1 != EVP_EncryptUpdate(ctx, NULL, &len, aad, aad_size)) ||
+        1 != EVP_EncryptUpdate(ctx, dest, &len, src, size)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+    ciphertext_len = len;
+
+    /* ChaCha20 is a stream cipher, Final does not add any byte but computes the tag */
+    if (1 != EVP_EncryptFinal_ex(ctx, dest + len, &len) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_SIZE, tag)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+    ciphertext_len += len;
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return ciphertext_len;
+}
+
+int openssl_aead_decode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, const unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx;
+    int len;
+    int plaintext_len;
+
+    if (!(ctx = EVP_CIPHER_CTX_new())) return -1;
+
+    if (1 != EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL) ||
+        1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, AEAD_NONCE_SIZE, NULL) ||
+        1 != EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    if ((aad_size > 0 && 1 != EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_size)) ||
+        1 != EVP_DecryptUpdate(ctx, dest, &len, src, size)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+    plaintext_len = len;
+
+    /* The expected tag must be set before Final, which fails if the block was tampered with */
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_SIZE, (void*)tag) ||
+        EVP_DecryptFinal_ex(ctx, dest + len, &len) <= 0) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+    plaintext_len += len;
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return plaintext_len;
+}
+
+#else
+
+int openssl_aead_supported() { return 0; }
+
+int openssl_aead_encode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, unsigned char* tag) {
+    return -1;
+}
+
+int openssl_aead_decode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, const unsigned char* tag) {
+    return -1;
+}
+
+#endif /* HAVE_CHACHA20_POLY1305 */
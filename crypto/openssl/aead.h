@@ -0,0 +1,50 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#ifndef __OPENSSL_AEAD_H__
+#define __OPENSSL_AEAD_H__
+
+#include <openssl/opensslv.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include "../../logdef.h"
+
+// ChaCha20-Poly1305 is only available from OpenSSL 1.1.0 onwards
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+#define HAVE_CHACHA20_POLY1305
+#endif
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+
+/**
+ * Tells if the linked OpenSSL provides ChaCha20-Poly1305
+ * @return 1 if it does, 0 otherwise
+ */
+int openssl_aead_supported();
+
+/**
+ * Encrypts and authenticates size bytes of src with ChaCha20-Poly1305
+ * @param key Key of AEAD_KEY_SIZE bytes
+ * @param nonce Nonce of AEAD_NONCE_SIZE bytes, it must never be reused with the same key
+ * @param aad Additional data authenticated with the block but not stored, aad_size bytes
+ * @param tag Destination for the AEAD_TAG_SIZE bytes of the authentication tag
+ * @return The number of bytes written in dest (always size) or -1 on error
+ */
+int openssl_aead_encode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, unsigned char* tag);
+
+/**
+ * Decrypts size bytes of src and checks them and aad against the authentication tag
+ * @return The number of bytes written in dest or -1 if the block does not authenticate
+ */
+int openssl_aead_decode(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, int aad_size,
+                        unsigned char* dest, const unsigned char* src, int size, const unsigned char* tag);
+
+#endif /* __OPENSSL_AEAD_H__ */
@@ -138,4 +138,24 @@ int openssl_decode(unsigned char* iv, unsigned char* dest, const unsigned char*
     return plaintext_len;
 }
 
+/*
+ * Encrypts nblocks AES blocks (16 bytes each) with AES-128-ECB and the given 16 byte key. The blocks
+ * are independent, so passing them in a single call lets OpenSSL pipeline them.
+ */
+int openssl_ecb_encode(const unsigned char* key, unsigned char* dest, const unsigned char* src, int nblocks) {
+    EVP_CIPHER_CTX* ctx;
+    int len;
+
+    if (!(ctx = EVP_CIPHER_CTX_new())) handleErrors();
+
+    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, key, NULL)) handleErrors();
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+
+    if (1 != EVP_EncryptUpdate(ctx, dest, &len, src, nblocks * 16)) handleErrors();
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return len;
+}
+
 int openssl_clean() { return 0; }
@@ -20,6 +20,8 @@ int openssl_encode(unsigned char* iv, unsigned char* dest, const unsigned char*
 
 int openssl_decode(unsigned char* iv, unsigned char* dest, const unsigned char* src, int size);
 
+int openssl_ecb_encode(const unsigned char* key, unsigned char* dest, const unsigned char* src, int nblocks);
+
 int openssl_clean();
 
 unsigned char* openssl_rand_str(int length);
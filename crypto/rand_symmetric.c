@@ -7,12 +7,10 @@
 
 #include "rand_symmetric.h"
 
-int RAND_BLOCKSIZE = 0;
 int IV_SIZE = 0;
 int RAND_FINALPADSIZE = 0;
 
-int rand_init(char* key, int key_size, block_align_config config) {
-    RAND_BLOCKSIZE = config.block_size;
+int rand_init(char* key, int key_size) {
     IV_SIZE = key_size;
     RAND_FINALPADSIZE = IV_SIZE + RAND_PADSIZE;
     int init_sym_val = openssl_init(key, key_size);
@@ -79,9 +77,9 @@ int rand_clean() {
 }
 
 off_t rand_get_file_size(const char* path, off_t original_size, struct fuse_file_info* fi_in,
-                         struct fuse_operations nextlayer) {
-    uint64_t nr_complete_blocks = original_size / (RAND_BLOCKSIZE + RAND_FINALPADSIZE);
-    int last_incomplete_block_size = original_size % (RAND_BLOCKSIZE + RAND_FINALPADSIZE);
+                         const struct fuse_operations *nextlayer, int block_size) {
+    uint64_t nr_complete_blocks = original_size / (block_size + RAND_FINALPADSIZE);
+    int last_incomplete_block_size = original_size % (block_size + RAND_FINALPADSIZE);
     uint64_t last_block_address = original_size - last_incomplete_block_size;
     int last_block_real_size = 0;
 
@@ -104,7 +102,7 @@ off_t rand_get_file_size(const char* path, off_t original_size, struct fuse_file
 
             // TODO: add -D_GNU_SOURCE for O_LARGEFILE
             fi->flags = O_RDONLY;
-            res = nextlayer.open(path, fi);
+            res = nextlayer->open(path, fi);
             if (res == -1) {
                 DEBUG_MSG("Failed open %s original size is %lu last block size is %d, last_block_address is %llu\n",
                           path, original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -113,7 +111,7 @@ off_t rand_get_file_size(const char* path, off_t original_size, struct fuse_file
         }
 
         // read the block and decode to understand the number of bytes actually written
-        res = nextlayer.read(path, aux_cyphered_buf, last_incomplete_block_size, last_block_address, fi);
+        res = nextlayer->read(path, aux_cyphered_buf, last_incomplete_block_size, last_block_address, fi);
         if (res < last_incomplete_block_size) {
             DEBUG_MSG("Failed write %s original size is %lu last block size is %d, last_block_address is %llu\n", path,
                       original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -121,7 +119,7 @@ off_t rand_get_file_size(const char* path, off_t original_size, struct fuse_file
         }
 
         if (fi_in == NULL) {
-            res = nextlayer.release(path, fi);
+            res = nextlayer->release(path, fi);
             if (res == -1) {
                 DEBUG_MSG("Failed close %s original size is %lu last block size is %d, last_block_address is %llu\n",
                           path, original_size, last_incomplete_block_size, (unsigned long long int)last_block_address);
@@ -135,9 +133,9 @@ off_t rand_get_file_size(const char* path, off_t original_size, struct fuse_file
     }
 
     DEBUG_MSG("size for file %s , last block real size is %d and file real size is %lu.\n", path, last_block_real_size,
-              nr_complete_blocks * (RAND_BLOCKSIZE) + last_block_real_size);
+              nr_complete_blocks * (block_size) + last_block_real_size);
 
-    return nr_complete_blocks * RAND_BLOCKSIZE + last_block_real_size;
+    return nr_complete_blocks * block_size + last_block_real_size;
 }
 
 int rand_get_cyphered_block_size(int origin_size) {
@@ -146,19 +144,18 @@ int rand_get_cyphered_block_size(int origin_size) {
     return offset_block_aligned + RAND_FINALPADSIZE;
 }
 
-uint64_t rand_get_cyphered_block_offset(uint64_t origin_offset) {
-    DEBUG_MSG("RAND_BLOCKSIZE is  %d.\n", RAND_BLOCKSIZE);
-    printf("RAND_BLOCKSIZE");
-    uint64_t blockid = origin_offset / RAND_BLOCKSIZE;
+uint64_t rand_get_cyphered_block_offset(uint64_t origin_offset, int block_size) {
+    DEBUG_MSG("Block size is  %d.\n", block_size);
+    uint64_t blockid = origin_offset / block_size;
 
-    return blockid * (RAND_BLOCKSIZE + RAND_FINALPADSIZE);
+    return blockid * (block_size + RAND_FINALPADSIZE);
 }
 
-off_t rand_get_truncate_size(off_t size) {
-    uint64_t nr_blocks = size / RAND_BLOCKSIZE;
-    uint64_t extra_bytes = size % RAND_BLOCKSIZE;
+off_t rand_get_truncate_size(off_t size, int block_size) {
+    uint64_t nr_blocks = size / block_size;
+    uint64_t extra_bytes = size % block_size;
 
-    off_t truncate_size = nr_blocks * (RAND_BLOCKSIZE + RAND_FINALPADSIZE);
+    off_t truncate_size = nr_blocks * (block_size + RAND_FINALPADSIZE);
 
     if (extra_bytes > 0) {
         truncate_size += rand_get_cyphered_block_size(extra_bytes);
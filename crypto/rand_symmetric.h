@@ -19,21 +19,21 @@
 
 #define RAND_PADSIZE 16
 
-int rand_init(char* key, int block_size, block_align_config config);
+int rand_init(char* key, int key_size);
 
 int rand_encode(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 int rand_decode(unsigned char* dest, const unsigned char* src, int size, void* ident);
 
 off_t rand_get_file_size(const char* path, off_t origin_size, struct fuse_file_info* fi,
-                         struct fuse_operations nextlayer);
+                         const struct fuse_operations *nextlayer, int block_size);
 
 int rand_get_cyphered_block_size(int origin_size);
 
-uint64_t rand_get_cyphered_block_offset(uint64_t origin_size);
+uint64_t rand_get_cyphered_block_offset(uint64_t origin_size, int block_size);
 
 int rand_clean();
 
-off_t rand_get_truncate_size(off_t size);
+off_t rand_get_truncate_size(off_t size, int block_size);
 
 #endif
@@ -0,0 +1,272 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+
+#include "geometry.h"
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../logdef.h"
+#include "../map/map.h"
+
+// Entries kept, the least recently used one is forgotten to make room for a new one
+#define GEOMETRY_CACHE_MAX 65536
+
+static int initialized = 0;
+static int DEFAULT_BLOCKSIZE = 0;
+// struct block_size_policy, from the configuration
+static GSList *policies = NULL;
+
+struct geometry_entry {
+    char *path;
+    int block_size;
+    // link in lru
+    GList link;
+};
+
+// path -> struct geometry_entry of the files looked up or created since the mount
+static GHashTable *sizes = NULL;
+// entries from the least to the most recently used
+static GQueue lru;
+static GMutex geometry_mutex;
+
+static void free_entry(gpointer data) {
+    struct geometry_entry *entry = data;
+    g_queue_unlink(&lru, &entry->link);
+    free(entry->path);
+    free(entry);
+}
+
+void init_geometry(block_align_config config) {
+    if (initialized) {
+        return;
+    }
+    initialized = 1;
+
+    DEFAULT_BLOCKSIZE = config.block_size;
+    policies = config.block_size_policies;
+
+    // without policies every file has the default block size and nothing is looked up
+    if (policies == NULL) {
+        return;
+    }
+
+    g_mutex_init(&geometry_mutex);
+    g_queue_init(&lru);
+    sizes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_entry);
+}
+
+void clean_geometry() {
+    if (!initialized) {
+        return;
+    }
+    initialized = 0;
+
+    if (sizes != NULL) {
+        g_hash_table_destroy(sizes);
+        g_mutex_clear(&geometry_mutex);
+        sizes = NULL;
+    }
+}
+
+// Block size of path if it is known, 0 otherwise. Must be called with geometry_mutex held.
+static int lookup_size(const char *path) {
+    struct geometry_entry *entry = g_hash_table_lookup(sizes, path);
+    if (entry == NULL) {
+        return 0;
+    }
+    g_queue_unlink(&lru, &entry->link);
+    g_queue_push_tail_link(&lru, &entry->link);
+    return entry->block_size;
+}
+
+// Must be called with geometry_mutex held
+static void store_size(const char *path, int block_size) {
+    struct geometry_entry *entry = g_hash_table_lookup(sizes, path);
+    if (entry != NULL) {
+        entry->block_size = block_size;
+        g_queue_unlink(&lru, &entry->link);
+        g_queue_push_tail_link(&lru, &entry->link);
+        return;
+    }
+
+    if (g_hash_table_size(sizes) >= GEOMETRY_CACHE_MAX) {
+        struct geometry_entry *oldest = g_queue_peek_head(&lru);
+        g_hash_table_remove(sizes, oldest->path);
+    }
+
+    entry = malloc(sizeof(struct geometry_entry));
+    entry->path = strdup(path);
+    entry->block_size = block_size;
+    entry->link.data = entry;
+    entry->link.prev = NULL;
+    entry->link.next = NULL;
+    g_queue_push_tail_link(&lru, &entry->link);
+    g_hash_table_insert(sizes, entry->path, entry);
+}
+
+static int policy_block_size(const char *path) {
+    GSList *current;
+    int block_size = DEFAULT_BLOCKSIZE;
+    size_t matched = 0;
+
+    for (current = policies; current != NULL; current = current->next) {
+        struct block_size_policy *policy = current->data;
+        size_t prefix_size = strlen(policy->prefix);
+
+        if (prefix_size >= matched && path_has_prefix(path, policy->prefix)) {
+            block_size = policy->block_size;
+            matched = prefix_size;
+        }
+    }
+
+    return block_size;
+}
+
+int geometry_new_file(const char *path, const struct fuse_operations *nextlayer) {
+    if (sizes == NULL) {
+        return DEFAULT_BLOCKSIZE;
+    }
+
+    int block_size = policy_block_size(path);
+
+    g_mutex_lock(&geometry_mutex);
+    int known = lookup_size(path);
+    g_mutex_unlock(&geometry_mutex);
+
+    // already recorded by a layer below
+    if (known == block_size) {
+        return block_size;
+    }
+
+    if (block_size != DEFAULT_BLOCKSIZE) {
+        char value[16];
+        int size = snprintf(value, sizeof(value), "%d", block_size);
+        int res = (nextlayer->setxattr != NULL) ? nextlayer->setxattr(path, GEOMETRY_XATTR, value, size, 0) : -ENOTSUP;
+        if (res < 0) {
+            ERROR_MSG("Could not record the block size of %s, using %d bytes: %s\n", path, DEFAULT_BLOCKSIZE,
+                      strerror(-res));
+            block_size = DEFAULT_BLOCKSIZE;
+        }
+    }
+
+    g_mutex_lock(&geometry_mutex);
+    store_size(path, block_size);
+    g_mutex_unlock(&geometry_mutex);
+
+    DEBUG_MSG("File %s created with block size %d\n", path, block_size);
+
+    return block_size;
+}
+
+int geometry_block_size(const char *path, const struct fuse_operations *nextlayer) {
+    if (sizes == NULL) {
+        return DEFAULT_BLOCKSIZE;
+    }
+
+    g_mutex_lock(&geometry_mutex);
+    int known = lookup_size(path);
+    g_mutex_unlock(&geometry_mutex);
+
+    if (known > 0) {
+        return known;
+    }
+
+    char value[16];
+    int block_size = DEFAULT_BLOCKSIZE;
+    int res = (nextlayer->getxattr != NULL) ? nextlayer->getxattr(path, GEOMETRY_XATTR, value, sizeof(value) - 1)
+                                           : -ENOTSUP;
+    if (res > 0) {
+        value[res] = '\0';
+        block_size = atoi(value);
+        if (block_size <= 0) {
+            ERROR_MSG("Invalid block size %s recorded for %s\n", value, path);
+            block_size = DEFAULT_BLOCKSIZE;
+        }
+    } else if (res == -ENOENT) {
+        // nothing to remember for a file that does not exist
+        return DEFAULT_BLOCKSIZE;
+    }
+
+    g_mutex_lock(&geometry_mutex);
+    store_size(path, block_size);
+    g_mutex_unlock(&geometry_mutex);
+
+    return block_size;
+}
+
+static gboolean size_under_path(gpointer key, gpointer value, gpointer prefix) {
+    return path_has_prefix((const char *)key, (const char *)prefix);
+}
+
+void geometry_remove(const char *path) {
+    if (sizes == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&geometry_mutex);
+    g_hash_table_foreach_remove(sizes, size_under_path, (gpointer)path);
+    g_mutex_unlock(&geometry_mutex);
+}
+
+void geometry_rename(const char *from, const char *to) {
+    if (sizes == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&geometry_mutex);
+    int known = lookup_size(from);
+    // the files below a renamed directory are looked up again under their new path
+    g_hash_table_foreach_remove(sizes, size_under_path, (gpointer)from);
+    g_hash_table_foreach_remove(sizes, size_under_path, (gpointer)to);
+    if (known > 0) {
+        store_size(to, known);
+    }
+    g_mutex_unlock(&geometry_mutex);
+}
+
+static int is_layer_xattr(const char *name) {
+    return strncmp(name, SAFEFS_XATTR_PREFIX, strlen(SAFEFS_XATTR_PREFIX)) == 0;
+}
+
+int geometry_setxattr(const char *path, const char *name, const char *value, size_t size, int flags,
+                      const struct fuse_operations *nextlayer) {
+    if (is_layer_xattr(name)) {
+        return -EPERM;
+    }
+    return nextlayer->setxattr(path, name, value, size, flags);
+}
+
+int geometry_removexattr(const char *path, const char *name, const struct fuse_operations *nextlayer) {
+    if (is_layer_xattr(name)) {
+        return -EPERM;
+    }
+    return nextlayer->removexattr(path, name);
+}
+
+int geometry_listxattr(const char *path, char *list, size_t size, const struct fuse_operations *nextlayer) {
+    int res = nextlayer->listxattr(path, list, size);
+
+    // a size query may count the hidden names, the caller only relies on the length of the second call
+    if (res <= 0 || size == 0) {
+        return res;
+    }
+
+    int i = 0;
+    while (i < res) {
+        int name_size = strlen(&list[i]) + 1;
+        if (is_layer_xattr(&list[i])) {
+            memmove(&list[i], &list[i + name_size], res - i - name_size);
+            res -= name_size;
+        } else {
+            i += name_size;
+        }
+    }
+
+    return res;
+}
@@ -0,0 +1,57 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Plaintext block size of each file.
+ * The block size of a new file is chosen from the block_align policies, the longest path prefix
+ * matching the file wins and block_size is used otherwise. A size other than block_size is recorded
+ * in the GEOMETRY_XATTR extended attribute of the file, so that it is found again by every layer and
+ * across mounts. Files without the attribute use block_size.
+ *
+ * The layers look the block size up when a file is opened or created and keep it with the open file,
+ * the table of known sizes only serves the opens and the requests made without an open file.
+ */
+
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+
+#ifdef __linux__
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 26
+#endif /* FUSE_USE_VERSION */
+#endif /* __linux__ */
+
+#include <fuse.h>
+#include "../SFSConfig.h"
+
+// Extended attributes the layers record in the files, e.g. GEOMETRY_XATTR
+#define SAFEFS_XATTR_PREFIX "user.safefs."
+#define GEOMETRY_XATTR SAFEFS_XATTR_PREFIX "block_size"
+
+// May be called by several layers, the first call wins
+void init_geometry(block_align_config config);
+
+void clean_geometry();
+
+// Block size of a file just created at path, recorded in its metadata through nextlayer if needed
+int geometry_new_file(const char *path, const struct fuse_operations *nextlayer);
+
+// Block size of the file at path, read from its metadata through nextlayer if it is not known yet
+int geometry_block_size(const char *path, const struct fuse_operations *nextlayer);
+
+// Forgets path and every path below it
+void geometry_remove(const char *path);
+
+void geometry_rename(const char *from, const char *to);
+
+// Extended attribute operations of the layers using the geometry, the attributes of the layers
+// (SAFEFS_XATTR_PREFIX) can not be changed or listed through them
+int geometry_setxattr(const char *path, const char *name, const char *value, size_t size, int flags,
+                      const struct fuse_operations *nextlayer);
+int geometry_removexattr(const char *path, const char *name, const struct fuse_operations *nextlayer);
+int geometry_listxattr(const char *path, char *list, size_t size, const struct fuse_operations *nextlayer);
+
+#endif /* __GEOMETRY_H__ */
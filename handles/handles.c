@@ -0,0 +1,31 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "handles.h"
+
+void layer_file_attach(struct fuse_file_info *fi, struct layer_file *file) {
+    file->fh = fi->fh;
+    fi->fh = (uintptr_t)file;
+}
+
+struct layer_file *layer_file_of(const struct fuse_file_info *fi) {
+    return (fi != NULL) ? (struct layer_file *)(uintptr_t)fi->fh : NULL;
+}
+
+struct fuse_file_info *layer_file_lower(const struct fuse_file_info *fi, struct fuse_file_info *lower) {
+    if (fi == NULL) {
+        return NULL;
+    }
+    *lower = *fi;
+    lower->fh = layer_file_of(fi)->fh;
+    return lower;
+}
+
+struct layer_file *layer_file_detach(struct fuse_file_info *fi) {
+    struct layer_file *file = layer_file_of(fi);
+    fi->fh = file->fh;
+    return file;
+}
@@ -0,0 +1,38 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * State kept by a layer for each file it opens.
+ * Once the open or create of the layer below succeeded, the layer replaces fi->fh with a pointer to
+ * its state, a structure starting with struct layer_file that keeps the handle of the layer below.
+ * The layer below is then given a copy of fi holding its own handle (layer_file_lower), and the state
+ * is detached before the release of the layer below.
+ */
+
+#ifndef __HANDLES_H__
+#define __HANDLES_H__
+
+#include <stdint.h>
+#include "../layers_def.h"
+
+struct layer_file {
+    // handle returned by the layer below
+    uint64_t fh;
+};
+
+// Attaches file to fi, which holds the handle returned by the layer below
+void layer_file_attach(struct fuse_file_info *fi, struct layer_file *file);
+
+// State attached to fi, NULL if fi is NULL
+struct layer_file *layer_file_of(const struct fuse_file_info *fi);
+
+// Copies fi to lower with the handle of the layer below. Returns lower, or NULL if fi is NULL.
+struct fuse_file_info *layer_file_lower(const struct fuse_file_info *fi, struct fuse_file_info *lower);
+
+// Gives fi back the handle of the layer below and returns the state that was attached to it
+struct layer_file *layer_file_detach(struct fuse_file_info *fi);
+
+#endif /* __HANDLES_H__ */
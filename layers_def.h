@@ -25,40 +25,188 @@ typedef unsigned long u_long;
 #include <stdlib.h>
 #include <sys/stat.h>
 
+/*
+ * Context of a layer in the stack, kept by the layer from its init until it is cleaned. The operations
+ * of the layer below and the state of the layer are reached through stable pointers, which are handed
+ * to the drivers instead of copies of struct fuse_operations.
+ */
+struct layer_context {
+    // operations of the layer below
+    const struct fuse_operations *next;
+    // asynchronous operations of the layer below, NULL if it only has the synchronous ones
+    const struct layer_async_operations *next_async;
+    // state of the layer, e.g. its driver
+    void *private_data;
+};
+
+// Completion of an asynchronous operation, res is what the synchronous operation would have returned
+typedef void (*layer_callback)(int res, void *user_data);
+
+/*
+ * Asynchronous variants of the data operations of a layer. They return once the request is issued and
+ * call callback exactly once when it is done, possibly from another thread or before returning. The
+ * buffers and fi must stay valid until then.
+ */
+struct layer_async_operations {
+    void (*read)(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                 layer_callback callback, void *user_data);
+    void (*write)(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                  layer_callback callback, void *user_data);
+    void (*fsync)(const char *path, int isdatasync, struct fuse_file_info *fi, layer_callback callback,
+                  void *user_data);
+};
+
+/*
+ * Signatures of the operations of struct fuse_operations, for the layers generating their wrappers of
+ * the layer below with macros (trace, stats, capture and the router). LAYER_PARAMS(operation) is the
+ * parameter list of the operation and LAYER_ARGS(operation, fi) the arguments handing them to the
+ * layer below, with fi as its file. LAYER_OPERATIONS(X) expands X(operation) for each of them.
+ */
+#define LAYER_PARAMS(operation) LAYER_PARAMS_##operation
+#define LAYER_ARGS(operation, fi) LAYER_ARGS_##operation(fi)
+
+#define LAYER_OPERATIONS(X)                                                                                   \
+    X(getattr) X(fgetattr) X(access) X(readlink) X(opendir) X(readdir) X(releasedir) X(mknod) X(mkdir)        \
+    X(symlink) X(unlink) X(rmdir) X(rename) X(link) X(chmod) X(chown) X(truncate) X(ftruncate) X(utimens)     \
+    X(create) X(open) X(read) X(write) X(statfs) X(flush) X(release) X(fsync) X(setxattr) X(getxattr)         \
+    X(listxattr) X(removexattr)
+
+#define LAYER_PARAMS_getattr (const char *path, struct stat *stbuf)
+#define LAYER_ARGS_getattr(fi) (path, stbuf)
+#define LAYER_PARAMS_fgetattr (const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+#define LAYER_ARGS_fgetattr(fi) (path, stbuf, fi)
+#define LAYER_PARAMS_access (const char *path, int mask)
+#define LAYER_ARGS_access(fi) (path, mask)
+#define LAYER_PARAMS_readlink (const char *path, char *buf, size_t size)
+#define LAYER_ARGS_readlink(fi) (path, buf, size)
+#define LAYER_PARAMS_opendir (const char *path, struct fuse_file_info *fi)
+#define LAYER_ARGS_opendir(fi) (path, fi)
+#define LAYER_PARAMS_readdir \
+    (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+#define LAYER_ARGS_readdir(fi) (path, buf, filler, offset, fi)
+#define LAYER_PARAMS_releasedir (const char *path, struct fuse_file_info *fi)
+#define LAYER_ARGS_releasedir(fi) (path, fi)
+#define LAYER_PARAMS_mknod (const char *path, mode_t mode, dev_t rdev)
+#define LAYER_ARGS_mknod(fi) (path, mode, rdev)
+#define LAYER_PARAMS_mkdir (const char *path, mode_t mode)
+#define LAYER_ARGS_mkdir(fi) (path, mode)
+#define LAYER_PARAMS_symlink (const char *from, const char *to)
+#define LAYER_ARGS_symlink(fi) (from, to)
+#define LAYER_PARAMS_unlink (const char *path)
+#define LAYER_ARGS_unlink(fi) (path)
+#define LAYER_PARAMS_rmdir (const char *path)
+#define LAYER_ARGS_rmdir(fi) (path)
+#define LAYER_PARAMS_rename (const char *from, const char *to)
+#define LAYER_ARGS_rename(fi) (from, to)
+#define LAYER_PARAMS_link (const char *from, const char *to)
+#define LAYER_ARGS_link(fi) (from, to)
+#define LAYER_PARAMS_chmod (const char *path, mode_t mode)
+#define LAYER_ARGS_chmod(fi) (path, mode)
+#define LAYER_PARAMS_chown (const char *path, uid_t uid, gid_t gid)
+#define LAYER_ARGS_chown(fi) (path, uid, gid)
+#define LAYER_PARAMS_truncate (const char *path, off_t size)
+#define LAYER_ARGS_truncate(fi) (path, size)
+#define LAYER_PARAMS_ftruncate (const char *path, off_t size, struct fuse_file_info *fi)
+#define LAYER_ARGS_ftruncate(fi) (path, size, fi)
+#define LAYER_PARAMS_utimens (const char *path, const struct timespec tv[2])
+#define LAYER_ARGS_utimens(fi) (path, tv)
+#define LAYER_PARAMS_create (const char *path, mode_t mode, struct fuse_file_info *fi)
+#define LAYER_ARGS_create(fi) (path, mode, fi)
+#define LAYER_PARAMS_open (const char *path, struct fuse_file_info *fi)
+#define LAYER_ARGS_open(fi) (path, fi)
+#define LAYER_PARAMS_read (const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+#define LAYER_ARGS_read(fi) (path, buf, size, offset, fi)
+#define LAYER_PARAMS_write \
+    (const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+#define LAYER_ARGS_write(fi) (path, buf, size, offset, fi)
+#define LAYER_PARAMS_statfs (const char *path, struct statvfs *stbuf)
+#define LAYER_ARGS_statfs(fi) (path, stbuf)
+#define LAYER_PARAMS_flush (const char *path, struct fuse_file_info *fi)
+#define LAYER_ARGS_flush(fi) (path, fi)
+#define LAYER_PARAMS_release (const char *path, struct fuse_file_info *fi)
+#define LAYER_ARGS_release(fi) (path, fi)
+#define LAYER_PARAMS_fsync (const char *path, int isdatasync, struct fuse_file_info *fi)
+#define LAYER_ARGS_fsync(fi) (path, isdatasync, fi)
+#define LAYER_PARAMS_setxattr (const char *path, const char *name, const char *value, size_t size, int flags)
+#define LAYER_ARGS_setxattr(fi) (path, name, value, size, flags)
+#define LAYER_PARAMS_getxattr (const char *path, const char *name, char *value, size_t size)
+#define LAYER_ARGS_getxattr(fi) (path, name, value, size)
+#define LAYER_PARAMS_listxattr (const char *path, char *list, size_t size)
+#define LAYER_ARGS_listxattr(fi) (path, list, size)
+#define LAYER_PARAMS_removexattr (const char *path, const char *name)
+#define LAYER_ARGS_removexattr(fi) (path, name)
+
+// Installs <layer>_<operation> in <layer>_oper when the layer below has the operation, unsets it otherwise
+#define LAYER_WRAP(layer, next, operation) \
+    ((layer##_oper).operation = ((next)->operation != NULL) ? layer##_##operation : NULL)
+
+// Size of the IVs computed by encode_driver.derive_ivs
+#define DERIVED_IV_SIZE 16
+
+// Size of the random identity sfuse records for each new file, see encode_driver.binds_file_id
+#define FILE_ID_SIZE 16
+
 // This is used by the sfuse layer drivers
 struct key_info {
     const char *path;
     uint64_t offset;
+    // IV of this block already derived by the caller, NULL if the driver has to compute it
+    const unsigned char *iv;
+    // Plaintext block size of the file
+    int block_size;
+    // Identity of the file (FILE_ID_SIZE bytes, zeros for files created without one), only set for
+    // the drivers binding it
+    const unsigned char *file_id;
 };
 
 struct encode_driver {
     int (*encode)(unsigned char *dest, const unsigned char *src, int size, void *ident);
     int (*decode)(unsigned char *dest, const unsigned char *src, int size, void *ident);
+    // block_size is the plaintext block size of the file
     off_t (*get_file_size)(const char *path, off_t orig_size, struct fuse_file_info *fi,
-                           struct fuse_operations nextlayer);
+                           const struct fuse_operations *nextlayer, int block_size);
     int (*get_cyphered_block_size)(int orig_size);
-    uint64_t (*get_cyphered_block_offset)(uint64_t orig_offset);
-    off_t (*get_truncate_size)(off_t size);
+    uint64_t (*get_cyphered_block_offset)(uint64_t orig_offset, int block_size);
+    off_t (*get_truncate_size)(off_t size, int block_size);
     int (*copy_dbkeys)(const char *from, const char *to);
     int (*delete_dbkeys)(const char *path);
+    // Only set by drivers whose IVs are derived from the path and block index. Computes the IVs of
+    // nblocks consecutive blocks at once. Files encoded this way can not be renamed nor linked.
+    int (*derive_ivs)(const char *path, uint64_t first_block, int nblocks, unsigned char *ivs);
+    // Set by drivers authenticating each block with the identity of its file and its index, so that
+    // blocks can not be moved within or across files. The identity is kept in the metadata of the
+    // file and follows it across renames.
+    int binds_file_id;
 };
 
+// block_size is the plaintext block size of the file (see geometry/geometry.h)
 struct align_driver {
-    int (*align_read)(const char *path, char *buf, size_t size, off_t offset, void *fi,
-                      struct fuse_operations nextlayer);
-    int (*align_write)(const char *path, const char *buf, size_t size, off_t offset, void *fi,
-                       struct fuse_operations nextlayer);
-    int (*align_create)(const char *path, mode_t mode, void *fi, struct fuse_operations nextlayer);
-    int (*align_open)(const char *path, void *fi, struct fuse_operations nextlayer);
-    int (*align_truncate)(const char *path, off_t size, struct fuse_file_info *fi, struct fuse_operations nextlayer);
+    int (*align_read)(const char *path, char *buf, size_t size, off_t offset, void *fi, int block_size,
+                      const struct fuse_operations *nextlayer);
+    int (*align_write)(const char *path, const char *buf, size_t size, off_t offset, void *fi, int block_size,
+                       const struct fuse_operations *nextlayer);
+    int (*align_create)(const char *path, mode_t mode, void *fi, const struct fuse_operations *nextlayer);
+    int (*align_open)(const char *path, void *fi, const struct fuse_operations *nextlayer);
+    int (*align_truncate)(const char *path, off_t size, struct fuse_file_info *fi, int block_size,
+                          const struct fuse_operations *nextlayer);
+    int (*align_release)(const char *path, struct fuse_file_info *fi, const struct fuse_operations *nextlayer);
+    int (*align_unlink)(const char *path, const struct fuse_operations *nextlayer);
+    int (*align_rename)(const char *from, const char *to, const struct fuse_operations *nextlayer);
+    int (*align_link)(const char *from, const char *to, const struct fuse_operations *nextlayer);
 };
 
+// defined in multi_loop_drivers/io_request.h
+struct io_request;
+
 struct multi_driver {
     void (*get_driver_offset)(const char *path, off_t offset, off_t *driver_offset);
     void (*get_driver_size)(const char *path, off_t offset, uint64_t *driver_size);
-    void (*encode)(const char *path, unsigned char **magicblocks, unsigned char *block, off_t offset, int size,
+    // fills one request per device with the encoded block, requests may reference block without copying it
+    void (*encode)(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
                    int ndevs);
-    void (*decode)(unsigned char *block, unsigned char **magicblocks, int size, int ndevs);
+    // sets where each device reads to, devices may read straight into block
+    void (*prepare_read)(struct io_request *requests, unsigned char *block, int size, int ndevs);
+    void (*decode)(unsigned char *block, struct io_request *requests, int size, int ndevs);
     uint64_t (*get_file_size)(const char *path);
     void (*rename)(char *from, char *to);
     void (*create)(char *path);
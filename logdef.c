@@ -6,6 +6,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +35,34 @@ static debug_func_t debug = NULL;
 static error_func_t error = NULL;
 static screen_func_t screen = NULL;
 
+int sfs_log_level = LOG_LEVEL_NONE;
+
+// longer messages are allocated by the asynchronous sink
+#define LOG_ENTRY_SIZE 512
+
+struct log_entry {
+    int level;
+    // the message when it does not fit in msg, freed by the writer
+    char *long_msg;
+    char msg[LOG_ENTRY_SIZE];
+};
+
+/*
+ * Messages formatted by the logging threads and written to zlog by writer_thread.
+ * Entries head - tail to head are queued, debug messages are dropped when it is full.
+ */
+static struct log_entry *log_queue = NULL;
+static int log_queue_size = 0;
+static uint64_t log_head = 0;
+static uint64_t log_tail = 0;
+// dropped since the writer last reported them, and since the start
+static uint64_t log_dropped = 0;
+static uint64_t log_dropped_total = 0;
+static int log_stop = 0;
+static pthread_mutex_t log_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
 /**
 * Check if the directory hosting the file stored at path exists and is a
 * directory.
@@ -115,6 +146,114 @@ void ACTIVE_ERROR_MSG(const char *format, va_list args) {
     vzlog_error(CATEGORY, format, args);
 }
 
+/**
+ * Writes the queued messages to zlog until LOG_EXIT, and reports the dropped
+ * messages as soon as the queue has room again.
+ * @param arg Unused
+ */
+static void *writer_thread(void *arg) {
+    struct log_entry entry;
+
+    pthread_mutex_lock(&log_queue_lock);
+    while (1) {
+        while (log_head == log_tail && log_dropped == 0 && !log_stop) {
+            pthread_cond_wait(&log_queue_cond, &log_queue_lock);
+        }
+        if (log_head == log_tail && log_dropped == 0) {
+            break;
+        }
+        int has_entry = log_head != log_tail;
+        if (has_entry) {
+            entry = log_queue[log_tail % log_queue_size];
+            log_tail++;
+        }
+        uint64_t dropped = log_dropped;
+        log_dropped = 0;
+        pthread_mutex_unlock(&log_queue_lock);
+
+        if (dropped > 0) {
+            zlog_error(CATEGORY, "%lu debug messages dropped, the log queue was full\n", (unsigned long)dropped);
+        }
+        if (has_entry) {
+            const char *msg = (entry.long_msg != NULL) ? entry.long_msg : entry.msg;
+            if (entry.level == LOG_LEVEL_ERROR) {
+                zlog_error(CATEGORY, "%s", msg);
+            } else {
+                zlog_debug(CATEGORY, "%s", msg);
+            }
+            free(entry.long_msg);
+        }
+
+        pthread_mutex_lock(&log_queue_lock);
+    }
+    pthread_mutex_unlock(&log_queue_lock);
+
+    return NULL;
+}
+
+/**
+ * Formats a message and queues it for writer_thread. Errors are written by the
+ * calling thread when the queue is full.
+ * @param level Level of the message
+ * @param format Format of the message
+ * @param args A list of arguments accompanying the format
+ */
+static void queue_msg(int level, const char *format, va_list args) {
+    char msg[LOG_ENTRY_SIZE];
+    char *long_msg = NULL;
+    int queued = 1;
+    va_list copy;
+
+    // formatted before taking the lock, the queue only holds copies
+    va_copy(copy, args);
+    int len = vsnprintf(msg, sizeof(msg), format, args);
+    if (len >= (int)sizeof(msg)) {
+        long_msg = malloc(len + 1);
+        if (long_msg != NULL) {
+            vsnprintf(long_msg, len + 1, format, copy);
+        }
+    }
+    va_end(copy);
+
+    pthread_mutex_lock(&log_queue_lock);
+    if (log_head - log_tail < (uint64_t)log_queue_size) {
+        struct log_entry *entry = &log_queue[log_head % log_queue_size];
+        entry->level = level;
+        entry->long_msg = long_msg;
+        memcpy(entry->msg, msg, sizeof(msg));
+        log_head++;
+        pthread_cond_signal(&log_queue_cond);
+    } else if (level == LOG_LEVEL_ERROR) {
+        queued = 0;
+    } else {
+        // reported by the writer once it makes room
+        log_dropped++;
+        log_dropped_total++;
+        pthread_cond_signal(&log_queue_cond);
+        free(long_msg);
+    }
+    pthread_mutex_unlock(&log_queue_lock);
+
+    if (!queued) {
+        zlog_error(CATEGORY, "%s", (long_msg != NULL) ? long_msg : msg);
+        free(long_msg);
+    }
+}
+
+/**
+ * A function that queues debug level messages for the writer thread.
+ * @param format Format of the message
+ * @param args A list of arguments accompanying the format
+ */
+static void ASYNC_DEBUG_MSG(const char *format, va_list args) { queue_msg(LOG_LEVEL_DEBUG, format, args); }
+
+/**
+ * A function that queues error level messages for the writer thread.
+ * @param format Format of the message
+ * @param args A list of arguments accompanying the format
+ */
+static void ASYNC_ERROR_MSG(const char *format, va_list args) { queue_msg(LOG_LEVEL_ERROR, format, args); }
+
 /**
  * A function that logs messages on the screen using vprintf.
  * @param format Format of the message
@@ -168,7 +307,21 @@ void LOG_INIT() {
         debug = ACTIVE_DEBUG_MSG;
         error = ACTIVE_ERROR_MSG;
         screen = ACTIVE_SCREEN_MSG;
-        fprintf(stdout, "logging enabled\n");
+
+        const log_config *log = &CONFIGURATION->logging_configuration;
+        if (log->async && log->level == LOG_LEVEL_DEBUG && log->queue_size > 0) {
+            log_queue_size = log->queue_size;
+            log_queue = malloc(log_queue_size * sizeof(struct log_entry));
+            if (log_queue == NULL || pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+                fprintf(stderr, "[logdef::LOG_INIT] Could not start the log writer thread\n");
+                exit(EXIT_FAILURE);
+            }
+            debug = ASYNC_DEBUG_MSG;
+            error = ASYNC_ERROR_MSG;
+        }
+        sfs_log_level = log->level;
+        fprintf(stdout, "logging enabled (%s%s)\n", (log->level == LOG_LEVEL_DEBUG) ? "debug" : "error",
+                (log_queue != NULL) ? ", asynchronous" : "");
     } else {
         debug = DROP_MSG;
         error = DROP_MSG;
@@ -181,27 +334,42 @@ void LOG_INIT() {
  * Tears down the logging infrastructure
  */
 void LOG_EXIT() {
+    sfs_log_level = LOG_LEVEL_NONE;
+    if (log_queue != NULL) {
+        // the queued messages are written before the writer exits
+        pthread_mutex_lock(&log_queue_lock);
+        log_stop = 1;
+        pthread_cond_signal(&log_queue_cond);
+        pthread_mutex_unlock(&log_queue_lock);
+        pthread_join(writer, NULL);
+        free(log_queue);
+        log_queue = NULL;
+        if (log_dropped_total > 0) {
+            fprintf(stderr, "%lu debug messages were dropped, the log queue was full\n",
+                    (unsigned long)log_dropped_total);
+        }
+    }
     if (CONFIGURATION->logging_configuration.mode) {
         zlog_fini();
     }
     clean_config(CONFIGURATION);
 }
 
-void DEBUG_MSG(const char *format, ...) {
+void log_debug(const char *format, ...) {
     va_list args;
     va_start(args, format);
     debug(format, args);
     va_end(args);
 }
 
-void ERROR_MSG(const char *format, ...) {
+void log_error(const char *format, ...) {
     va_list args;
     va_start(args, format);
     error(format, args);
     va_end(args);
 }
 
-void SCREEN_MSG(const char *format, ...) {
+void log_screen(const char *format, ...) {
     va_list args;
     va_start(args, format);
     screen(format, args);
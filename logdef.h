@@ -9,6 +9,25 @@
 
 #define LOCAL_ZLOGCONFIG_PATH "zlog.conf"
 #define DEFAULT_ZLOGCONFIG_PATH "/etc/safefs/zlog.conf"
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_DEBUG 2
+
+/*
+ * Messages above this level are removed at compile time, with their arguments,
+ * e.g. make CFLAGS_EXTRA+=-DSFS_LOG_LEVEL=LOG_LEVEL_ERROR
+ */
+#ifndef SFS_LOG_LEVEL
+#define SFS_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * Messages above this level are dropped before their arguments are evaluated.
+ * LOG_LEVEL_NONE until LOG_INIT sets the level of the configuration.
+ */
+extern int sfs_log_level;
+
 /**
  * Initializes the logging facilities
  */
@@ -19,21 +38,47 @@ void LOG_INIT();
  */
 void LOG_EXIT();
 
+/**
+ * Logs a debug message, use DEBUG_MSG
+ * @param format Format message
+ */
+void log_debug(const char *format, ...);
+
+/**
+ * Logs an error message, use ERROR_MSG
+ * @param format Format message
+ */
+void log_error(const char *format, ...);
+
+/**
+ * Prints a message on the screen, use SCREEN_MSG
+ * @param format Format message
+ */
+void log_screen(const char *format, ...);
+
+#define LOG_MSG(level, func, ...)                                                        \
+    do {                                                                                 \
+        if (SFS_LOG_LEVEL >= (level) && __builtin_expect(sfs_log_level >= (level), 0)) { \
+            func(__VA_ARGS__);                                                           \
+        }                                                                                \
+    } while (0)
+
 /**
  * Logs a debug message
  * @param format Format message
  */
-void DEBUG_MSG(const char *format, ...);
+#define DEBUG_MSG(...) LOG_MSG(LOG_LEVEL_DEBUG, log_debug, __VA_ARGS__)
 
 /**
  * Logs an error message
  * @param format Format message
  */
-void ERROR_MSG(const char *format, ...);
+#define ERROR_MSG(...) LOG_MSG(LOG_LEVEL_ERROR, log_error, __VA_ARGS__)
 
 /**
- * Prints a message on the screen
+ * Prints a message on the screen when logging is enabled
  * @param format Format message
  */
-void SCREEN_MSG(const char *format, ...);
+#define SCREEN_MSG(...) LOG_MSG(LOG_LEVEL_ERROR, log_screen, __VA_ARGS__)
+
 #endif /*__LOGDEF_H__*/
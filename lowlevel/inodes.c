@@ -0,0 +1,285 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "inodes.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct sfs_inode {
+    fuse_ino_t ino;
+    char *path;
+    uint64_t nlookup;
+    // still reachable through path_table
+    int linked;
+    // files of the kernel open on the inode
+    uint64_t nopen;
+    // moved to a hidden name when removed while open
+    int hidden;
+    // directory inode the path is in, NULL once unlinked
+    struct sfs_inode *parent;
+    // linked inodes in this directory, an inode is kept while it has some as libfuse does
+    GQueue children;
+    GList child_link;
+};
+
+// fuse_ino_t -> struct sfs_inode
+static GHashTable *inode_table = NULL;
+// path -> struct sfs_inode, only for linked inodes
+static GHashTable *path_table = NULL;
+static GMutex inodes_mutex;
+static fuse_ino_t next_ino = FUSE_ROOT_ID + 1;
+
+// Inode of the directory of path, NULL if it is unknown
+static struct sfs_inode *parent_of(const char *path) {
+    const char *name = strrchr(path, '/');
+    if (name == path) {
+        return g_hash_table_lookup(path_table, "/");
+    }
+    char *dir = g_strndup(path, name - path);
+    struct sfs_inode *parent = g_hash_table_lookup(path_table, dir);
+    g_free(dir);
+    return parent;
+}
+
+static void attach_inode(struct sfs_inode *inode, struct sfs_inode *parent) {
+    inode->parent = parent;
+    if (parent != NULL) {
+        g_queue_push_tail_link(&parent->children, &inode->child_link);
+    }
+}
+
+// Detaches inode from its directory, returns the directory
+static struct sfs_inode *detach_inode(struct sfs_inode *inode) {
+    struct sfs_inode *parent = inode->parent;
+    if (parent != NULL) {
+        g_queue_unlink(&parent->children, &inode->child_link);
+        inode->parent = NULL;
+    }
+    return parent;
+}
+
+static struct sfs_inode *new_inode(fuse_ino_t ino, const char *path) {
+    struct sfs_inode *inode = malloc(sizeof(struct sfs_inode));
+    inode->ino = ino;
+    inode->path = strdup(path);
+    inode->nlookup = 0;
+    inode->linked = 1;
+    inode->nopen = 0;
+    inode->hidden = 0;
+    g_queue_init(&inode->children);
+    inode->child_link.data = inode;
+    inode->child_link.prev = NULL;
+    inode->child_link.next = NULL;
+    attach_inode(inode, (ino == FUSE_ROOT_ID) ? NULL : parent_of(path));
+
+    g_hash_table_insert(inode_table, GSIZE_TO_POINTER(ino), inode);
+    g_hash_table_insert(path_table, inode->path, inode);
+    return inode;
+}
+
+static void release_inode(struct sfs_inode *inode);
+
+static void unlink_inode(struct sfs_inode *inode) {
+    if (inode->linked) {
+        g_hash_table_remove(path_table, inode->path);
+        inode->linked = 0;
+        release_inode(detach_inode(inode));
+    }
+}
+
+// Removes inode once the kernel forgot it and no inode below it is left
+static void release_inode(struct sfs_inode *inode) {
+    if (inode != NULL && inode->ino != FUSE_ROOT_ID && inode->nlookup == 0 &&
+        g_queue_is_empty(&inode->children)) {
+        unlink_inode(inode);
+        g_hash_table_remove(inode_table, GSIZE_TO_POINTER(inode->ino));
+    }
+}
+
+static void free_inode(gpointer data) {
+    struct sfs_inode *inode = data;
+    free(inode->path);
+    free(inode);
+}
+
+// Moves inode to path, and the inodes below it to the same names under path
+static void move_inode(struct sfs_inode *inode, char *path) {
+    g_hash_table_remove(path_table, inode->path);
+    free(inode->path);
+    inode->path = path;
+
+    // an entry left at the new path by a replaced directory
+    struct sfs_inode *stale = g_hash_table_lookup(path_table, path);
+    if (stale != NULL) {
+        unlink_inode(stale);
+    }
+    g_hash_table_insert(path_table, inode->path, inode);
+
+    GList *current;
+    for (current = inode->children.head; current != NULL; current = current->next) {
+        struct sfs_inode *child = current->data;
+        const char *name = strrchr(child->path, '/') + 1;
+        char *child_path = malloc(strlen(path) + strlen(name) + 2);
+        sprintf(child_path, "%s/%s", path, name);
+        move_inode(child, child_path);
+    }
+}
+
+void init_inodes() {
+    inode_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_inode);
+    path_table = g_hash_table_new(g_str_hash, g_str_equal);
+    g_mutex_init(&inodes_mutex);
+
+    // the root is never forgotten
+    new_inode(FUSE_ROOT_ID, "/")->nlookup = 1;
+}
+
+void clean_inodes() {
+    g_hash_table_destroy(path_table);
+    g_hash_table_destroy(inode_table);
+    g_mutex_clear(&inodes_mutex);
+}
+
+char *inode_path(fuse_ino_t ino) {
+    char *path = NULL;
+
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(inode_table, GSIZE_TO_POINTER(ino));
+    if (inode != NULL) {
+        path = strdup(inode->path);
+    }
+    g_mutex_unlock(&inodes_mutex);
+
+    return path;
+}
+
+char *inode_child_path(fuse_ino_t parent, const char *name) {
+    char *path = NULL;
+
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(inode_table, GSIZE_TO_POINTER(parent));
+    if (inode != NULL) {
+        // the root is "/", every other directory has no trailing '/'
+        const char *separator = (parent == FUSE_ROOT_ID) ? "" : "/";
+        path = malloc(strlen(inode->path) + strlen(name) + 2);
+        sprintf(path, "%s%s%s", inode->path, separator, name);
+    }
+    g_mutex_unlock(&inodes_mutex);
+
+    return path;
+}
+
+fuse_ino_t inode_lookup(const char *path) {
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(path_table, path);
+    if (inode == NULL) {
+        inode = new_inode(next_ino++, path);
+    }
+    inode->nlookup++;
+    fuse_ino_t ino = inode->ino;
+    g_mutex_unlock(&inodes_mutex);
+
+    return ino;
+}
+
+void inode_forget(fuse_ino_t ino, unsigned long nlookup) {
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(inode_table, GSIZE_TO_POINTER(ino));
+    if (inode != NULL && ino != FUSE_ROOT_ID) {
+        inode->nlookup = (inode->nlookup > nlookup) ? inode->nlookup - nlookup : 0;
+        release_inode(inode);
+    }
+    g_mutex_unlock(&inodes_mutex);
+}
+
+void inode_remove(const char *path) {
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(path_table, path);
+    if (inode != NULL) {
+        unlink_inode(inode);
+    }
+    g_mutex_unlock(&inodes_mutex);
+}
+
+void inode_open(fuse_ino_t ino) {
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(inode_table, GSIZE_TO_POINTER(ino));
+    if (inode != NULL) {
+        inode->nopen++;
+    }
+    g_mutex_unlock(&inodes_mutex);
+}
+
+char *inode_close(fuse_ino_t ino) {
+    char *hidden = NULL;
+
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(inode_table, GSIZE_TO_POINTER(ino));
+    if (inode != NULL && inode->nopen > 0) {
+        inode->nopen--;
+        if (inode->nopen == 0 && inode->hidden && inode->linked) {
+            hidden = strdup(inode->path);
+        }
+    }
+    g_mutex_unlock(&inodes_mutex);
+
+    return hidden;
+}
+
+char *inode_hidden_path(const char *path, int try) {
+    char *hidden = NULL;
+
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(path_table, path);
+    if (inode != NULL && inode->nopen > 0) {
+        // the name libfuse gives to hidden files, in the directory of the entry
+        const char *name = strrchr(path, '/');
+        int dir_size = name - path + 1;
+        hidden = malloc(dir_size + 32);
+        sprintf(hidden, "%.*s.fuse_hidden%08x%08x", dir_size, path, (unsigned int)inode->ino, (unsigned int)try);
+    }
+    g_mutex_unlock(&inodes_mutex);
+
+    return hidden;
+}
+
+void inode_hide(const char *path, const char *hidden) {
+    inode_rename(path, hidden);
+
+    g_mutex_lock(&inodes_mutex);
+    struct sfs_inode *inode = g_hash_table_lookup(path_table, hidden);
+    if (inode != NULL) {
+        inode->hidden = 1;
+    }
+    g_mutex_unlock(&inodes_mutex);
+}
+
+void inode_rename(const char *from, const char *to) {
+    g_mutex_lock(&inodes_mutex);
+
+    struct sfs_inode *inode = g_hash_table_lookup(path_table, from);
+    struct sfs_inode *old_parent = NULL;
+    if (inode != NULL) {
+        old_parent = detach_inode(inode);
+        attach_inode(inode, parent_of(to));
+    }
+
+    // an entry replaced by the rename keeps its inode until it is forgotten
+    struct sfs_inode *replaced = g_hash_table_lookup(path_table, to);
+    if (replaced != NULL && replaced != inode) {
+        unlink_inode(replaced);
+    }
+
+    // only the moved inode and the ones below it are updated
+    if (inode != NULL) {
+        move_inode(inode, strdup(to));
+        release_inode(old_parent);
+    }
+
+    g_mutex_unlock(&inodes_mutex);
+}
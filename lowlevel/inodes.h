@@ -0,0 +1,81 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Inode table of the low-level front end.
+ * Each inode known by the kernel keeps the full path it is reached with in the layer stack, so
+ * requests on an inode get their path with a single lookup instead of walking the tree. Paths are
+ * only built when an entry is looked up or created, and updated when it is renamed. Inode numbers
+ * are never reused.
+ *
+ * Each inode is linked to the inode of its directory, so a rename only updates the paths of the
+ * moved inode and of the inodes below it. As in libfuse, a directory inode is kept while the kernel
+ * still knows inodes below it.
+ *
+ * The layers find files by path, so an entry removed while the kernel still has it open is moved to a
+ * hidden name in its directory instead, and removed with its last release, as libfuse does.
+ */
+
+#ifndef __INODES_H__
+#define __INODES_H__
+
+#ifndef FUSE_USE_VERSION
+#ifdef SFS_FUSE3
+#define FUSE_USE_VERSION 31
+#else
+#define FUSE_USE_VERSION 26
+#endif /* SFS_FUSE3 */
+#endif /* FUSE_USE_VERSION */
+
+#include <fuse_lowlevel.h>
+
+void init_inodes();
+void clean_inodes();
+
+/**
+ * Path of an inode.
+ * @return a copy of the path to free, NULL if the inode is unknown
+ */
+char *inode_path(fuse_ino_t ino);
+
+/**
+ * Path of the entry name of the directory parent.
+ * @return the path to free, NULL if parent is unknown
+ */
+char *inode_child_path(fuse_ino_t parent, const char *name);
+
+// Returns the inode of path, creating it if needed, and adds one kernel reference to it
+fuse_ino_t inode_lookup(const char *path);
+
+// Drops nlookup kernel references of ino, the inode is removed with the last one
+void inode_forget(fuse_ino_t ino, unsigned long nlookup);
+
+// The entry at path was removed, a new entry at the same path gets a new inode
+void inode_remove(const char *path);
+
+// Moves the inode of from, and of everything below it, to the path to
+void inode_rename(const char *from, const char *to);
+
+// The kernel opened ino
+void inode_open(fuse_ino_t ino);
+
+/**
+ * The kernel released an open file of ino.
+ * @return the hidden path to remove if it was the last open file of a hidden entry, to free, NULL otherwise
+ */
+char *inode_close(fuse_ino_t ino);
+
+/**
+ * Hidden path to move the entry at path to instead of removing it, try is incremented to get another
+ * name if the previous one is in use.
+ * @return the path to free, NULL if the entry is not open
+ */
+char *inode_hidden_path(const char *path, int try);
+
+// The entry at path was moved to hidden, which is removed with the last release of the inode
+void inode_hide(const char *path, const char *hidden);
+
+#endif /* __INODES_H__ */
@@ -0,0 +1,810 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "lowlevel.h"
+#include "inodes.h"
+#include "stack.h"
+#include "../logdef.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// validity of the names and attributes given to the kernel, the defaults of the high-level API
+#define ENTRY_TIMEOUT 1.0
+#define ATTR_TIMEOUT 1.0
+
+// largest read and write requests asked from the kernel
+#define MAX_IO_SIZE (1024 * 1024)
+
+// the stack handles writes of any offset and size, set by lowlevel_main
+static int writeback_allowed;
+
+// set when the kernel caches writes, it then merges them into requests of any offset and size
+static int writeback_cache;
+
+// orders the opens, the last releases and the removals of the entries, so that an entry is hidden
+// whenever it is removed while open
+static GMutex hide_mutex;
+
+// attempts at finding an unused hidden name, as libfuse
+#define HIDE_TRIES 10
+
+// the layers return -errno, or -1 for some failures of the backends
+static void reply_res(fuse_req_t req, int res) { fuse_reply_err(req, (res < 0) ? -res : 0); }
+
+static void to_stack_file(const struct fuse_file_info *fi, struct stack_file *file) {
+    memset(file, 0, sizeof(struct stack_file));
+    file->flags = fi->flags;
+    file->fh = fi->fh;
+    file->direct_io = fi->direct_io;
+    file->keep_cache = fi->keep_cache;
+    file->nonseekable = fi->nonseekable;
+}
+
+static void from_stack_file(const struct stack_file *file, struct fuse_file_info *fi) {
+    fi->fh = file->fh;
+    fi->direct_io = file->direct_io;
+    fi->keep_cache = file->keep_cache;
+    fi->nonseekable = file->nonseekable;
+}
+
+// NULL when fi is NULL, the stack calls then take the path based variant of the operation
+static struct stack_file *stack_file_of(struct fuse_file_info *fi, struct stack_file *file) {
+    if (fi == NULL) {
+        return NULL;
+    }
+    to_stack_file(fi, file);
+    return file;
+}
+
+// Open flags given to the stack
+static int open_flags(int flags) {
+    if (writeback_cache) {
+        // the kernel reads the pages partially written by the application and appends by itself
+        if ((flags & O_ACCMODE) == O_WRONLY) {
+            flags = (flags & ~O_ACCMODE) | O_RDWR;
+        }
+        flags &= ~O_APPEND;
+    }
+    return flags;
+}
+
+// Counts an open file of ino, before the layers open it so that a concurrent unlink hides the entry
+static void open_inode(fuse_ino_t ino) {
+    g_mutex_lock(&hide_mutex);
+    inode_open(ino);
+    g_mutex_unlock(&hide_mutex);
+}
+
+// Drops an open file of ino, the entry is removed if it was hidden and this was its last open file
+static void close_inode(fuse_ino_t ino) {
+    g_mutex_lock(&hide_mutex);
+    char *hidden = inode_close(ino);
+    if (hidden != NULL) {
+        if (stack_unlink(hidden) == 0) {
+            inode_remove(hidden);
+        } else {
+            ERROR_MSG("Could not remove the hidden file %s\n", hidden);
+        }
+        free(hidden);
+    }
+    g_mutex_unlock(&hide_mutex);
+}
+
+/*
+ * Moves the entry at path to a hidden name if it is open, called with hide_mutex held.
+ * @return 1 if it was hidden, 0 if it is not open, or what the layers returned
+ */
+static int hide_entry(const char *path) {
+    struct stat stbuf;
+    int res = 0;
+    int try;
+
+    for (try = 0; try < HIDE_TRIES; try++) {
+        char *hidden = inode_hidden_path(path, try);
+        if (hidden == NULL) {
+            return 0;
+        }
+
+        if (stack_getattr(hidden, &stbuf, NULL) == -ENOENT) {
+            res = stack_rename(path, hidden);
+            if (res == 0) {
+                inode_hide(path, hidden);
+                res = 1;
+            }
+            free(hidden);
+            return res;
+        }
+        free(hidden);
+    }
+    return -EBUSY;
+}
+
+// Replies with the inode of the entry at path, which was just looked up or created
+static void reply_entry(fuse_req_t req, const char *path, struct fuse_file_info *fi) {
+    struct fuse_entry_param e;
+    struct stack_file file;
+    memset(&e, 0, sizeof(e));
+
+    int res = stack_getattr(path, &e.attr, stack_file_of(fi, &file));
+    if (res < 0) {
+        reply_res(req, res);
+        return;
+    }
+
+    e.ino = inode_lookup(path);
+    e.attr.st_ino = e.ino;
+    e.attr_timeout = ATTR_TIMEOUT;
+    e.entry_timeout = ENTRY_TIMEOUT;
+
+    if (fi != NULL) {
+        inode_open(e.ino);
+        if (fuse_reply_create(req, &e, fi) == -ENOENT) {
+            // the request was interrupted, the file is not open for the kernel
+            stack_release(path, &file);
+            close_inode(e.ino);
+            inode_forget(e.ino, 1);
+        }
+    } else if (fuse_reply_entry(req, &e) == -ENOENT) {
+        inode_forget(e.ino, 1);
+    }
+}
+
+static void sfs_ll_init(void *userdata, struct fuse_conn_info *conn) {
+#if FUSE_USE_VERSION >= 30
+    if (writeback_allowed && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)) {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        writeback_cache = 1;
+    }
+#else
+    // libfuse 2 limits the requests to 128 KiB
+    if (conn->capable & FUSE_CAP_BIG_WRITES) {
+        conn->want |= FUSE_CAP_BIG_WRITES;
+    }
+#endif
+    // libfuse lowers these to what it and the kernel support
+    conn->max_write = MAX_IO_SIZE;
+    conn->max_readahead = MAX_IO_SIZE;
+
+    DEBUG_MSG("Low-level front end with max_write %u, writeback cache %d\n", conn->max_write, writeback_cache);
+    stack_init();
+}
+
+static void sfs_ll_destroy(void *userdata) { stack_destroy(); }
+
+static void sfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    reply_entry(req, path, NULL);
+    free(path);
+}
+
+static void sfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    inode_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void sfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stat stbuf;
+    struct stack_file file;
+    int res = stack_getattr(path, &stbuf, stack_file_of(fi, &file));
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        stbuf.st_ino = ino;
+        fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+    }
+    free(path);
+}
+
+static void sfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    struct stack_file *open_file = stack_file_of(fi, &file);
+    int res = 0;
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        res = stack_chmod(path, attr->st_mode);
+    }
+    if (res == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+        uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
+        gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
+        res = stack_chown(path, uid, gid);
+    }
+    if (res == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+        res = stack_truncate(path, attr->st_size, open_file);
+    }
+    if (res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        struct timespec tv[2];
+        tv[0].tv_sec = attr->st_atime;
+        tv[0].tv_nsec = (to_set & FUSE_SET_ATTR_ATIME) ? 0 : UTIME_OMIT;
+        tv[1].tv_sec = attr->st_mtime;
+        tv[1].tv_nsec = (to_set & FUSE_SET_ATTR_MTIME) ? 0 : UTIME_OMIT;
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+            tv[0].tv_nsec = UTIME_NOW;
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+            tv[1].tv_nsec = UTIME_NOW;
+        }
+        res = stack_utimens(path, tv);
+    }
+
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        struct stat stbuf;
+        res = stack_getattr(path, &stbuf, open_file);
+        if (res < 0) {
+            reply_res(req, res);
+        } else {
+            stbuf.st_ino = ino;
+            fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+        }
+    }
+    free(path);
+}
+
+static void sfs_ll_readlink(fuse_req_t req, fuse_ino_t ino) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    char link[PATH_MAX + 1];
+    int res = stack_readlink(path, link, sizeof(link));
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        fuse_reply_readlink(req, link);
+    }
+    free(path);
+}
+
+static void sfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int res = stack_mknod(path, mode, rdev);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        reply_entry(req, path, NULL);
+    }
+    free(path);
+}
+
+static void sfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int res = stack_mkdir(path, mode);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        reply_entry(req, path, NULL);
+    }
+    free(path);
+}
+
+static void sfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    g_mutex_lock(&hide_mutex);
+    int res = hide_entry(path);
+    if (res == 0) {
+        res = stack_unlink(path);
+        if (res == 0) {
+            inode_remove(path);
+        }
+    }
+    g_mutex_unlock(&hide_mutex);
+
+    reply_res(req, (res == 1) ? 0 : res);
+    free(path);
+}
+
+static void sfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int res = stack_rmdir(path);
+    if (res == 0) {
+        inode_remove(path);
+    }
+    reply_res(req, res);
+    free(path);
+}
+
+static void sfs_ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int res = stack_symlink(link, path);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        reply_entry(req, path, NULL);
+    }
+    free(path);
+}
+
+#if FUSE_USE_VERSION >= 30
+static void sfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent,
+                          const char *newname, unsigned int flags) {
+    // the layers have no RENAME_EXCHANGE or RENAME_NOREPLACE
+    if (flags != 0) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+#else
+static void sfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent,
+                          const char *newname) {
+#endif
+    char *from = inode_child_path(parent, name);
+    char *to = inode_child_path(newparent, newname);
+
+    if (from == NULL || to == NULL) {
+        fuse_reply_err(req, ENOENT);
+    } else {
+        // an open entry replaced by the rename is kept as a hidden file
+        g_mutex_lock(&hide_mutex);
+        int res = hide_entry(to);
+        if (res >= 0) {
+            res = stack_rename(from, to);
+            if (res == 0) {
+                inode_rename(from, to);
+            }
+        }
+        g_mutex_unlock(&hide_mutex);
+        reply_res(req, res);
+    }
+    free(from);
+    free(to);
+}
+
+static void sfs_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname) {
+    char *from = inode_path(ino);
+    char *to = inode_child_path(newparent, newname);
+
+    if (from == NULL || to == NULL) {
+        fuse_reply_err(req, ENOENT);
+    } else {
+        int res = stack_link(from, to);
+        if (res < 0) {
+            reply_res(req, res);
+        } else {
+            reply_entry(req, to, NULL);
+        }
+    }
+    free(from);
+    free(to);
+}
+
+static void sfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                          struct fuse_file_info *fi) {
+    char *path = inode_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    file.flags = open_flags(fi->flags);
+    int res = stack_create(path, mode, &file);
+    from_stack_file(&file, fi);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        reply_entry(req, path, fi);
+    }
+    free(path);
+}
+
+static void sfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    file.flags = open_flags(fi->flags);
+    open_inode(ino);
+    int res = stack_open(path, &file);
+    from_stack_file(&file, fi);
+    if (res < 0) {
+        close_inode(ino);
+        reply_res(req, res);
+    } else if (fuse_reply_open(req, fi) == -ENOENT) {
+        // the request was interrupted, the file is not open for the kernel
+        stack_release(path, &file);
+        close_inode(ino);
+    }
+    free(path);
+}
+
+static void sfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    char *buf = malloc(size);
+    int res = stack_read(path, buf, size, off, &file);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        fuse_reply_buf(req, buf, res);
+    }
+    free(buf);
+    free(path);
+}
+
+static void sfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                         struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    int res = stack_write(path, buf, size, off, &file);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        fuse_reply_write(req, res);
+    }
+    free(path);
+}
+
+static void sfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    int res = stack_flush(path, &file);
+    reply_res(req, (res == -ENOSYS) ? 0 : res);
+    free(path);
+}
+
+static void sfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    int res = stack_release(path, &file);
+    close_inode(ino);
+    reply_res(req, res);
+    free(path);
+}
+
+static void sfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    reply_res(req, stack_fsync(path, datasync, &file));
+    free(path);
+}
+
+static void sfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    int res = stack_opendir(path, &file);
+    from_stack_file(&file, fi);
+    if (res < 0) {
+        reply_res(req, res);
+    } else if (fuse_reply_open(req, fi) == -ENOENT) {
+        stack_releasedir(path, &file);
+    }
+    free(path);
+}
+
+// Directory entries of a readdir reply
+struct dir_buf {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+};
+
+static int fill_dir(void *data, const char *name, const struct stat *stbuf, off_t off) {
+    struct dir_buf *dir = (struct dir_buf *)data;
+    struct stat st;
+
+    memset(&st, 0, sizeof(st));
+    if (stbuf != NULL) {
+        st.st_ino = stbuf->st_ino;
+        st.st_mode = stbuf->st_mode;
+    }
+
+    size_t entry_size = fuse_add_direntry(dir->req, NULL, 0, name, NULL, 0);
+    if (dir->used + entry_size > dir->size) {
+        return 1;
+    }
+    fuse_add_direntry(dir->req, &dir->buf[dir->used], dir->size - dir->used, name, &st, off);
+    dir->used += entry_size;
+    return 0;
+}
+
+static void sfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // the layers fill entries with the offset of the next one, as the readdir of the high-level API does
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    struct dir_buf dir = {req, malloc(size), size, 0};
+    int res = stack_readdir(path, &dir, fill_dir, off, &file);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        fuse_reply_buf(req, dir.buf, dir.used);
+    }
+    free(dir.buf);
+    free(path);
+}
+
+static void sfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stack_file file;
+    to_stack_file(fi, &file);
+    reply_res(req, stack_releasedir(path, &file));
+    free(path);
+}
+
+static void sfs_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+    struct statvfs stbuf;
+    int res = stack_statfs("/", &stbuf);
+    if (res < 0) {
+        reply_res(req, res);
+    } else {
+        fuse_reply_statfs(req, &stbuf);
+    }
+}
+
+static void sfs_ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size,
+                            int flags) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    reply_res(req, stack_setxattr(path, name, value, size, flags));
+    free(path);
+}
+
+// Replies to getxattr and listxattr, size 0 asks for the size of the value
+static void reply_xattr(fuse_req_t req, int res, const char *value, size_t size) {
+    if (res < 0) {
+        reply_res(req, res);
+    } else if (size == 0) {
+        fuse_reply_xattr(req, res);
+    } else {
+        fuse_reply_buf(req, value, res);
+    }
+}
+
+static void sfs_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    char *value = (size > 0) ? malloc(size) : NULL;
+    int res = stack_getxattr(path, name, value, size);
+    reply_xattr(req, res, value, size);
+    free(value);
+    free(path);
+}
+
+static void sfs_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    char *list = (size > 0) ? malloc(size) : NULL;
+    int res = stack_listxattr(path, list, size);
+    reply_xattr(req, res, list, size);
+    free(list);
+    free(path);
+}
+
+static void sfs_ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    reply_res(req, stack_removexattr(path, name));
+    free(path);
+}
+
+static void sfs_ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+    char *path = inode_path(ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    reply_res(req, stack_access(path, mask));
+    free(path);
+}
+
+static struct fuse_lowlevel_ops sfs_ll_oper = {
+    .init = sfs_ll_init,
+    .destroy = sfs_ll_destroy,
+    .lookup = sfs_ll_lookup,
+    .forget = sfs_ll_forget,
+    .getattr = sfs_ll_getattr,
+    .setattr = sfs_ll_setattr,
+    .readlink = sfs_ll_readlink,
+    .mknod = sfs_ll_mknod,
+    .mkdir = sfs_ll_mkdir,
+    .unlink = sfs_ll_unlink,
+    .rmdir = sfs_ll_rmdir,
+    .symlink = sfs_ll_symlink,
+    .rename = sfs_ll_rename,
+    .link = sfs_ll_link,
+    .create = sfs_ll_create,
+    .open = sfs_ll_open,
+    .read = sfs_ll_read,
+    .write = sfs_ll_write,
+    .flush = sfs_ll_flush,
+    .release = sfs_ll_release,
+    .fsync = sfs_ll_fsync,
+    .opendir = sfs_ll_opendir,
+    .readdir = sfs_ll_readdir,
+    .releasedir = sfs_ll_releasedir,
+    .statfs = sfs_ll_statfs,
+    .setxattr = sfs_ll_setxattr,
+    .getxattr = sfs_ll_getxattr,
+    .listxattr = sfs_ll_listxattr,
+    .removexattr = sfs_ll_removexattr,
+    .access = sfs_ll_access,
+};
+
+#if FUSE_USE_VERSION >= 30
+int lowlevel_main(struct fuse_args *args, const struct fuse_operations *operations, int writeback) {
+    struct fuse_cmdline_opts opts;
+    int res = -1;
+
+    stack_set_operations(operations);
+    writeback_allowed = writeback;
+    init_inodes();
+    g_mutex_init(&hide_mutex);
+
+    if (fuse_parse_cmdline(args, &opts) != 0 || opts.mountpoint == NULL) {
+        ERROR_MSG("Could not parse the fuse options\n");
+        free(opts.mountpoint);
+        clean_inodes();
+        return -1;
+    }
+
+    struct fuse_session *se = fuse_session_new(args, &sfs_ll_oper, sizeof(sfs_ll_oper), NULL);
+    if (se != NULL) {
+        if (fuse_set_signal_handlers(se) != -1) {
+            if (fuse_session_mount(se, opts.mountpoint) == 0) {
+                fuse_daemonize(opts.foreground);
+                res = opts.singlethread ? fuse_session_loop(se) : fuse_session_loop_mt(se, opts.clone_fd);
+                fuse_session_unmount(se);
+            }
+            fuse_remove_signal_handlers(se);
+        }
+        fuse_session_destroy(se);
+    }
+    free(opts.mountpoint);
+    clean_inodes();
+
+    return res;
+}
+#else
+int lowlevel_main(struct fuse_args *args, const struct fuse_operations *operations, int writeback) {
+    char *mountpoint;
+    int multithreaded, foreground;
+    int res = -1;
+
+    // the writeback cache needs libfuse 3
+    stack_set_operations(operations);
+    writeback_allowed = writeback;
+    init_inodes();
+    g_mutex_init(&hide_mutex);
+
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+        ERROR_MSG("Could not parse the fuse options\n");
+        clean_inodes();
+        return -1;
+    }
+
+    struct fuse_chan *ch = fuse_mount(mountpoint, args);
+    if (ch != NULL) {
+        struct fuse_session *se = fuse_lowlevel_new(args, &sfs_ll_oper, sizeof(sfs_ll_oper), NULL);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                fuse_daemonize(foreground);
+                res = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+    clean_inodes();
+
+    return res;
+}
+#endif
@@ -0,0 +1,28 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Front end on the low-level (inode based) fuse API.
+ * The kernel addresses files by inode number, and the path of each inode is kept in the inode table
+ * so it is not rebuilt by libfuse on every request. The layer stack still receives paths.
+ * With SFS_FUSE3 the front end is built against libfuse 3, which adds the kernel writeback cache
+ * and requests of up to 1 MiB.
+ */
+
+#ifndef __LOWLEVEL_H__
+#define __LOWLEVEL_H__
+
+// the front end may be built against libfuse 3, so the fuse headers of the layers are not included
+struct fuse_args;
+struct fuse_operations;
+
+/**
+ * Mounts the stack on the mount point given in args and serves requests until it is unmounted
+ * @param writeback the stack handles writes of any offset and size, so the kernel may cache them
+ */
+int lowlevel_main(struct fuse_args *args, const struct fuse_operations *operations, int writeback);
+
+#endif /* __LOWLEVEL_H__ */
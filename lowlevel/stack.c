@@ -0,0 +1,297 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "stack.h"
+#include "../layers_def.h"
+#include <errno.h>
+#include <string.h>
+
+// operations of the top layer of the stack
+static const struct fuse_operations *stack;
+
+static void to_fuse_file(const struct stack_file *file, struct fuse_file_info *fi) {
+    memset(fi, 0, sizeof(struct fuse_file_info));
+    fi->flags = file->flags;
+    fi->fh = file->fh;
+    fi->direct_io = file->direct_io;
+    fi->keep_cache = file->keep_cache;
+    fi->nonseekable = file->nonseekable;
+}
+
+// the layers may set the handle and open flags of the file
+static void from_fuse_file(const struct fuse_file_info *fi, struct stack_file *file) {
+    file->fh = fi->fh;
+    file->direct_io = fi->direct_io;
+    file->keep_cache = fi->keep_cache;
+    file->nonseekable = fi->nonseekable;
+}
+
+void stack_set_operations(const struct fuse_operations *operations) { stack = operations; }
+
+void stack_init() {
+    struct fuse_conn_info conn;
+
+    if (stack->init != NULL) {
+        memset(&conn, 0, sizeof(conn));
+        stack->init(&conn);
+    }
+}
+
+void stack_destroy() {
+    if (stack->destroy != NULL) {
+        stack->destroy(NULL);
+    }
+}
+
+int stack_getattr(const char *path, struct stat *stbuf, struct stack_file *file) {
+    if (file != NULL && stack->fgetattr != NULL) {
+        struct fuse_file_info fi;
+        to_fuse_file(file, &fi);
+        return stack->fgetattr(path, stbuf, &fi);
+    }
+    return stack->getattr(path, stbuf);
+}
+
+int stack_truncate(const char *path, off_t size, struct stack_file *file) {
+    if (file != NULL && stack->ftruncate != NULL) {
+        struct fuse_file_info fi;
+        to_fuse_file(file, &fi);
+        return stack->ftruncate(path, size, &fi);
+    }
+    if (stack->truncate == NULL) {
+        return -ENOSYS;
+    }
+    return stack->truncate(path, size);
+}
+
+int stack_chmod(const char *path, mode_t mode) {
+    if (stack->chmod == NULL) {
+        return -ENOSYS;
+    }
+    return stack->chmod(path, mode);
+}
+
+int stack_chown(const char *path, uid_t uid, gid_t gid) {
+    if (stack->chown == NULL) {
+        return -ENOSYS;
+    }
+    return stack->chown(path, uid, gid);
+}
+
+int stack_utimens(const char *path, const struct timespec tv[2]) {
+    if (stack->utimens == NULL) {
+        return -ENOSYS;
+    }
+    return stack->utimens(path, tv);
+}
+
+int stack_readlink(const char *path, char *buf, size_t size) {
+    if (stack->readlink == NULL) {
+        return -ENOSYS;
+    }
+    return stack->readlink(path, buf, size);
+}
+
+int stack_mknod(const char *path, mode_t mode, dev_t rdev) {
+    if (stack->mknod == NULL) {
+        return -ENOSYS;
+    }
+    return stack->mknod(path, mode, rdev);
+}
+
+int stack_mkdir(const char *path, mode_t mode) {
+    if (stack->mkdir == NULL) {
+        return -ENOSYS;
+    }
+    return stack->mkdir(path, mode);
+}
+
+int stack_unlink(const char *path) {
+    if (stack->unlink == NULL) {
+        return -ENOSYS;
+    }
+    return stack->unlink(path);
+}
+
+int stack_rmdir(const char *path) {
+    if (stack->rmdir == NULL) {
+        return -ENOSYS;
+    }
+    return stack->rmdir(path);
+}
+
+int stack_symlink(const char *from, const char *to) {
+    if (stack->symlink == NULL) {
+        return -ENOSYS;
+    }
+    return stack->symlink(from, to);
+}
+
+int stack_rename(const char *from, const char *to) {
+    if (stack->rename == NULL) {
+        return -ENOSYS;
+    }
+    return stack->rename(from, to);
+}
+
+int stack_link(const char *from, const char *to) {
+    if (stack->link == NULL) {
+        return -ENOSYS;
+    }
+    return stack->link(from, to);
+}
+
+int stack_create(const char *path, mode_t mode, struct stack_file *file) {
+    if (stack->create == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->create(path, mode, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_open(const char *path, struct stack_file *file) {
+    if (stack->open == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->open(path, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_read(const char *path, char *buf, size_t size, off_t offset, struct stack_file *file) {
+    if (stack->read == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->read(path, buf, size, offset, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_write(const char *path, const char *buf, size_t size, off_t offset, struct stack_file *file) {
+    if (stack->write == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->write(path, buf, size, offset, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_flush(const char *path, struct stack_file *file) {
+    if (stack->flush == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->flush(path, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_release(const char *path, struct stack_file *file) {
+    if (stack->release == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->release(path, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_fsync(const char *path, int datasync, struct stack_file *file) {
+    if (stack->fsync == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->fsync(path, datasync, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_opendir(const char *path, struct stack_file *file) {
+    if (stack->opendir == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->opendir(path, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_readdir(const char *path, void *buf, stack_fill_dir_t filler, off_t offset, struct stack_file *file) {
+    if (stack->readdir == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->readdir(path, buf, filler, offset, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_releasedir(const char *path, struct stack_file *file) {
+    if (stack->releasedir == NULL) {
+        return -ENOSYS;
+    }
+    struct fuse_file_info fi;
+    to_fuse_file(file, &fi);
+    int res = stack->releasedir(path, &fi);
+    from_fuse_file(&fi, file);
+    return res;
+}
+
+int stack_statfs(const char *path, struct statvfs *stbuf) {
+    if (stack->statfs == NULL) {
+        return -ENOSYS;
+    }
+    return stack->statfs(path, stbuf);
+}
+
+int stack_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    if (stack->setxattr == NULL) {
+        return -ENOSYS;
+    }
+    return stack->setxattr(path, name, value, size, flags);
+}
+
+int stack_getxattr(const char *path, const char *name, char *value, size_t size) {
+    if (stack->getxattr == NULL) {
+        return -ENOSYS;
+    }
+    return stack->getxattr(path, name, value, size);
+}
+
+int stack_listxattr(const char *path, char *list, size_t size) {
+    if (stack->listxattr == NULL) {
+        return -ENOSYS;
+    }
+    return stack->listxattr(path, list, size);
+}
+
+int stack_removexattr(const char *path, const char *name) {
+    if (stack->removexattr == NULL) {
+        return -ENOSYS;
+    }
+    return stack->removexattr(path, name);
+}
+
+int stack_access(const char *path, int mask) {
+    if (stack->access == NULL) {
+        return -ENOSYS;
+    }
+    return stack->access(path, mask);
+}
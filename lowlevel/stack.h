@@ -0,0 +1,74 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Calls from the low-level front end into the layer stack.
+ * The front end can be built against libfuse 2 or 3 while the layers always use the libfuse 2
+ * operations, so this interface does not depend on the fuse headers: open files are described by
+ * struct stack_file instead of struct fuse_file_info, whose layout differs between both versions.
+ * Operations missing from the stack return -ENOSYS.
+ */
+
+#ifndef __STACK_H__
+#define __STACK_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct fuse_operations;
+
+struct stack_file {
+    int flags;
+    uint64_t fh;
+    unsigned int direct_io : 1;
+    unsigned int keep_cache : 1;
+    unsigned int nonseekable : 1;
+};
+
+// same as fuse_fill_dir_t of libfuse 2
+typedef int (*stack_fill_dir_t)(void *buf, const char *name, const struct stat *stbuf, off_t off);
+
+void stack_set_operations(const struct fuse_operations *operations);
+
+void stack_init();
+void stack_destroy();
+
+// uses fgetattr when file is not NULL
+int stack_getattr(const char *path, struct stat *stbuf, struct stack_file *file);
+int stack_chmod(const char *path, mode_t mode);
+int stack_chown(const char *path, uid_t uid, gid_t gid);
+// uses ftruncate when file is not NULL
+int stack_truncate(const char *path, off_t size, struct stack_file *file);
+int stack_utimens(const char *path, const struct timespec tv[2]);
+int stack_readlink(const char *path, char *buf, size_t size);
+int stack_mknod(const char *path, mode_t mode, dev_t rdev);
+int stack_mkdir(const char *path, mode_t mode);
+int stack_unlink(const char *path);
+int stack_rmdir(const char *path);
+int stack_symlink(const char *from, const char *to);
+int stack_rename(const char *from, const char *to);
+int stack_link(const char *from, const char *to);
+int stack_create(const char *path, mode_t mode, struct stack_file *file);
+int stack_open(const char *path, struct stack_file *file);
+int stack_read(const char *path, char *buf, size_t size, off_t offset, struct stack_file *file);
+int stack_write(const char *path, const char *buf, size_t size, off_t offset, struct stack_file *file);
+int stack_flush(const char *path, struct stack_file *file);
+int stack_release(const char *path, struct stack_file *file);
+int stack_fsync(const char *path, int datasync, struct stack_file *file);
+int stack_opendir(const char *path, struct stack_file *file);
+int stack_readdir(const char *path, void *buf, stack_fill_dir_t filler, off_t offset, struct stack_file *file);
+int stack_releasedir(const char *path, struct stack_file *file);
+int stack_statfs(const char *path, struct statvfs *stbuf);
+int stack_setxattr(const char *path, const char *name, const char *value, size_t size, int flags);
+int stack_getxattr(const char *path, const char *name, char *value, size_t size);
+int stack_listxattr(const char *path, char *list, size_t size);
+int stack_removexattr(const char *path, const char *name);
+int stack_access(const char *path, int mask);
+
+#endif /* __STACK_H__ */
@@ -38,6 +38,11 @@ int init_hash(ivdb* st) {
     return 0;
 }
 
+int init_hash_full(ivdb* st) {
+    st->hash = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    return 0;
+}
+
 int hash_put(ivdb* st, char* key, value_db* value) {
     g_hash_table_insert(st->hash, key, value);
 
@@ -80,4 +85,21 @@ void move_key(ivdb* st, char* from, char* to) {
     }
 }
 
-void remove_keys(ivdb* st, char* key) { g_hash_table_remove(st->hash, key); }
\ No newline at end of file
+void remove_keys(ivdb* st, char* key) { g_hash_table_remove(st->hash, key); }
+
+int path_has_prefix(const char* path, const char* prefix) {
+    size_t len = strlen(prefix);
+
+    if (strncmp(path, prefix, len) != 0) {
+        return 0;
+    }
+    return path[len] == '\0' || path[len] == '/';
+}
+
+static gboolean is_under_path(gpointer key, gpointer value, gpointer prefix) {
+    return path_has_prefix((char*)key, (char*)prefix);
+}
+
+void remove_keys_with_prefix(ivdb* st, const char* key) {
+    g_hash_table_foreach_remove(st->hash, is_under_path, (gpointer)key);
+}
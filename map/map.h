@@ -15,12 +15,22 @@
 
 typedef struct db_struct { GHashTable* hash; } ivdb;
 
-typedef struct value { uint64_t file_size; } value_db;
+typedef struct value {
+    uint64_t file_size;
+    // Open handles keeping the entry, for maps of open files
+    int open_count;
+    // Blocks [zero_start, zero_end) known to be zeros, for maps of file sizes
+    uint64_t zero_start;
+    uint64_t zero_end;
+} value_db;
 
 char* get_unique_ident(int offset, const char* path);
 
 int init_hash(ivdb* db);
 
+// Same as init_hash but keys and values are freed when removed or replaced
+int init_hash_full(ivdb* db);
+
 int hash_put(ivdb* db, char* key, value_db* value);
 
 int hash_get(ivdb* db, char* key, value_db** value);
@@ -36,6 +46,12 @@ void print_keys(struct db_struct* st);
 
 void remove_keys(ivdb* st, char* key);
 
+// Returns 1 if path is prefix or a path inside the directory prefix
+int path_has_prefix(const char* path, const char* prefix);
+
+// Remove the key and every key naming a path inside the directory "key"
+void remove_keys_with_prefix(ivdb* st, const char* key);
+
 void move_key(ivdb* st, char* from, char* to);
 
 #endif
@@ -104,11 +104,24 @@ void init_erasure(int k, int m) {
     init_hash(&file_sizes);
 }
 
-void erasure_decode(unsigned char* block, unsigned char** magicblocks, int size, int ndevs) {
+void erasure_prepare_read(struct io_request* requests, unsigned char* block, int size, int ndevs) {
+    int i;
+    for (i = 0; i < ndevs; i++) {
+        io_request_append(&requests[i], malloc(size), size, 1);
+    }
+}
+
+void erasure_decode(unsigned char* block, struct io_request* requests, int size, int ndevs) {
     uint64_t decoded_size;
     char* decoded_block;
+    char* fragments[ndevs];
+    int i;
 
-    liberasurecode_decode(instance_descriptor, (char**)magicblocks, ndevs, size, 0, &decoded_block, &decoded_size);
+    for (i = 0; i < ndevs; i++) {
+        fragments[i] = requests[i].iov[0].iov_base;
+    }
+
+    liberasurecode_decode(instance_descriptor, fragments, ndevs, size, 0, &decoded_block, &decoded_size);
 
     memcpy(block, decoded_block, (int)decoded_size);
 
@@ -150,7 +163,7 @@ void increment_file_size(const char* path, off_t offset, int block_size) {
     g_mutex_unlock(&size_mutex);
 }
 
-void erasure_encode(const char* path, unsigned char** magicblocks, unsigned char* block, off_t offset, int size,
+void erasure_encode(const char* path, struct io_request* requests, const unsigned char* block, off_t offset, int size,
                     int ndevs) {
     g_mutex_lock(&mutex);
 
@@ -214,19 +227,19 @@ void erasure_encode(const char* path, unsigned char** magicblocks, unsigned char
     hash_put(&offset_map, read_block_start_offset, db_read_block_start_offset);
     hash_put(&offset_map, read_block_start_size, db_read_block_start_size);
 
-    int l;
-    for (l = 0; l < ndevs; l++) {
-        magicblocks[l] = malloc(fragment_length);
-    }
-
+    // the fragments are released by liberasurecode_encode_cleanup, so the requests keep their own copy
     int i;
     for (i = 0; i < args.k; i++) {
-        memcpy(magicblocks[i], encoded_data[i], fragment_length);
+        unsigned char* fragment = malloc(fragment_length);
+        memcpy(fragment, encoded_data[i], fragment_length);
+        io_request_append(&requests[i], fragment, fragment_length, 1);
     }
 
     int j;
     for (j = 0; j < args.m; j++) {
-        memcpy(magicblocks[i + j], encoded_parity[j], fragment_length);
+        unsigned char* fragment = malloc(fragment_length);
+        memcpy(fragment, encoded_parity[j], fragment_length);
+        io_request_append(&requests[i + j], fragment, fragment_length, 1);
     }
     liberasurecode_encode_cleanup(instance_descriptor, encoded_data, encoded_parity);
     g_mutex_unlock(&mutex);
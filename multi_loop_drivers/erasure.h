@@ -2,6 +2,7 @@
 #define __ERASURE_H__
 
 #include <sys/types.h>
+#include "io_request.h"
 
 void init_erasure(int k, int m);
 
@@ -11,16 +12,20 @@ void get_erasure_block_offset(const char* path, off_t offset, off_t* erasure_siz
 
 void get_erasure_block_size(const char* path, off_t offset, uint64_t* erasue_size);
 
-void erasure_encode(const char* path, unsigned char** magicblocks, unsigned char* block, off_t offset, int size,
+void erasure_encode(const char* path, struct io_request* requests, const unsigned char* block, off_t offset, int size,
                     int ndevs);
+
+// fragments are read into buffers of the requests since they are larger than the decoded block
+void erasure_prepare_read(struct io_request* requests, unsigned char* block, int size, int ndevs);
+
 /**
  * Decode blocks of erasure coded data.
  * @param block Destination for the decoded block
- * @param magicblocks Encoded blocks
- * @param size Size of the blocks
- * @param ndevs The number of blocks to write to
+ * @param requests Requests holding the encoded fragments
+ * @param size Size of the fragments
+ * @param ndevs The number of fragments
  */
-void erasure_decode(unsigned char* block, unsigned char** magicblocks, int size, int ndevs);
+void erasure_decode(unsigned char* block, struct io_request* requests, int size, int ndevs);
 
 void erasure_rename(char* from, char* to);
 
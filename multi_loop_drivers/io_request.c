@@ -0,0 +1,54 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "io_request.h"
+#include <stdlib.h>
+#include <string.h>
+
+void io_request_init(struct io_request *request) { request->nsegments = 0; }
+
+int io_request_append(struct io_request *request, void *buf, size_t size, int owned) {
+    if (request->nsegments == IO_REQUEST_MAX_SEGMENTS) {
+        return -1;
+    }
+    request->iov[request->nsegments].iov_base = buf;
+    request->iov[request->nsegments].iov_len = size;
+    request->owned[request->nsegments] = owned;
+    request->nsegments++;
+    return 0;
+}
+
+int io_request_prepend(struct io_request *request, void *buf, size_t size, int owned) {
+    if (request->nsegments == IO_REQUEST_MAX_SEGMENTS) {
+        return -1;
+    }
+    memmove(&request->iov[1], &request->iov[0], request->nsegments * sizeof(struct iovec));
+    memmove(&request->owned[1], &request->owned[0], request->nsegments * sizeof(int));
+    request->iov[0].iov_base = buf;
+    request->iov[0].iov_len = size;
+    request->owned[0] = owned;
+    request->nsegments++;
+    return 0;
+}
+
+size_t io_request_size(const struct io_request *request) {
+    size_t size = 0;
+    int i;
+    for (i = 0; i < request->nsegments; i++) {
+        size += request->iov[i].iov_len;
+    }
+    return size;
+}
+
+void io_request_clean(struct io_request *request) {
+    int i;
+    for (i = 0; i < request->nsegments; i++) {
+        if (request->owned[i]) {
+            free(request->iov[i].iov_base);
+        }
+    }
+    request->nsegments = 0;
+}
@@ -0,0 +1,48 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+
+#ifndef __IO_REQUEST_H__
+#define __IO_REQUEST_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define IO_REQUEST_MAX_SEGMENTS 4
+
+/*
+ * Data read or written on one device as a list of segments, issued with a single preadv/pwritev.
+ * Segments either reference memory of the caller (e.g. the fuse buffer) or are owned by the
+ * request and freed by io_request_clean, so drivers only allocate the data they actually transform.
+ */
+struct io_request {
+    struct iovec iov[IO_REQUEST_MAX_SEGMENTS];
+    int owned[IO_REQUEST_MAX_SEGMENTS];
+    int nsegments;
+};
+
+void io_request_init(struct io_request *request);
+
+/**
+ * Adds a segment at the end of the request.
+ * @param owned 1 if the request takes ownership of buf, 0 if buf must outlive the request
+ * @return 0 on success, -1 if the request has no free segments
+ */
+int io_request_append(struct io_request *request, void *buf, size_t size, int owned);
+
+/**
+ * Adds a segment at the start of the request, e.g. a header in front of the data.
+ * @return 0 on success, -1 if the request has no free segments
+ */
+int io_request_prepend(struct io_request *request, void *buf, size_t size, int owned);
+
+// total number of bytes of the request
+size_t io_request_size(const struct io_request *request);
+
+// frees the owned segments and leaves the request empty
+void io_request_clean(struct io_request *request);
+
+#endif /* __IO_REQUEST_H__ */
@@ -8,15 +8,27 @@
 #include <string.h>
 #include <stdlib.h>
 
-void rep_decode(unsigned char *block, unsigned char **magicblocks, int size, int ndevs) {
-    memcpy(block, magicblocks[0], size);
+void rep_prepare_read(struct io_request *requests, unsigned char *block, int size, int ndevs) {
+    int i;
+
+    // the first replica is read straight into the destination, the others are only checked for their size
+    io_request_append(&requests[0], block, size, 0);
+    for (i = 1; i < ndevs; i++) {
+        io_request_append(&requests[i], malloc(size), size, 1);
+    }
+}
+
+void rep_decode(unsigned char *block, struct io_request *requests, int size, int ndevs) {
+    if (requests[0].iov[0].iov_base != block) {
+        memcpy(block, requests[0].iov[0].iov_base, size);
+    }
 }
 
-void rep_encode(const char *path, unsigned char **magicblocks, unsigned char *block, off_t offset, int size,
+void rep_encode(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
                 int ndevs) {
     int i = 0;
 
     for (i = 0; i < ndevs; i++) {
-        memcpy(magicblocks[i], block, size);
+        io_request_append(&requests[i], (void *)block, size, 0);
     }
-}
\ No newline at end of file
+}
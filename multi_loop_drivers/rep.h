@@ -9,9 +9,14 @@
 #define __MULTI_REP_H__
 
 #include <sys/types.h>
+#include "io_request.h"
 
-void rep_decode(unsigned char *block, unsigned char **magicblocks, int size, int ndevs);
+void rep_prepare_read(struct io_request *requests, unsigned char *block, int size, int ndevs);
 
-void rep_encode(const char *path, unsigned char **magicblocks, unsigned char *block, off_t offset, int size, int ndevs);
+void rep_decode(unsigned char *block, struct io_request *requests, int size, int ndevs);
+
+// every replica is written from block, which must stay valid until the requests are done
+void rep_encode(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
+                int ndevs);
 
 #endif /* __MULTI_REP_H__ */
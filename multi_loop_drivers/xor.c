@@ -10,30 +10,52 @@
 #include <stdlib.h>
 #include "../utils.h"
 
-void xor_blocks(unsigned char *b1, unsigned char *b2, unsigned char *r, int len) {
+void xor_blocks(const unsigned char *b1, const unsigned char *b2, unsigned char *r, int len) {
     int i;
     for (i = 0; i < len; i++) {
         r[i] = (char)(b1[i] ^ b2[i]);
     }
 }
 
-void decode_xor(unsigned char *block, unsigned char **magicblocks, int size, int ndevs) {
+void prepare_read_xor(struct io_request *requests, unsigned char *block, int size, int ndevs) {
+    int i;
+
+    // the first share is read into the destination and the others are xored on top of it
+    io_request_append(&requests[0], block, size, 0);
+    for (i = 1; i < ndevs; i++) {
+        io_request_append(&requests[i], malloc(size), size, 1);
+    }
+}
+
+void decode_xor(unsigned char *block, struct io_request *requests, int size, int ndevs) {
     int i = 0;
 
-    memcpy(block, magicblocks[0], size);
+    if (requests[0].iov[0].iov_base != block) {
+        memcpy(block, requests[0].iov[0].iov_base, size);
+    }
 
     for (i = 1; i < ndevs; i++) {
-        xor_blocks(block, magicblocks[i], block, size);
+        xor_blocks(block, requests[i].iov[0].iov_base, block, size);
     }
 }
 
-void encode_xor(const char *path, unsigned char **magicblocks, unsigned char *block, off_t offset, int size,
+void encode_xor(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
                 int ndevs) {
     int i = 0;
+    unsigned char *parity = malloc(size);
+    const unsigned char *src = block;
+
+    // the parity is computed while generating the random shares, so block is never modified or copied
     for (i = 0; i < ndevs - 1; i++) {
-        generate_random_block(magicblocks[i], size);
-        xor_blocks(block, magicblocks[i], block, size);
+        unsigned char *share = malloc(size);
+        generate_random_block(share, size);
+        xor_blocks(src, share, parity, size);
+        src = parity;
+        io_request_append(&requests[i], share, size, 1);
     }
 
-    memcpy(magicblocks[i], block, size);
+    if (i == 0) {
+        memcpy(parity, block, size);
+    }
+    io_request_append(&requests[i], parity, size, 1);
 }
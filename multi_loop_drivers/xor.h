@@ -10,9 +10,13 @@
 #define __XOR_H__
 
 #include <sys/types.h>
+#include "io_request.h"
 
-void decode_xor(unsigned char *block, unsigned char **magicblocks, int size, int ndevs);
+void prepare_read_xor(struct io_request *requests, unsigned char *block, int size, int ndevs);
 
-void encode_xor(const char *path, unsigned char **magicblocks, unsigned char *block, off_t offset, int size, int ndevs);
+void decode_xor(unsigned char *block, struct io_request *requests, int size, int ndevs);
+
+void encode_xor(const char *path, struct io_request *requests, const unsigned char *block, off_t offset, int size,
+                int ndevs);
 
 #endif /* __XOR_H__ */
@@ -9,44 +9,73 @@
 #include "multi_loopback.h"
 #include "utils.h"
 #include "timestamps/timestamps.h"
+#include "plugins/plugin.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
 
-int NDEVS;
-// struct with encode algorithms
-char **devices_path;
-GThreadPool *thread_pool;
+// shared by the devices of every instance
+static GThreadPool *thread_pool = NULL;
 
 #define MAX_THREADS 10
 
-static struct multi_driver m_driver;
-int DRIVER;
+// one per stack with a multi_loopback layer
+static struct multi_loop_instance instances[MAX_MULTI_LOOP_INSTANCES];
+static int ninstances = 0;
 
-GSList *multi_write_list = NULL, *multi_read_list = NULL;
+static struct latency_histogram *multi_write_latency, *multi_read_latency;
+
+static void complete_async_op(struct async_request *request);
+
+// names of the traced device operations, by op_type
+static const char *op_names[] = {
+    [READ_OP] = "preadv", [WRITE_OP] = "pwritev", [RELEASE_OP] = "close", [RENAME_OP] = "rename",
+    [FLUSH_OP] = "flush", [FSYNC_OP] = "fsync", [TRUNCATE_OP] = "truncate", [FTRUNCATE_OP] = "ftruncate",
+    [MKNOD_OP] = "mknod", [MKDIR_OP] = "mkdir", [UNLINK_OP] = "unlink", [RMDIR_OP] = "rmdir",
+    [CREATE_OP] = "create", [OPEN_OP] = "open", [OPENDIR_OP] = "opendir", [RELEASEDIR_OP] = "closedir",
+    [SYMLINK_OP] = "symlink", [LINK_OP] = "link", [CHMOD_OP] = "chmod", [CHOWN_OP] = "lchown"};
+
+// Hands the operation of device dev to the device threads
+static void push_op(struct op_info *inf, int dev) {
+    inf->dev = dev;
+    inf->trace_request = trace_current();
+    if (inf->trace_request != 0) {
+        inf->queued = latency_now();
+    }
+    g_thread_pool_push(thread_pool, inf, NULL);
+}
 
 void threads_func(gpointer data, gpointer user_data) {
     struct op_info *inf = (struct op_info *)data;
+    uint64_t tstart = 0;
+
+    if (inf->trace_request != 0) {
+        tstart = latency_now();
+        trace_record(inf->trace_request, "multi.queue", inf->queued, inf->dev);
+    }
 
     switch (inf->op_type) {
         case READ_OP:
-            if (DRIVER == ERASURE) {
+            // reads and writes are always asynchronous requests
+            if (inf->async->ml->mode == ERASURE) {
                 DEBUG_MSG("1-Reading CONTENT off %lld and size %lld\n", inf->magicblockoffset, inf->magicblocksize);
-                inf->op_res = pread(inf->fd, inf->buf, inf->magicblocksize, inf->magicblockoffset);
+                inf->op_res = preadv(inf->fd, inf->request->iov, inf->request->nsegments, inf->magicblockoffset);
                 DEBUG_MSG("Content actually read was %ld\n", inf->op_res);
                 if (inf->op_res > 0) {
                     inf->op_res = inf->size;
                 }
             } else {
                 DEBUG_MSG("2-Reading CONTENT off %lld and size %lld\n", inf->offset, inf->size);
-                inf->op_res = pread(inf->fd, inf->buf, inf->size, inf->offset);
+                inf->op_res = preadv(inf->fd, inf->request->iov, inf->request->nsegments, inf->offset);
             }
             break;
         case WRITE_OP:
-            if (DRIVER == ERASURE) {
+            if (inf->async->ml->mode == ERASURE) {
                 DEBUG_MSG("1-Writing CONTENT off %lld and size %lld\n", inf->magicblockoffset, inf->magicblocksize);
-                pwrite(inf->fd, inf->buf, inf->magicblocksize, inf->magicblockoffset);
+                pwritev(inf->fd, inf->request->iov, inf->request->nsegments, inf->magicblockoffset);
                 inf->op_res = inf->size;
             } else {
                 DEBUG_MSG("2-Writing CONTENT off %lld and size %lld\n", inf->offset, inf->size);
-                int res = pwrite(inf->fd, inf->buf, inf->size, inf->offset);
+                int res = pwritev(inf->fd, inf->request->iov, inf->request->nsegments, inf->offset);
                 DEBUG_MSG("result is %d\n", res);
                 inf->op_res = res;
             }
@@ -125,6 +154,16 @@ void threads_func(gpointer data, gpointer user_data) {
         inf->op_error = -errno;
     }
 
+    if (inf->trace_request != 0) {
+        trace_record(inf->trace_request, op_names[inf->op_type], tstart, inf->dev);
+    }
+
+    if (inf->cond == NULL) {
+        // asynchronous requests complete on the thread of their last device operation
+        complete_async_op(inf->async);
+        return;
+    }
+
     pthread_mutex_lock(inf->lock);
 
     *inf->ops_done = *inf->ops_done + 1;
@@ -134,19 +173,18 @@ void threads_func(gpointer data, gpointer user_data) {
     pthread_mutex_unlock(inf->lock);
 }
 
-int wait_for_all_requests(struct op_info *inf, pthread_mutex_t *op_lock, pthread_cond_t *wait_ops) {
-    DEBUG_MSG("waitrequests\n");
-
+// Result of an operation done on every device, -1 if a device failed or the devices disagree
+static int gather_results(const struct multi_loop_instance *ml, struct op_info *inf) {
     int res;
     int i = 0;
 
-    pthread_mutex_lock(op_lock);
-    while (*inf[0].ops_done < NDEVS) {
-        pthread_cond_wait(wait_ops, op_lock);
+    for (i = 0; i < ml->ndevs; i++) {
+        if (inf[i].op_res < 0) {
+            __atomic_fetch_add(&ml->device_errors[i], 1, __ATOMIC_RELAXED);
+        }
     }
-    pthread_mutex_unlock(op_lock);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         if (inf[i].op_res == -1) {
             inf[0].op_error = inf[i].op_error;
             return -1;
@@ -167,23 +205,135 @@ int wait_for_all_requests(struct op_info *inf, pthread_mutex_t *op_lock, pthread
     return res;
 }
 
+int wait_for_all_requests(const struct multi_loop_instance *ml, struct op_info *inf, pthread_mutex_t *op_lock,
+                          pthread_cond_t *wait_ops) {
+    DEBUG_MSG("waitrequests\n");
+
+    pthread_mutex_lock(op_lock);
+    while (*inf[0].ops_done < ml->ndevs) {
+        pthread_cond_wait(wait_ops, op_lock);
+    }
+    pthread_mutex_unlock(op_lock);
+
+    return gather_results(ml, inf);
+}
+
+static struct async_request *new_async_request(const struct multi_loop_instance *ml, layer_callback callback,
+                                               void *user_data) {
+    struct async_request *request = calloc(1, sizeof(struct async_request));
+    int i;
+
+    request->ml = ml;
+    request->inf = calloc(ml->ndevs, sizeof(struct op_info));
+    request->requests = malloc(ml->ndevs * sizeof(struct io_request));
+    for (i = 0; i < ml->ndevs; i++) {
+        io_request_init(&request->requests[i]);
+        request->inf[i].async = request;
+    }
+    pthread_mutex_init(&request->lock, 0);
+    request->callback = callback;
+    request->user_data = user_data;
+    request->tstart = latency_now();
+    request->trace_request = trace_current();
+
+    return request;
+}
+
+// Issues the operations of an asynchronous request, request must not be used afterwards
+static void push_async_request(struct async_request *request) {
+    // the last operation may free request before the loop ends
+    struct op_info *inf = request->inf;
+    int ndevs = request->ml->ndevs;
+    int i;
+    for (i = 0; i < ndevs; i++) {
+        push_op(&inf[i], i);
+    }
+}
+
+static void complete_async_op(struct async_request *request) {
+    const struct multi_loop_instance *ml = request->ml;
+
+    pthread_mutex_lock(&request->lock);
+    request->ops_done++;
+    int last = request->ops_done == ml->ndevs;
+    pthread_mutex_unlock(&request->lock);
+
+    if (!last) {
+        return;
+    }
+
+    int res = gather_results(ml, request->inf);
+    int i;
+
+    switch (request->inf[0].op_type) {
+        case READ_OP:
+            if (res > 0) {
+                DEBUG_MSG("Call result is %d\n", res);
+                ml->driver.decode((unsigned char *)request->buf, request->requests, request->decode_size, ml->ndevs);
+            }
+            store_io(multi_read_latency, request->tstart, (res > 0) ? res : 0);
+            trace_record(request->trace_request, "multi.read", request->tstart, -1);
+            break;
+        case WRITE_OP:
+            store_io(multi_write_latency, request->tstart, (res > 0) ? res : 0);
+            trace_record(request->trace_request, "multi.write", request->tstart, -1);
+            break;
+        case FSYNC_OP:
+            res = (res == -1) ? request->inf[0].op_error : 0;
+            break;
+    }
+
+    for (i = 0; i < ml->ndevs; i++) {
+        io_request_clean(&request->requests[i]);
+    }
+    pthread_mutex_destroy(&request->lock);
+    free(request->requests);
+    free(request->inf);
+
+    layer_callback callback = request->callback;
+    void *user_data = request->user_data;
+    free(request);
+
+    DEBUG_MSG("Exiting asynchronous operation %d\n", res);
+    callback(res, user_data);
+}
+
+// Instance of the stack of path, stacks are told apart by their top-level directory
+static const struct multi_loop_instance *instance_of(const char *path) {
+    int i;
+
+    // the router only sends paths of its stacks
+    for (i = 0; i < ninstances - 1; i++) {
+        if (path_has_prefix(path, instances[i].prefix)) {
+            break;
+        }
+    }
+    return &instances[i];
+}
+
+// Path of the stack path on device i of ml, appended to newpath
+static void device_path(const struct multi_loop_instance *ml, int i, const char *path, char *newpath) {
+    strcpy(newpath, ml->devices_path[i]);
+    replace_path(path + ml->prefix_size, newpath);
+}
+
 static int loopback_getattr(const char *path, struct stat *stbuf) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
 
     DEBUG_MSG("getattr\n");
 
     // Check only the status from one pen since this is replicated in all
     char newpath[PATHSIZE];
-    strcpy(newpath, devices_path[0]);
-    replace_path(path, newpath);
+    device_path(ml, 0, path, newpath);
 
     res = lstat(newpath, stbuf);
 
     if (res == -1) {
         return -errno;
     }
-    if (DRIVER == ERASURE) {
-        uint64_t size = m_driver.get_file_size(path);
+    if (ml->mode == ERASURE) {
+        uint64_t size = ml->driver.get_file_size(path);
         DEBUG_MSG("Size found is %lld\n", size);
         stbuf->st_size = size;
     }
@@ -191,6 +341,7 @@ static int loopback_getattr(const char *path, struct stat *stbuf) {
 }
 
 static int loopback_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
 
     DEBUG_MSG("fgetattr\n");
@@ -203,8 +354,8 @@ static int loopback_fgetattr(const char *path, struct stat *stbuf, struct fuse_f
         return -errno;
     }
 
-    if (DRIVER == ERASURE) {
-        uint64_t size = m_driver.get_file_size(path);
+    if (ml->mode == ERASURE) {
+        uint64_t size = ml->driver.get_file_size(path);
         DEBUG_MSG("Size found is %lld\n", size);
         stbuf->st_size = size;
     }
@@ -213,6 +364,7 @@ static int loopback_fgetattr(const char *path, struct stat *stbuf, struct fuse_f
 }
 
 static int loopback_readlink(const char *path, char *buf, size_t size) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
 
     DEBUG_MSG("readlink\n");
@@ -220,15 +372,14 @@ static int loopback_readlink(const char *path, char *buf, size_t size) {
     char newpath[PATHSIZE];
     int psize;
     char auxbuf[PATHSIZE];
-    strcpy(newpath, devices_path[0]);
-    replace_path(path, newpath);
+    device_path(ml, 0, path, newpath);
 
     res = readlink(newpath, auxbuf, size - 1);
     if (res == -1) {
         return -errno;
     }
 
-    psize = strlen(devices_path[0]);
+    psize = strlen(ml->devices_path[0]);
     strcpy(buf, &auxbuf[psize]);
 
     buf[res - psize] = '\0';
@@ -237,30 +388,30 @@ static int loopback_readlink(const char *path, char *buf, size_t size) {
 }
 
 static int loopback_opendir(const char *path, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
 
     DEBUG_MSG("opendir\n");
 
     struct mpath_aux *mp = malloc(sizeof(struct mpath_aux));
-    mp->ldp = malloc(sizeof(struct loopback_dirp) * NDEVS);
+    mp->ldp = malloc(sizeof(struct loopback_dirp) * ml->ndevs);
     int i;
 
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     // create folder in each device
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -274,15 +425,15 @@ static int loopback_opendir(const char *path, struct fuse_file_info *fi) {
             return -ENOMEM;
         }
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -335,12 +486,13 @@ static int loopback_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 }
 
 static int loopback_releasedir(const char *path, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("releasedir\n");
     int res;
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
@@ -350,17 +502,17 @@ static int loopback_releasedir(const char *path, struct fuse_file_info *fi) {
 
     int i;
     // create folder in each device
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         inf[i].cond = &wait_ops;
         inf[i].lock = &op_lock;
         inf[i].ops_done = &ops_done;
         inf[i].op_type = RELEASEDIR_OP;
         inf[i].d = &(mp->ldp[i]);
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
@@ -377,6 +529,7 @@ static int loopback_releasedir(const char *path, struct fuse_file_info *fi) {
 }
 
 static int loopback_mknod(const char *path, mode_t mode, dev_t rdev) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res = 0;
 
     DEBUG_MSG("mknod\n");
@@ -384,20 +537,19 @@ static int loopback_mknod(const char *path, mode_t mode, dev_t rdev) {
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     // mknod in each device
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -407,15 +559,15 @@ static int loopback_mknod(const char *path, mode_t mode, dev_t rdev) {
         inf[i].mode = mode;
         inf[i].rdev = rdev;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -427,26 +579,26 @@ static int loopback_mknod(const char *path, mode_t mode, dev_t rdev) {
 }
 
 static int loopback_mkdir(const char *path, mode_t mode) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
 
     DEBUG_MSG("mkdir\n");
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     // create folder in each device
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -455,15 +607,15 @@ static int loopback_mkdir(const char *path, mode_t mode) {
         inf[i].op_type = MKDIR_OP;
         inf[i].mode = mode;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -475,26 +627,26 @@ static int loopback_mkdir(const char *path, mode_t mode) {
 }
 
 static int loopback_unlink(const char *path) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res = 0;
 
     DEBUG_MSG("unlink path %s\n", path);
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     // remove file in each device
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -502,15 +654,15 @@ static int loopback_unlink(const char *path) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = UNLINK_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -523,25 +675,25 @@ static int loopback_unlink(const char *path) {
 }
 
 static int loopback_rmdir(const char *path) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res = 0;
     int i;
     DEBUG_MSG("rmdir\n");
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     // remove folder in each device
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -549,15 +701,15 @@ static int loopback_rmdir(const char *path) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = RMDIR_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -569,6 +721,7 @@ static int loopback_rmdir(const char *path) {
 }
 
 static int loopback_symlink(const char *from, const char *to) {
+    const struct multi_loop_instance *ml = instance_of(to);
     DEBUG_MSG("symlink\n");
 
     int res;
@@ -577,23 +730,23 @@ static int loopback_symlink(const char *from, const char *to) {
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newfrompath[NDEVS];
-    char *devices_newtopath[NDEVS];
+    char *devices_newfrompath[ml->ndevs];
+    char *devices_newtopath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newfrompath[i] = malloc(PATHSIZE);
-        strcpy(devices_newfrompath[i], devices_path[i]);
+        // the target is not a path of the stack, readlink removes the device directory again
+        strcpy(devices_newfrompath[i], ml->devices_path[i]);
         replace_path(from, devices_newfrompath[i]);
 
         devices_newtopath[i] = malloc(PATHSIZE);
-        strcpy(devices_newtopath[i], devices_path[i]);
-        replace_path(to, devices_newtopath[i]);
+        device_path(ml, i, to, devices_newtopath[i]);
 
         inf[i].frompath = devices_newfrompath[i];
         inf[i].topath = devices_newtopath[i];
@@ -602,15 +755,15 @@ static int loopback_symlink(const char *from, const char *to) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = SYMLINK_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newfrompath[i]);
         free(devices_newtopath[i]);
     }
@@ -622,6 +775,7 @@ static int loopback_symlink(const char *from, const char *to) {
 }
 
 static int loopback_rename(const char *from, const char *to) {
+    const struct multi_loop_instance *ml = instance_of(from);
     int res = 0;
 
     DEBUG_MSG("rename\n");
@@ -630,23 +784,21 @@ static int loopback_rename(const char *from, const char *to) {
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newfrompath[NDEVS];
-    char *devices_newtopath[NDEVS];
+    char *devices_newfrompath[ml->ndevs];
+    char *devices_newtopath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newfrompath[i] = malloc(PATHSIZE);
-        strcpy(devices_newfrompath[i], devices_path[i]);
-        replace_path(from, devices_newfrompath[i]);
+        device_path(ml, i, from, devices_newfrompath[i]);
 
         devices_newtopath[i] = malloc(PATHSIZE);
-        strcpy(devices_newtopath[i], devices_path[i]);
-        replace_path(to, devices_newtopath[i]);
+        device_path(ml, i, to, devices_newtopath[i]);
 
         inf[i].frompath = devices_newfrompath[i];
         inf[i].topath = devices_newtopath[i];
@@ -655,15 +807,15 @@ static int loopback_rename(const char *from, const char *to) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = RENAME_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
     DEBUG_MSG("Exit wait\n");
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newfrompath[i]);
         free(devices_newtopath[i]);
     }
@@ -671,15 +823,16 @@ static int loopback_rename(const char *from, const char *to) {
     if (res == -1) {
         return inf[0].op_error;
     }
-    if (DRIVER == ERASURE) {
+    if (ml->mode == ERASURE) {
         DEBUG_MSG("Going to rename\n");
-        m_driver.rename((char *)from, (char *)to);
+        ml->driver.rename((char *)from, (char *)to);
     }
 
     return 0;
 }
 
 static int loopback_link(const char *from, const char *to) {
+    const struct multi_loop_instance *ml = instance_of(from);
     DEBUG_MSG("link\n");
 
     int res;
@@ -687,23 +840,21 @@ static int loopback_link(const char *from, const char *to) {
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newfrompath[NDEVS];
-    char *devices_newtopath[NDEVS];
+    char *devices_newfrompath[ml->ndevs];
+    char *devices_newtopath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newfrompath[i] = malloc(PATHSIZE);
-        strcpy(devices_newfrompath[i], devices_path[i]);
-        replace_path(from, devices_newfrompath[i]);
+        device_path(ml, i, from, devices_newfrompath[i]);
 
         devices_newtopath[i] = malloc(PATHSIZE);
-        strcpy(devices_newtopath[i], devices_path[i]);
-        replace_path(to, devices_newtopath[i]);
+        device_path(ml, i, to, devices_newtopath[i]);
 
         inf[i].frompath = devices_newfrompath[i];
         inf[i].topath = devices_newtopath[i];
@@ -712,15 +863,15 @@ static int loopback_link(const char *from, const char *to) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = LINK_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newfrompath[i]);
         free(devices_newtopath[i]);
     }
@@ -733,27 +884,27 @@ static int loopback_link(const char *from, const char *to) {
 }
 
 static int loopback_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("create\n");
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
     int res;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
     struct mpath_aux *mp = malloc(sizeof(struct mpath_aux));
-    mp->devs_fd = malloc(sizeof(unsigned long) * NDEVS);
+    mp->devs_fd = malloc(sizeof(unsigned long) * ml->ndevs);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].flags = fi->flags;
@@ -764,15 +915,15 @@ static int loopback_create(const char *path, mode_t mode, struct fuse_file_info
         inf[i].op_type = CREATE_OP;
 
         DEBUG_MSG("sending create op %s\n", inf[i].path);
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -783,41 +934,41 @@ static int loopback_create(const char *path, mode_t mode, struct fuse_file_info
         return inf[0].op_error;
     }
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         mp->devs_fd[i] = inf[i].op_res;
     }
 
     fi->fh = (unsigned long)mp;
-    if (DRIVER == ERASURE) {
+    if (ml->mode == ERASURE) {
         DEBUG_MSG("GOING TO REMOVE keys if exist\n");
-        m_driver.create((char *)path);
+        ml->driver.create((char *)path);
     }
     return 0;
 }
 
 static int loopback_open(const char *path, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("open\n");
 
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
     int res;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
     struct mpath_aux *mp = malloc(sizeof(struct mpath_aux));
-    mp->devs_fd = malloc(sizeof(unsigned long) * NDEVS);
+    mp->devs_fd = malloc(sizeof(unsigned long) * ml->ndevs);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].flags = fi->flags;
@@ -826,15 +977,15 @@ static int loopback_open(const char *path, struct fuse_file_info *fi) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = OPEN_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -845,7 +996,7 @@ static int loopback_open(const char *path, struct fuse_file_info *fi) {
         return inf[0].op_error;
     }
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         mp->devs_fd[i] = inf[i].op_res;
     }
     fi->fh = (unsigned long)mp;
@@ -853,192 +1004,131 @@ static int loopback_open(const char *path, struct fuse_file_info *fi) {
     return 0;
 }
 
-static int loopback_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    // struct timespec tstart={0,0}, tend={0,0};
-    // clock_gettime(CLOCK_MONOTONIC, &tstart);
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
-
+static void loopback_read_async(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                                layer_callback callback, void *user_data) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("read size %lld and offset %lld\n", size, offset);
-    int res = 0;
     int i;
-    pthread_mutex_t op_lock;
-    pthread_cond_t wait_ops;
-    int ops_done = 0;
 
-    unsigned char *magicblocks[NDEVS];
+    struct async_request *request = new_async_request(ml, callback, user_data);
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
-    struct op_info inf[NDEVS];
-
-    // Initialize mutex and condition variable
-    pthread_mutex_init(&op_lock, 0);
-    pthread_cond_init(&wait_ops, 0);
 
     off_t driver_offset = 0;
     uint64_t driver_size = 0;
-    if (DRIVER == ERASURE) {
+    int decode_size = size;
+    if (ml->mode == ERASURE) {
         DEBUG_MSG("Going to get driver_offset and drive-size for offset %lld\n", offset);
-        m_driver.get_driver_offset(path, offset, &driver_offset);
-        m_driver.get_driver_size(path, offset, &driver_size);
+        ml->driver.get_driver_offset(path, offset, &driver_offset);
+        ml->driver.get_driver_size(path, offset, &driver_size);
         DEBUG_MSG("Driver-offset is %lld\n", driver_offset);
         DEBUG_MSG("Driver-size is %lld\n", driver_size);
+        decode_size = driver_size;
     }
-    for (i = 0; i < NDEVS; i++) {
-        // TODO: newpath is only here for debug purposes
-        char newpath[PATHSIZE];
 
-        if (DRIVER != ERASURE) {
-            magicblocks[i] = malloc(size);
-        } else {
-            magicblocks[i] = malloc(driver_size);
-        }
-        strcpy(newpath, devices_path[i]);
-        replace_path(path, newpath);
+    // the driver decides which devices read directly into buf
+    ml->driver.prepare_read(request->requests, (unsigned char *)buf, decode_size, ml->ndevs);
+    request->buf = buf;
+    request->decode_size = decode_size;
 
-        DEBUG_MSG("Reading CONTENT at %s off %lld and size %lld\n", newpath, offset, size);
+    for (i = 0; i < ml->ndevs; i++) {
+        struct op_info *inf = &request->inf[i];
 
-        inf[i].fd = mp->devs_fd[i];
-        inf[i].buf = (char *)magicblocks[i];
-        inf[i].size = size;
-        inf[i].offset = offset;
-        inf[i].magicblocksize = -1;
-        inf[i].magicblockoffset = -1;
+        DEBUG_MSG("Reading CONTENT at device %d off %lld and size %lld\n", i, offset, size);
 
-        if (DRIVER == ERASURE) {
-            inf[i].magicblocksize = driver_size;
-            inf[i].magicblockoffset = driver_offset;
-        }
+        inf->fd = mp->devs_fd[i];
+        inf->request = &request->requests[i];
+        inf->size = size;
+        inf->offset = offset;
+        inf->magicblocksize = -1;
+        inf->magicblockoffset = -1;
 
-        inf[i].cond = &wait_ops;
-        inf[i].lock = &op_lock;
-        inf[i].ops_done = &ops_done;
-        inf[i].op_type = READ_OP;
-
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
-    }
-
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
-
-    if (res > 0) {
-        int decode_size = size;
-
-        if (DRIVER == ERASURE) {
-            decode_size = driver_size;
+        if (ml->mode == ERASURE) {
+            inf->magicblocksize = driver_size;
+            inf->magicblockoffset = driver_offset;
         }
-        DEBUG_MSG("Call result is %d\n", res);
-        m_driver.decode((unsigned char *)buf, magicblocks, decode_size, NDEVS);
-    }
 
-    for (i = 0; i < NDEVS; i++) {
-        free(magicblocks[i]);
+        inf->op_type = READ_OP;
     }
 
-    pthread_mutex_destroy(&op_lock);
-    pthread_cond_destroy(&wait_ops);
+    push_async_request(request);
+}
 
-    // clock_gettime(CLOCK_MONOTONIC, &tend);
-    gettimeofday(&tend, NULL);
-    store(&multi_read_list, tstart, tend);
+static int loopback_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct layer_future future;
+    struct trace_span span;
 
-    DEBUG_MSG("Exiting read  operation %d\n", res);
+    // starts the request when multi_loopback is the top layer, the read is recorded when it completes
+    trace_span_begin(&span);
+    layer_future_init(&future);
+    loopback_read_async(path, buf, size, offset, fi, layer_future_complete, &future);
+    int res = layer_future_wait(&future);
+    trace_span_end(&span, NULL, -1);
 
     return res;
 }
 
-static int loopback_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    // struct timespec tstart={0,0}, tend={0,0};
-    // clock_gettime(CLOCK_MONOTONIC, &tstart);
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
-
+static void loopback_write_async(const char *path, const char *buf, size_t size, off_t offset,
+                                 struct fuse_file_info *fi, layer_callback callback, void *user_data) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("write\n");
-    int res;
     int i = 0;
-    pthread_mutex_t op_lock;
-    pthread_cond_t wait_ops;
-    int ops_done = 0;
 
+    struct async_request *request = new_async_request(ml, callback, user_data);
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
-    unsigned char *magicblocks[NDEVS];
-    struct op_info inf[NDEVS];
-
-    // Initialize mutex and condition variable
-    pthread_mutex_init(&op_lock, 0);
-    pthread_cond_init(&wait_ops, 0);
-
-    if (DRIVER != ERASURE) {
-        for (i = 0; i < NDEVS; i++) {
-            magicblocks[i] = malloc(size);
-        }
-    }
 
-    unsigned char block[size];
-    memcpy(block, buf, size);
-
-    m_driver.encode(path, magicblocks, block, offset, size, NDEVS);
+    // the requests may reference buf directly, it stays valid until the request completes
+    ml->driver.encode(path, request->requests, (const unsigned char *)buf, offset, size, ml->ndevs);
 
     off_t magicblockoffset = -1;
     uint64_t magicblocksize = -1;
-    if (DRIVER == ERASURE) {
-        get_erasure_block_offset(path, offset, &magicblockoffset);
-        get_erasure_block_size(path, offset, &magicblocksize);
+    if (ml->mode == ERASURE) {
+        ml->driver.get_driver_offset(path, offset, &magicblockoffset);
+        ml->driver.get_driver_size(path, offset, &magicblocksize);
     }
-    // this must be assync in the future
-    // Use a thread pool
-    for (i = 0; i < NDEVS; i++) {
-        // TODO: newpath is only here for debug purposes
-        char newpath[PATHSIZE];
-        strcpy(newpath, devices_path[i]);
-        replace_path(path, newpath);
 
-        inf[i].fd = mp->devs_fd[i];
-        inf[i].buf = (char *)magicblocks[i];
-        inf[i].size = size;
-        inf[i].offset = offset;
-        inf[i].magicblockoffset = magicblockoffset;
-        inf[i].magicblocksize = magicblocksize;
-        inf[i].cond = &wait_ops;
-        inf[i].lock = &op_lock;
-        inf[i].ops_done = &ops_done;
-        inf[i].op_type = WRITE_OP;
+    for (i = 0; i < ml->ndevs; i++) {
+        struct op_info *inf = &request->inf[i];
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        inf->fd = mp->devs_fd[i];
+        inf->request = &request->requests[i];
+        inf->size = size;
+        inf->offset = offset;
+        inf->magicblockoffset = magicblockoffset;
+        inf->magicblocksize = magicblocksize;
+        inf->op_type = WRITE_OP;
 
-        if (DRIVER == ERASURE) {
-            DEBUG_MSG("WRITING CONTENT at %s off %lld and size %lld\n", newpath, inf[i].magicblockoffset,
-                      inf[i].magicblocksize);
+        if (ml->mode == ERASURE) {
+            DEBUG_MSG("WRITING CONTENT at device %d off %lld and size %lld\n", i, inf->magicblockoffset,
+                      inf->magicblocksize);
         } else {
-            DEBUG_MSG("WRITING CONTENT at %s off %lld and size %lld\n", newpath, offset, size);
+            DEBUG_MSG("WRITING CONTENT at device %d off %lld and size %lld\n", i, offset, size);
         }
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
-    DEBUG_MSG("DOne waiting\n");
-
-    for (i = 0; i < NDEVS; i++) {
-        free(magicblocks[i]);
-    }
-    DEBUG_MSG("devs blocks free\n");
+    push_async_request(request);
+}
 
-    pthread_mutex_destroy(&op_lock);
-    pthread_cond_destroy(&wait_ops);
-    DEBUG_MSG("Exiting write with res %d\n", res);
+static int loopback_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct layer_future future;
+    struct trace_span span;
 
-    // clock_gettime(CLOCK_MONOTONIC, &tend);
-    gettimeofday(&tend, NULL);
-    store(&multi_write_list, tstart, tend);
+    trace_span_begin(&span);
+    layer_future_init(&future);
+    loopback_write_async(path, buf, size, offset, fi, layer_future_complete, &future);
+    int res = layer_future_wait(&future);
+    trace_span_end(&span, NULL, -1);
 
     return res;
 }
 
 static int loopback_statfs(const char *path, struct statvfs *stbuf) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
     DEBUG_MSG("statfs\n");
 
     // Check only first device since all are replicates
     char newpath[PATHSIZE];
-    strcpy(newpath, devices_path[0]);
-    replace_path(path, newpath);
+    device_path(ml, 0, path, newpath);
 
     res = statvfs(newpath, stbuf);
     if (res == -1) {
@@ -1049,6 +1139,7 @@ static int loopback_statfs(const char *path, struct statvfs *stbuf) {
 }
 
 static int loopback_flush(const char *path, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     int res;
     DEBUG_MSG("flush\n");
     pthread_mutex_t op_lock;
@@ -1057,7 +1148,7 @@ static int loopback_flush(const char *path, struct fuse_file_info *fi) {
 
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
 
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
@@ -1069,17 +1160,17 @@ static int loopback_flush(const char *path, struct fuse_file_info *fi) {
     // Use a thread pool
     // call flush in all devices
     int i;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         inf[i].fd = mp->devs_fd[i];
         inf[i].cond = &wait_ops;
         inf[i].lock = &op_lock;
         inf[i].ops_done = &ops_done;
         inf[i].op_type = FLUSH_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
@@ -1092,6 +1183,7 @@ static int loopback_flush(const char *path, struct fuse_file_info *fi) {
 }
 
 static int loopback_release(const char *path, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     (void)path;
     DEBUG_MSG("release\n");
 
@@ -1101,7 +1193,7 @@ static int loopback_release(const char *path, struct fuse_file_info *fi) {
 
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
 
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
@@ -1109,17 +1201,17 @@ static int loopback_release(const char *path, struct fuse_file_info *fi) {
 
     int i, res;
     // call release in all devices
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         inf[i].fd = mp->devs_fd[i];
         inf[i].cond = &wait_ops;
         inf[i].lock = &op_lock;
         inf[i].ops_done = &ops_done;
         inf[i].op_type = RELEASE_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
@@ -1134,69 +1226,54 @@ static int loopback_release(const char *path, struct fuse_file_info *fi) {
     return 0;
 }
 
-static int loopback_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
-    int res;
+static void loopback_fsync_async(const char *path, int isdatasync, struct fuse_file_info *fi,
+                                 layer_callback callback, void *user_data) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("fsync\n");
-    pthread_mutex_t op_lock;
-    pthread_cond_t wait_ops;
-    int ops_done = 0;
 
     (void)path;
 
     (void)isdatasync;
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
+    struct async_request *request = new_async_request(ml, callback, user_data);
 
-    struct op_info inf[NDEVS];
-
-    // Initialize mutex and condition variable
-    pthread_mutex_init(&op_lock, 0);
-    pthread_cond_init(&wait_ops, 0);
-
-    // this must be assync in the future
-    // Use a thread pool
-    // call flush in all devices
+    // call fsync in all devices
     int i;
-    for (i = 0; i < NDEVS; i++) {
-        inf[i].fd = mp->devs_fd[i];
-        inf[i].cond = &wait_ops;
-        inf[i].lock = &op_lock;
-        inf[i].ops_done = &ops_done;
-        inf[i].op_type = FSYNC_OP;
-
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+    for (i = 0; i < ml->ndevs; i++) {
+        request->inf[i].fd = mp->devs_fd[i];
+        request->inf[i].op_type = FSYNC_OP;
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
-
-    pthread_mutex_destroy(&op_lock);
-    pthread_cond_destroy(&wait_ops);
+    push_async_request(request);
+}
 
-    if (res == -1) {
-        return inf[0].op_error;
-    }
+static int loopback_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    struct layer_future future;
 
-    return 0;
+    layer_future_init(&future);
+    loopback_fsync_async(path, isdatasync, fi, layer_future_complete, &future);
+    return layer_future_wait(&future);
 }
 
 static int loopback_truncate(const char *path, off_t size) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("truncate\n");
     int i, res;
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
 
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -1205,15 +1282,15 @@ static int loopback_truncate(const char *path, off_t size) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = TRUNCATE_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -1225,20 +1302,21 @@ static int loopback_truncate(const char *path, off_t size) {
 }
 
 static int loopback_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("ftruncate\n");
     pthread_mutex_t op_lock;
     pthread_cond_t wait_ops;
     int ops_done = 0;
 
     struct mpath_aux *mp = (struct mpath_aux *)(uintptr_t)fi->fh;
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
     int i, res;
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         inf[i].fd = mp->devs_fd[i];
         inf[i].cond = &wait_ops;
         inf[i].lock = &op_lock;
@@ -1246,10 +1324,10 @@ static int loopback_ftruncate(const char *path, off_t size, struct fuse_file_inf
         inf[i].op_type = FTRUNCATE_OP;
         inf[i].size = size;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
@@ -1262,6 +1340,7 @@ static int loopback_ftruncate(const char *path, off_t size, struct fuse_file_inf
 }
 
 static int loopback_chmod(const char *path, mode_t mode) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("chmod\n");
 
     int i, res;
@@ -1269,18 +1348,17 @@ static int loopback_chmod(const char *path, mode_t mode) {
     pthread_cond_t wait_ops;
     int ops_done = 0;
 
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -1289,15 +1367,15 @@ static int loopback_chmod(const char *path, mode_t mode) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = CHMOD_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -1309,6 +1387,7 @@ static int loopback_chmod(const char *path, mode_t mode) {
 }
 
 static int loopback_chown(const char *path, uid_t uid, gid_t gid) {
+    const struct multi_loop_instance *ml = instance_of(path);
     DEBUG_MSG("chown\n");
 
     int i, res;
@@ -1316,18 +1395,17 @@ static int loopback_chown(const char *path, uid_t uid, gid_t gid) {
     pthread_cond_t wait_ops;
     int ops_done = 0;
 
-    struct op_info inf[NDEVS];
+    struct op_info inf[ml->ndevs];
 
     // Initialize mutex and condition variable
     pthread_mutex_init(&op_lock, 0);
     pthread_cond_init(&wait_ops, 0);
 
-    char *devices_newpath[NDEVS];
+    char *devices_newpath[ml->ndevs];
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         devices_newpath[i] = malloc(PATHSIZE);
-        strcpy(devices_newpath[i], devices_path[i]);
-        replace_path(path, devices_newpath[i]);
+        device_path(ml, i, path, devices_newpath[i]);
 
         inf[i].path = devices_newpath[i];
         inf[i].cond = &wait_ops;
@@ -1337,15 +1415,15 @@ static int loopback_chown(const char *path, uid_t uid, gid_t gid) {
         inf[i].ops_done = &ops_done;
         inf[i].op_type = CHOWN_OP;
 
-        g_thread_pool_push(thread_pool, &inf[i], NULL);
+        push_op(&inf[i], i);
     }
 
-    res = wait_for_all_requests(inf, &op_lock, &wait_ops);
+    res = wait_for_all_requests(ml, inf, &op_lock, &wait_ops);
 
     pthread_mutex_destroy(&op_lock);
     pthread_cond_destroy(&wait_ops);
 
-    for (i = 0; i < NDEVS; i++) {
+    for (i = 0; i < ml->ndevs; i++) {
         free(devices_newpath[i]);
     }
 
@@ -1356,6 +1434,77 @@ static int loopback_chown(const char *path, uid_t uid, gid_t gid) {
     return 0;
 }
 
+// Extended attributes are kept on the file of every device, like its mode and owner
+static int loopback_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    const struct multi_loop_instance *ml = instance_of(path);
+    int i, res;
+
+    DEBUG_MSG("setxattr\n");
+
+    for (i = 0; i < ml->ndevs; i++) {
+        char newpath[PATHSIZE];
+        device_path(ml, i, path, newpath);
+
+        res = lsetxattr(newpath, name, value, size, flags);
+        if (res == -1) {
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
+static int loopback_getxattr(const char *path, const char *name, char *value, size_t size) {
+    const struct multi_loop_instance *ml = instance_of(path);
+    int res;
+
+    DEBUG_MSG("getxattr\n");
+
+    char newpath[PATHSIZE];
+    device_path(ml, 0, path, newpath);
+
+    res = lgetxattr(newpath, name, value, size);
+    if (res == -1) {
+        return -errno;
+    }
+    return res;
+}
+
+static int loopback_listxattr(const char *path, char *list, size_t size) {
+    const struct multi_loop_instance *ml = instance_of(path);
+    int res;
+
+    DEBUG_MSG("listxattr\n");
+
+    char newpath[PATHSIZE];
+    device_path(ml, 0, path, newpath);
+
+    res = llistxattr(newpath, list, size);
+    if (res == -1) {
+        return -errno;
+    }
+    return res;
+}
+
+static int loopback_removexattr(const char *path, const char *name) {
+    const struct multi_loop_instance *ml = instance_of(path);
+    int i, res;
+
+    DEBUG_MSG("removexattr\n");
+
+    for (i = 0; i < ml->ndevs; i++) {
+        char newpath[PATHSIZE];
+        device_path(ml, i, path, newpath);
+
+        res = lremovexattr(newpath, name);
+        if (res == -1) {
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
 // BASIC - necessary for writing, reading and listing one pdf inside the folder
 // SECOND - necessary to copy files via GUI
 // THIRD
@@ -1387,14 +1536,24 @@ static struct fuse_operations loopback_oper = {
     .fsync = loopback_fsync,      // FIFTH
     .truncate = loopback_truncate,
     .ftruncate = loopback_ftruncate,
+    .setxattr = loopback_setxattr,
+    .getxattr = loopback_getxattr,
+    .listxattr = loopback_listxattr,
+    .removexattr = loopback_removexattr,
 
 };
 
-int init_paths(configuration config) {
+static struct layer_async_operations loopback_async_oper = {
+    .read = loopback_read_async,
+    .write = loopback_write_async,
+    .fsync = loopback_fsync_async,
+};
+
+static int init_paths(struct multi_loop_instance *ml, configuration config) {
     GSList *current = config.m_loop_config.loop_paths;
     DEBUG_MSG("Current list pointer is %p\n", current);
     int ndevs = config.m_loop_config.ndevs;
-    devices_path = malloc(ndevs * sizeof(char **));
+    ml->devices_path = malloc(ndevs * sizeof(char **));
     int i = 0;
 
     do {
@@ -1404,12 +1563,12 @@ int init_paths(configuration config) {
         DEBUG_MSG("Current path is %s\n", path);
         // Check that the paths exist and if not create them
         assert(mkdir_p(path) == 0);
-        devices_path[i] = path;
-        int path_size = strlen(devices_path[i]);
+        ml->devices_path[i] = path;
+        int path_size = strlen(ml->devices_path[i]);
 
-        if (devices_path[i][path_size - 1] != '/') {
-            devices_path[i][path_size] = '/';
-            devices_path[i][path_size + 1] = '\0';
+        if (ml->devices_path[i][path_size - 1] != '/') {
+            ml->devices_path[i][path_size] = '/';
+            ml->devices_path[i][path_size + 1] = '\0';
         }
 
         DEBUG_MSG("modified path is %s\n", path);
@@ -1420,63 +1579,141 @@ int init_paths(configuration config) {
 
     } while (current != NULL);
 
-    // Init thread pool
-    thread_pool = g_thread_pool_new((GFunc)threads_func, NULL, MAX_THREADS, FALSE, NULL);
+    // Init thread pool, shared by the instances
+    if (thread_pool == NULL) {
+        thread_pool = g_thread_pool_new((GFunc)threads_func, NULL, MAX_THREADS, FALSE, NULL);
+    }
 
     return 0;
 }
 
-int init_multi_loopback_driver(struct fuse_operations **fuse_operations, configuration data) {
-    DEBUG_MSG("Starting multi_loopback driver %d\n");
+// Driver of a plugin, with mode 2 it also replaces the layout of the erasure driver
+static int init_plugin_driver(struct multi_loop_instance *ml, configuration data) {
+    m_loop_conf config = data.m_loop_config;
+    const struct plugin_configuration *pconfig;
+    const struct sfs_plugin *plugin = find_plugin(config.driver, SFS_PLUGIN_MULTI_DRIVER, &data, &pconfig);
 
-    DEBUG_MSG("Going to setup paths\n");
+    if (plugin == NULL) {
+        return 1;
+    }
 
-    init_paths(data);
-    // DEBUG_MSG("path 1 is %s\n", devices_path[0]);
-    // DEBUG_MSG("path 2 is %s\n", devices_path[1]);
+    memset(&ml->driver, 0, sizeof(struct multi_driver));
+    if (plugin->init_multi_driver(&ml->driver, &config, pconfig) != 0) {
+        ERROR_MSG("Could not init multi driver %s\n", config.driver);
+        return 1;
+    }
 
-    DEBUG_MSG("Going to copy root_path\n");
+    if (ml->driver.encode == NULL || ml->driver.prepare_read == NULL || ml->driver.decode == NULL) {
+        ERROR_MSG("Multi driver %s does not encode and decode blocks\n", config.driver);
+        return 1;
+    }
+    if (ml->mode == ERASURE &&
+        (ml->driver.get_driver_offset == NULL || ml->driver.get_driver_size == NULL ||
+         ml->driver.get_file_size == NULL || ml->driver.rename == NULL || ml->driver.create == NULL)) {
+        ERROR_MSG("Multi driver %s does not keep the layout of mode %d\n", config.driver, ERASURE);
+        return 1;
+    }
+    return 0;
+}
 
-    // strcpy(ROOTPATH, data.m_loop_config.root_path);
-    // DEBUG_MSG("rootpath is %s\n", ROOTPATH);
+static void multi_loopback_stats(GString *out) {
+    int i, j;
+
+    g_string_append_printf(out, "multi_loop.queue_depth %u\n", g_thread_pool_unprocessed(thread_pool));
+    for (i = 0; i < ninstances; i++) {
+        const struct multi_loop_instance *ml = &instances[i];
+        // the stack directory without its slash, nothing for a single stack
+        const char *stack = (ml->prefix_size > 0) ? ml->prefix + 1 : "";
+        for (j = 0; j < ml->ndevs; j++) {
+            g_string_append_printf(out, "multi_loop.%s%sdevice.%d.errors %lu\n", stack, (*stack != '\0') ? "." : "",
+                                   j, __atomic_load_n(&ml->device_errors[j], __ATOMIC_RELAXED));
+        }
+    }
+}
 
-    DRIVER = data.m_loop_config.mode;
-    DEBUG_MSG("Driver is %d\n", DRIVER);
+int init_multi_loopback_driver(struct fuse_operations **fuse_operations, configuration data) {
+    DEBUG_MSG("Starting multi_loopback driver %d\n", ninstances);
 
-    switch (DRIVER) {
-        case XOR:
-            m_driver.encode = encode_xor;
-            m_driver.decode = decode_xor;
-            break;
-        case REP:
-            m_driver.encode = rep_encode;
-            m_driver.decode = rep_decode;
-            break;
-        case ERASURE:
-            init_erasure(2, 1);
-            m_driver.encode = erasure_encode;
-            m_driver.decode = erasure_decode;
-            m_driver.get_driver_offset = get_erasure_block_offset;
-            m_driver.get_driver_size = get_erasure_block_size;
-            m_driver.get_file_size = erasure_get_file_size;
-            m_driver.rename = erasure_rename;
-            m_driver.create = erasure_create;
-            break;
-        default:
+    if (ninstances == MAX_MULTI_LOOP_INSTANCES) {
+        ERROR_MSG("Too many stacks with a multi_loopback layer\n");
+        return 1;
+    }
+    struct multi_loop_instance *ml = &instances[ninstances];
+
+    ml->mode = data.m_loop_config.mode;
+    DEBUG_MSG("Driver is %d\n", ml->mode);
+
+    if (data.m_loop_config.driver != NULL) {
+        if (init_plugin_driver(ml, data) != 0) {
             return 1;
+        }
+    } else {
+        switch (ml->mode) {
+            case XOR:
+                ml->driver.encode = encode_xor;
+                ml->driver.prepare_read = prepare_read_xor;
+                ml->driver.decode = decode_xor;
+                break;
+            case REP:
+                ml->driver.encode = rep_encode;
+                ml->driver.prepare_read = rep_prepare_read;
+                ml->driver.decode = rep_decode;
+                break;
+            case ERASURE: {
+                // the erasure driver keeps a single codec and file table
+                int i;
+                for (i = 0; i < ninstances; i++) {
+                    if (instances[i].driver.encode == erasure_encode) {
+                        ERROR_MSG("Only one stack can use erasure codes\n");
+                        return 1;
+                    }
+                }
+                init_erasure(2, 1);
+                ml->driver.encode = erasure_encode;
+                ml->driver.prepare_read = erasure_prepare_read;
+                ml->driver.decode = erasure_decode;
+                ml->driver.get_driver_offset = get_erasure_block_offset;
+                ml->driver.get_driver_size = get_erasure_block_size;
+                ml->driver.get_file_size = erasure_get_file_size;
+                ml->driver.rename = erasure_rename;
+                ml->driver.create = erasure_create;
+                break;
+            }
+            default:
+                return 1;
+        }
     }
 
-    NDEVS = data.m_loop_config.ndevs;
+    DEBUG_MSG("Going to setup paths\n");
+    init_paths(ml, data);
+
+    ml->ndevs = data.m_loop_config.ndevs;
+    ml->device_errors = calloc(ml->ndevs, sizeof(uint64_t));
+    ml->prefix = (data.prefix != NULL) ? data.prefix : "";
+    ml->prefix_size = strlen(ml->prefix);
 
     *fuse_operations = &loopback_oper;
+    // every instance has the same operations
+    if (ninstances == 0) {
+        register_async_operations(&loopback_oper, &loopback_async_oper);
+        multi_write_latency = new_latency_histogram("multi", "write");
+        multi_read_latency = new_latency_histogram("multi", "read");
+        register_stats_source(multi_loopback_stats);
+    }
+    ninstances++;
     DEBUG_MSG("Going to return setup driver");
 
     return 0;
 }
 
 int clean_multi_loopback_driver(configuration data) {
+    // the latencies are shared by the instances
+    free(instances[--ninstances].device_errors);
+    if (ninstances > 0) {
+        return 0;
+    }
     // DEBUG_MSG("Going to clean multi_loopback drivers\n");
-    print_latencies(multi_write_list, "multi", "write");
-    print_latencies(multi_read_list, "multi", "read");
+    print_latencies(multi_write_latency);
+    print_latencies(multi_read_latency);
     return 0;
 }
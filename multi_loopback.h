@@ -22,9 +22,12 @@
 #include <dirent.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/xattr.h>
 #include "utils.h"
 #include "SFSConfig.h"
 #include "layers_def.h"
+#include "async/async.h"
+#include "multi_loop_drivers/io_request.h"
 #include "multi_loop_drivers/xor.h"
 #include "multi_loop_drivers/rep.h"
 #include "multi_loop_drivers/erasure.h"
@@ -56,6 +59,22 @@
 #define CHMOD_OP 20
 #define CHOWN_OP 21
 
+// stacks of one process that may have a multi_loopback layer, see [stacks] in the README
+#define MAX_MULTI_LOOP_INSTANCES 8
+
+// Devices and driver of the multi_loopback layer of one stack
+struct multi_loop_instance {
+    // top-level directory of the stack, removed from the paths stored on the devices, "" for a single stack
+    const char *prefix;
+    size_t prefix_size;
+    int ndevs;
+    char **devices_path;
+    int mode;
+    struct multi_driver driver;
+    // operations that failed on each device
+    uint64_t *device_errors;
+};
+
 struct loopback_dirp {
     DIR *dp;
     struct dirent *entry;
@@ -74,7 +93,7 @@ struct op_info {
     char *path;
     char *frompath;
     char *topath;
-    char *buf;
+    struct io_request *request;
     uid_t uid;
     gid_t gid;
     off_t size;
@@ -86,9 +105,33 @@ struct op_info {
     int flags;
     struct loopback_dirp *d;
     pthread_mutex_t *lock;
+    // NULL for the operations of an asynchronous request
     pthread_cond_t *cond;
     int *ops_done;
     int op_error;
+    struct async_request *async;
+    // index of the device
+    int dev;
+    // traced request of the operation, 0 if it is not traced, and when it was queued
+    uint64_t trace_request;
+    uint64_t queued;
+};
+
+// Operation done on every device that completes through a callback instead of a waiting thread
+struct async_request {
+    const struct multi_loop_instance *ml;
+    // one per device
+    struct op_info *inf;
+    struct io_request *requests;
+    pthread_mutex_t lock;
+    int ops_done;
+    // destination of reads
+    char *buf;
+    int decode_size;
+    uint64_t tstart;
+    uint64_t trace_request;
+    layer_callback callback;
+    void *user_data;
 };
 
 int init_multi_loopback_driver(struct fuse_operations **fuse_operations, configuration data);
@@ -5,40 +5,47 @@
 */
 #include "nopfuse.h"
 #include "timestamps/timestamps.h"
+#include "trace/trace.h"
 
-// struct with original operations from mounted filesystem
-static struct fuse_operations *originalfs_oper;
+// operations of the layer below, the layer has no state of its own
+static struct layer_context nop_layer;
 // struct with nop operations
 static struct fuse_operations nop_oper;
 
-GSList *nop_write_list = NULL, *nop_read_list = NULL;
+static struct latency_histogram *nop_write_latency, *nop_read_latency;
 
 static int nopfuse_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
+    uint64_t tstart = latency_now();
+    struct trace_span span;
 
-    int res = originalfs_oper->read(path, buf, size, offset, fi);
+    trace_span_begin(&span);
 
-    gettimeofday(&tend, NULL);
-    store(&nop_read_list, tstart, tend);
+    int res = nop_layer.next->read(path, buf, size, offset, fi);
+
+    store_io(nop_read_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "nop.read", -1);
 
     return res;
 }
 
 static int nopfuse_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
+    uint64_t tstart = latency_now();
+    struct trace_span span;
+
+    trace_span_begin(&span);
 
-    int res = originalfs_oper->write(path, buf, size, offset, fi);
+    int res = nop_layer.next->write(path, buf, size, offset, fi);
 
-    gettimeofday(&tend, NULL);
-    store(&nop_write_list, tstart, tend);
+    store_io(nop_write_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "nop.write", -1);
 
     return res;
 }
 
 int init_nop_layer(struct fuse_operations **originop, configuration data) {
-    originalfs_oper = *originop;
+    const struct fuse_operations *originalfs_oper = *originop;
+    nop_layer.next = originalfs_oper;
+    nop_layer.private_data = NULL;
 
     nop_oper.init = originalfs_oper->init;
     nop_oper.destroy = originalfs_oper->destroy;
@@ -68,13 +75,14 @@ int init_nop_layer(struct fuse_operations **originop, configuration data) {
     nop_oper.ftruncate = originalfs_oper->ftruncate;
     nop_oper.chown = originalfs_oper->chown;
     nop_oper.chmod = originalfs_oper->chmod;
-    // nop_oper.setxattr    = originalfs_oper->setxattr;
-    // nop_oper.getxattr    = originalfs_oper->getxattr;
-    // nop_oper.listxattr   = originalfs_oper->listxattr;
-    // nop_oper.removexattr = originalfs_oper->removexattr;
+    nop_oper.setxattr = originalfs_oper->setxattr;
+    nop_oper.getxattr = originalfs_oper->getxattr;
+    nop_oper.listxattr = originalfs_oper->listxattr;
+    nop_oper.removexattr = originalfs_oper->removexattr;
+
+    nop_write_latency = new_latency_histogram("nop", "write");
+    nop_read_latency = new_latency_histogram("nop", "read");
 
-    // Copy original filesystem opers to a struct
-    // TODO: try to avoid originalfs_oper being a global variable
     *originop = &nop_oper;
 
     return 0;
@@ -82,7 +90,7 @@ int init_nop_layer(struct fuse_operations **originop, configuration data) {
 
 int clean_nop_layer(configuration data) {
     // DEBUG_MSG("Going to clean nop drivers\n");
-    print_latencies(nop_write_list, "nop", "write");
-    print_latencies(nop_read_list, "nop", "read");
+    print_latencies(nop_write_latency);
+    print_latencies(nop_read_latency);
     return 0;
 }
@@ -0,0 +1,172 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "plugin.h"
+#include <dlfcn.h>
+#include "../logdef.h"
+
+#define MAX_PLUGINS 16
+
+struct loaded_plugin {
+    const struct plugin_configuration *config;
+    void *handle;
+    const struct sfs_plugin *plugin;
+};
+
+static struct loaded_plugin loaded_plugins[MAX_PLUGINS];
+static int nloaded_plugins = 0;
+
+static const char *plugin_type_name(int type) {
+    switch (type) {
+        case SFS_PLUGIN_LAYER:
+            return "layer";
+        case SFS_PLUGIN_ENCODE_DRIVER:
+            return "encode driver";
+        case SFS_PLUGIN_MULTI_DRIVER:
+            return "multi driver";
+        default:
+            return "unknown";
+    }
+}
+
+static struct loaded_plugin *find_loaded(const char *name) {
+    int i;
+    for (i = 0; i < nloaded_plugins; i++) {
+        if (strcmp(loaded_plugins[i].config->name, name) == 0) {
+            return &loaded_plugins[i];
+        }
+    }
+    return NULL;
+}
+
+// The plugin has the functions of its type and the capabilities they need
+static int check_plugin(const struct plugin_configuration *config, const struct sfs_plugin *plugin) {
+    if (plugin->abi_version != SFS_PLUGIN_ABI_VERSION) {
+        ERROR_MSG("Plugin %s has ABI version %d instead of %d\n", config->name, plugin->abi_version,
+                  SFS_PLUGIN_ABI_VERSION);
+        return -1;
+    }
+
+    switch (plugin->type) {
+        case SFS_PLUGIN_LAYER:
+            return (plugin->init_layer != NULL) ? 0 : -1;
+        case SFS_PLUGIN_ENCODE_DRIVER:
+            return (plugin->init_encode_driver != NULL) ? 0 : -1;
+        case SFS_PLUGIN_MULTI_DRIVER:
+            if (!(plugin->capabilities & SFS_CAP_VECTORED_IO)) {
+                ERROR_MSG("Multi driver %s does not fill io requests\n", config->name);
+                return -1;
+            }
+            return (plugin->init_multi_driver != NULL) ? 0 : -1;
+        default:
+            ERROR_MSG("Plugin %s has an unknown type %d\n", config->name, plugin->type);
+            return -1;
+    }
+}
+
+static int load_plugin(const struct plugin_configuration *config) {
+    struct loaded_plugin *loaded = find_loaded(config->name);
+
+    // stacks may share plugins
+    if (loaded != NULL) {
+        if (strcmp(loaded->config->path, config->path) != 0) {
+            ERROR_MSG("Plugin %s is loaded from %s and %s\n", config->name, loaded->config->path, config->path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (nloaded_plugins == MAX_PLUGINS) {
+        ERROR_MSG("Too many plugins, at most %d are supported\n", MAX_PLUGINS);
+        return -1;
+    }
+
+    void *handle = dlopen(config->path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        ERROR_MSG("Could not load plugin %s: %s\n", config->name, dlerror());
+        return -1;
+    }
+
+    const struct sfs_plugin *plugin = dlsym(handle, SFS_PLUGIN_SYMBOL);
+    if (plugin == NULL || check_plugin(config, plugin) != 0) {
+        ERROR_MSG("%s is not a valid SafeFS plugin\n", config->path);
+        dlclose(handle);
+        return -1;
+    }
+
+    loaded_plugins[nloaded_plugins].config = config;
+    loaded_plugins[nloaded_plugins].handle = handle;
+    loaded_plugins[nloaded_plugins].plugin = plugin;
+    nloaded_plugins++;
+
+    DEBUG_MSG("Loaded %s plugin %s from %s, capabilities %x\n", plugin_type_name(plugin->type), config->name,
+              config->path, plugin->capabilities);
+
+    return 0;
+}
+
+const char *plugin_option(const struct plugin_configuration *plugin, const char *name) {
+    return g_hash_table_lookup(plugin->options, name);
+}
+
+int load_plugins(configuration config) {
+    GSList *current;
+
+    for (current = config.plugins; current != NULL; current = current->next) {
+        if (load_plugin(current->data) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Configuration of plugin name in the plugins of a stack
+static const struct plugin_configuration *find_configuration(const char *name, const configuration *config) {
+    GSList *current;
+
+    for (current = config->plugins; current != NULL; current = current->next) {
+        const struct plugin_configuration *pconfig = current->data;
+        if (strcmp(pconfig->name, name) == 0) {
+            return pconfig;
+        }
+    }
+    return NULL;
+}
+
+const struct sfs_plugin *find_plugin(const char *name, int type, const configuration *config,
+                                     const struct plugin_configuration **pconfig) {
+    struct loaded_plugin *loaded = find_loaded(name);
+
+    // the shared object is shared by the stacks, the options are those of the stack
+    *pconfig = find_configuration(name, config);
+    if (*pconfig == NULL) {
+        ERROR_MSG("Plugin %s is not listed in the [plugins] of the stack\n", name);
+        return NULL;
+    }
+    if (loaded == NULL) {
+        ERROR_MSG("Plugin %s is not loaded\n", name);
+        return NULL;
+    }
+    if (loaded->plugin->type != type) {
+        ERROR_MSG("Plugin %s is a %s, not a %s\n", name, plugin_type_name(loaded->plugin->type),
+                  plugin_type_name(type));
+        return NULL;
+    }
+
+    return loaded->plugin;
+}
+
+void clean_plugins() {
+    int i;
+
+    for (i = 0; i < nloaded_plugins; i++) {
+        if (loaded_plugins[i].plugin->clean != NULL) {
+            loaded_plugins[i].plugin->clean();
+        }
+        dlclose(loaded_plugins[i].handle);
+    }
+    nloaded_plugins = 0;
+}
@@ -0,0 +1,71 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Layers and drivers loaded from shared objects.
+ * A plugin is a shared object listed in [plugins] that exports SFS_PLUGIN_SYMBOL, a struct sfs_plugin
+ * describing one layer, sfuse encode driver or multi_loopback driver. Plugins are built against the
+ * headers of the SafeFS sources with the same SFS_PLUGIN_ABI_VERSION, and may call the functions of
+ * the safefs binary (e.g. register_async_operations, io_request_append). A plugin listed by several
+ * stacks is loaded once, and its init function is called by each stack with the options of that stack.
+ */
+
+#ifndef __PLUGIN_H__
+#define __PLUGIN_H__
+
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+// bumped when struct sfs_plugin, the driver structs or the configuration structs change
+#define SFS_PLUGIN_ABI_VERSION 1
+#define SFS_PLUGIN_SYMBOL "sfs_plugin"
+
+#define SFS_PLUGIN_LAYER 0
+#define SFS_PLUGIN_ENCODE_DRIVER 1
+#define SFS_PLUGIN_MULTI_DRIVER 2
+
+// Capabilities
+// the layer registers asynchronous operations for the operations it returns
+#define SFS_CAP_ASYNC (1 << 0)
+// the multi driver fills the io_request of each device, required from multi drivers
+#define SFS_CAP_VECTORED_IO (1 << 1)
+// the encode driver keeps the size of blocks, its size functions may be left NULL
+#define SFS_CAP_LENGTH_PRESERVING (1 << 2)
+
+struct sfs_plugin {
+    int abi_version;
+    int type;
+    int capabilities;
+    // SFS_PLUGIN_LAYER, same contract as the built-in layers: *fuse_operations is the layer below and is
+    // replaced by the operations of the plugin
+    int (*init_layer)(struct fuse_operations **fuse_operations, const configuration *config,
+                      const struct plugin_configuration *plugin);
+    // SFS_PLUGIN_ENCODE_DRIVER, fills the driver used by sfuse
+    int (*init_encode_driver)(struct encode_driver *driver, const enc_config *config,
+                              const struct plugin_configuration *plugin);
+    // SFS_PLUGIN_MULTI_DRIVER, fills the driver used by multi_loopback, the erasure functions are only
+    // needed with mode 2
+    int (*init_multi_driver)(struct multi_driver *driver, const m_loop_conf *config,
+                             const struct plugin_configuration *plugin);
+    // May be NULL
+    int (*clean)();
+};
+
+// Value of option name in the section of the plugin, NULL if it is not set
+const char *plugin_option(const struct plugin_configuration *plugin, const char *name);
+
+// Loads the plugins of config that are not loaded yet, -1 if one of them can not be used
+int load_plugins(configuration config);
+
+// Plugin name of the given type, NULL if it is not loaded. pconfig is set to its configuration in the
+// stack of config, so that a plugin used by several stacks is initialized with the options of each.
+const struct sfs_plugin *find_plugin(const char *name, int type, const configuration *config,
+                                     const struct plugin_configuration **pconfig);
+
+// Unloads the plugins, after the layers are cleaned
+void clean_plugins();
+
+#endif /* __PLUGIN_H__ */
@@ -0,0 +1,333 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "router.h"
+#include "../logdef.h"
+#include "../map/map.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct routed_stack {
+    const char *prefix;
+    const struct fuse_operations *oper;
+};
+
+static struct routed_stack stacks[MAX_STACKS];
+static int nstacks = 0;
+
+static struct fuse_operations router_oper;
+
+// times of the root directory
+static time_t mount_time;
+
+static int is_root(const char *path) { return strcmp(path, "/") == 0; }
+
+// Index of the stack serving path, -1 for the root directory and the paths outside of the stacks
+static int stack_index(const char *path) {
+    int i;
+    for (i = 0; i < nstacks; i++) {
+        if (path_has_prefix(path, stacks[i].prefix)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Stack serving path, NULL for the root directory and the paths outside of the stacks.
+// Stacks with the same top layer share their operations, compare stack_index to tell them apart.
+static const struct fuse_operations *stack_of(const char *path) {
+    int i = stack_index(path);
+    return (i < 0) ? NULL : stacks[i].oper;
+}
+
+static int is_stack_root(const char *path) {
+    int i;
+    for (i = 0; i < nstacks; i++) {
+        if (strcmp(path, stacks[i].prefix) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Error of an operation on a path outside of the stacks, the root directory can not be modified
+static int outside_error(const char *path, int creates) {
+    if (creates) {
+        return -EACCES;
+    }
+    return is_root(path) ? -EPERM : -ENOENT;
+}
+
+// Operations served by the stack of the path in routed. creates tells if they create that path and
+// missing is returned when the stack does not have the operation.
+#define ROUTER_OPERATION(operation, routed, creates, missing)                                      \
+    static int router_##operation LAYER_PARAMS(operation) {                                        \
+        const struct fuse_operations *next = stack_of(routed);                                     \
+        if (next == NULL) {                                                                        \
+            return outside_error(routed, creates);                                                 \
+        }                                                                                          \
+        return (next->operation != NULL) ? next->operation LAYER_ARGS(operation, fi) : missing;    \
+    }
+
+static void *router_init(struct fuse_conn_info *conn) {
+    int i;
+    for (i = 0; i < nstacks; i++) {
+        if (stacks[i].oper->init != NULL) {
+            stacks[i].oper->init(conn);
+        }
+    }
+    return NULL;
+}
+
+static void router_destroy(void *private_data) {
+    int i;
+    for (i = 0; i < nstacks; i++) {
+        if (stacks[i].oper->destroy != NULL) {
+            stacks[i].oper->destroy(NULL);
+        }
+    }
+}
+
+static int router_getattr(const char *path, struct stat *stbuf) {
+    if (is_root(path)) {
+        memset(stbuf, 0, sizeof(struct stat));
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2 + nstacks;
+        stbuf->st_uid = getuid();
+        stbuf->st_gid = getgid();
+        stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = mount_time;
+        return 0;
+    }
+
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return -ENOENT;
+    }
+    return next->getattr(path, stbuf);
+}
+
+static int router_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return router_getattr(path, stbuf);
+    }
+    return (next->fgetattr != NULL) ? next->fgetattr(path, stbuf, fi) : next->getattr(path, stbuf);
+}
+
+static int router_access(const char *path, int mask) {
+    if (is_root(path)) {
+        return (mask & W_OK) ? -EACCES : 0;
+    }
+
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return -ENOENT;
+    }
+    return (next->access != NULL) ? next->access(path, mask) : 0;
+}
+
+ROUTER_OPERATION(readlink, path, 0, -ENOSYS)
+
+static int router_opendir(const char *path, struct fuse_file_info *fi) {
+    if (is_root(path)) {
+        fi->fh = 0;
+        return 0;
+    }
+
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return -ENOENT;
+    }
+    return (next->opendir != NULL) ? next->opendir(path, fi) : 0;
+}
+
+static int router_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                          struct fuse_file_info *fi) {
+    if (is_root(path)) {
+        // ".", ".." and the stacks, each entry with the offset of the next one
+        off_t i;
+        for (i = offset; i < nstacks + 2; i++) {
+            const char *name = (i == 0) ? "." : (i == 1) ? ".." : stacks[i - 2].prefix + 1;
+            if (filler(buf, name, NULL, i + 1)) {
+                break;
+            }
+        }
+        return 0;
+    }
+
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return -ENOENT;
+    }
+    return next->readdir(path, buf, filler, offset, fi);
+}
+
+static int router_releasedir(const char *path, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return 0;
+    }
+    return (next->releasedir != NULL) ? next->releasedir(path, fi) : 0;
+}
+
+ROUTER_OPERATION(mknod, path, 1, -ENOSYS)
+ROUTER_OPERATION(mkdir, path, 1, -ENOSYS)
+ROUTER_OPERATION(symlink, to, 1, -ENOSYS)
+ROUTER_OPERATION(unlink, path, 0, -ENOSYS)
+
+static int router_rmdir(const char *path) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return outside_error(path, 0);
+    }
+    if (is_stack_root(path)) {
+        return -EBUSY;
+    }
+    return (next->rmdir != NULL) ? next->rmdir(path) : -ENOSYS;
+}
+
+static int router_rename(const char *from, const char *to) {
+    int from_stack = stack_index(from);
+    int to_stack = stack_index(to);
+    const struct fuse_operations *next;
+    if (from_stack < 0) {
+        return outside_error(from, 0);
+    }
+    if (to_stack < 0) {
+        return outside_error(to, 1);
+    }
+    if (to_stack != from_stack) {
+        return -EXDEV;
+    }
+    next = stacks[from_stack].oper;
+    if (is_stack_root(from) || is_stack_root(to)) {
+        return -EBUSY;
+    }
+    return (next->rename != NULL) ? next->rename(from, to) : -ENOSYS;
+}
+
+static int router_link(const char *from, const char *to) {
+    int from_stack = stack_index(from);
+    int to_stack = stack_index(to);
+    const struct fuse_operations *next;
+    if (from_stack < 0) {
+        return outside_error(from, 0);
+    }
+    if (to_stack < 0) {
+        return outside_error(to, 1);
+    }
+    if (to_stack != from_stack) {
+        return -EXDEV;
+    }
+    next = stacks[from_stack].oper;
+    return (next->link != NULL) ? next->link(from, to) : -ENOSYS;
+}
+
+ROUTER_OPERATION(chmod, path, 0, -ENOSYS)
+ROUTER_OPERATION(chown, path, 0, -ENOSYS)
+ROUTER_OPERATION(truncate, path, 0, -ENOSYS)
+
+static int router_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return outside_error(path, 0);
+    }
+    if (next->ftruncate == NULL) {
+        return router_truncate(path, size);
+    }
+    return next->ftruncate(path, size, fi);
+}
+
+ROUTER_OPERATION(utimens, path, 0, -ENOSYS)
+ROUTER_OPERATION(create, path, 1, -ENOSYS)
+ROUTER_OPERATION(open, path, 0, 0)
+
+static int router_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    return stack_of(path)->read(path, buf, size, offset, fi);
+}
+
+static int router_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    return stack_of(path)->write(path, buf, size, offset, fi);
+}
+
+static int router_statfs(const char *path, struct statvfs *stbuf) {
+    // the root directory reports the first stack
+    if (stack_of(path) == NULL) {
+        path = stacks[0].prefix;
+    }
+
+    const struct fuse_operations *next = stack_of(path);
+    return (next->statfs != NULL) ? next->statfs(path, stbuf) : -ENOSYS;
+}
+
+static int router_flush(const char *path, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    return (next->flush != NULL) ? next->flush(path, fi) : 0;
+}
+
+static int router_release(const char *path, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    return (next->release != NULL) ? next->release(path, fi) : 0;
+}
+
+static int router_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    const struct fuse_operations *next = stack_of(path);
+    return (next->fsync != NULL) ? next->fsync(path, isdatasync, fi) : 0;
+}
+
+ROUTER_OPERATION(setxattr, path, 0, -ENOTSUP)
+
+static int router_getxattr(const char *path, const char *name, char *value, size_t size) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return is_root(path) ? -ENODATA : -ENOENT;
+    }
+    return (next->getxattr != NULL) ? next->getxattr(path, name, value, size) : -ENOTSUP;
+}
+
+static int router_listxattr(const char *path, char *list, size_t size) {
+    const struct fuse_operations *next = stack_of(path);
+    if (next == NULL) {
+        return is_root(path) ? 0 : -ENOENT;
+    }
+    return (next->listxattr != NULL) ? next->listxattr(path, list, size) : -ENOTSUP;
+}
+
+ROUTER_OPERATION(removexattr, path, 0, -ENOTSUP)
+
+int router_add_stack(const char *prefix, const struct fuse_operations *operations) {
+    if (nstacks == MAX_STACKS) {
+        ERROR_MSG("Too many stacks, at most %d are supported\n", MAX_STACKS);
+        return -1;
+    }
+    stacks[nstacks].prefix = prefix;
+    stacks[nstacks].oper = operations;
+    nstacks++;
+    return 0;
+}
+
+#define ROUTER_INSTALL(operation) router_oper.operation = router_##operation;
+
+int init_router(struct fuse_operations **fuse_operations) {
+    DEBUG_MSG("Going to init the router of %d stacks\n", nstacks);
+
+    if (nstacks == 0) {
+        return 1;
+    }
+    mount_time = time(NULL);
+
+    router_oper.init = router_init;
+    router_oper.destroy = router_destroy;
+    LAYER_OPERATIONS(ROUTER_INSTALL)
+
+    *fuse_operations = &router_oper;
+
+    return 0;
+}
+
+void clean_router() { nstacks = 0; }
@@ -0,0 +1,28 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Router of the stacks hosted by one process.
+ * Each stack serves a top-level directory of the mount and receives the paths below it unchanged,
+ * including the directory. The root directory only lists the stacks and can not be modified, and
+ * files can not be renamed or linked across stacks.
+ */
+
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+#define MAX_STACKS 8
+
+// Adds the stack serving the top-level directory prefix, before init_router
+int router_add_stack(const char *prefix, const struct fuse_operations *operations);
+
+int init_router(struct fuse_operations **fuse_operations);
+void clean_router();
+
+#endif /* __ROUTER_H__ */
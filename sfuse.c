@@ -7,34 +7,501 @@
 
 #include "sfuse.h"
 #include "timestamps/timestamps.h"
+#include "geometry/geometry.h"
+#include "async/async.h"
+#include "plugins/plugin.h"
+#include "stats/stats.h"
+#include "trace/trace.h"
+#include "handles/handles.h"
 
-// struct with original operations from mounted filesystem
-static struct fuse_operations *originalfs_oper;
+// operations of the layer below, private_data is the encoding driver
+static struct layer_context sfuse_layer;
 // struct with sfuse operations
 static struct fuse_operations sfuse_oper;
 
 // struct with encoding algorithms
 static struct encode_driver enc_driver;
 
-GSList *sfuse_write_list = NULL, *sfuse_read_list = NULL;
+// Encoding mode in use, AUTO_CIPHER is resolved at init
+static int SFUSE_MODE;
 
-static int sfuse_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    // struct timespec tstart={0,0}, tend={0,0};
-    // clock_gettime(CLOCK_MONOTONIC, &tstart);
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
+// Plugin providing enc_driver, NULL when it is one of the built-in drivers
+static const struct sfs_plugin *enc_plugin = NULL;
 
-    DEBUG_MSG("(sfuse.c) - Going to read from the file-system.\n");
-    DEBUG_MSG("Going to read offset %ld with size %lu\n", offset, size);
+// Workers encoding/decoding the blocks of multi-block requests (NULL if they run on the calling thread)
+static GThreadPool *crypto_pool = NULL;
+
+static struct latency_histogram *sfuse_write_latency, *sfuse_read_latency;
+
+// Logical (plaintext) size of regular files, so that getattr does not decode the last block every time
+static ivdb size_cache;
+static GMutex size_cache_mutex;
+static int size_cache_enabled = 0;
+static uint64_t size_cache_hits = 0, size_cache_misses = 0;
+
+// Bumped on every change to a size, a size computed from the lower layer is only cached if the slot
+// of its path did not change meanwhile
+#define SIZE_CACHE_SLOTS 64
+static uint64_t size_cache_generation[SIZE_CACHE_SLOTS];
+
+static int size_cache_slot(const char *path) { return g_str_hash(path) % SIZE_CACHE_SLOTS; }
+
+// Returns 0 if the size of path is cached, otherwise a token to pass to size_cache_fill
+static uint64_t size_cache_lookup(const char *path, off_t *size) {
+    value_db *value = NULL;
+    uint64_t generation;
+
+    g_mutex_lock(&size_cache_mutex);
+    hash_get(&size_cache, (char *)path, &value);
+    if (value != NULL) {
+        *size = value->file_size;
+        size_cache_hits++;
+    } else {
+        size_cache_misses++;
+    }
+    generation = size_cache_generation[size_cache_slot(path)];
+    g_mutex_unlock(&size_cache_mutex);
+
+    return (value != NULL) ? 0 : generation + 1;
+}
+
+// Caches a size read from the lower layer, unless it was changed since the lookup returned generation
+static void size_cache_fill(const char *path, off_t size, uint64_t generation) {
+    g_mutex_lock(&size_cache_mutex);
+    if (size_cache_generation[size_cache_slot(path)] + 1 == generation) {
+        value_db *value = malloc(sizeof(value_db));
+        value->file_size = size;
+        hash_put(&size_cache, strdup(path), value);
+    }
+    g_mutex_unlock(&size_cache_mutex);
+}
+
+static void size_cache_set(const char *path, off_t size) {
+    g_mutex_lock(&size_cache_mutex);
+    size_cache_generation[size_cache_slot(path)]++;
+    value_db *value = NULL;
+    hash_get(&size_cache, (char *)path, &value);
+    if (value != NULL) {
+        value->file_size = size;
+    }
+    g_mutex_unlock(&size_cache_mutex);
+}
+
+static void size_cache_extend(const char *path, off_t end) {
+    g_mutex_lock(&size_cache_mutex);
+    size_cache_generation[size_cache_slot(path)]++;
+    value_db *value = NULL;
+    hash_get(&size_cache, (char *)path, &value);
+    if (value != NULL && value->file_size < end) {
+        value->file_size = end;
+    }
+    g_mutex_unlock(&size_cache_mutex);
+}
+
+// Forgets the size of a file, the other slots and entries are left as they are
+static void size_cache_remove(const char *path) {
+    g_mutex_lock(&size_cache_mutex);
+    size_cache_generation[size_cache_slot(path)]++;
+    remove_keys(&size_cache, (char *)path);
+    g_mutex_unlock(&size_cache_mutex);
+}
+
+// Forgets path and, if it is a directory, every path below it, which may be in any slot
+static void size_cache_remove_tree(const char *path) {
+    int i;
+
+    g_mutex_lock(&size_cache_mutex);
+    for (i = 0; i < SIZE_CACHE_SLOTS; i++) {
+        size_cache_generation[i]++;
+    }
+    remove_keys_with_prefix(&size_cache, path);
+    g_mutex_unlock(&size_cache_mutex);
+}
+
+// Plaintext block size of the file at path. Requests spanning several blocks are split on it.
+static int file_block_size(const char *path) { return geometry_block_size(path, sfuse_layer.next); }
+
+// State of a file opened through sfuse, fi->fh points to it (see handles/handles.h)
+struct sfuse_file {
+    struct layer_file lower;
+    // identity of the file, zeros when the driver does not bind it or the file has none
+    unsigned char id[FILE_ID_SIZE];
+    // plaintext block size, looked up once per open
+    int block_size;
+};
+
+// Reads the identity recorded in the metadata of the file at path
+static void read_file_id(const char *path, unsigned char *id) {
+    memset(id, 0, FILE_ID_SIZE);
+    if (!enc_driver.binds_file_id || sfuse_layer.next->getxattr == NULL) {
+        return;
+    }
+
+    int res = sfuse_layer.next->getxattr(path, FILE_ID_XATTR, (char *)id, FILE_ID_SIZE);
+    if (res != FILE_ID_SIZE) {
+        // files created without an identity are bound to zeros, their blocks to their index only
+        memset(id, 0, FILE_ID_SIZE);
+    }
+}
+
+// Chooses the identity of a file just created at path and records it in its metadata
+static void new_file_id(const char *path, unsigned char *id) {
+    memset(id, 0, FILE_ID_SIZE);
+    if (!enc_driver.binds_file_id) {
+        return;
+    }
+
+    int res = (RAND_bytes(id, FILE_ID_SIZE) == 1) ? 0 : -EIO;
+    if (res == 0) {
+        res = (sfuse_layer.next->setxattr != NULL)
+                  ? sfuse_layer.next->setxattr(path, FILE_ID_XATTR, (const char *)id, FILE_ID_SIZE, 0)
+                  : -ENOTSUP;
+    }
+    if (res < 0) {
+        ERROR_MSG("Could not record the identity of %s, its blocks are only bound to their index: %s\n", path,
+                  strerror(-res));
+        memset(id, 0, FILE_ID_SIZE);
+    }
+}
+
+// Identity of the file of a request, read from its metadata if it is not open
+static const unsigned char *request_file_id(const char *path, struct fuse_file_info *fi, unsigned char *buf) {
+    if (fi != NULL) {
+        return ((struct sfuse_file *)layer_file_of(fi))->id;
+    }
+    read_file_id(path, buf);
+    return buf;
+}
+
+// Block size of the file of a request, looked up if it is not open
+static int request_block_size(const char *path, struct fuse_file_info *fi) {
+    if (fi != NULL) {
+        return ((struct sfuse_file *)layer_file_of(fi))->block_size;
+    }
+    return file_block_size(path);
+}
+
+// Logical size of a regular file, from the cache or by asking the encoding driver
+static off_t sfuse_file_size(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    off_t size;
+    uint64_t generation = 0;
+
+    if (size_cache_enabled) {
+        generation = size_cache_lookup(path, &size);
+        if (generation == 0) {
+            return size;
+        }
+    }
+
+    size = enc_driver.get_file_size(path, stbuf->st_size, layer_file_lower(fi, &lower), sfuse_layer.next,
+                                    request_block_size(path, fi));
+
+    // with hard links the same data is reachable from paths that would not be kept in sync
+    if (size_cache_enabled && size >= 0 && stbuf->st_nlink <= 1) {
+        size_cache_fill(path, size, generation);
+    }
+
+    return size;
+}
+
+// Whole ciphered blocks made only of zeros are holes left by block_align sparse truncates and read as zeros.
+// Never set with authenticated encryption, block_align then writes zero blocks instead of holes.
+static int zero_holes = 0;
+
+static int is_hole(const struct encode_driver *driver, const unsigned char *src, int size, int block_size) {
+    int i;
+
+    if (!zero_holes || block_size <= 0 || size != driver->get_cyphered_block_size(block_size)) {
+        return 0;
+    }
+    for (i = 0; i < size; i++) {
+        if (src[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int sfuse_decode(const struct encode_driver *driver, unsigned char *dest, const unsigned char *src, int size,
+                        struct key_info *info) {
+    if (is_hole(driver, src, size, info->block_size)) {
+        memset(dest, 0, info->block_size);
+        return info->block_size;
+    }
+    return driver->decode(dest, src, size, info);
+}
+
+// user_data is the encoding driver of the layer
+static void crypto_func(gpointer data, gpointer user_data) {
+    struct crypto_job *job = (struct crypto_job *)data;
+    const struct encode_driver *driver = user_data;
+    uint64_t tstart = 0;
+
+    if (job->trace_request != 0) {
+        tstart = latency_now();
+        trace_record(job->trace_request, "sfuse.queue", job->queued, -1);
+    }
+
+    if (job->op_type == ENCODE_OP) {
+        job->res = driver->encode(job->dest, job->src, job->size, &job->info);
+    } else {
+        job->res = sfuse_decode(driver, job->dest, job->src, job->size, &job->info);
+    }
+    trace_record(job->trace_request, (job->op_type == ENCODE_OP) ? "sfuse.encode" : "sfuse.decode", tstart, -1);
+
+    pthread_mutex_lock(job->lock);
+    job->done = 1;
+    pthread_cond_signal(job->cond);
+    pthread_mutex_unlock(job->lock);
+}
+
+static void dispatch_crypto_job(struct crypto_job *job) {
+    job->trace_request = trace_current();
+    if (job->trace_request != 0) {
+        job->queued = latency_now();
+    }
+
+    if (crypto_pool != NULL) {
+        g_thread_pool_push(crypto_pool, job, NULL);
+    } else {
+        crypto_func(job, sfuse_layer.private_data);
+    }
+}
+
+static void wait_for_crypto_job(struct crypto_job *job) {
+    pthread_mutex_lock(job->lock);
+    while (!job->done) {
+        pthread_cond_wait(job->cond, job->lock);
+    }
+    pthread_mutex_unlock(job->lock);
+}
+
+static void wait_for_all_crypto_jobs(struct crypto_job *jobs, int njobs) {
+    int i;
+    for (i = 0; i < njobs; i++) {
+        wait_for_crypto_job(&jobs[i]);
+    }
+}
+
+// IVs of the blocks of a request when the driver derives them, all computed at once (NULL otherwise)
+static unsigned char *derive_request_ivs(const char *path, uint64_t first_block, int nblocks) {
+    if (enc_driver.derive_ivs == NULL) {
+        return NULL;
+    }
+
+    unsigned char *ivs = malloc(nblocks * DERIVED_IV_SIZE);
+    enc_driver.derive_ivs(path, first_block, nblocks, ivs);
+    return ivs;
+}
+
+// A request is split into blocks when it starts at a block boundary and does not fit in a single block
+static int is_multi_block(size_t size, off_t offset, int block_size) {
+    return block_size > 0 && size > block_size && offset % block_size == 0;
+}
+
+/*
+ * Reads a request spanning several blocks with a single call to the lower layer and decodes its
+ * blocks in parallel. Each block keeps its own padding/IV, so the ciphered blocks are laid out
+ * every get_cyphered_block_size(block_size) bytes.
+ */
+static int sfuse_read_blocks(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                             int block_size, const unsigned char *file_id) {
+    int nblocks = (size + block_size - 1) / block_size;
+    int last_plain_size = size - (uint64_t)(nblocks - 1) * block_size;
+    int cstride = enc_driver.get_cyphered_block_size(block_size);
+    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset, block_size);
+    uint64_t csize = (uint64_t)(nblocks - 1) * cstride + enc_driver.get_cyphered_block_size(last_plain_size);
+
+    DEBUG_MSG("Going to read path %s cblock_offset %lu with csize %lu in %d blocks\n", path, cblock_offset, csize,
+              nblocks);
+
+    char *cyphered_buf = malloc(csize);
+    int res = sfuse_layer.next->read(path, cyphered_buf, csize, cblock_offset, fi);
+    if (res <= 0) {
+        free(cyphered_buf);
+        return res;
+    }
+
+    // The last block may decode to more bytes than requested, it is decoded apart and then trimmed
+    unsigned char *last_plain_buf = NULL;
+    int njobs = (res + cstride - 1) / cstride;
+    unsigned char *ivs = derive_request_ivs(path, cblock_offset / cstride, njobs);
+    struct crypto_job *jobs = malloc(njobs * sizeof(struct crypto_job));
+    pthread_mutex_t job_lock;
+    pthread_cond_t job_cond;
+    pthread_mutex_init(&job_lock, 0);
+    pthread_cond_init(&job_cond, 0);
+
+    int i;
+    for (i = 0; i < njobs; i++) {
+        uint64_t block_start = (uint64_t)i * cstride;
+
+        jobs[i].op_type = DECODE_OP;
+        jobs[i].src = (unsigned char *)&cyphered_buf[block_start];
+        jobs[i].size = (res - block_start < cstride) ? res - block_start : cstride;
+        jobs[i].dest = (unsigned char *)&buf[(uint64_t)i * block_size];
+        jobs[i].info.path = path;
+        jobs[i].info.offset = cblock_offset + block_start;
+        jobs[i].info.iv = (ivs != NULL) ? &ivs[i * DERIVED_IV_SIZE] : NULL;
+        jobs[i].info.block_size = block_size;
+        jobs[i].info.file_id = file_id;
+        jobs[i].done = 0;
+        jobs[i].lock = &job_lock;
+        jobs[i].cond = &job_cond;
+
+        if (i == nblocks - 1 && last_plain_size < block_size) {
+            last_plain_buf = malloc(jobs[i].size);
+            jobs[i].dest = last_plain_buf;
+        }
+
+        dispatch_crypto_job(&jobs[i]);
+    }
+
+    wait_for_all_crypto_jobs(jobs, njobs);
+
+    // Only the bytes of consecutive decoded blocks are returned
+    res = 0;
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].res < 0) {
+            res = (i == 0) ? -1 : res;
+            break;
+        }
+        if (jobs[i].dest == last_plain_buf) {
+            jobs[i].res = (jobs[i].res < last_plain_size) ? jobs[i].res : last_plain_size;
+            memcpy(&buf[(uint64_t)i * block_size], last_plain_buf, jobs[i].res);
+        }
+        res += jobs[i].res;
+        if (jobs[i].res < block_size) {
+            break;
+        }
+    }
+
+    pthread_mutex_destroy(&job_lock);
+    pthread_cond_destroy(&job_cond);
+    free(last_plain_buf);
+    free(ivs);
+    free(jobs);
+    free(cyphered_buf);
+
+    return res;
+}
+
+/*
+ * Encodes the blocks of a request spanning several blocks in parallel. While the workers are still
+ * encoding, the blocks already encoded are written to the lower layer, coalesced in as few writes as
+ * their completion order allows. Writes are issued asynchronously when the lower layer supports it,
+ * so several of them can be in flight while the next blocks are encoded.
+ */
+static int sfuse_write_blocks(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                              int block_size, const unsigned char *file_id) {
+    int nblocks = (size + block_size - 1) / block_size;
+    int cstride = enc_driver.get_cyphered_block_size(block_size);
+    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset, block_size);
+
+    DEBUG_MSG("Going to write path %s cblock_offset %lu in %d blocks\n", path, cblock_offset, nblocks);
+
+    char *cyphered_buf = malloc((uint64_t)nblocks * cstride);
+    unsigned char *ivs = derive_request_ivs(path, cblock_offset / cstride, nblocks);
+    struct crypto_job *jobs = malloc(nblocks * sizeof(struct crypto_job));
+    pthread_mutex_t job_lock;
+    pthread_cond_t job_cond;
+    pthread_mutex_init(&job_lock, 0);
+    pthread_cond_init(&job_cond, 0);
+
+    int i;
+    for (i = 0; i < nblocks; i++) {
+        uint64_t plain_start = (uint64_t)i * block_size;
+
+        jobs[i].op_type = ENCODE_OP;
+        jobs[i].src = (const unsigned char *)&buf[plain_start];
+        jobs[i].size = (size - plain_start < block_size) ? size - plain_start : block_size;
+        jobs[i].dest = (unsigned char *)&cyphered_buf[(uint64_t)i * cstride];
+        jobs[i].info.path = path;
+        jobs[i].info.offset = cblock_offset + (uint64_t)i * cstride;
+        jobs[i].info.iv = (ivs != NULL) ? &ivs[i * DERIVED_IV_SIZE] : NULL;
+        jobs[i].info.block_size = block_size;
+        jobs[i].info.file_id = file_id;
+        jobs[i].done = 0;
+        jobs[i].lock = &job_lock;
+        jobs[i].cond = &job_cond;
+
+        dispatch_crypto_job(&jobs[i]);
+    }
+
+    // one write per coalesced run of blocks at most
+    struct layer_future *writes = malloc(nblocks * sizeof(struct layer_future));
+    uint64_t *write_sizes = malloc(nblocks * sizeof(uint64_t));
+    int nwrites = 0;
+
+    int res = size;
+    int next_block = 0;
+    while (next_block < nblocks) {
+        wait_for_crypto_job(&jobs[next_block]);
+
+        // extend the write with the following blocks that are already encoded
+        int last_block = next_block;
+        pthread_mutex_lock(&job_lock);
+        while (last_block + 1 < nblocks && jobs[last_block + 1].done) {
+            last_block++;
+        }
+        pthread_mutex_unlock(&job_lock);
+
+        uint64_t csize = 0;
+        for (i = next_block; i <= last_block; i++) {
+            int cblock_size = enc_driver.get_cyphered_block_size(jobs[i].size);
+            if (jobs[i].res < cblock_size) {
+                DEBUG_MSG("RES < cblock for encode path %s block %d\n", path, i);
+                res = -1;
+                break;
+            }
+            csize += cblock_size;
+        }
+        if (res < 0) {
+            break;
+        }
+
+        uint64_t write_offset = cblock_offset + (uint64_t)next_block * cstride;
+        layer_future_init(&writes[nwrites]);
+        write_sizes[nwrites] = csize;
+        layer_write_async(&sfuse_layer, path, &cyphered_buf[(uint64_t)next_block * cstride], csize, write_offset,
+                          fi, layer_future_complete, &writes[nwrites]);
+        nwrites++;
 
+        next_block = last_block + 1;
+    }
+
+    // buffers can only be released once every worker and write is done with them
+    for (i = 0; i < nwrites; i++) {
+        int write_res = layer_future_wait(&writes[i]);
+        if (res >= 0 && (write_res < 0 || write_res < write_sizes[i])) {
+            res = (write_res < 0) ? write_res : -1;
+        }
+    }
+    wait_for_all_crypto_jobs(jobs, nblocks);
+
+    pthread_mutex_destroy(&job_lock);
+    pthread_cond_destroy(&job_cond);
+    free(write_sizes);
+    free(writes);
+    free(ivs);
+    free(jobs);
+    free(cyphered_buf);
+
+    return res;
+}
+
+// Reads a request within a single block
+static int sfuse_read_block(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                            int block_size, const unsigned char *file_id) {
     int cblock_size = enc_driver.get_cyphered_block_size(size);
-    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset);
+    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset, block_size);
 
     DEBUG_MSG("Going to read path %s cblock_offset %ld with cblock_size %lu\n", path, cblock_offset, cblock_size);
 
     char aux_cyphered_buf[cblock_size];
 
-    int res = originalfs_oper->read(path, aux_cyphered_buf, cblock_size, cblock_offset, fi);
+    int res = sfuse_layer.next->read(path, aux_cyphered_buf, cblock_size, cblock_offset, fi);
     if (res <= 0) {
         return res;
     }
@@ -44,32 +511,53 @@ static int sfuse_read(const char *path, char *buf, size_t size, off_t offset, st
     struct key_info info;
     info.path = path;
     info.offset = cblock_offset;
+    info.iv = NULL;
+    info.block_size = block_size;
+    info.file_id = file_id;
 
-    res = enc_driver.decode((unsigned char *)buf, (unsigned char *)aux_cyphered_buf, res, &info);
+    struct trace_span span;
+    trace_span_begin(&span);
+    res = sfuse_decode(sfuse_layer.private_data, (unsigned char *)buf, (unsigned char *)aux_cyphered_buf, res, &info);
+    trace_span_end(&span, "sfuse.decode", -1);
     DEBUG_MSG("Read path %s cblock_offset %ld with cblock_size %lu return size%d\n", path, cblock_offset, cblock_size,
               res);
 
-    gettimeofday(&tend, NULL);
-
-    // clock_gettime(CLOCK_MONOTONIC, &tend);
-    store(&sfuse_read_list, tstart, tend);
-
     return res;
 }
 
-static int sfuse_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    // struct timespec tstart={0,0}, tend={0,0};
-    // clock_gettime(CLOCK_MONOTONIC, &tstart);
-    struct timeval tstart, tend;
-    gettimeofday(&tstart, NULL);
+static int sfuse_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    uint64_t tstart = latency_now();
+    struct trace_span span;
+    int res;
 
-    DEBUG_MSG("(sfuse.c) - Going to write to the file-system.\n");
-    DEBUG_MSG("Going to write path %s offset %ld with size %lu\n", path, offset, size);
+    trace_span_begin(&span);
 
-    int res;
+    DEBUG_MSG("(sfuse.c) - Going to read from the file-system.\n");
+    DEBUG_MSG("Going to read offset %ld with size %lu\n", offset, size);
+
+    int block_size = request_block_size(path, fi);
+    unsigned char id_buf[FILE_ID_SIZE];
+    const unsigned char *file_id = request_file_id(path, fi, id_buf);
+    struct fuse_file_info lower;
+    fi = layer_file_lower(fi, &lower);
+
+    if (is_multi_block(size, offset, block_size)) {
+        res = sfuse_read_blocks(path, buf, size, offset, fi, block_size, file_id);
+    } else {
+        res = sfuse_read_block(path, buf, size, offset, fi, block_size, file_id);
+    }
+
+    store_io(sfuse_read_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "sfuse.read", -1);
+
+    return res;
+}
 
+// Writes a request within a single block
+static int sfuse_write_block(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi,
+                             int block_size, const unsigned char *file_id) {
     int cblock_size = enc_driver.get_cyphered_block_size(size);
-    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset);
+    uint64_t cblock_offset = enc_driver.get_cyphered_block_offset(offset, block_size);
 
     DEBUG_MSG("Going to write path %s cblock_offset %ld with cblock_size %lu\n", path, cblock_offset, cblock_size);
 
@@ -78,8 +566,14 @@ static int sfuse_write(const char *path, const char *buf, size_t size, off_t off
     struct key_info info;
     info.path = path;
     info.offset = cblock_offset;
+    info.iv = NULL;
+    info.block_size = block_size;
+    info.file_id = file_id;
 
-    res = enc_driver.encode((unsigned char *)aux_cyphered_buf, (unsigned char *)buf, size, &info);
+    struct trace_span span;
+    trace_span_begin(&span);
+    int res = enc_driver.encode((unsigned char *)aux_cyphered_buf, (unsigned char *)buf, size, &info);
+    trace_span_end(&span, "sfuse.encode", -1);
     if (res < cblock_size) {
         DEBUG_MSG("RES < cblock for encode Going to write path %s cblock_offset %ld with cblock_size %lu\n", path,
                   cblock_offset, cblock_size);
@@ -87,35 +581,62 @@ static int sfuse_write(const char *path, const char *buf, size_t size, off_t off
         return -1;
     }
 
-    res = originalfs_oper->write(path, aux_cyphered_buf, cblock_size, cblock_offset, fi);
+    res = sfuse_layer.next->write(path, aux_cyphered_buf, cblock_size, cblock_offset, fi);
     if (res < 0) {
         return res;
     }
     if (res < cblock_size) {
         return -1;
     }
-    // clock_gettime(CLOCK_MONOTONIC, &tend);
-    gettimeofday(&tend, NULL);
-
-    store(&sfuse_write_list, tstart, tend);
 
     return size;
 }
 
+static int sfuse_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    uint64_t tstart = latency_now();
+    struct trace_span span;
+    int res;
+
+    trace_span_begin(&span);
+
+    DEBUG_MSG("(sfuse.c) - Going to write to the file-system.\n");
+    DEBUG_MSG("Going to write path %s offset %ld with size %lu\n", path, offset, size);
+
+    int block_size = request_block_size(path, fi);
+    unsigned char id_buf[FILE_ID_SIZE];
+    const unsigned char *file_id = request_file_id(path, fi, id_buf);
+    struct fuse_file_info lower;
+    fi = layer_file_lower(fi, &lower);
+
+    if (is_multi_block(size, offset, block_size)) {
+        res = sfuse_write_blocks(path, buf, size, offset, fi, block_size, file_id);
+    } else {
+        res = sfuse_write_block(path, buf, size, offset, fi, block_size, file_id);
+    }
+    if (res > 0 && size_cache_enabled) {
+        size_cache_extend(path, offset + res);
+    }
+
+    store_io(sfuse_write_latency, tstart, (res > 0) ? res : 0);
+    trace_span_end(&span, "sfuse.write", -1);
+
+    return res;
+}
+
 static int sfuse_getattr(const char *path, struct stat *stbuf) {
     int res;
 
     DEBUG_MSG("(sfuse.c) - Going to gettattr to the file-system.\n");
     DEBUG_MSG("path %s\n", path);
 
-    res = originalfs_oper->getattr(path, stbuf);
+    res = sfuse_layer.next->getattr(path, stbuf);
 
     DEBUG_MSG("path checking if is reg file%s\n", path);
 
     if (res >= 0 && S_ISREG(stbuf->st_mode)) {
         DEBUG_MSG("path is reg file%s\n", path);
 
-        stbuf->st_size = enc_driver.get_file_size(path, stbuf->st_size, NULL, *originalfs_oper);
+        stbuf->st_size = sfuse_file_size(path, stbuf, NULL);
 
         if (stbuf->st_size < 0) {
             return -1;
@@ -126,6 +647,7 @@ static int sfuse_getattr(const char *path, struct stat *stbuf) {
 }
 
 static int sfuse_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
     int res;
 
     (void)path;
@@ -133,14 +655,14 @@ static int sfuse_fgetattr(const char *path, struct stat *stbuf, struct fuse_file
     DEBUG_MSG("(sfuse.c) - Going to fgettattr to the file-system.\n");
     DEBUG_MSG("path %s\n", path);
 
-    res = originalfs_oper->fgetattr(path, stbuf, fi);
+    res = sfuse_layer.next->fgetattr(path, stbuf, layer_file_lower(fi, &lower));
 
     DEBUG_MSG("res is %d\n", res);
 
     if (res == 0 && S_ISREG(stbuf->st_mode)) {
         DEBUG_MSG("path is reg file%s\n", path);
 
-        stbuf->st_size = enc_driver.get_file_size(path, stbuf->st_size, fi, *originalfs_oper);
+        stbuf->st_size = sfuse_file_size(path, stbuf, fi);
         if (stbuf->st_size < 0) {
             return -1;
         }
@@ -152,34 +674,215 @@ static int sfuse_fgetattr(const char *path, struct stat *stbuf, struct fuse_file
 static int sfuse_truncate(const char *path, off_t size) {
     DEBUG_MSG("sfuse truncate path %s %lu\n", path, size);
     // Check if it is working
-    off_t truncate_size = enc_driver.get_truncate_size(size);
+    off_t truncate_size = enc_driver.get_truncate_size(size, file_block_size(path));
 
-    // int res=originalfs_oper->truncate(path,size);
-    int res = originalfs_oper->truncate(path, truncate_size);
+    // int res=sfuse_layer.next->truncate(path,size);
+    int res = sfuse_layer.next->truncate(path, truncate_size);
     if (res == -1) {
         return -errno;
     }
+    if (size_cache_enabled) {
+        size_cache_set(path, size);
+    }
 
     return 0;
 }
 
 static int sfuse_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
     DEBUG_MSG("ftruncate path %s %lu\n", path, size);
 
-    off_t truncate_size = enc_driver.get_truncate_size(size);
+    off_t truncate_size = enc_driver.get_truncate_size(size, request_block_size(path, fi));
 
-    int res = originalfs_oper->ftruncate(path, truncate_size, fi);
+    int res = sfuse_layer.next->ftruncate(path, truncate_size, layer_file_lower(fi, &lower));
     if (res == -1) {
         return -errno;
     }
+    if (size_cache_enabled) {
+        size_cache_set(path, size);
+    }
 
     return 0;
 }
 
+static int sfuse_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    int res = sfuse_layer.next->create(path, mode, fi);
+    if (res == 0) {
+        struct sfuse_file *file = malloc(sizeof(struct sfuse_file));
+        file->block_size = geometry_new_file(path, sfuse_layer.next);
+        new_file_id(path, file->id);
+        layer_file_attach(fi, &file->lower);
+    }
+    if (res == 0 && size_cache_enabled) {
+        size_cache_remove(path);
+    }
+    return res;
+}
+
+static int sfuse_open(const char *path, struct fuse_file_info *fi) {
+    int res = sfuse_layer.next->open(path, fi);
+    if (res == 0) {
+        struct sfuse_file *file = malloc(sizeof(struct sfuse_file));
+        file->block_size = file_block_size(path);
+        read_file_id(path, file->id);
+        layer_file_attach(fi, &file->lower);
+    }
+    return res;
+}
+
+static int sfuse_release(const char *path, struct fuse_file_info *fi) {
+    struct layer_file *file = layer_file_detach(fi);
+    int res = sfuse_layer.next->release(path, fi);
+    free(file);
+    return res;
+}
+
+static int sfuse_flush(const char *path, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return sfuse_layer.next->flush(path, layer_file_lower(fi, &lower));
+}
+
+static int sfuse_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    struct fuse_file_info lower;
+    return sfuse_layer.next->fsync(path, isdatasync, layer_file_lower(fi, &lower));
+}
+
+static int sfuse_unlink(const char *path) {
+    int res = sfuse_layer.next->unlink(path);
+    if (res == 0) {
+        geometry_remove(path);
+    }
+    if (res == 0 && size_cache_enabled) {
+        size_cache_remove(path);
+    }
+    return res;
+}
+
+// Prefix of the names the fuse front ends give to files unlinked while they are still open
+#define FUSE_HIDDEN_PREFIX ".fuse_hidden"
+
+static int is_hidden_name(const char *path) {
+    const char *name = strrchr(path, '/');
+    return strncmp((name != NULL) ? name + 1 : path, FUSE_HIDDEN_PREFIX, strlen(FUSE_HIDDEN_PREFIX)) == 0;
+}
+
+static int sfuse_rename(const char *from, const char *to) {
+    int res;
+
+    /*
+     * With IVs derived from the path, the blocks of a renamed file could only be decoded after being
+     * encrypted again under the new path, which can not be done atomically nor while the file is open.
+     * Renames fail as across file systems, so that mv copies the file. Hiding an open file that is
+     * unlinked is a rename as well, the unlink then fails as for a busy file.
+     */
+    if (enc_driver.derive_ivs != NULL) {
+        return is_hidden_name(to) ? -EBUSY : -EXDEV;
+    }
+
+    res = sfuse_layer.next->rename(from, to);
+    if (res == 0) {
+        geometry_rename(from, to);
+    }
+    if (res == 0 && size_cache_enabled) {
+        size_cache_remove_tree(from);
+        size_cache_remove_tree(to);
+    }
+    return res;
+}
+
+static int sfuse_link(const char *from, const char *to) {
+    // the blocks of a file can only be decoded from the path they were encoded for
+    if (enc_driver.derive_ivs != NULL) {
+        return -EPERM;
+    }
+
+    int res = sfuse_layer.next->link(from, to);
+    if (res == 0 && size_cache_enabled) {
+        size_cache_remove(from);
+    }
+    return res;
+}
+
+static int sfuse_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    return geometry_setxattr(path, name, value, size, flags, sfuse_layer.next);
+}
+
+static int sfuse_listxattr(const char *path, char *list, size_t size) {
+    return geometry_listxattr(path, list, size, sfuse_layer.next);
+}
+
+static int sfuse_removexattr(const char *path, const char *name) {
+    return geometry_removexattr(path, name, sfuse_layer.next);
+}
+
 // TODO: IVS should also be deleted for unlinked (removed) files.
 
+static int resolve_mode(int mode) {
+    if (mode == AUTO_CIPHER) {
+        // Without AES instructions ChaCha20 is several times faster than software AES
+        return (cpu_has_aes_instructions() || !chacha_supported()) ? STANDARD : CHACHA;
+    }
+    return mode;
+}
+
+// Drivers of plugins may authenticate their blocks, they are assumed to
+int sfuse_authenticated(enc_config config) { return config.driver != NULL || resolve_mode(config.mode) == CHACHA; }
+
+// Encode driver of a plugin, length preserving drivers may leave the size functions NULL
+static int init_plugin_driver(configuration data) {
+    enc_config config = data.enc_config;
+    const struct plugin_configuration *pconfig;
+
+    enc_plugin = find_plugin(config.driver, SFS_PLUGIN_ENCODE_DRIVER, &data, &pconfig);
+    if (enc_plugin == NULL) {
+        return -1;
+    }
+
+    memset(&enc_driver, 0, sizeof(struct encode_driver));
+    if (enc_plugin->init_encode_driver(&enc_driver, &config, pconfig) != 0) {
+        ERROR_MSG("Could not init encode driver %s\n", config.driver);
+        enc_plugin = NULL;
+        return -1;
+    }
+
+    if (enc_plugin->capabilities & SFS_CAP_LENGTH_PRESERVING) {
+        enc_driver.get_file_size = (enc_driver.get_file_size != NULL) ? enc_driver.get_file_size : nop_get_file_size;
+        enc_driver.get_cyphered_block_size = (enc_driver.get_cyphered_block_size != NULL)
+                                                 ? enc_driver.get_cyphered_block_size
+                                                 : nop_get_cyphered_block_size;
+        enc_driver.get_cyphered_block_offset = (enc_driver.get_cyphered_block_offset != NULL)
+                                                   ? enc_driver.get_cyphered_block_offset
+                                                   : nop_get_cyphered_block_offset;
+        enc_driver.get_truncate_size =
+            (enc_driver.get_truncate_size != NULL) ? enc_driver.get_truncate_size : nop_get_truncate_size;
+    }
+
+    if (enc_driver.encode == NULL || enc_driver.decode == NULL || enc_driver.get_file_size == NULL ||
+        enc_driver.get_cyphered_block_size == NULL || enc_driver.get_cyphered_block_offset == NULL ||
+        enc_driver.get_truncate_size == NULL) {
+        ERROR_MSG("Encode driver %s is incomplete\n", config.driver);
+        enc_plugin = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void sfuse_stats(GString *out) {
+    g_string_append_printf(out, "sfuse.crypto_queue_depth %u\n",
+                           (crypto_pool != NULL) ? g_thread_pool_unprocessed(crypto_pool) : 0);
+    if (size_cache_enabled) {
+        g_mutex_lock(&size_cache_mutex);
+        g_string_append_printf(out, "sfuse.size_cache.hits %lu\n", size_cache_hits);
+        g_string_append_printf(out, "sfuse.size_cache.misses %lu\n", size_cache_misses);
+        g_mutex_unlock(&size_cache_mutex);
+    }
+}
+
 int init_sfuse_driver(struct fuse_operations **originop, configuration data) {
-    originalfs_oper = *originop;
+    const struct fuse_operations *originalfs_oper = *originop;
+    sfuse_layer.next = originalfs_oper;
+    sfuse_layer.next_async = find_async_operations(originalfs_oper);
+    sfuse_layer.private_data = &enc_driver;
 
     // TODO:
     // Maybe this could be initialized with the sfuse_oper struct
@@ -195,69 +898,111 @@ int init_sfuse_driver(struct fuse_operations **originop, configuration data) {
     sfuse_oper.mknod = originalfs_oper->mknod;
     sfuse_oper.mkdir = originalfs_oper->mkdir;
     sfuse_oper.symlink = originalfs_oper->symlink;
-    sfuse_oper.unlink = originalfs_oper->unlink;
+    sfuse_oper.unlink = sfuse_unlink;
     sfuse_oper.rmdir = originalfs_oper->rmdir;
-    sfuse_oper.rename = originalfs_oper->rename;
-    sfuse_oper.link = originalfs_oper->link;
-    sfuse_oper.create = originalfs_oper->create;
-    sfuse_oper.open = originalfs_oper->open;
+    sfuse_oper.rename = sfuse_rename;
+    sfuse_oper.link = sfuse_link;
+    sfuse_oper.create = sfuse_create;
+    sfuse_oper.open = sfuse_open;
     sfuse_oper.read = sfuse_read;
     sfuse_oper.write = sfuse_write;
     sfuse_oper.statfs = originalfs_oper->statfs;
-    sfuse_oper.flush = originalfs_oper->flush;
-    sfuse_oper.release = originalfs_oper->release;
-    sfuse_oper.fsync = originalfs_oper->fsync;
+    sfuse_oper.flush = (originalfs_oper->flush != NULL) ? sfuse_flush : NULL;
+    sfuse_oper.release = sfuse_release;
+    sfuse_oper.fsync = (originalfs_oper->fsync != NULL) ? sfuse_fsync : NULL;
     sfuse_oper.truncate = sfuse_truncate;
     sfuse_oper.ftruncate = sfuse_ftruncate;
     sfuse_oper.chown = originalfs_oper->chown;
     sfuse_oper.chmod = originalfs_oper->chmod;
-    // sfuse_oper.setxattr    = originalfs_oper->setxattr;
-    // sfuse_oper.getxattr    = originalfs_oper->getxattr;
-    // sfuse_oper.listxattr   = originalfs_oper->listxattr;
-    // sfuse_oper.removexattr = originalfs_oper->removexattr;
+    // the attributes recorded in the files by the layers can only be changed by them
+    sfuse_oper.setxattr = (originalfs_oper->setxattr != NULL) ? sfuse_setxattr : NULL;
+    sfuse_oper.getxattr = originalfs_oper->getxattr;
+    sfuse_oper.listxattr = (originalfs_oper->listxattr != NULL) ? sfuse_listxattr : NULL;
+    sfuse_oper.removexattr = (originalfs_oper->removexattr != NULL) ? sfuse_removexattr : NULL;
 
-    switch (data.enc_config.mode) {
-        case STANDARD:
-            rand_init(data.enc_config.key, 16, data.block_config);
-            enc_driver.encode = rand_encode;
-            enc_driver.decode = rand_decode;
-            enc_driver.get_file_size = rand_get_file_size;
-            enc_driver.get_cyphered_block_size = rand_get_cyphered_block_size;
-            enc_driver.get_cyphered_block_offset = rand_get_cyphered_block_offset;
-            enc_driver.get_truncate_size = rand_get_truncate_size;
-            break;
-        case DETERMINISTIC:
-            det_init(data.enc_config.key, (unsigned char *)data.enc_config.iv, 16, data.block_config);
-            enc_driver.encode = det_encode;
-            enc_driver.decode = det_decode;
-            enc_driver.get_file_size = det_get_file_size;
-            enc_driver.get_cyphered_block_size = det_get_cyphered_block_size;
-            enc_driver.get_cyphered_block_offset = det_get_cyphered_block_offset;
-            enc_driver.get_truncate_size = det_get_truncate_size;
-            break;
-        case NOPCRYPT:
-            enc_driver.encode = nop_encode;
-            enc_driver.decode = nop_decode;
-            enc_driver.get_file_size = nop_get_file_size;
-            enc_driver.get_cyphered_block_size = nop_get_cyphered_block_size;
-            enc_driver.get_cyphered_block_offset = nop_get_cyphered_block_offset;
-            enc_driver.get_truncate_size = nop_get_truncate_size;
-            break;
-        case NOPCRYPT_PAD:
-            nop_padded_init(data.block_config);
-            enc_driver.encode = nop_encode_padded;
-            enc_driver.decode = nop_decode_padded;
-            enc_driver.get_file_size = nop_get_file_size_padded;
-            enc_driver.get_cyphered_block_size = nop_get_cyphered_block_size_padded;
-            enc_driver.get_cyphered_block_offset = nop_get_cyphered_block_offset_padded;
-            enc_driver.get_truncate_size = nop_get_truncate_size_padded;
-            break;
-        default:
+    SFUSE_MODE = resolve_mode(data.enc_config.mode);
+    if (data.enc_config.driver != NULL) {
+        if (init_plugin_driver(data) != 0) {
             return -1;
+        }
+    } else if (data.enc_config.mode == AUTO_CIPHER) {
+        SCREEN_MSG("sfuse selected %s encryption\n", (SFUSE_MODE == CHACHA) ? "ChaCha20-Poly1305" : "AES");
     }
 
-    // Copy original filesystem opers to a struct
-    // TODO: try to avoid originalfs_oper being a global variable
+    if (enc_plugin == NULL) {
+        switch (SFUSE_MODE) {
+            case STANDARD:
+                rand_init(data.enc_config.key, 16);
+                enc_driver.encode = rand_encode;
+                enc_driver.decode = rand_decode;
+                enc_driver.get_file_size = rand_get_file_size;
+                enc_driver.get_cyphered_block_size = rand_get_cyphered_block_size;
+                enc_driver.get_cyphered_block_offset = rand_get_cyphered_block_offset;
+                enc_driver.get_truncate_size = rand_get_truncate_size;
+                break;
+            case DETERMINISTIC:
+                det_init(data.enc_config.key, (unsigned char *)data.enc_config.iv, 16, data.enc_config.derive_ivs);
+                enc_driver.encode = det_encode;
+                enc_driver.decode = det_decode;
+                enc_driver.get_file_size = det_get_file_size;
+                enc_driver.get_cyphered_block_size = det_get_cyphered_block_size;
+                enc_driver.get_cyphered_block_offset = det_get_cyphered_block_offset;
+                enc_driver.get_truncate_size = det_get_truncate_size;
+                enc_driver.derive_ivs = data.enc_config.derive_ivs ? det_derive_ivs : NULL;
+                break;
+            case CHACHA:
+                if (chacha_init(data.enc_config.key) < 0) {
+                    ERROR_MSG("ChaCha20-Poly1305 is not supported by this OpenSSL\n");
+                    return -1;
+                }
+                enc_driver.encode = chacha_encode;
+                enc_driver.decode = chacha_decode;
+                enc_driver.get_file_size = chacha_get_file_size;
+                enc_driver.get_cyphered_block_size = chacha_get_cyphered_block_size;
+                enc_driver.get_cyphered_block_offset = chacha_get_cyphered_block_offset;
+                enc_driver.get_truncate_size = chacha_get_truncate_size;
+                enc_driver.binds_file_id = 1;
+                break;
+            case NOPCRYPT:
+                enc_driver.encode = nop_encode;
+                enc_driver.decode = nop_decode;
+                enc_driver.get_file_size = nop_get_file_size;
+                enc_driver.get_cyphered_block_size = nop_get_cyphered_block_size;
+                enc_driver.get_cyphered_block_offset = nop_get_cyphered_block_offset;
+                enc_driver.get_truncate_size = nop_get_truncate_size;
+                break;
+            case NOPCRYPT_PAD:
+                enc_driver.encode = nop_encode_padded;
+                enc_driver.decode = nop_decode_padded;
+                enc_driver.get_file_size = nop_get_file_size_padded;
+                enc_driver.get_cyphered_block_size = nop_get_cyphered_block_size_padded;
+                enc_driver.get_cyphered_block_offset = nop_get_cyphered_block_offset_padded;
+                enc_driver.get_truncate_size = nop_get_truncate_size_padded;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    init_geometry(data.block_config);
+    // a forged block of zeros would be read as a hole without checking its tag
+    zero_holes = data.block_config.sparse_truncate && !sfuse_authenticated(data.enc_config);
+
+    if (data.enc_config.crypto_threads > 0) {
+        crypto_pool = g_thread_pool_new((GFunc)crypto_func, sfuse_layer.private_data, data.enc_config.crypto_threads,
+                                        FALSE, NULL);
+    }
+
+    size_cache_enabled = data.enc_config.size_cache;
+    if (size_cache_enabled) {
+        g_mutex_init(&size_cache_mutex);
+        init_hash_full(&size_cache);
+    }
+
+    sfuse_write_latency = new_latency_histogram("sfuse", "write");
+    sfuse_read_latency = new_latency_histogram("sfuse", "read");
+    register_stats_source(sfuse_stats);
+
     *originop = &sfuse_oper;
 
     return 0;
@@ -265,14 +1010,34 @@ int init_sfuse_driver(struct fuse_operations **originop, configuration data) {
 
 int clean_sfuse_driver(configuration data) {
     // DEBUG_MSG("Going to clean sfuse drivers\n");
-    print_latencies(sfuse_write_list, "sfuse", "write");
-    print_latencies(sfuse_read_list, "sfuse", "read");
+    print_latencies(sfuse_write_latency);
+    print_latencies(sfuse_read_latency);
+
+    if (crypto_pool != NULL) {
+        g_thread_pool_free(crypto_pool, FALSE, TRUE);
+        crypto_pool = NULL;
+    }
+
+    if (size_cache_enabled) {
+        g_hash_table_destroy(size_cache.hash);
+        g_mutex_clear(&size_cache_mutex);
+    }
+
+    clean_geometry();
+
+    // the plugin is cleaned when it is unloaded
+    if (enc_plugin != NULL) {
+        enc_plugin = NULL;
+        return 0;
+    }
 
-    switch (data.enc_config.mode) {
+    switch (SFUSE_MODE) {
         case STANDARD:
             return rand_clean();
         case DETERMINISTIC:
             return det_clean();
+        case CHACHA:
+            return chacha_clean();
         default:
             return 0;
     }
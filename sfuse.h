@@ -32,12 +32,15 @@ typedef unsigned long u_long;
 #include <sys/time.h>
 #include <sys/xattr.h>
 #include <sys/param.h>
+#include <pthread.h>
 #include "layers_def.h"
 #include "crypto/nopcrypt.h"
 #include "crypto/nopcrypt_padded.h"
 #include "SFSConfig.h"
 #include "crypto/rand_symmetric.h"
 #include "crypto/det_symmetric.h"
+#include "crypto/chacha_symmetric.h"
+#include "crypto/cpu_features.h"
 #include "crypto/nopcrypt.h"
 
 #include "logdef.h"
@@ -46,8 +49,36 @@ typedef unsigned long u_long;
 #define NOPCRYPT_PAD 1
 #define STANDARD 2
 #define DETERMINISTIC 3
+#define CHACHA 4
+// STANDARD on processors with AES instructions, CHACHA otherwise
+#define AUTO_CIPHER 5
+
+// Identity of each file for the drivers binding it (encode_driver.binds_file_id), hidden from the
+// layers above like the geometry attribute
+#define FILE_ID_XATTR "user.safefs.file_id"
+
+#define ENCODE_OP 0
+#define DECODE_OP 1
+
+// A block of a multi-block request handed to the crypto workers
+struct crypto_job {
+    int op_type;
+    unsigned char *dest;
+    const unsigned char *src;
+    int size;
+    struct key_info info;
+    int res;
+    int done;
+    pthread_mutex_t *lock;
+    pthread_cond_t *cond;
+    // traced request of the job, 0 if it is not traced, and when it was queued
+    uint64_t trace_request;
+    uint64_t queued;
+};
 
 int init_sfuse_driver(struct fuse_operations** originop, configuration data);
+// Whether the blocks encoded with config are authenticated, such blocks can not be read back from holes
+int sfuse_authenticated(enc_config config);
 int clean_sfuse_driver(configuration data);
 
 #endif /* __SFUSE_H__ */
@@ -0,0 +1,392 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "stats.h"
+#include "../logdef.h"
+#include "../map/map.h"
+#include "../timestamps/timestamps.h"
+#include "../trace/trace.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MAX_STATS_SOURCES 32
+
+static stats_source sources[MAX_STATS_SOURCES];
+static int nsources = 0;
+static pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// operations of the stack below
+static const struct fuse_operations *next;
+static struct fuse_operations stats_oper;
+
+static time_t mount_time;
+
+static int is_stats_dir(const char *path) { return strcmp(path, STATS_DIR) == 0; }
+
+// File of the statistics directory and how its content is generated
+struct stats_file {
+    const char *path;
+    void (*print)(GString *out);
+};
+
+static const struct stats_file stats_files[] = {{STATS_FILE, print_stats}, {TRACE_FILE, print_trace}};
+
+#define NSTATS_FILES (sizeof(stats_files) / sizeof(stats_files[0]))
+
+// the trace file is only there when the requests are traced
+static int stats_file_enabled(const struct stats_file *file) {
+    return file->print != print_trace || trace_enabled();
+}
+
+static const struct stats_file *find_stats_file(const char *path) {
+    size_t i;
+
+    for (i = 0; i < NSTATS_FILES; i++) {
+        if (strcmp(path, stats_files[i].path) == 0) {
+            return stats_file_enabled(&stats_files[i]) ? &stats_files[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+static int is_stats_file(const char *path) { return find_stats_file(path) != NULL; }
+
+static int is_reserved(const char *path) { return path_has_prefix(path, STATS_DIR); }
+
+// Error of an operation modifying a reserved path
+static int reserved_error(const char *path, int creates) {
+    if (creates) {
+        return -EACCES;
+    }
+    return (is_stats_dir(path) || is_stats_file(path)) ? -EPERM : -ENOENT;
+}
+
+void register_stats_source(stats_source source) {
+    int i;
+
+    pthread_mutex_lock(&sources_mutex);
+    for (i = 0; i < nsources; i++) {
+        if (sources[i] == source) {
+            break;
+        }
+    }
+    if (i == nsources && nsources < MAX_STATS_SOURCES) {
+        sources[nsources++] = source;
+    }
+    pthread_mutex_unlock(&sources_mutex);
+}
+
+static void print_latency_histogram(const struct latency_histogram *histogram, void *data) {
+    GString *out = data;
+    struct latency_snapshot snapshot;
+
+    latency_snapshot(histogram, &snapshot);
+
+    const char *layer = histogram->layer;
+    const char *op = histogram->op;
+    g_string_append_printf(out, "latency.%s.%s.count %lu\n", layer, op, snapshot.count);
+    g_string_append_printf(out, "latency.%s.%s.bytes %lu\n", layer, op, snapshot.bytes);
+    g_string_append_printf(out, "latency.%s.%s.mean_ns %lu\n", layer, op,
+                           (snapshot.count > 0) ? snapshot.sum / snapshot.count : 0);
+    g_string_append_printf(out, "latency.%s.%s.p50_ns %lu\n", layer, op, latency_percentile(&snapshot, 50));
+    g_string_append_printf(out, "latency.%s.%s.p90_ns %lu\n", layer, op, latency_percentile(&snapshot, 90));
+    g_string_append_printf(out, "latency.%s.%s.p99_ns %lu\n", layer, op, latency_percentile(&snapshot, 99));
+    g_string_append_printf(out, "latency.%s.%s.p999_ns %lu\n", layer, op, latency_percentile(&snapshot, 99.9));
+    g_string_append_printf(out, "latency.%s.%s.max_ns %lu\n", layer, op, snapshot.max);
+}
+
+void print_stats(GString *out) {
+    int i;
+
+    g_string_append_printf(out, "uptime_s %ld\n", (long)(time(NULL) - mount_time));
+    for_each_latency_histogram(print_latency_histogram, out);
+
+    pthread_mutex_lock(&sources_mutex);
+    for (i = 0; i < nsources; i++) {
+        sources[i](out);
+    }
+    pthread_mutex_unlock(&sources_mutex);
+}
+
+static void fill_stats_stat(const char *path, struct stat *stbuf, off_t size) {
+    memset(stbuf, 0, sizeof(struct stat));
+    if (is_stats_dir(path)) {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+    } else {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = size;
+    }
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = stbuf->st_ctime = mount_time;
+    stbuf->st_mtime = time(NULL);
+}
+
+// Operations refused on the reserved paths, checked is the parameter holding the path that may be reserved
+#define STATS_OPERATION(operation, checked, creates)             \
+    static int stats_##operation LAYER_PARAMS(operation) {       \
+        if (is_reserved(checked)) {                              \
+            return reserved_error(checked, creates);             \
+        }                                                        \
+        return next->operation LAYER_ARGS(operation, fi);        \
+    }
+
+static int stats_getattr(const char *path, struct stat *stbuf) {
+    if (!is_reserved(path)) {
+        return next->getattr(path, stbuf);
+    }
+    if (!is_stats_dir(path) && !is_stats_file(path)) {
+        return -ENOENT;
+    }
+    // the content is generated on open, it is read with direct_io whatever the size
+    fill_stats_stat(path, stbuf, 0);
+    return 0;
+}
+
+static int stats_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    if (!is_reserved(path)) {
+        return (next->fgetattr != NULL) ? next->fgetattr(path, stbuf, fi) : next->getattr(path, stbuf);
+    }
+    if (is_stats_file(path) && fi != NULL && fi->fh != 0) {
+        fill_stats_stat(path, stbuf, ((GString *)(uintptr_t)fi->fh)->len);
+        return 0;
+    }
+    return stats_getattr(path, stbuf);
+}
+
+static int stats_access(const char *path, int mask) {
+    if (!is_reserved(path)) {
+        return (next->access != NULL) ? next->access(path, mask) : 0;
+    }
+    if (!is_stats_dir(path) && !is_stats_file(path)) {
+        return -ENOENT;
+    }
+    return (mask & W_OK) ? -EACCES : 0;
+}
+
+static int stats_readlink(const char *path, char *buf, size_t size) {
+    if (is_reserved(path)) {
+        return is_stats_file(path) ? -EINVAL : reserved_error(path, 0);
+    }
+    return next->readlink(path, buf, size);
+}
+
+static int stats_opendir(const char *path, struct fuse_file_info *fi) {
+    if (!is_reserved(path)) {
+        return (next->opendir != NULL) ? next->opendir(path, fi) : 0;
+    }
+    if (!is_stats_dir(path)) {
+        return is_stats_file(path) ? -ENOTDIR : -ENOENT;
+    }
+    fi->fh = 0;
+    return 0;
+}
+
+static int stats_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+                         struct fuse_file_info *fi) {
+    if (!is_reserved(path)) {
+        return next->readdir(path, buf, filler, offset, fi);
+    }
+
+    // each entry with the offset of the next one
+    const char *entries[2 + NSTATS_FILES] = {".", ".."};
+    off_t nentries = 2;
+    size_t j;
+    for (j = 0; j < NSTATS_FILES; j++) {
+        if (stats_file_enabled(&stats_files[j])) {
+            entries[nentries++] = stats_files[j].path + strlen(STATS_DIR) + 1;
+        }
+    }
+
+    off_t i;
+    for (i = offset; i < nentries; i++) {
+        if (filler(buf, entries[i], NULL, i + 1)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int stats_releasedir(const char *path, struct fuse_file_info *fi) {
+    if (is_reserved(path)) {
+        return 0;
+    }
+    return (next->releasedir != NULL) ? next->releasedir(path, fi) : 0;
+}
+
+STATS_OPERATION(mknod, path, 1)
+STATS_OPERATION(mkdir, path, 1)
+STATS_OPERATION(symlink, to, 1)
+STATS_OPERATION(unlink, path, 0)
+STATS_OPERATION(rmdir, path, 0)
+
+static int stats_rename(const char *from, const char *to) {
+    if (is_reserved(from)) {
+        return reserved_error(from, 0);
+    }
+    return is_reserved(to) ? reserved_error(to, 1) : next->rename(from, to);
+}
+
+static int stats_link(const char *from, const char *to) {
+    if (is_reserved(from)) {
+        return reserved_error(from, 0);
+    }
+    return is_reserved(to) ? reserved_error(to, 1) : next->link(from, to);
+}
+
+STATS_OPERATION(chmod, path, 0)
+STATS_OPERATION(chown, path, 0)
+STATS_OPERATION(truncate, path, 0)
+
+static int stats_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    if (is_reserved(path)) {
+        return reserved_error(path, 0);
+    }
+    return (next->ftruncate != NULL) ? next->ftruncate(path, size, fi) : next->truncate(path, size);
+}
+
+STATS_OPERATION(utimens, path, 0)
+STATS_OPERATION(create, path, 1)
+
+static int stats_open(const char *path, struct fuse_file_info *fi) {
+    if (!is_reserved(path)) {
+        return (next->open != NULL) ? next->open(path, fi) : 0;
+    }
+    const struct stats_file *file = find_stats_file(path);
+    if (file == NULL) {
+        return is_stats_dir(path) ? -EISDIR : -ENOENT;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    // every open reads a consistent snapshot of the statistics
+    GString *content = g_string_new(NULL);
+    file->print(content);
+    fi->fh = (uintptr_t)content;
+    fi->direct_io = 1;
+    return 0;
+}
+
+static int stats_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    if (!is_stats_file(path)) {
+        return next->read(path, buf, size, offset, fi);
+    }
+
+    const GString *content = (const GString *)(uintptr_t)fi->fh;
+    if (offset >= (off_t)content->len) {
+        return 0;
+    }
+    if (offset + size > content->len) {
+        size = content->len - offset;
+    }
+    memcpy(buf, content->str + offset, size);
+    return size;
+}
+
+static int stats_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    return is_stats_file(path) ? -EBADF : next->write(path, buf, size, offset, fi);
+}
+
+static int stats_statfs(const char *path, struct statvfs *stbuf) {
+    return next->statfs(is_reserved(path) ? "/" : path, stbuf);
+}
+
+static int stats_flush(const char *path, struct fuse_file_info *fi) {
+    if (is_stats_file(path)) {
+        return 0;
+    }
+    return (next->flush != NULL) ? next->flush(path, fi) : 0;
+}
+
+static int stats_release(const char *path, struct fuse_file_info *fi) {
+    if (is_stats_file(path)) {
+        g_string_free((GString *)(uintptr_t)fi->fh, TRUE);
+        return 0;
+    }
+    return (next->release != NULL) ? next->release(path, fi) : 0;
+}
+
+static int stats_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    if (is_stats_file(path)) {
+        return 0;
+    }
+    return (next->fsync != NULL) ? next->fsync(path, isdatasync, fi) : 0;
+}
+
+STATS_OPERATION(setxattr, path, 0)
+
+static int stats_getxattr(const char *path, const char *name, char *value, size_t size) {
+    if (is_reserved(path)) {
+        return (is_stats_dir(path) || is_stats_file(path)) ? -ENODATA : -ENOENT;
+    }
+    return next->getxattr(path, name, value, size);
+}
+
+static int stats_listxattr(const char *path, char *list, size_t size) {
+    if (is_reserved(path)) {
+        return (is_stats_dir(path) || is_stats_file(path)) ? 0 : -ENOENT;
+    }
+    return next->listxattr(path, list, size);
+}
+
+STATS_OPERATION(removexattr, path, 0)
+
+int init_stats(struct fuse_operations **fuse_operations) {
+    DEBUG_MSG("Going to serve the statistics in %s\n", STATS_FILE);
+
+    next = *fuse_operations;
+    mount_time = time(NULL);
+
+    // the operations the stack does not have are left unset
+    stats_oper = *next;
+    stats_oper.getattr = stats_getattr;
+    stats_oper.fgetattr = stats_fgetattr;
+    stats_oper.access = stats_access;
+    stats_oper.opendir = stats_opendir;
+    stats_oper.readdir = stats_readdir;
+    stats_oper.releasedir = stats_releasedir;
+    stats_oper.open = stats_open;
+    stats_oper.read = stats_read;
+    stats_oper.write = stats_write;
+    stats_oper.flush = stats_flush;
+    stats_oper.release = stats_release;
+    stats_oper.fsync = stats_fsync;
+    stats_oper.ftruncate = stats_ftruncate;
+    LAYER_WRAP(stats, next, readlink);
+    LAYER_WRAP(stats, next, mknod);
+    LAYER_WRAP(stats, next, mkdir);
+    LAYER_WRAP(stats, next, symlink);
+    LAYER_WRAP(stats, next, unlink);
+    LAYER_WRAP(stats, next, rmdir);
+    LAYER_WRAP(stats, next, rename);
+    LAYER_WRAP(stats, next, link);
+    LAYER_WRAP(stats, next, chmod);
+    LAYER_WRAP(stats, next, chown);
+    LAYER_WRAP(stats, next, truncate);
+    LAYER_WRAP(stats, next, utimens);
+    LAYER_WRAP(stats, next, create);
+    LAYER_WRAP(stats, next, statfs);
+    LAYER_WRAP(stats, next, setxattr);
+    LAYER_WRAP(stats, next, getxattr);
+    LAYER_WRAP(stats, next, listxattr);
+    LAYER_WRAP(stats, next, removexattr);
+
+    *fuse_operations = &stats_oper;
+
+    return 0;
+}
+
+void clean_stats() {
+    pthread_mutex_lock(&sources_mutex);
+    nsources = 0;
+    pthread_mutex_unlock(&sources_mutex);
+}
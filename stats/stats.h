@@ -0,0 +1,38 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Statistics of the running stack served in the read-only file /.safefs/stats.
+ * The file is generated when it is opened, as "name value" lines sorted by module. Names are made of
+ * dot separated lowercase words and are not changed once released, so that monitoring tools can rely
+ * on them. The latencies of the layers are always reported, the other modules register a source.
+ * The sampled requests are served next to it in /.safefs/trace when tracing is on, see trace/trace.h.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <glib.h>
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+#define STATS_DIR "/.safefs"
+#define STATS_FILE STATS_DIR "/stats"
+
+// Appends the "name value" lines of a module to out
+typedef void (*stats_source)(GString *out);
+
+// Adds source to the statistics, registering the same source again does nothing
+void register_stats_source(stats_source source);
+
+// Statistics of the layers and of the registered sources
+void print_stats(GString *out);
+
+// Serves STATS_DIR on top of the stack in *fuse_operations, the other paths are handed to it unchanged
+int init_stats(struct fuse_operations **fuse_operations);
+void clean_stats();
+
+#endif /* __STATS_H__ */
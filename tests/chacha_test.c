@@ -0,0 +1,153 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Test of the ChaCha20-Poly1305 mode of sfuse, without FUSE.
+ *
+ * Blocks are written through sfuse on top of multi_loopback, then moved in the storage backend to
+ * another offset of their file or to another file. Reading them back must fail, while renamed
+ * files are still read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../multi_loopback.h"
+#include "../sfuse.h"
+
+#define BLOCK_SIZE 4096
+#define CBLOCK_SIZE (BLOCK_SIZE + CHACHA_PADSIZE)
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static struct fuse_operations *operations = NULL;
+static char device[PATH_MAX];
+
+// Writes two blocks of distinct content to a new file
+static void write_file(const char *path, char fill) {
+    struct fuse_file_info fi;
+    char buf[2 * BLOCK_SIZE];
+
+    memset(buf, fill, BLOCK_SIZE);
+    memset(&buf[BLOCK_SIZE], fill + 1, BLOCK_SIZE);
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDWR | O_CREAT;
+    CHECK(operations->create(path, 0644, &fi) == 0);
+    CHECK(operations->write(path, buf, sizeof(buf), 0, &fi) == sizeof(buf));
+    operations->release(path, &fi);
+}
+
+// Reads the block of path at index, returns the result of the read and the first byte in first
+static int read_block(const char *path, int index, char *first) {
+    struct fuse_file_info fi;
+    char buf[BLOCK_SIZE];
+    int res;
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+    if (operations->open(path, &fi) != 0) {
+        return -1;
+    }
+    res = operations->read(path, buf, BLOCK_SIZE, (off_t)index * BLOCK_SIZE, &fi);
+    operations->release(path, &fi);
+    *first = buf[0];
+    return res;
+}
+
+// Copies the ciphered block from_index of from over the block to_index of to, in the storage backend
+static void move_block(const char *from, int from_index, const char *to, int to_index) {
+    char from_path[PATH_MAX], to_path[PATH_MAX];
+    char cblock[CBLOCK_SIZE];
+    FILE *file;
+
+    snprintf(from_path, sizeof(from_path), "%s%s", device, from);
+    snprintf(to_path, sizeof(to_path), "%s%s", device, to);
+
+    file = fopen(from_path, "rb");
+    CHECK(file != NULL && fseek(file, (long)from_index * CBLOCK_SIZE, SEEK_SET) == 0 &&
+          fread(cblock, 1, CBLOCK_SIZE, file) == CBLOCK_SIZE);
+    if (file != NULL) {
+        fclose(file);
+    }
+    file = fopen(to_path, "r+b");
+    CHECK(file != NULL && fseek(file, (long)to_index * CBLOCK_SIZE, SEEK_SET) == 0 &&
+          fwrite(cblock, 1, CBLOCK_SIZE, file) == CBLOCK_SIZE);
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char base[] = "/tmp/safefs_chacha_XXXXXX";
+    char command[PATH_MAX];
+    configuration config;
+    char first;
+
+    if (!chacha_supported()) {
+        printf("chacha_test: skipped, ChaCha20-Poly1305 is not supported by this OpenSSL\n");
+        return 0;
+    }
+    if (mkdtemp(base) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(device, sizeof(device), "%s/dev0", base);
+
+    memset(&config, 0, sizeof(config));
+    config.m_loop_config.mode = REP;
+    config.m_loop_config.ndevs = 1;
+    // multi_loopback adds a slash to the path of the device
+    config.m_loop_config.loop_paths = g_slist_append(NULL, g_strdup_printf("%s/", device));
+    config.block_config.block_size = BLOCK_SIZE;
+    config.enc_config.mode = CHACHA;
+    config.enc_config.key = "0123456789abcdef0123456789abcdef";
+    if (init_multi_loopback_driver(&operations, config) != 0 || init_sfuse_driver(&operations, config) != 0) {
+        fprintf(stderr, "Could not initialize the layers\n");
+        return 1;
+    }
+
+    write_file("/a", 'a');
+    write_file("/b", 'x');
+    CHECK(read_block("/a", 0, &first) == BLOCK_SIZE && first == 'a');
+    CHECK(read_block("/a", 1, &first) == BLOCK_SIZE && first == 'b');
+
+    // a block moved to another offset of its file
+    move_block("/a", 1, "/a", 0);
+    CHECK(read_block("/a", 0, &first) < 0);
+    CHECK(read_block("/a", 1, &first) == BLOCK_SIZE && first == 'b');
+
+    // a block moved to the same offset of another file
+    move_block("/a", 1, "/b", 1);
+    CHECK(read_block("/b", 1, &first) < 0);
+    CHECK(read_block("/b", 0, &first) == BLOCK_SIZE && first == 'x');
+
+    // the identity of a file follows it across renames
+    CHECK(operations->rename("/b", "/c") == 0);
+    CHECK(read_block("/c", 0, &first) == BLOCK_SIZE && first == 'x');
+
+    clean_sfuse_driver(config);
+    snprintf(command, sizeof(command), "rm -rf %s", base);
+    if (system(command) != 0) {
+        fprintf(stderr, "Could not remove %s\n", base);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "chacha_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("chacha_test: ok\n");
+    return 0;
+}
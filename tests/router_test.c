@@ -0,0 +1,110 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Test of the router of the stacks, without FUSE.
+ *
+ * Two stacks made only of multi_loopback share the operations of the layer, renames and links
+ * across them must be refused and leave the files in the devices of their stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../multi_loopback.h"
+#include "../router/router.h"
+
+#define NDEVS 2
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+// Replicated stack on NDEVS directories below base
+static int init_stack(const char *base, char *prefix, struct fuse_operations **operations) {
+    configuration config;
+    int i;
+
+    memset(&config, 0, sizeof(config));
+    config.prefix = prefix;
+    config.m_loop_config.mode = REP;
+    config.m_loop_config.ndevs = NDEVS;
+    for (i = 0; i < NDEVS; i++) {
+        // multi_loopback creates the devices, the paths end with a slash as in the configuration files
+        char *dev = g_strdup_printf("%s%s%d/", base, prefix, i);
+        config.m_loop_config.loop_paths = g_slist_append(config.m_loop_config.loop_paths, dev);
+    }
+    return init_multi_loopback_driver(operations, config);
+}
+
+static int exists(const char *base, const char *dev, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", base, dev, name);
+    return access(path, F_OK) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    char base[] = "/tmp/safefs_router_XXXXXX";
+    struct fuse_operations *a = NULL;
+    struct fuse_operations *b = NULL;
+    struct fuse_operations *operations = NULL;
+    struct fuse_file_info fi;
+    struct stat stbuf;
+    char command[PATH_MAX];
+
+    if (mkdtemp(base) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (init_stack(base, "/a", &a) != 0 || init_stack(base, "/b", &b) != 0) {
+        fprintf(stderr, "Could not initialize the stacks\n");
+        return 1;
+    }
+    router_add_stack("/a", a);
+    router_add_stack("/b", b);
+    if (init_router(&operations) != 0) {
+        fprintf(stderr, "Could not initialize the router\n");
+        return 1;
+    }
+
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDWR | O_CREAT;
+    CHECK(operations->create("/a/f", 0644, &fi) == 0);
+    CHECK(operations->write("/a/f", "router", 6, 0, &fi) == 6);
+    operations->release("/a/f", &fi);
+
+    CHECK(operations->rename("/a/f", "/b/g") == -EXDEV);
+    CHECK(operations->link("/a/f", "/b/g") == -EXDEV);
+    CHECK(operations->getattr("/a/f", &stbuf) == 0 && stbuf.st_size == 6);
+    CHECK(operations->getattr("/b/g", &stbuf) == -ENOENT);
+    CHECK(exists(base, "/a0", "/f") && exists(base, "/a1", "/f"));
+    CHECK(!exists(base, "/b0", "/g") && !exists(base, "/b1", "/g"));
+
+    // renames within a stack are still served
+    CHECK(operations->rename("/a/f", "/a/g") == 0);
+    CHECK(exists(base, "/a0", "/g") && !exists(base, "/a0", "/f"));
+
+    clean_router();
+    snprintf(command, sizeof(command), "rm -rf %s", base);
+    if (system(command) != 0) {
+        fprintf(stderr, "Could not remove %s\n", base);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "router_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("router_test: ok\n");
+    return 0;
+}
@@ -9,35 +9,258 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <pthread.h>
 #include "timestamps.h"
 #include "../logdef.h"
 
-// structure used to store timestamps of layers.
+#define MAX_LATENCY_HISTOGRAMS 64
 
-void store(GSList** list, struct timeval start, struct timeval stop) {
-    /**
-     *adjust the second part to microseonds and the nanoseconds to microseconds.
-     *previous code did not take into account the seconds part as usec wrapped around 0.
-     * http://stackoverflow.com/questions/10192903/time-in-milliseconds
-     */
-    long elapsed = (stop.tv_sec - start.tv_sec) * 1000000 + (stop.tv_usec - start.tv_usec);
+static struct latency_histogram histograms[MAX_LATENCY_HISTOGRAMS];
+static int nhistograms = 0;
+static pthread_mutex_t histograms_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    (*list) = g_slist_prepend(*list, GSIZE_TO_POINTER(elapsed));
+// blocks of the calling thread, indexed by histogram id
+static __thread struct latency_block *thread_blocks[MAX_LATENCY_HISTOGRAMS];
+
+// releases the blocks of exiting threads
+static pthread_key_t blocks_key;
+static pthread_once_t blocks_key_once = PTHREAD_ONCE_INIT;
+
+static void release_blocks(void *blocks) {
+    struct latency_block **thread = blocks;
+    int i;
+
+    for (i = 0; i < MAX_LATENCY_HISTOGRAMS; i++) {
+        if (thread[i] != NULL) {
+            __atomic_store_n(&thread[i]->in_use, 0, __ATOMIC_RELEASE);
+            thread[i] = NULL;
+        }
+    }
+}
+
+static void create_blocks_key() { pthread_key_create(&blocks_key, release_blocks); }
+
+static int bucket_of(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return value;
+    }
+
+    int bits = 63 - __builtin_clzll(value);
+    if (bits > LATENCY_MAX_BITS) {
+        return LATENCY_BUCKETS - 1;
+    }
+    // the LATENCY_SUB_BUCKET_BITS bits below the highest one select the sub bucket
+    int sub_bucket = (value >> (bits - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return LATENCY_SUB_BUCKETS * (bits - LATENCY_SUB_BUCKET_BITS + 1) + sub_bucket;
+}
+
+uint64_t latency_bucket_value(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int bits = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    int sub_bucket = bucket % LATENCY_SUB_BUCKETS;
+    return (uint64_t)(LATENCY_SUB_BUCKETS + sub_bucket) << (bits - LATENCY_SUB_BUCKET_BITS);
+}
+
+// Block of the calling thread, a block released by an exited thread is reused before allocating one
+static struct latency_block *thread_block(struct latency_histogram *histogram) {
+    struct latency_block *block;
+
+    for (block = __atomic_load_n(&histogram->blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next) {
+        int free_block = 0;
+        if (__atomic_compare_exchange_n(&block->in_use, &free_block, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (block == NULL) {
+        block = calloc(1, sizeof(struct latency_block));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->in_use = 1;
+        block->next = __atomic_load_n(&histogram->blocks, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&histogram->blocks, &block->next, block, 0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+
+    thread_blocks[histogram->id] = block;
+    pthread_setspecific(blocks_key, thread_blocks);
+    return block;
+}
+
+struct latency_histogram *new_latency_histogram(const char *layer, const char *op) {
+    struct latency_histogram *histogram = NULL;
+    int i;
+
+    pthread_once(&blocks_key_once, create_blocks_key);
+
+    pthread_mutex_lock(&histograms_mutex);
+    for (i = 0; i < nhistograms; i++) {
+        if (strcmp(histograms[i].layer, layer) == 0 && strcmp(histograms[i].op, op) == 0) {
+            histogram = &histograms[i];
+            break;
+        }
+    }
+    if (histogram == NULL && nhistograms < MAX_LATENCY_HISTOGRAMS) {
+        histogram = &histograms[nhistograms];
+        histogram->layer = layer;
+        histogram->op = op;
+        histogram->id = nhistograms;
+        histogram->blocks = NULL;
+        nhistograms++;
+    }
+    pthread_mutex_unlock(&histograms_mutex);
+
+    if (histogram == NULL) {
+        ERROR_MSG("Too many latency histograms, %s %s is not recorded\n", layer, op);
+    }
+    return histogram;
+}
+
+uint64_t latency_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void store_latency(struct latency_histogram *histogram, uint64_t value) {
+    if (histogram == NULL) {
+        return;
+    }
+
+    struct latency_block *block = thread_blocks[histogram->id];
+    if (block == NULL && (block = thread_block(histogram)) == NULL) {
+        return;
+    }
+
+    // only this thread writes the block, the stores are atomic for the snapshots
+    uint64_t *count = &block->counts[bucket_of(value)];
+    __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->sum, block->sum + value, __ATOMIC_RELAXED);
+    if (value > block->max) {
+        __atomic_store_n(&block->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+void store(struct latency_histogram *histogram, uint64_t start) { store_latency(histogram, latency_now() - start); }
+
+void store_io(struct latency_histogram *histogram, uint64_t start, uint64_t bytes) {
+    store_latency(histogram, latency_now() - start);
+
+    // the block was taken by store_latency
+    if (histogram != NULL && thread_blocks[histogram->id] != NULL) {
+        struct latency_block *block = thread_blocks[histogram->id];
+        __atomic_store_n(&block->bytes, block->bytes + bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void latency_snapshot(const struct latency_histogram *histogram, struct latency_snapshot *snapshot) {
+    const struct latency_block *block;
+    int i;
+
+    memset(snapshot, 0, sizeof(struct latency_snapshot));
+
+    for (block = __atomic_load_n(&histogram->blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next) {
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+            uint64_t count = __atomic_load_n(&block->counts[i], __ATOMIC_RELAXED);
+            snapshot->counts[i] += count;
+            snapshot->count += count;
+        }
+        snapshot->sum += __atomic_load_n(&block->sum, __ATOMIC_RELAXED);
+        snapshot->bytes += __atomic_load_n(&block->bytes, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&block->max, __ATOMIC_RELAXED);
+        snapshot->max = (max > snapshot->max) ? max : snapshot->max;
+    }
+}
+
+void latency_reset(struct latency_histogram *histogram) {
+    struct latency_block *block;
+
+    for (block = __atomic_load_n(&histogram->blocks, __ATOMIC_ACQUIRE); block != NULL; block = block->next) {
+        memset(block->counts, 0, sizeof(block->counts));
+        block->sum = 0;
+        block->max = 0;
+        block->bytes = 0;
+    }
+}
+
+uint64_t latency_percentile(const struct latency_snapshot *snapshot, double percentile) {
+    uint64_t rank = (uint64_t)(snapshot->count * percentile / 100.0);
+    uint64_t seen = 0;
+    int i;
+
+    if (snapshot->count == 0) {
+        return 0;
+    }
+    rank = (rank < snapshot->count) ? rank + 1 : snapshot->count;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += snapshot->counts[i];
+        if (seen >= rank) {
+            uint64_t upper = latency_bucket_value(i + 1) - 1;
+            return (upper < snapshot->max) ? upper : snapshot->max;
+        }
+    }
+    return snapshot->max;
+}
+
+void for_each_latency_histogram(void (*fn)(const struct latency_histogram *histogram, void *data), void *data) {
+    int i;
+
+    pthread_mutex_lock(&histograms_mutex);
+    int count = nhistograms;
+    pthread_mutex_unlock(&histograms_mutex);
+
+    for (i = 0; i < count; i++) {
+        fn(&histograms[i], data);
+    }
 }
 
-void print_latencies(GSList* list, char* driver, char* op) {
+void print_latencies(const struct latency_histogram *histogram) {
+    struct latency_snapshot snapshot;
     char filename[200];
-    // sprintf(filename, "/usr/local/src/sdsfuse/code/SDSFuse/%s_%s.txt", driver, op);
-    sprintf(filename, "/opt/dump/%s_%s.txt", driver, op);
-    FILE* f = fopen(filename, "w");
-
-    GSList* current = list;
-    while (current != NULL) {
-        // GPOINTER_TO_SIZE()
-        // tsp* value = current->data;
-        fprintf(f, "%ld\n", GPOINTER_TO_SIZE(current->data));
-        // ERROR_MSG("%s|%s|%lf\n", op, driver, 1.0e-3*(value->val));
-        current = current->next;
+    int i;
+
+    if (histogram == NULL) {
+        return;
+    }
+    latency_snapshot(histogram, &snapshot);
+    DEBUG_MSG("%s %s: %lu ops, p50 %lu ns, p99 %lu ns, max %lu ns\n", histogram->layer, histogram->op,
+              snapshot.count, latency_percentile(&snapshot, 50), latency_percentile(&snapshot, 99), snapshot.max);
+
+    sprintf(filename, "/opt/dump/%s_%s.txt", histogram->layer, histogram->op);
+    FILE *f = fopen(filename, "w");
+    if (f == NULL) {
+        DEBUG_MSG("Could not write %s\n", filename);
+        return;
+    }
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        if (snapshot.counts[i] > 0) {
+            fprintf(f, "%lu %lu\n", latency_bucket_value(i), snapshot.counts[i]);
+        }
     }
     fclose(f);
-}
\ No newline at end of file
+}
+
+void clean_latencies() {
+    int i;
+
+    pthread_mutex_lock(&histograms_mutex);
+    for (i = 0; i < nhistograms; i++) {
+        struct latency_block *block = histograms[i].blocks;
+        while (block != NULL) {
+            struct latency_block *next = block->next;
+            free(block);
+            block = next;
+        }
+        histograms[i].blocks = NULL;
+    }
+    nhistograms = 0;
+    memset(thread_blocks, 0, sizeof(thread_blocks));
+    pthread_mutex_unlock(&histograms_mutex);
+}
@@ -4,12 +4,85 @@
 
 */
 
+/*
+ * Latency histograms of the operations of the layers.
+ * Each thread records into histogram blocks of its own, so recording takes no lock and no allocation
+ * once a thread has its block. Blocks are merged when a snapshot is taken. Buckets are log-linear:
+ * values below LATENCY_SUB_BUCKETS nanoseconds have a bucket each and every power of two above is split
+ * in LATENCY_SUB_BUCKETS buckets, so a value is known within 1/LATENCY_SUB_BUCKETS of itself.
+ */
 
 #ifndef __TIMESTAMPS_H__
 #define __TIMESTAMPS_H__
 
-void store(GSList** list, struct timeval start, struct timeval stop);
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+// latencies above 2^LATENCY_MAX_BITS ns (about 2.4 hours) are counted in the last bucket
+#define LATENCY_MAX_BITS 43
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 2))
+
+// Counts of the threads that recorded latencies, released when a thread exits and reused by the next one
+struct latency_block {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+    uint64_t bytes;
+    int in_use;
+    struct latency_block *next;
+};
+
+struct latency_histogram {
+    const char *layer;
+    const char *op;
+    int id;
+    // pushed without lock, never removed until clean_latencies
+    struct latency_block *blocks;
+};
+
+// Merged counts of a histogram, in nanoseconds
+struct latency_snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t bytes;
+    uint64_t counts[LATENCY_BUCKETS];
+};
+
+// Histogram of op of layer, the same one is returned for the same names (e.g. by the layer of each stack)
+struct latency_histogram *new_latency_histogram(const char *layer, const char *op);
+
+// Start of an operation, CLOCK_MONOTONIC in nanoseconds
+uint64_t latency_now();
+
+// Records the latency of an operation started at start
+void store(struct latency_histogram *histogram, uint64_t start);
+
+// Records the latency of a read or write of bytes started at start
+void store_io(struct latency_histogram *histogram, uint64_t start, uint64_t bytes);
+
+// Records a latency of value nanoseconds
+void store_latency(struct latency_histogram *histogram, uint64_t value);
+
+void latency_snapshot(const struct latency_histogram *histogram, struct latency_snapshot *snapshot);
+
+// Clears the counts of histogram, while no thread records latencies in it
+void latency_reset(struct latency_histogram *histogram);
+
+// Upper bound of the latency of the given percentile (0-100) of a snapshot, 0 if it is empty
+uint64_t latency_percentile(const struct latency_snapshot *snapshot, double percentile);
+
+// Lowest latency counted in bucket
+uint64_t latency_bucket_value(int bucket);
+
+// Calls fn with every histogram, in creation order
+void for_each_latency_histogram(void (*fn)(const struct latency_histogram *histogram, void *data), void *data);
+
+// Writes the non empty buckets of histogram to /opt/dump/<layer>_<op>.txt as "latency_ns count" lines
+void print_latencies(const struct latency_histogram *histogram);
 
-void print_latencies(GSList* list, char* driver, char* op);
+// Frees the histograms, once no thread records latencies anymore
+void clean_latencies();
 
-#endif /* __XOR_H__ */
+#endif /* __TIMESTAMPS_H__ */
@@ -0,0 +1,258 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+#include "trace.h"
+#include "../logdef.h"
+#include "../timestamps/timestamps.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// thread is not in a sampled request
+#define UNSAMPLED UINT64_MAX
+
+struct trace_event {
+    // seqlock, odd while the event is written and 0 when it was never written
+    uint64_t seq;
+    uint64_t request;
+    uint64_t start;
+    uint64_t duration;
+    const char *name;
+    int tid;
+    int device;
+};
+
+// Events of a thread, the oldest ones are overwritten. Released when the thread exits and reused by the next one.
+struct trace_ring {
+    uint64_t head;
+    int in_use;
+    struct trace_ring *next;
+    struct trace_event events[];
+};
+
+static int sample = 0;
+static int ring_size = 0;
+static uint64_t nrequests = 0;
+// pushed without lock, freed by clean_trace
+static struct trace_ring *rings = NULL;
+
+static __thread uint64_t current_request = 0;
+static __thread struct trace_ring *thread_ring = NULL;
+static __thread int thread_id = 0;
+
+static pthread_key_t ring_key;
+
+static void release_ring(void *ring) {
+    __atomic_store_n(&((struct trace_ring *)ring)->in_use, 0, __ATOMIC_RELEASE);
+    thread_ring = NULL;
+}
+
+static struct trace_ring *acquire_ring() {
+    struct trace_ring *ring;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        int free_ring = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(struct trace_ring) + ring_size * sizeof(struct trace_event));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->in_use = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    thread_ring = ring;
+    thread_id = syscall(SYS_gettid);
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+void init_trace(trace_conf config) {
+    if (config.sample <= 0) {
+        return;
+    }
+
+    sample = config.sample;
+    ring_size = (config.buffer_size > 0) ? config.buffer_size : 4096;
+    pthread_key_create(&ring_key, release_ring);
+
+    DEBUG_MSG("Tracing one request out of %d, %d events per thread\n", sample, ring_size);
+}
+
+void clean_trace() {
+    if (sample == 0) {
+        return;
+    }
+
+    struct trace_ring *ring = rings;
+    while (ring != NULL) {
+        struct trace_ring *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    rings = NULL;
+    thread_ring = NULL;
+    pthread_key_delete(ring_key);
+    sample = 0;
+}
+
+int trace_enabled() { return sample > 0; }
+
+uint64_t trace_current() { return (current_request == UNSAMPLED) ? 0 : current_request; }
+
+void trace_set_current(uint64_t request) { current_request = request; }
+
+void trace_span_begin(struct trace_span *span) {
+    span->request = 0;
+    span->root = 0;
+
+    if (sample == 0) {
+        return;
+    }
+
+    if (current_request == 0) {
+        uint64_t n = __atomic_fetch_add(&nrequests, 1, __ATOMIC_RELAXED);
+        current_request = (n % sample == 0) ? n + 1 : UNSAMPLED;
+        span->root = 1;
+    }
+    if (current_request != UNSAMPLED) {
+        span->request = current_request;
+        span->start = latency_now();
+    }
+}
+
+void trace_span_end(struct trace_span *span, const char *name, int device) {
+    if (span->request != 0 && name != NULL) {
+        trace_record(span->request, name, span->start, device);
+    }
+    if (span->root) {
+        current_request = 0;
+    }
+}
+
+void trace_record(uint64_t request, const char *name, uint64_t start, int device) {
+    if (request == 0 || sample == 0) {
+        return;
+    }
+
+    struct trace_ring *ring = thread_ring;
+    if (ring == NULL && (ring = acquire_ring()) == NULL) {
+        return;
+    }
+
+    struct trace_event *event = &ring->events[ring->head % ring_size];
+    uint64_t seq = event->seq;
+
+    // only this thread writes the ring, readers retry the events changed while they copied them
+    __atomic_store_n(&event->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->request = request;
+    event->start = start;
+    event->duration = latency_now() - start;
+    event->name = name;
+    event->tid = thread_id;
+    event->device = device;
+    __atomic_store_n(&event->seq, seq + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Copy of an event that is not being written, 0 if there is none
+static int read_event(const struct trace_event *event, struct trace_event *copy) {
+    uint64_t seq = __atomic_load_n(&event->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (seq & 1)) {
+        return 0;
+    }
+
+    copy->request = event->request;
+    copy->start = event->start;
+    copy->duration = event->duration;
+    copy->name = event->name;
+    copy->tid = event->tid;
+    copy->device = event->device;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&event->seq, __ATOMIC_RELAXED) == seq;
+}
+
+void print_trace(GString *out) {
+    const struct trace_ring *ring;
+    const char *separator = "";
+    pid_t pid = getpid();
+
+    g_string_append(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t i = (head > (uint64_t)ring_size) ? head - ring_size : 0;
+
+        for (; i < head; i++) {
+            struct trace_event event;
+            if (!read_event(&ring->events[i % ring_size], &event)) {
+                continue;
+            }
+            // microseconds with nanosecond precision
+            g_string_append_printf(out,
+                                   "%s\n{\"name\":\"%s\",\"cat\":\"safefs\",\"ph\":\"X\",\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,"
+                                   "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%lu",
+                                   separator, event.name, event.start / 1000, event.start % 1000,
+                                   event.duration / 1000, event.duration % 1000, pid, event.tid, event.request);
+            if (event.device >= 0) {
+                g_string_append_printf(out, ",\"device\":%d", event.device);
+            }
+            g_string_append(out, "}}");
+            separator = ",";
+        }
+    }
+
+    g_string_append(out, "\n]}\n");
+}
+
+/*
+ * Operations starting the requests, on top of the stack. Each operation is the root span of its
+ * request, named fuse.<operation>, and the spans of the layers below are nested in it.
+ */
+static const struct fuse_operations *next;
+static struct fuse_operations trace_oper;
+
+// Root span of the request of an operation
+#define TRACE_OPERATION(operation)                                     \
+    static int trace_##operation LAYER_PARAMS(operation) {             \
+        struct trace_span span;                                        \
+        trace_span_begin(&span);                                       \
+        int res = next->operation LAYER_ARGS(operation, fi);           \
+        trace_span_end(&span, "fuse." #operation, -1);                 \
+        return res;                                                    \
+    }
+
+LAYER_OPERATIONS(TRACE_OPERATION)
+
+#define TRACE_WRAP(operation) LAYER_WRAP(trace, next, operation);
+
+int init_trace_operations(struct fuse_operations **fuse_operations) {
+    if (sample == 0) {
+        return 0;
+    }
+
+    next = *fuse_operations;
+
+    // the operations the stack does not have are left unset
+    trace_oper = *next;
+    LAYER_OPERATIONS(TRACE_WRAP)
+
+    *fuse_operations = &trace_oper;
+
+    return 0;
+}
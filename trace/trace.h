@@ -0,0 +1,61 @@
+/*
+  SafeFS
+  (c) 2016 2016 INESC TEC. Written by J. Paulo and R. Pontes
+
+*/
+
+/*
+ * Tracing of sampled requests across the layers.
+ * Every file system operation starts a request on top of the stack (init_trace_operations), which is
+ * sampled one out of [trace] sample times. The request id is kept by the thread while the operation
+ * goes down the stack and is carried by the jobs handed to worker threads. Every traced span is
+ * recorded in a ring buffer of the recording thread, without locks, and the rings are exported as
+ * Chrome trace JSON (chrome://tracing, Perfetto) when /.safefs/trace is read.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <glib.h>
+#include "../layers_def.h"
+#include "../SFSConfig.h"
+
+#define TRACE_FILE "/.safefs/trace"
+
+// Span of a layer, started with trace_span_begin and recorded by trace_span_end
+struct trace_span {
+    // 0 when the request is not traced
+    uint64_t request;
+    uint64_t start;
+    // the span started the request of the thread
+    int root;
+};
+
+void init_trace(trace_conf config);
+void clean_trace();
+
+int trace_enabled();
+
+// Request of the calling thread, 0 if it is not traced
+uint64_t trace_current();
+
+// Work of request done by the calling thread, until trace_set_current(0)
+void trace_set_current(uint64_t request);
+
+// Starts a span of the calling thread, and its request if the thread has none
+void trace_span_begin(struct trace_span *span);
+
+// Records span as name, unless name is NULL. device is -1 when the span is not about a device
+void trace_span_end(struct trace_span *span, const char *name, int device);
+
+// Records a span of request that started at start (CLOCK_MONOTONIC ns, see latency_now) and ends now
+void trace_record(uint64_t request, const char *name, uint64_t start, int device);
+
+// Appends the recorded spans to out as a Chrome trace JSON object
+void print_trace(GString *out);
+
+// Starts a request for every operation of the stack in *fuse_operations, nothing when tracing is off
+int init_trace_operations(struct fuse_operations **fuse_operations);
+
+#endif /* __TRACE_H__ */